@@ -0,0 +1,99 @@
+#include "bench.h"
+
+double bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+void bench_report(const char *name, double bytes, double seconds)
+{
+    printf("%-24s %10.3f s %10.1f MB/s\n", name, seconds, bytes / seconds / (1024.0 * 1024.0));
+}
+
+const char *bench_dir(int argc, char **argv)
+{
+    const char *dir = argc > 1 ? argv[1] : getenv("TMPDIR");
+    return dir ? dir : ".";
+}
+
+int bench_make_file(const char *path, size_t size)
+{
+    size_t i;
+    int result;
+    unsigned char *data = (unsigned char *)malloc(size ? size : 1);
+    if (!data)
+    {
+        return 0;
+    }
+
+    for (i = 0; i < size; ++i)
+    {
+        data[i] = (unsigned char)((i * 2654435761u) >> 13);
+    }
+
+    result = fs_write_file(path, data, size);
+    free(data);
+    return result;
+}
+
+void bench_delete_tree(const char *path)
+{
+    char child[LIBFS_MAX_PATH];
+    struct fs_directory_iterator *it = fs_open_dir(path);
+    if (!it)
+    {
+        fs_delete_file(path);
+        return;
+    }
+
+    while (fs_read_dir(it))
+    {
+        if (strcmp(it->path, ".") == 0 || strcmp(it->path, "..") == 0)
+        {
+            continue;
+        }
+
+        fs_join_path(child, LIBFS_MAX_PATH, path, it->path);
+        if (fs_dir_entry_type(it) == LIBFS_TYPE_DIRECTORY)
+        {
+            bench_delete_tree(child);
+        }
+        else
+        {
+            fs_delete_file(child);
+        }
+    }
+
+    fs_close_dir(it);
+    fs_delete_dir(path);
+}
+
+int bench_make_tree(const char *path, size_t files, size_t per_dir, size_t size)
+{
+    char dir[LIBFS_MAX_PATH];
+    char file[LIBFS_MAX_PATH];
+    char name[32];
+    char *data = (char *)calloc(1, size ? size : 1);
+    size_t i;
+    int result = data && fs_make_dir(path);
+
+    for (i = 0; result && i < files; ++i)
+    {
+        sprintf(name, "d%lu", (unsigned long)(i / per_dir));
+        fs_join_path(dir, LIBFS_MAX_PATH, path, name);
+        if (i % per_dir == 0 && !fs_make_dir(dir))
+        {
+            result = 0;
+            break;
+        }
+
+        sprintf(name, "f%lu", (unsigned long)i);
+        fs_join_path(file, LIBFS_MAX_PATH, dir, name);
+        result = fs_write_file(file, data, size);
+    }
+
+    free(data);
+    return result;
+}
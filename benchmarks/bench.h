@@ -0,0 +1,72 @@
+#ifndef LIBFS_BENCH__h
+#define LIBFS_BENCH__h
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "fs.h"
+
+#ifndef LIBFS_MAX_PATH
+/** Maximum path size. */
+#define LIBFS_MAX_PATH 256
+#endif
+
+    /**
+     * Gets a monotonic timestamp.
+     * @return The current time in seconds.
+     */
+    double bench_now(void);
+
+    /**
+     * Prints the throughput of a benchmark run.
+     * @param[in] name Name of the run
+     * @param[in] bytes Number of bytes processed
+     * @param[in] seconds Elapsed time
+     */
+    void bench_report(const char *name, double bytes, double seconds);
+
+    /**
+     * Gets the directory benchmarks write to.
+     * @param[in] argc Program argument count
+     * @param[in] argv Program arguments
+     * @return The first argument, or TMPDIR, or the current directory.
+     */
+    const char *bench_dir(int argc, char **argv);
+
+    /**
+     * Creates a file filled with pseudo random bytes.
+     * @param[in] path Some null-terminated path
+     * @param[in] size File size in bytes
+     * @return If the file was created.
+     */
+    int bench_make_file(const char *path, size_t size);
+
+    /**
+     * Recursively deletes a directory.
+     * @param[in] path Some null-terminated path
+     */
+    void bench_delete_tree(const char *path);
+
+    /**
+     * Creates a tree of small files.
+     * @param[in] path Some null-terminated path to the root directory
+     * @param[in] files Number of files
+     * @param[in] per_dir Number of files per sub directory
+     * @param[in] size Size of each file
+     * @return If the tree was created.
+     */
+    int bench_make_tree(const char *path, size_t files, size_t per_dir, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
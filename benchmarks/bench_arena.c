@@ -0,0 +1,86 @@
+#include "bench.h"
+
+/*
+ * Reads the same small files request after request, freeing each file
+ * with the hooks or releasing a whole request with fs_arena_reset.
+ *
+ * usage: libfs-bench_arena [dir] [files] [requests]
+ */
+static void bench_run(const char *name, char **paths, size_t count, size_t requests, struct fs_context *ctx,
+                      struct fs_arena *arena)
+{
+    double start = bench_now();
+    double bytes = 0;
+    size_t size;
+    size_t i;
+    size_t j;
+    void *data;
+
+    for (i = 0; i < requests; ++i)
+    {
+        for (j = 0; j < count; ++j)
+        {
+            data = fs_read_file_ctx(ctx, paths[j], &size, 0);
+            if (!data)
+            {
+                fprintf(stderr, "%s: failed to read %s\n", name, paths[j]);
+                return;
+            }
+
+            bytes += (double)size;
+            if (!arena)
+            {
+                free(data);
+            }
+        }
+
+        if (arena)
+        {
+            fs_arena_reset(arena);
+        }
+    }
+
+    bench_report(name, bytes, bench_now() - start);
+}
+
+int main(int argc, char **argv)
+{
+    const char *dir = bench_dir(argc, argv);
+    size_t count = argc > 2 ? (size_t)atol(argv[2]) : 200;
+    size_t requests = argc > 3 ? (size_t)atol(argv[3]) : 500;
+    struct fs_context ctx;
+    struct fs_arena *arena;
+    char root[LIBFS_MAX_PATH];
+    char name[32];
+    char **paths;
+    size_t i;
+
+    fs_join_path(root, LIBFS_MAX_PATH, dir, "libfs_bench_arena");
+    fs_make_dir(root);
+    paths = (char **)malloc(count * sizeof(char *));
+    for (i = 0; i < count; ++i)
+    {
+        sprintf(name, "%lu.txt", (unsigned long)i);
+        paths[i] = (char *)malloc(LIBFS_MAX_PATH);
+        fs_join_path(paths[i], LIBFS_MAX_PATH, root, name);
+        bench_make_file(paths[i], 512 + (i * 7919) % 8192);
+    }
+
+    arena = fs_arena_create(1024 * 1024);
+    fs_arena_context(arena, &ctx);
+    bench_run("hooks", paths, count, requests, NULL, NULL);
+    bench_run("arena", paths, count, requests, &ctx, arena);
+    bench_run("hooks", paths, count, requests, NULL, NULL);
+    bench_run("arena", paths, count, requests, &ctx, arena);
+    fs_arena_destroy(arena);
+
+    for (i = 0; i < count; ++i)
+    {
+        fs_delete_file(paths[i]);
+        free(paths[i]);
+    }
+
+    free(paths);
+    fs_delete_dir(root);
+    return 0;
+}
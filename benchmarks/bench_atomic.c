@@ -0,0 +1,79 @@
+#include "bench.h"
+
+/*
+ * Compares writing many small files with fs_write_file, which is not
+ * durable, against fs_write_file_atomic for each file and against a
+ * single fs_atomic_batch commit.
+ *
+ * usage: libfs-bench_atomic [dir] [number of files]
+ */
+static int write_plain(const char *path, const char *content, size_t size, struct fs_atomic_batch *batch)
+{
+    (void)batch;
+    return fs_write_file(path, content, size);
+}
+
+static int write_atomic(const char *path, const char *content, size_t size, struct fs_atomic_batch *batch)
+{
+    (void)batch;
+    return fs_write_file_atomic(path, content, size);
+}
+
+static int write_batch(const char *path, const char *content, size_t size, struct fs_atomic_batch *batch)
+{
+    return fs_atomic_batch_write(batch, path, content, size);
+}
+
+static void bench_run(const char *name, int (*fn)(const char *, const char *, size_t, struct fs_atomic_batch *),
+                      const char *root, size_t files)
+{
+    struct fs_atomic_batch *batch = fs_atomic_batch_create();
+    char path[LIBFS_MAX_PATH];
+    char file[32];
+    char content[64];
+    size_t i;
+    double start = bench_now();
+    double seconds;
+
+    for (i = 0; i < files; ++i)
+    {
+        sprintf(file, "f%lu", (unsigned long)i);
+        sprintf(content, "state %lu", (unsigned long)i);
+        fs_join_path(path, LIBFS_MAX_PATH, root, file);
+        if (!fn(path, content, strlen(content), batch))
+        {
+            fprintf(stderr, "%s failed\n", name);
+            break;
+        }
+    }
+
+    if (!fs_atomic_batch_commit(batch))
+    {
+        fprintf(stderr, "%s commit failed\n", name);
+    }
+
+    seconds = bench_now() - start;
+    printf("%-24s %10.3f s %10.2f us/file\n", name, seconds, seconds * 1e6 / (double)files);
+    fs_atomic_batch_destroy(batch);
+}
+
+int main(int argc, char **argv)
+{
+    const char *dir = bench_dir(argc, argv);
+    size_t files = (size_t)(argc > 2 ? atol(argv[2]) : 10000);
+    char root[LIBFS_MAX_PATH];
+
+    fs_join_path(root, LIBFS_MAX_PATH, dir, "libfs_bench_atomic");
+    if (!fs_make_dir(root))
+    {
+        fprintf(stderr, "can't create %s\n", root);
+        return 1;
+    }
+
+    bench_run("fs_write_file", write_plain, root, files);
+    bench_run("fs_write_file_atomic", write_atomic, root, files);
+    bench_run("fs_atomic_batch", write_batch, root, files);
+
+    bench_delete_tree(root);
+    return 0;
+}
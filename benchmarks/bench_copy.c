@@ -0,0 +1,86 @@
+#include "bench.h"
+
+/*
+ * Compares the strategies of fs_copy_file_ex on a single large file.
+ *
+ * usage: libfs-bench_copy [dir] [size in MB] [runs]
+ *
+ * Run it once on tmpfs (e.g. /dev/shm) and once on ext4 to compare
+ * copy_file_range, sendfile and the read/write fallback. The clone run
+ * only succeeds on filesystems supporting reflinks such as btrfs or XFS.
+ */
+int main(int argc, char **argv)
+{
+    static const struct
+    {
+        const char *name;
+        enum fs_copy_method method;
+    } methods[] = {
+        {"copy_file_range", LIBFS_COPY_RANGE},
+        {"sendfile", LIBFS_COPY_SENDFILE},
+        {"read/write", LIBFS_COPY_READ_WRITE},
+        {"auto", LIBFS_COPY_AUTO},
+        {"clone", LIBFS_COPY_CLONE}};
+    const char *dir = bench_dir(argc, argv);
+    size_t size = (size_t)(argc > 2 ? atol(argv[2]) : 512) * 1024 * 1024;
+    int runs = argc > 3 ? atoi(argv[3]) : 3;
+    char from[LIBFS_MAX_PATH];
+    char to[LIBFS_MAX_PATH];
+    size_t i;
+    int run;
+
+    fs_join_path(from, LIBFS_MAX_PATH, dir, "libfs_bench_copy.src");
+    fs_join_path(to, LIBFS_MAX_PATH, dir, "libfs_bench_copy.dst");
+    if (!bench_make_file(from, size))
+    {
+        fprintf(stderr, "can't create %s\n", from);
+        return 1;
+    }
+
+    printf("copying %lu MB in %s, %d runs\n", (unsigned long)(size >> 20), dir, runs);
+    for (i = 0; i < sizeof(methods) / sizeof(methods[0]); ++i)
+    {
+        struct fs_copy_options options;
+        enum fs_copy_method used = LIBFS_COPY_AUTO;
+        double start;
+        double best = 0;
+
+        memset(&options, 0, sizeof(options));
+        options.method = methods[i].method;
+        if (methods[i].method == LIBFS_COPY_CLONE)
+        {
+            options.clone = LIBFS_CLONE_ALWAYS;
+        }
+
+        for (run = 0; run < runs; ++run)
+        {
+            double elapsed;
+            fs_delete_file(to);
+            start = bench_now();
+            if (!fs_copy_file_ex(from, to, &options, &used))
+            {
+                fprintf(stderr, "%s failed\n", methods[i].name);
+                break;
+            }
+
+            elapsed = bench_now() - start;
+            if (run == 0 || elapsed < best)
+            {
+                best = elapsed;
+            }
+        }
+
+        if (run == runs)
+        {
+            bench_report(methods[i].name, (double)size, best);
+            if (used != methods[i].method && methods[i].method != LIBFS_COPY_AUTO)
+            {
+                printf("  (fell back to method %d)\n", (int)used);
+            }
+        }
+    }
+
+    fs_delete_file(to);
+    fs_delete_file(from);
+    return 0;
+}
@@ -0,0 +1,51 @@
+#include "bench.h"
+
+/*
+ * Measures fs_copy_tree throughput depending on the number of threads.
+ *
+ * usage: libfs-bench_copy_tree [dir] [files] [file size] [max threads]
+ */
+int main(int argc, char **argv)
+{
+    const char *dir = bench_dir(argc, argv);
+    size_t files = (size_t)(argc > 2 ? atol(argv[2]) : 100000);
+    size_t size = (size_t)(argc > 3 ? atol(argv[3]) : 4096);
+    size_t max_threads = (size_t)(argc > 4 ? atol(argv[4]) : 16);
+    char from[LIBFS_MAX_PATH];
+    char to[LIBFS_MAX_PATH];
+    char name[32];
+    struct fs_copy_tree_options options;
+    size_t threads;
+    double start;
+
+    fs_join_path(from, LIBFS_MAX_PATH, dir, "libfs_bench_tree.src");
+    fs_join_path(to, LIBFS_MAX_PATH, dir, "libfs_bench_tree.dst");
+    bench_delete_tree(from);
+    bench_delete_tree(to);
+    if (!bench_make_tree(from, files, 1000, size))
+    {
+        fprintf(stderr, "can't create %s\n", from);
+        return 1;
+    }
+
+    printf("copying %lu files of %lu bytes in %s\n", (unsigned long)files, (unsigned long)size, dir);
+    memset(&options, 0, sizeof(options));
+    options.copy.clone = LIBFS_CLONE_NEVER;
+    for (threads = 1; threads <= max_threads; threads *= 2)
+    {
+        options.threads = threads;
+        start = bench_now();
+        if (!fs_copy_tree(from, to, &options))
+        {
+            fprintf(stderr, "fs_copy_tree failed\n");
+            return 1;
+        }
+
+        sprintf(name, "%lu threads", (unsigned long)threads);
+        bench_report(name, (double)files * (double)size, bench_now() - start);
+        bench_delete_tree(to);
+    }
+
+    bench_delete_tree(from);
+    return 0;
+}
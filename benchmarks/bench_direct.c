@@ -0,0 +1,120 @@
+/* Required for sync */
+#define _DEFAULT_SOURCE
+#include "bench.h"
+#include <unistd.h>
+
+/*
+ * Compares writing, reading and copying a large file through the page
+ * cache and with LIBFS_IO_DIRECT, reporting how much the page cache grew.
+ * The page cache is measured from /proc/meminfo, and is written back and
+ * dropped before each run when possible, which requires root.
+ *
+ * usage: libfs-bench_direct [dir] [size in MiB]
+ */
+static long cached_kib(void)
+{
+    char line[256];
+    long kib = -1;
+    FILE *file = fopen("/proc/meminfo", "r");
+    if (!file)
+    {
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), file))
+    {
+        if (sscanf(line, "Cached: %ld kB", &kib) == 1)
+        {
+            break;
+        }
+    }
+
+    fclose(file);
+    return kib;
+}
+
+static void drop_caches(void)
+{
+    FILE *file;
+    sync();
+    file = fopen("/proc/sys/vm/drop_caches", "w");
+    if (file)
+    {
+        fputs("3", file);
+        fclose(file);
+    }
+}
+
+static void bench_run(const char *name, int op, const char *path, const char *copy, char *buf, size_t size, int flags)
+{
+    struct fs_copy_options options;
+    double start;
+    double seconds;
+    long cached;
+    size_t readen = 0;
+    void *data;
+    int result = 1;
+
+    drop_caches();
+    cached = cached_kib();
+    start = bench_now();
+    if (op == 0)
+    {
+        result = fs_write_file_ex(path, buf, size, flags);
+    }
+    else if (op == 1)
+    {
+        data = fs_read_file_ex(path, &readen, flags);
+        result = data && readen == size;
+        if (flags & LIBFS_IO_DIRECT)
+        {
+            fs_aligned_free(data);
+        }
+        else
+        {
+            free(data);
+        }
+    }
+    else
+    {
+        memset(&options, 0, sizeof(options));
+        options.clone = LIBFS_CLONE_NEVER;
+        options.flags = flags;
+        result = fs_copy_file_ex(path, copy, &options, NULL);
+    }
+
+    seconds = bench_now() - start;
+    if (!result)
+    {
+        fprintf(stderr, "%s failed\n", name);
+    }
+
+    printf("%-20s %10.3f s %10.1f MiB/s %10ld MiB cached\n", name, seconds, (double)size / (1024.0 * 1024.0) / seconds,
+           (cached_kib() - cached) / 1024);
+}
+
+int main(int argc, char **argv)
+{
+    const char *dir = bench_dir(argc, argv);
+    size_t size = (size_t)(argc > 2 ? atol(argv[2]) : 512) * 1024 * 1024;
+    char path[LIBFS_MAX_PATH];
+    char copy[LIBFS_MAX_PATH];
+    char *buf;
+
+    fs_join_path(path, LIBFS_MAX_PATH, dir, "libfs_bench_direct");
+    fs_join_path(copy, LIBFS_MAX_PATH, dir, "libfs_bench_direct_copy");
+    buf = (char *)fs_aligned_alloc(LIBFS_DIRECT_ALIGNMENT, size);
+    memset(buf, 'd', size);
+
+    bench_run("write", 0, path, copy, buf, size, 0);
+    bench_run("write direct", 0, path, copy, buf, size, LIBFS_IO_DIRECT);
+    bench_run("read", 1, path, copy, buf, size, 0);
+    bench_run("read direct", 1, path, copy, buf, size, LIBFS_IO_DIRECT);
+    bench_run("copy", 2, path, copy, buf, size, 0);
+    bench_run("copy direct", 2, path, copy, buf, size, LIBFS_IO_DIRECT);
+
+    fs_aligned_free(buf);
+    fs_delete_file(path);
+    fs_delete_file(copy);
+    return 0;
+}
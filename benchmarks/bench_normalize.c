@@ -0,0 +1,86 @@
+#include "bench.h"
+#include <unistd.h>
+
+/*
+ * Canonicalizes relative cache keys of existing files with fs_absolute,
+ * which resolves them through the filesystem, and with
+ * fs_absolute_lexical and fs_normalize, which don't.
+ *
+ * usage: libfs-bench_normalize [dir] [files] [rounds]
+ */
+static void bench_run(const char *name, char **keys, size_t count, size_t rounds,
+                      char *(*fn)(const char *, char *, size_t))
+{
+    char buf[LIBFS_MAX_PATH];
+    double start = bench_now();
+    double seconds;
+    size_t check = 0;
+    size_t i;
+    size_t j;
+
+    for (i = 0; i < rounds; ++i)
+    {
+        for (j = 0; j < count; ++j)
+        {
+            if (!fn(keys[j], buf, LIBFS_MAX_PATH))
+            {
+                fprintf(stderr, "%s: failed on %s\n", name, keys[j]);
+                return;
+            }
+
+            check += strlen(buf);
+        }
+    }
+
+    seconds = bench_now() - start;
+    printf("%-20s %8.3f s %10.2f Mkeys/s (%lu)\n", name, seconds, (double)(count * rounds) / seconds / 1e6,
+           (unsigned long)check);
+}
+
+int main(int argc, char **argv)
+{
+    const char *dir = bench_dir(argc, argv);
+    size_t count = argc > 2 ? (size_t)atol(argv[2]) : 1000;
+    size_t rounds = argc > 3 ? (size_t)atol(argv[3]) : 200;
+    char root[LIBFS_MAX_PATH];
+    char sub[LIBFS_MAX_PATH];
+    char name[64];
+    char **keys;
+    size_t i;
+
+    fs_join_path(root, LIBFS_MAX_PATH, dir, "libfs_bench_normalize");
+    fs_join_path(sub, LIBFS_MAX_PATH, root, "cache");
+    fs_make_dir(root);
+    fs_make_dir(sub);
+    if (chdir(root) != 0)
+    {
+        fprintf(stderr, "failed to enter %s\n", root);
+        return 1;
+    }
+
+    /* Keys are relative and not canonical, like user provided paths */
+    keys = (char **)malloc(count * sizeof(char *));
+    for (i = 0; i < count; ++i)
+    {
+        sprintf(name, "cache/%lu.bin", (unsigned long)i);
+        bench_make_file(name, 0);
+        keys[i] = (char *)malloc(LIBFS_MAX_PATH);
+        sprintf(keys[i], "./cache//../cache/./%lu.bin", (unsigned long)i);
+    }
+
+    bench_run("fs_absolute", keys, count, rounds, fs_absolute);
+    bench_run("fs_absolute_lexical", keys, count, rounds, fs_absolute_lexical);
+    bench_run("fs_normalize", keys, count, rounds, fs_normalize);
+
+    for (i = 0; i < count; ++i)
+    {
+        sprintf(name, "cache/%lu.bin", (unsigned long)i);
+        fs_delete_file(name);
+        free(keys[i]);
+    }
+
+    free(keys);
+    fs_delete_dir(sub);
+    fs_delete_dir(root);
+    return 0;
+}
@@ -0,0 +1,78 @@
+#include "bench.h"
+
+/*
+ * Builds the path of every entry of a deep directory like a walk does,
+ * with snprintf, fs_join_path, and a single fs_path where names are
+ * pushed and truncated.
+ *
+ * usage: libfs-bench_path [depth] [joins]
+ */
+static const char *const bench_names[] = {"a.txt", "CMakeLists.txt", "fs.c", "libfs_bench_entry.dat",
+                                          "README.md", "x", "some_longer_file_name.json", "bench.h"};
+
+#define BENCH_NAMES (sizeof(bench_names) / sizeof(bench_names[0]))
+
+static void bench_result(const char *name, size_t joins, size_t check, double seconds)
+{
+    printf("%-16s %8.3f s %10.2f Mjoins/s (%lu)\n", name, seconds, (double)joins / seconds / 1e6,
+           (unsigned long)check);
+}
+
+int main(int argc, char **argv)
+{
+    size_t depth = argc > 1 ? (size_t)atol(argv[1]) : 8;
+    size_t joins = argc > 2 ? (size_t)atol(argv[2]) : 10000000;
+    char dir[LIBFS_MAX_PATH];
+    char buf[LIBFS_MAX_PATH];
+    struct fs_path path;
+    size_t length;
+    size_t check;
+    size_t run;
+    size_t i;
+    double start;
+
+    /* Parent of the entries, around 16 bytes per level */
+    dir[0] = '\0';
+    for (i = 0; i < depth; ++i)
+    {
+        strcat(dir, i ? "/directory_name" : "/home/libfs_user");
+    }
+
+    fs_path_init(&path, NULL, 0);
+    for (run = 0; run < 2; ++run)
+    {
+        check = 0;
+        start = bench_now();
+        for (i = 0; i < joins; ++i)
+        {
+            check += (size_t)snprintf(buf, LIBFS_MAX_PATH, "%s/%s", dir, bench_names[i % BENCH_NAMES]);
+        }
+
+        bench_result("snprintf", joins, check, bench_now() - start);
+
+        check = 0;
+        start = bench_now();
+        for (i = 0; i < joins; ++i)
+        {
+            check += fs_join_path(buf, LIBFS_MAX_PATH, dir, bench_names[i % BENCH_NAMES]);
+        }
+
+        bench_result("fs_join_path", joins, check, bench_now() - start);
+
+        check = 0;
+        start = bench_now();
+        fs_path_set(&path, dir);
+        length = path.length;
+        for (i = 0; i < joins; ++i)
+        {
+            fs_path_truncate(&path, length);
+            fs_path_push(&path, bench_names[i % BENCH_NAMES]);
+            check += path.length;
+        }
+
+        bench_result("fs_path_push", joins, check, bench_now() - start);
+    }
+
+    fs_path_free(&path);
+    return 0;
+}
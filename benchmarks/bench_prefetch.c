@@ -0,0 +1,97 @@
+/* Required for sync */
+#define _DEFAULT_SOURCE
+#include "bench.h"
+#include <unistd.h>
+
+/*
+ * Reads many small files in a known order with a cold page cache, with
+ * and without warming it up first with fs_prefetch. Dropping the page
+ * cache between runs requires root, otherwise all runs are warm.
+ *
+ * usage: libfs-bench_prefetch [dir] [files] [size in KiB]
+ */
+static void drop_caches(void)
+{
+    FILE *file;
+    sync();
+    file = fopen("/proc/sys/vm/drop_caches", "w");
+    if (file)
+    {
+        fputs("3", file);
+        fclose(file);
+    }
+}
+
+static void bench_run(const char *name, const char *const *paths, size_t count, size_t size, int prefetch, int flags)
+{
+    double start;
+    double prefetched = 0;
+    size_t readen;
+    size_t i;
+    void *data;
+    struct fs_prefetch_batch *batch;
+
+    drop_caches();
+    start = bench_now();
+    /* Files are read while the next ones are prefetched in the background */
+    batch = prefetch ? fs_prefetch(paths, count) : NULL;
+    prefetched = bench_now() - start;
+    for (i = 0; i < count; ++i)
+    {
+        data = fs_read_file_ex(paths[i], &readen, flags);
+        if (!data || readen != size)
+        {
+            fprintf(stderr, "%s: failed to read %s\n", name, paths[i]);
+        }
+
+        free(data);
+    }
+
+    if (prefetch && fs_prefetch_wait(batch) != count)
+    {
+        fprintf(stderr, "%s: fs_prefetch failed\n", name);
+    }
+
+    bench_report(name, (double)count * (double)size, bench_now() - start);
+    if (prefetch)
+    {
+        printf("%-24s %10.3f s\n", "  starting fs_prefetch", prefetched);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const char *dir = bench_dir(argc, argv);
+    size_t count = argc > 2 ? (size_t)atol(argv[2]) : 10000;
+    size_t size = (argc > 3 ? (size_t)atol(argv[3]) : 16) * 1024;
+    char root[LIBFS_MAX_PATH];
+    char name[32];
+    char **paths;
+    size_t i;
+
+    fs_join_path(root, LIBFS_MAX_PATH, dir, "libfs_bench_prefetch");
+    fs_make_dir(root);
+    paths = (char **)malloc(count * sizeof(char *));
+    for (i = 0; i < count; ++i)
+    {
+        sprintf(name, "%lu.bin", (unsigned long)i);
+        paths[i] = (char *)malloc(LIBFS_MAX_PATH);
+        fs_join_path(paths[i], LIBFS_MAX_PATH, root, name);
+        bench_make_file(paths[i], size);
+    }
+
+    bench_run("read cold", (const char *const *)paths, count, size, 0, 0);
+    bench_run("prefetch + read", (const char *const *)paths, count, size, 1, 0);
+    bench_run("read sequential", (const char *const *)paths, count, size, 0, LIBFS_IO_SEQUENTIAL);
+    bench_run("prefetch + read once", (const char *const *)paths, count, size, 1, LIBFS_IO_ONCE);
+
+    for (i = 0; i < count; ++i)
+    {
+        fs_delete_file(paths[i]);
+        free(paths[i]);
+    }
+
+    free(paths);
+    fs_delete_dir(root);
+    return 0;
+}
@@ -0,0 +1,98 @@
+#include "bench.h"
+
+/*
+ * Compares listing a large flat directory one entry at a time with
+ * fs_read_dir against fs_read_dir_batch with a 1 MB buffer.
+ *
+ * usage: libfs-bench_read_dir [dir] [number of entries]
+ */
+static size_t read_dir_count(const char *path)
+{
+    size_t count = 0;
+    struct fs_directory_iterator *it = fs_open_dir(path);
+    if (!it)
+    {
+        return 0;
+    }
+
+    while (fs_read_dir(it))
+    {
+        ++count;
+    }
+
+    fs_close_dir(it);
+    return count;
+}
+
+static size_t read_dir_batch_count(const char *path)
+{
+    size_t count = 0;
+    size_t n;
+    size_t size = 1024 * 1024;
+    struct fs_dir_entry entries[4096];
+    void *buf = malloc(size);
+    struct fs_directory_iterator *it = fs_open_dir(path);
+    if (!it || !buf)
+    {
+        free(buf);
+        if (it)
+        {
+            fs_close_dir(it);
+        }
+        return 0;
+    }
+
+    while ((n = fs_read_dir_batch(it, buf, size, entries, 4096)) && n != (size_t)-1)
+    {
+        count += n;
+    }
+
+    fs_close_dir(it);
+    free(buf);
+    return count;
+}
+
+static void bench_run(const char *name, size_t (*fn)(const char *), const char *path)
+{
+    double start = bench_now();
+    size_t count = fn(path);
+    double seconds = bench_now() - start;
+    printf("%-24s %10.3f s %10.1f Mentries/s\n", name, seconds, (double)count / seconds / 1e6);
+    printf("  %lu entries\n", (unsigned long)count);
+}
+
+int main(int argc, char **argv)
+{
+    const char *dir = bench_dir(argc, argv);
+    size_t entries = (size_t)(argc > 2 ? atol(argv[2]) : 1000000);
+    char path[LIBFS_MAX_PATH];
+    char file[LIBFS_MAX_PATH];
+    char name[32];
+    size_t i;
+
+    fs_join_path(path, LIBFS_MAX_PATH, dir, "libfs_bench_read_dir");
+    if (!fs_make_dir(path))
+    {
+        fprintf(stderr, "can't create %s\n", path);
+        return 1;
+    }
+
+    for (i = 0; i < entries; ++i)
+    {
+        sprintf(name, "entry%lu", (unsigned long)i);
+        fs_join_path(file, LIBFS_MAX_PATH, path, name);
+        if (!fs_write_file(file, "", 0))
+        {
+            fprintf(stderr, "can't create %s\n", file);
+            break;
+        }
+    }
+
+    /* Warm the dentry cache so the runs measure listing */
+    bench_run("warm up", read_dir_count, path);
+    bench_run("fs_read_dir", read_dir_count, path);
+    bench_run("fs_read_dir_batch", read_dir_batch_count, path);
+
+    bench_delete_tree(path);
+    return 0;
+}
@@ -0,0 +1,91 @@
+#include "bench.h"
+
+/*
+ * Measures the per-file latency of fs_read_file against the stdio based
+ * implementation it replaced (fopen, fseek, ftell, fread), and of
+ * fs_read_file_into reusing the same buffer.
+ *
+ * usage: libfs-bench_read_file [dir] [iterations]
+ */
+static void *stdio_read_file(const char *path, size_t *size)
+{
+    char *data;
+    long file_size;
+    FILE *file = fopen(path, "rb");
+    if (!file)
+    {
+        return NULL;
+    }
+
+    fseek(file, 0, SEEK_END);
+    file_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    data = (char *)malloc((size_t)file_size + 1);
+    if (data)
+    {
+        *size = fread(data, 1, (size_t)file_size, file);
+        data[*size] = '\0';
+    }
+
+    fclose(file);
+    return data;
+}
+
+static double bench_read(void *(*fn)(const char *, size_t *), const char *path, size_t iterations)
+{
+    size_t i;
+    size_t size;
+    double start = bench_now();
+    for (i = 0; i < iterations; ++i)
+    {
+        free(fn(path, &size));
+    }
+
+    return (bench_now() - start) / (double)iterations;
+}
+
+static double bench_read_into(const char *path, size_t iterations)
+{
+    struct fs_buffer buf = {NULL, 0, 0};
+    size_t i;
+    double start = bench_now();
+    for (i = 0; i < iterations; ++i)
+    {
+        fs_read_file_into(path, &buf);
+    }
+
+    start = (bench_now() - start) / (double)iterations;
+    fs_free_buffer(&buf);
+    return start;
+}
+
+int main(int argc, char **argv)
+{
+    static const size_t sizes[] = {1024, 64 * 1024, 16 * 1024 * 1024};
+    const char *dir = bench_dir(argc, argv);
+    size_t iterations = (size_t)(argc > 2 ? atol(argv[2]) : 20000);
+    char path[LIBFS_MAX_PATH];
+    size_t i;
+    size_t n;
+
+    fs_join_path(path, LIBFS_MAX_PATH, dir, "libfs_bench_read_file");
+    printf("%-10s %14s %18s %18s\n", "size", "stdio (us)", "fs_read_file (us)", "read_into (us)");
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i)
+    {
+        if (!bench_make_file(path, sizes[i]))
+        {
+            fprintf(stderr, "can't create %s\n", path);
+            return 1;
+        }
+
+        /* Keep the total amount of data read reasonable for large files */
+        n = sizes[i] > 1024 * 1024 ? iterations / 200 + 1 : iterations;
+        printf("%-10lu %14.2f", (unsigned long)sizes[i], bench_read(stdio_read_file, path, n) * 1e6);
+        printf(" %18.2f", bench_read(fs_read_file, path, n) * 1e6);
+        printf(" %18.2f\n", bench_read_into(path, n) * 1e6);
+    }
+
+    fs_delete_file(path);
+    return 0;
+}
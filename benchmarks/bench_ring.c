@@ -0,0 +1,159 @@
+#include "bench.h"
+
+/*
+ * Compares reading many small files with a fs_read_file loop against
+ * fs_ring with io_uring and with its thread pool, keeping up to depth
+ * reads in flight.
+ *
+ * With cold set to 1, the page cache is dropped before each run, which
+ * requires root.
+ *
+ * usage: libfs-bench_ring [dir] [number of files] [depth] [cold]
+ */
+static void drop_caches(void)
+{
+    FILE *file = fopen("/proc/sys/vm/drop_caches", "w");
+    if (file)
+    {
+        fputs("3", file);
+        fclose(file);
+    }
+}
+
+static size_t read_loop(const char **paths, size_t files, size_t depth)
+{
+    size_t total = 0;
+    size_t size;
+    size_t i;
+    void *data;
+    (void)depth;
+
+    for (i = 0; i < files; ++i)
+    {
+        data = fs_read_file(paths[i], &size);
+        if (data)
+        {
+            total += size;
+            free(data);
+        }
+    }
+
+    return total;
+}
+
+static size_t read_ring(const char **paths, size_t files, size_t depth, int flags)
+{
+    struct fs_ring_completion done[64];
+    struct fs_ring *ring = fs_ring_create(depth, flags);
+    size_t total = 0;
+    size_t next = 0;
+    size_t n;
+    size_t i;
+
+    if (!ring)
+    {
+        return 0;
+    }
+
+    for (;;)
+    {
+        while (next < files && fs_ring_read_file(ring, paths[next], NULL))
+        {
+            ++next;
+        }
+
+        n = fs_ring_wait(ring, done, 64, 1);
+        if (!n)
+        {
+            break;
+        }
+
+        for (i = 0; i < n; ++i)
+        {
+            if (!done[i].error)
+            {
+                total += done[i].size;
+                free(done[i].data);
+            }
+        }
+    }
+
+    fs_ring_destroy(ring);
+    return total;
+}
+
+static size_t read_uring(const char **paths, size_t files, size_t depth)
+{
+    return read_ring(paths, files, depth, 0);
+}
+
+static size_t read_threads(const char **paths, size_t files, size_t depth)
+{
+    return read_ring(paths, files, depth, LIBFS_RING_THREADS);
+}
+
+static void bench_run(const char *name, size_t (*fn)(const char **, size_t, size_t), const char **paths, size_t files,
+                      size_t depth, int cold)
+{
+    double start;
+    double seconds;
+    size_t total;
+
+    if (cold)
+    {
+        drop_caches();
+    }
+
+    start = bench_now();
+    total = fn(paths, files, depth);
+    seconds = bench_now() - start;
+    printf("%-24s %10.3f s %10.2f us/file\n", name, seconds, seconds * 1e6 / (double)files);
+    if (total != files * 4096)
+    {
+        fprintf(stderr, "%s read %lu bytes\n", name, (unsigned long)total);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const char *dir = bench_dir(argc, argv);
+    size_t files = (size_t)(argc > 2 ? atol(argv[2]) : 2000);
+    size_t depth = (size_t)(argc > 3 ? atol(argv[3]) : 64);
+    int cold = argc > 4 ? atoi(argv[4]) : 0;
+    const char **paths;
+    char *names;
+    char *content;
+    char root[LIBFS_MAX_PATH];
+    char file[32];
+    size_t i;
+
+    fs_join_path(root, LIBFS_MAX_PATH, dir, "libfs_bench_ring");
+    if (!fs_make_dir(root))
+    {
+        fprintf(stderr, "can't create %s\n", root);
+        return 1;
+    }
+
+    content = (char *)malloc(4096);
+    memset(content, 'x', 4096);
+    paths = (const char **)malloc(files * sizeof(const char *));
+    names = (char *)malloc(files * LIBFS_MAX_PATH);
+    for (i = 0; i < files; ++i)
+    {
+        sprintf(file, "f%lu", (unsigned long)i);
+        fs_join_path(names + i * LIBFS_MAX_PATH, LIBFS_MAX_PATH, root, file);
+        paths[i] = names + i * LIBFS_MAX_PATH;
+        fs_write_file(paths[i], content, 4096);
+    }
+
+    bench_run("warm up", read_loop, paths, files, depth, 0);
+    bench_run("fs_read_file loop", read_loop, paths, files, depth, cold);
+    bench_run("fs_ring io_uring", read_uring, paths, files, depth, cold);
+    bench_run("fs_ring threads", read_threads, paths, files, depth, cold);
+
+    free(paths);
+    free(names);
+    free(content);
+    bench_delete_tree(root);
+    return 0;
+}
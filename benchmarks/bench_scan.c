@@ -0,0 +1,112 @@
+#include "bench.h"
+
+/*
+ * Compares the vectorized delimiter scanning of fs_count_lines and
+ * fs_next_line against a memchr based loop over the same chunks.
+ *
+ * usage: libfs-bench_scan [dir] [size in MB] [average line length]
+ */
+static int memchr_count_lines(const char *path, size_t *count)
+{
+    const char *data;
+    const char *c;
+    const char *end;
+    size_t size;
+    struct fs_file_iterator *it = fs_iter_file_ex(path, 1024 * 1024);
+    if (!it)
+    {
+        return 0;
+    }
+
+    *count = 0;
+    while (fs_next_chunk(it, &data, &size))
+    {
+        end = data + size;
+        while ((c = (const char *)memchr(data, '\n', (size_t)(end - data))) != NULL)
+        {
+            ++*count;
+            data = c + 1;
+        }
+    }
+
+    fs_close_file(it);
+    return 1;
+}
+
+static int next_line_count_lines(const char *path, size_t *count)
+{
+    const char *line;
+    size_t size;
+    struct fs_file_iterator *it = fs_iter_file_ex(path, 1024 * 1024);
+    if (!it)
+    {
+        return 0;
+    }
+
+    *count = 0;
+    while (fs_next_line(it, &line, &size))
+    {
+        ++*count;
+    }
+
+    fs_close_file(it);
+    return 1;
+}
+
+static void bench_run(const char *name, int (*fn)(const char *, size_t *), const char *path, size_t size)
+{
+    size_t count = 0;
+    double start = bench_now();
+    if (!fn(path, &count))
+    {
+        fprintf(stderr, "%s failed\n", name);
+        return;
+    }
+
+    bench_report(name, (double)size, bench_now() - start);
+    printf("  %lu lines\n", (unsigned long)count);
+}
+
+int main(int argc, char **argv)
+{
+    const char *dir = bench_dir(argc, argv);
+    size_t size = (size_t)(argc > 2 ? atol(argv[2]) : 2048) * 1024 * 1024;
+    size_t line = (size_t)(argc > 3 ? atol(argv[3]) : 80);
+    size_t chunk = 1024 * 1024;
+    char path[LIBFS_MAX_PATH];
+    char *data;
+    size_t i;
+    FILE *file;
+
+    fs_join_path(path, LIBFS_MAX_PATH, dir, "libfs_bench_scan.txt");
+    file = fopen(path, "wb");
+    data = (char *)malloc(chunk);
+    if (!file || !data)
+    {
+        fprintf(stderr, "can't create %s\n", path);
+        return 1;
+    }
+
+    /* Lines of pseudo random length around the average */
+    for (i = 0; i < chunk; ++i)
+    {
+        data[i] = ((i * 2654435761u) >> 7) % line == 0 ? '\n' : 'x';
+    }
+
+    for (i = 0; i < size; i += chunk)
+    {
+        fwrite(data, 1, chunk, file);
+    }
+
+    fclose(file);
+    free(data);
+
+    /* Warm the page cache so the runs measure scanning */
+    bench_run("warm up", memchr_count_lines, path, size);
+    bench_run("memchr loop", memchr_count_lines, path, size);
+    bench_run("fs_next_line", next_line_count_lines, path, size);
+    bench_run("fs_count_lines", fs_count_lines, path, size);
+
+    fs_delete_file(path);
+    return 0;
+}
@@ -0,0 +1,190 @@
+#include "bench.h"
+#include <sys/stat.h>
+
+/*
+ * Compares getting the type, size and modification time of files with
+ * one fs_stat call against the separate fs_is_file, fs_is_directory and
+ * fs_file_size calls, and against the fopen/fstat fs_file_size used to do.
+ * Then compares a fs_stat loop with fs_stat_many over all the files, with
+ * io_uring where available and with the thread pool.
+ *
+ * With cold set to 1, the page cache is dropped before each fs_stat_many
+ * run, which requires root.
+ *
+ * usage: libfs-bench_stat [dir] [number of files] [rounds] [cold]
+ */
+static off_t fopen_file_size(const char *path)
+{
+    struct stat s;
+    off_t size = -1;
+    FILE *file = fopen(path, "rb");
+    if (!file)
+    {
+        return -1;
+    }
+
+    if (fstat(fileno(file), &s) == 0)
+    {
+        size = s.st_size;
+    }
+
+    fclose(file);
+    return size;
+}
+
+/* Type checks, a stat for the modification time and the old fs_file_size */
+static off_t separate_calls(const char *path)
+{
+    struct stat s;
+    if (!fs_is_file(path) || fs_is_directory(path) || stat(path, &s) != 0 || s.st_mtime < 0)
+    {
+        return -1;
+    }
+
+    return fopen_file_size(path);
+}
+
+static off_t libfs_calls(const char *path)
+{
+    if (!fs_is_file(path) || fs_is_directory(path))
+    {
+        return -1;
+    }
+
+    return fs_file_size(path);
+}
+
+static off_t single_stat(const char *path)
+{
+    struct fs_stat_result st;
+    if (!fs_stat(path, &st, LIBFS_STAT_TYPE | LIBFS_STAT_SIZE | LIBFS_STAT_MTIME) || st.type != LIBFS_TYPE_FILE)
+    {
+        return -1;
+    }
+
+    return st.size;
+}
+
+static void drop_caches(void)
+{
+    FILE *file = fopen("/proc/sys/vm/drop_caches", "w");
+    if (file)
+    {
+        fputs("3", file);
+        fclose(file);
+    }
+}
+
+static void bench_run_many(const char *name, const char **paths, size_t files, int many, int cold)
+{
+    struct fs_stat_result *results = (struct fs_stat_result *)malloc(files * sizeof(struct fs_stat_result));
+    size_t found = 0;
+    size_t i;
+    double start;
+    double seconds;
+
+    if (cold)
+    {
+        drop_caches();
+    }
+
+    start = bench_now();
+    if (many)
+    {
+        found = fs_stat_many(paths, files, results, LIBFS_STAT_TYPE | LIBFS_STAT_SIZE | LIBFS_STAT_MTIME, many > 1 ? LIBFS_STAT_MANY_THREADS : 0);
+    }
+    else
+    {
+        for (i = 0; i < files; ++i)
+        {
+            found += fs_stat(paths[i], &results[i], LIBFS_STAT_TYPE | LIBFS_STAT_SIZE | LIBFS_STAT_MTIME);
+        }
+    }
+
+    seconds = bench_now() - start;
+    printf("%-24s %10.3f s %10.2f us/file\n", name, seconds, seconds * 1e6 / (double)files);
+    if (found != files)
+    {
+        fprintf(stderr, "%s found %lu files\n", name, (unsigned long)found);
+    }
+
+    free(results);
+}
+
+static void bench_run(const char *name, off_t (*fn)(const char *), const char *root, size_t files, size_t rounds)
+{
+    char path[LIBFS_MAX_PATH];
+    char file[32];
+    size_t i;
+    size_t j;
+    double start = bench_now();
+    double seconds;
+
+    for (j = 0; j < rounds; ++j)
+    {
+        for (i = 0; i < files; ++i)
+        {
+            sprintf(file, "f%lu", (unsigned long)i);
+            fs_join_path(path, LIBFS_MAX_PATH, root, file);
+            if (fn(path) < 0)
+            {
+                fprintf(stderr, "%s failed\n", name);
+                return;
+            }
+        }
+    }
+
+    seconds = bench_now() - start;
+    printf("%-24s %10.3f s %10.2f us/file\n", name, seconds, seconds * 1e6 / (double)(files * rounds));
+}
+
+int main(int argc, char **argv)
+{
+    const char *dir = bench_dir(argc, argv);
+    size_t files = (size_t)(argc > 2 ? atol(argv[2]) : 1000);
+    size_t rounds = (size_t)(argc > 3 ? atol(argv[3]) : 200);
+    int cold = argc > 4 ? atoi(argv[4]) : 0;
+    const char **paths;
+    char *names;
+    char root[LIBFS_MAX_PATH];
+    char path[LIBFS_MAX_PATH];
+    char file[32];
+    size_t i;
+
+    fs_join_path(root, LIBFS_MAX_PATH, dir, "libfs_bench_stat");
+    if (!fs_make_dir(root))
+    {
+        fprintf(stderr, "can't create %s\n", root);
+        return 1;
+    }
+
+    for (i = 0; i < files; ++i)
+    {
+        sprintf(file, "f%lu", (unsigned long)i);
+        fs_join_path(path, LIBFS_MAX_PATH, root, file);
+        fs_write_file(path, "hello", 5);
+    }
+
+    bench_run("warm up", single_stat, root, files, 1);
+    bench_run("stat + fopen/fstat", separate_calls, root, files, rounds);
+    bench_run("fs_is_* + fs_file_size", libfs_calls, root, files, rounds);
+    bench_run("fs_stat", single_stat, root, files, rounds);
+
+    paths = (const char **)malloc(files * sizeof(const char *));
+    names = (char *)malloc(files * LIBFS_MAX_PATH);
+    for (i = 0; i < files; ++i)
+    {
+        sprintf(file, "f%lu", (unsigned long)i);
+        fs_join_path(names + i * LIBFS_MAX_PATH, LIBFS_MAX_PATH, root, file);
+        paths[i] = names + i * LIBFS_MAX_PATH;
+    }
+
+    bench_run_many("fs_stat loop", paths, files, 0, cold);
+    bench_run_many("fs_stat_many", paths, files, 1, cold);
+    bench_run_many("fs_stat_many threads", paths, files, 2, cold);
+    free(paths);
+    free(names);
+
+    bench_delete_tree(root);
+    return 0;
+}
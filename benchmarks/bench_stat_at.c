@@ -0,0 +1,105 @@
+#include "bench.h"
+
+/*
+ * Compares checking files at the bottom of a deep directory chain with
+ * full paths against paths relative to a fs_dir_handle.
+ *
+ * usage: libfs-bench_stat_at [dir] [depth] [number of files]
+ */
+static size_t is_file_path(const char *dir, size_t files)
+{
+    char path[LIBFS_MAX_PATH];
+    char name[32];
+    size_t count = 0;
+    size_t i;
+
+    for (i = 0; i < files; ++i)
+    {
+        sprintf(name, "f%lu", (unsigned long)i);
+        fs_join_path(path, LIBFS_MAX_PATH, dir, name);
+        count += fs_is_file(path);
+    }
+
+    return count;
+}
+
+static size_t is_file_at(const char *dir, size_t files)
+{
+    char name[32];
+    size_t count = 0;
+    size_t i;
+    struct fs_dir_handle *handle = fs_open_dir_handle(dir);
+    if (!handle)
+    {
+        return 0;
+    }
+
+    for (i = 0; i < files; ++i)
+    {
+        sprintf(name, "f%lu", (unsigned long)i);
+        count += fs_is_file_at(handle, name);
+    }
+
+    fs_close_dir_handle(handle);
+    return count;
+}
+
+static void bench_run(const char *name, size_t (*fn)(const char *, size_t), const char *dir, size_t files, size_t rounds)
+{
+    size_t count = 0;
+    size_t i;
+    double start = bench_now();
+    double seconds;
+
+    for (i = 0; i < rounds; ++i)
+    {
+        count += fn(dir, files);
+    }
+
+    seconds = bench_now() - start;
+    printf("%-24s %10.3f s %10.1f Mstat/s\n", name, seconds, (double)count / seconds / 1e6);
+}
+
+int main(int argc, char **argv)
+{
+    const char *dir = bench_dir(argc, argv);
+    size_t depth = (size_t)(argc > 2 ? atol(argv[2]) : 15);
+    size_t files = (size_t)(argc > 3 ? atol(argv[3]) : 1000);
+    char root[LIBFS_MAX_PATH];
+    char path[LIBFS_MAX_PATH];
+    char next[LIBFS_MAX_PATH];
+    char name[32];
+    size_t i;
+
+    fs_join_path(root, LIBFS_MAX_PATH, dir, "libfs_bench_stat_at");
+    strcpy(path, root);
+    for (i = 0; i <= depth; ++i)
+    {
+        if (!fs_make_dir(path))
+        {
+            fprintf(stderr, "can't create %s\n", path);
+            return 1;
+        }
+
+        if (i < depth)
+        {
+            sprintf(name, "level%lu", (unsigned long)i);
+            fs_join_path(next, LIBFS_MAX_PATH, path, name);
+            strcpy(path, next);
+        }
+    }
+
+    for (i = 0; i < files; ++i)
+    {
+        sprintf(name, "f%lu", (unsigned long)i);
+        fs_join_path(next, LIBFS_MAX_PATH, path, name);
+        fs_write_file(next, "", 0);
+    }
+
+    bench_run("warm up", is_file_path, path, files, 10);
+    bench_run("fs_is_file", is_file_path, path, files, 1000);
+    bench_run("fs_is_file_at", is_file_at, path, files, 1000);
+
+    bench_delete_tree(root);
+    return 0;
+}
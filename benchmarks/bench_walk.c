@@ -0,0 +1,187 @@
+#include "bench.h"
+
+/*
+ * Measures fs_walk throughput depending on the number of threads,
+ * against recursive fs_open_dir/fs_read_dir loops with allocated and
+ * caller-provided iterators, and the peak memory and number of
+ * allocations made by libfs during the walk.
+ *
+ * usage: libfs-bench_walk [dir] [files] [files per dir] [max threads]
+ */
+static size_t recursive_count(const char *path)
+{
+    char child[LIBFS_MAX_PATH];
+    size_t count = 0;
+    struct fs_directory_iterator *it = fs_open_dir(path);
+    if (!it)
+    {
+        return 0;
+    }
+
+    while (fs_read_dir(it))
+    {
+        if (strcmp(it->path, ".") == 0 || strcmp(it->path, "..") == 0)
+        {
+            continue;
+        }
+
+        ++count;
+        if (fs_dir_entry_type(it) == LIBFS_TYPE_DIRECTORY)
+        {
+            fs_join_path(child, LIBFS_MAX_PATH, path, it->path);
+            count += recursive_count(child);
+        }
+    }
+
+    fs_close_dir(it);
+    return count;
+}
+
+static size_t recursive_count_in(const char *path)
+{
+    char child[LIBFS_MAX_PATH];
+    struct fs_dir_storage storage;
+    size_t count = 0;
+    struct fs_directory_iterator *it = fs_open_dir_in(&storage, path);
+    if (!it)
+    {
+        return 0;
+    }
+
+    while (fs_read_dir(it))
+    {
+        if (strcmp(it->path, ".") == 0 || strcmp(it->path, "..") == 0)
+        {
+            continue;
+        }
+
+        ++count;
+        if (fs_dir_entry_type(it) == LIBFS_TYPE_DIRECTORY)
+        {
+            fs_join_path(child, LIBFS_MAX_PATH, path, it->path);
+            count += recursive_count_in(child);
+        }
+    }
+
+    fs_close_dir(it);
+    return count;
+}
+
+/* Memory allocated through the libfs hooks */
+static size_t allocated;
+static size_t allocations;
+static size_t peak;
+
+static void *count_malloc(size_t size)
+{
+    size_t *p = (size_t *)malloc(size + sizeof(size_t) * 2);
+    if (!p)
+    {
+        return NULL;
+    }
+
+    *p = size;
+    allocated += size;
+    allocations++;
+    peak = allocated > peak ? allocated : peak;
+    return p + 2;
+}
+
+static void count_free(void *ptr)
+{
+    size_t *p = (size_t *)ptr - 2;
+    allocated -= *p;
+    free(p);
+}
+
+static int walk_count(const struct fs_walk_entry *entry, void *user)
+{
+    (void)entry;
+    (void)user;
+    return LIBFS_WALK_CONTINUE;
+}
+
+static void bench_report_entries(const char *name, size_t count, double seconds)
+{
+    printf("%-24s %10.3f s %10.2f Mentries/s\n", name, seconds, (double)count / seconds / 1e6);
+}
+
+static void bench_run(const char *name, const char *root, const struct fs_walk_options *options, size_t entries)
+{
+    double start = bench_now();
+    if (!fs_walk(root, options, walk_count, NULL))
+    {
+        fprintf(stderr, "fs_walk failed\n");
+        return;
+    }
+
+    bench_report_entries(name, entries, bench_now() - start);
+}
+
+int main(int argc, char **argv)
+{
+    const char *dir = bench_dir(argc, argv);
+    size_t files = (size_t)(argc > 2 ? atol(argv[2]) : 200000);
+    size_t per_dir = (size_t)(argc > 3 ? atol(argv[3]) : 100);
+    size_t max_threads = (size_t)(argc > 4 ? atol(argv[4]) : 16);
+    size_t entries = files + (files + per_dir - 1) / per_dir;
+    char root[LIBFS_MAX_PATH];
+    char name[32];
+    struct fs_walk_options options;
+    struct fs_hooks hooks;
+    size_t threads;
+    size_t count;
+    double start;
+
+    hooks.malloc_fn = count_malloc;
+    hooks.free_fn = count_free;
+    fs_join_path(root, LIBFS_MAX_PATH, dir, "libfs_bench_walk");
+    bench_delete_tree(root);
+    if (!bench_make_tree(root, files, per_dir, 0))
+    {
+        fprintf(stderr, "can't create %s\n", root);
+        return 1;
+    }
+
+    printf("walking %lu entries in %s\n", (unsigned long)entries, dir);
+
+    /* Warm the dentry cache so the runs measure walking */
+    recursive_count(root);
+
+    start = bench_now();
+    count = recursive_count(root);
+    bench_report_entries("fs_read_dir recursion", count, bench_now() - start);
+
+    start = bench_now();
+    count = recursive_count_in(root);
+    bench_report_entries("fs_open_dir_in recursion", count, bench_now() - start);
+
+    memset(&options, 0, sizeof(options));
+    for (threads = 1; threads <= max_threads; threads *= 2)
+    {
+        options.threads = threads;
+        sprintf(name, "fs_walk %lu threads", (unsigned long)threads);
+        bench_run(name, root, &options, entries);
+    }
+
+    options.flags = LIBFS_WALK_STREAMING;
+    bench_run("fs_walk streaming", root, &options, entries);
+
+    /* Count allocations of single threaded walks only, the hooks aren't thread safe */
+    fs_init_hooks(&hooks);
+    options.threads = 1;
+    options.flags = 0;
+    peak = allocated;
+    allocations = 0;
+    fs_walk(root, &options, walk_count, NULL);
+    printf("%-24s %10.1f KB peak %10lu allocations\n", "fs_walk 1 thread", (double)peak / 1024.0, (unsigned long)allocations);
+
+    options.flags = LIBFS_WALK_STREAMING;
+    peak = allocated;
+    allocations = 0;
+    fs_walk(root, &options, walk_count, NULL);
+    printf("%-24s %10.1f KB peak %10lu allocations\n", "fs_walk streaming", (double)peak / 1024.0, (unsigned long)allocations);
+
+    bench_delete_tree(root);
+    return 0;
+}
@@ -0,0 +1,91 @@
+#include "bench.h"
+
+/*
+ * Compares writing a header, a large body and a trailer by gathering them
+ * into one buffer for fs_write_file against a single fs_write_filev.
+ *
+ * usage: libfs-bench_write_filev [dir] [body size in MiB] [rounds]
+ */
+static int gather_write(const char *path, const struct fs_iovec *iov, size_t count)
+{
+    size_t size = 0;
+    size_t i;
+    char *buf;
+    int result;
+
+    for (i = 0; i < count; ++i)
+    {
+        size += iov[i].size;
+    }
+
+    buf = (char *)malloc(size);
+    if (!buf)
+    {
+        return 0;
+    }
+
+    for (size = 0, i = 0; i < count; ++i)
+    {
+        memcpy(buf + size, iov[i].data, iov[i].size);
+        size += iov[i].size;
+    }
+
+    result = fs_write_file(path, buf, size);
+    free(buf);
+    return result;
+}
+
+static void bench_run(const char *name, int (*fn)(const char *, const struct fs_iovec *, size_t), const char *path,
+                      struct fs_iovec *iov, size_t rounds)
+{
+    size_t i;
+    double start = bench_now();
+    double seconds;
+
+    for (i = 0; i < rounds; ++i)
+    {
+        if (!fn(path, iov, 3))
+        {
+            fprintf(stderr, "%s failed\n", name);
+            return;
+        }
+    }
+
+    seconds = (bench_now() - start) / (double)rounds;
+    printf("%-24s %10.3f s %10.1f MiB/s\n", name, seconds, (double)iov[1].size / (1024.0 * 1024.0) / seconds);
+}
+
+int main(int argc, char **argv)
+{
+    const char *dir = bench_dir(argc, argv);
+    size_t body = (size_t)(argc > 2 ? atol(argv[2]) : 256) * 1024 * 1024;
+    size_t rounds = (size_t)(argc > 3 ? atol(argv[3]) : 5);
+    char header[4096];
+    char trailer[64];
+    char path[LIBFS_MAX_PATH];
+    struct fs_iovec iov[3];
+
+    fs_join_path(path, LIBFS_MAX_PATH, dir, "libfs_bench_write_filev");
+    memset(header, 'h', sizeof(header));
+    memset(trailer, 't', sizeof(trailer));
+    iov[0].data = header;
+    iov[0].size = sizeof(header);
+    iov[1].data = malloc(body);
+    iov[1].size = body;
+    iov[2].data = trailer;
+    iov[2].size = sizeof(trailer);
+    if (!iov[1].data)
+    {
+        fprintf(stderr, "can't allocate %lu bytes\n", (unsigned long)body);
+        return 1;
+    }
+
+    memset(iov[1].data, 'b', body);
+    bench_run("warm up", fs_write_filev, path, iov, 1);
+    bench_run("gather + fs_write_file", gather_write, path, iov, rounds);
+    bench_run("fs_write_filev", fs_write_filev, path, iov, rounds);
+
+    free(iov[1].data);
+    fs_delete_file(path);
+    return 0;
+}
@@ -0,0 +1,94 @@
+#include "bench.h"
+
+/*
+ * Compares streaming a large file in small records with stdio against
+ * fs_file_writer, with and without the expected size allocated up front.
+ *
+ * usage: libfs-bench_writer [dir] [size in MiB] [record size]
+ */
+static int write_stdio(const char *path, const char *record, size_t record_size, size_t total)
+{
+    size_t i;
+    int result = 1;
+    FILE *file = fopen(path, "wb");
+    if (!file)
+    {
+        return 0;
+    }
+
+    for (i = 0; i < total; i += record_size)
+    {
+        result = result && fwrite(record, 1, record_size, file) == record_size;
+    }
+
+    return (fclose(file) == 0) && result;
+}
+
+static int write_writer(const char *path, const char *record, size_t record_size, size_t total, off_t expected)
+{
+    struct fs_file_writer_options options;
+    struct fs_file_writer *w;
+    size_t i;
+    int result = 1;
+
+    memset(&options, 0, sizeof(options));
+    options.expected_size = expected;
+    w = fs_open_file_writer(path, &options);
+    if (!w)
+    {
+        return 0;
+    }
+
+    for (i = 0; i < total; i += record_size)
+    {
+        result = result && fs_writer_append(w, record, record_size);
+    }
+
+    return fs_close_file_writer(w) && result;
+}
+
+static void bench_run(const char *name, int method, const char *path, const char *record, size_t record_size, size_t total)
+{
+    double start = bench_now();
+    double seconds;
+    int result;
+
+    if (method == 0)
+    {
+        result = write_stdio(path, record, record_size, total);
+    }
+    else
+    {
+        result = write_writer(path, record, record_size, total, method == 2 ? (off_t)total : 0);
+    }
+
+    seconds = bench_now() - start;
+    if (!result)
+    {
+        fprintf(stderr, "%s failed\n", name);
+    }
+
+    printf("%-28s %10.3f s %10.1f MiB/s\n", name, seconds, (double)total / (1024.0 * 1024.0) / seconds);
+    fs_delete_file(path);
+}
+
+int main(int argc, char **argv)
+{
+    const char *dir = bench_dir(argc, argv);
+    size_t total = (size_t)(argc > 2 ? atol(argv[2]) : 512) * 1024 * 1024;
+    size_t record_size = (size_t)(argc > 3 ? atol(argv[3]) : 100);
+    char path[LIBFS_MAX_PATH];
+    char *record;
+
+    fs_join_path(path, LIBFS_MAX_PATH, dir, "libfs_bench_writer");
+    record = (char *)malloc(record_size);
+    memset(record, 'r', record_size);
+
+    bench_run("warm up", 1, path, record, record_size, total);
+    bench_run("stdio fwrite", 0, path, record, record_size, total);
+    bench_run("fs_file_writer", 1, path, record, record_size, total);
+    bench_run("fs_file_writer preallocated", 2, path, record, record_size, total);
+
+    free(record);
+    return 0;
+}
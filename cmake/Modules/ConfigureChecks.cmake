@@ -1,17 +1,27 @@
 include(CheckIncludeFile)
 include(CheckFunctionExists)
 include(CheckSymbolExists)
+include(CheckStructHasMember)
 
 # HEADER FILES
 check_include_file(dirent.h HAVE_DIRENT_H)
+check_include_file(fcntl.h HAVE_FCNTL_H)
+check_include_file(linux/fs.h HAVE_LINUX_FS_H)
+check_include_file(linux/io_uring.h HAVE_LINUX_IO_URING_H)
 check_include_file(malloc.h HAVE_MALLOC_H)
+check_include_file(pthread.h HAVE_PTHREAD_H)
 check_include_file(stddef.h HAVE_STDDEF_H)
 check_include_file(stdio.h HAVE_STDIO_H)
 check_include_file(stdlib.h HAVE_STDLIB_H)
 check_include_file(string.h HAVE_STRING_H)
+check_include_file(sys/ioctl.h HAVE_SYS_IOCTL_H)
+check_include_file(sys/mman.h HAVE_SYS_MMAN_H)
 check_include_file(sys/sendfile.h HAVE_SYS_SENDFILE_H)
 check_include_file(sys/types.h HAVE_SYS_TYPES_H)
+check_include_file(sys/uio.h HAVE_SYS_UIO_H)
 check_include_file(sys/stat.h HAVE_SYS_STAT_H)
+check_include_file(sys/syscall.h HAVE_SYS_SYSCALL_H)
+check_include_file(sys/sysmacros.h HAVE_SYS_SYSMACROS_H)
 check_include_file(unistd.h HAVE_UNISTD_H)
 check_include_file(windows.h HAVE_WINDOWS_H)
 
@@ -21,6 +31,21 @@ check_function_exists(malloc HAVE_MALLOC)
 check_function_exists(memcpy HAVE_MEMCPY)
 check_function_exists(memset HAVE_MEMSET)
 check_symbol_exists(snprintf stdio.h HAVE_SNPRINTF)
+check_symbol_exists(posix_fadvise fcntl.h HAVE_POSIX_FADVISE)
 check_symbol_exists(vsnprintf stdio.h HAVE_VSNPRINTF)
 check_function_exists(_snprintf HAVE__SNPRINTF)
-check_function_exists(_snprintf_s HAVE__SNPRINTF_S)
\ No newline at end of file
+check_function_exists(_snprintf_s HAVE__SNPRINTF_S)
+
+# GNU EXTENSIONS
+set(CMAKE_REQUIRED_DEFINITIONS -D_GNU_SOURCE)
+check_symbol_exists(copy_file_range unistd.h HAVE_COPY_FILE_RANGE)
+check_symbol_exists(fallocate fcntl.h HAVE_FALLOCATE)
+check_symbol_exists(readahead fcntl.h HAVE_READAHEAD)
+check_symbol_exists(statx sys/stat.h HAVE_STATX)
+check_symbol_exists(syncfs unistd.h HAVE_SYNCFS)
+check_symbol_exists(utimensat sys/stat.h HAVE_UTIMENSAT)
+
+# STRUCT MEMBERS
+check_struct_has_member("struct stat" st_mtim sys/stat.h HAVE_STRUCT_STAT_ST_MTIM)
+check_struct_has_member("struct stat" st_mtimespec sys/stat.h HAVE_STRUCT_STAT_ST_MTIMESPEC)
+unset(CMAKE_REQUIRED_DEFINITIONS)
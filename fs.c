@@ -1,16 +1,44 @@
+#ifndef _GNU_SOURCE
+/* Required for copy_file_range and other Linux specific functions */
+#define _GNU_SOURCE
+#endif
+
 #include "fs.h"
 
 #ifdef HAVE_DIRENT_H
 #include <dirent.h>
 #endif
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
 #ifdef HAVE_SYS_STAT_H
 #include <errno.h>
 #include <sys/stat.h>
 #endif
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
 #ifdef HAVE_SYS_SENDFILE_H
 #include <sys/sendfile.h>
 #endif
+#ifdef HAVE_SYS_SYSCALL_H
+#include <sys/syscall.h>
+#endif
+#ifdef HAVE_SYS_SYSMACROS_H
+#include <sys/sysmacros.h>
+#endif
+#ifdef HAVE_SYS_UIO_H
+#include <sys/uio.h>
+#endif
+#ifdef HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#endif
+#if defined(HAVE_SYS_IOCTL_H) && defined(HAVE_LINUX_FS_H)
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
 #ifdef HAVE_STDLIB_H
+#include <limits.h>
 #include <stdlib.h>
 #endif
 #ifdef HAVE_STDIO_H
@@ -23,9 +51,26 @@
 #ifdef HAVE_STRING_H
 #include <string.h>
 #endif
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+#if !defined(LIBFS_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+/* SSE2 is part of the x86-64 baseline */
+#define LIBFS_HAVE_SSE2 1
+#include <emmintrin.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+/* AVX2 is compiled per function and selected at runtime */
+#define LIBFS_HAVE_AVX2 1
+#include <immintrin.h>
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
 #ifdef HAVE_WINDOWS_H
 #include <windows.h>
 #include <strsafe.h>
+#include <io.h>
 #endif
 
 #ifndef realpath
@@ -57,6 +102,12 @@ static FILE *fs_open(const char *filename, const char *mode)
 
 	return NULL;
 }
+
+/* Flushes a file down to the storage, _commit is the fsync of Windows */
+static int fs_sync_file(FILE *file)
+{
+	return fflush(file) == 0 && _commit(_fileno(file)) == 0;
+}
 #else
 #define fs_open fopen
 #endif
@@ -68,6 +119,23 @@ static FILE *fs_open(const char *filename, const char *mode)
 #ifndef S_ISREG
 #define S_ISREG(x) ((x & _S_IFREG) == _S_IFREG)
 #endif
+#ifndef S_ISLNK
+#define S_ISLNK(x) 0
+#endif
+#define lstat stat
+#endif
+
+/* Nanosecond timestamps of struct stat, named st_*timespec on macOS */
+#if defined(HAVE_STRUCT_STAT_ST_MTIM)
+#define LIBFS_HAVE_STAT_TIMESPEC 1
+#define fs_stat_atim(s) ((s)->st_atim)
+#define fs_stat_mtim(s) ((s)->st_mtim)
+#define fs_stat_ctim(s) ((s)->st_ctim)
+#elif defined(HAVE_STRUCT_STAT_ST_MTIMESPEC)
+#define LIBFS_HAVE_STAT_TIMESPEC 1
+#define fs_stat_atim(s) ((s)->st_atimespec)
+#define fs_stat_mtim(s) ((s)->st_mtimespec)
+#define fs_stat_ctim(s) ((s)->st_ctimespec)
 #endif
 
 #define LIBFS_FALSE 0
@@ -76,7 +144,11 @@ static FILE *fs_open(const char *filename, const char *mode)
 #define LIBFS_UNUSED(x) (void)(x)
 
 typedef struct fs_hooks fs_hooks;
+typedef struct fs_context fs_context;
+typedef struct fs_arena fs_arena;
+typedef struct fs_buffer fs_buffer;
 typedef struct fs_directory_iterator fs_directory_iterator;
+typedef struct fs_dir_handle fs_dir_handle;
 
 #if defined(_MSC_VER)
 /* work around MSVC error C2322: '...' address of dllimport '...' is not static */
@@ -94,528 +166,7175 @@ static void LIBFS_CDECL internal_free(void *pointer)
 #define internal_free LIBFS_FREE
 #endif
 
+static void *LIBFS_CDECL fs_default_aligned_malloc(size_t alignment, size_t size);
+static void LIBFS_CDECL fs_default_aligned_free(void *ptr);
+
 static fs_hooks fs_global_hooks = {
 	internal_malloc,
-	internal_free};
+	internal_free,
+	fs_default_aligned_malloc,
+	fs_default_aligned_free};
 
 LIBFS_PUBLIC(void)
 fs_init_hooks(fs_hooks *hooks)
 {
 	fs_global_hooks.malloc_fn = hooks->malloc_fn;
 	fs_global_hooks.free_fn = hooks->free_fn;
+	if (hooks->aligned_malloc_fn && hooks->aligned_free_fn)
+	{
+		fs_global_hooks.aligned_malloc_fn = hooks->aligned_malloc_fn;
+		fs_global_hooks.aligned_free_fn = hooks->aligned_free_fn;
+	}
+	else
+	{
+		fs_global_hooks.aligned_malloc_fn = fs_default_aligned_malloc;
+		fs_global_hooks.aligned_free_fn = fs_default_aligned_free;
+	}
 }
 
 #define _LIBFS_MALLOC fs_global_hooks.malloc_fn
 #define _LIBFS_FREE fs_global_hooks.free_fn
 
-#if HAVE_STRING_H
-LIBFS_PUBLIC(const char *)
-fs_rsplit(const char *path)
+/* Over-allocates with malloc_fn and keeps the allocated pointer right before the aligned one */
+static void *LIBFS_CDECL fs_default_aligned_malloc(size_t alignment, size_t size)
 {
-	char *c1;
-	char *c2;
-
-	c1 = strrchr(path, '/');
-	if (!c1)
+	char *aligned;
+	char *ptr = (char *)_LIBFS_MALLOC(size + alignment + sizeof(void *));
+	if (!ptr)
 	{
-		return strrchr(path, '\\');
+		return NULL;
 	}
 
-	c2 = strrchr(c1, '\\');
-	return c2 ? c2 : c1;
+	aligned = ptr + sizeof(void *);
+	aligned += (alignment - (size_t)aligned % alignment) % alignment;
+	((void **)aligned)[-1] = ptr;
+	return aligned;
 }
-#endif
 
-#if HAVE_STDIO_H && HAVE_STRING_H
-LIBFS_PUBLIC(size_t)
-fs_dirname(const char *path, char *buf, size_t size)
+static void LIBFS_CDECL fs_default_aligned_free(void *ptr)
 {
-	const char *c = fs_rsplit(path);
-	if (!c)
-	{
-		snprintf(buf, size, "%s", "");
-		return 0;
-	}
-
-	return snprintf(buf, size, "%.*s", (int)(((size_t)c) - ((size_t)path)), path);
+	_LIBFS_FREE(((void **)ptr)[-1]);
 }
 
-LIBFS_PUBLIC(const char *)
-fs_basename(const char *path)
+LIBFS_PUBLIC(void *)
+fs_aligned_alloc(size_t alignment, size_t size)
 {
-	const char *c = fs_rsplit(path);
-	if (!c)
+	/* The pointer kept by the default allocator must stay aligned */
+	if (alignment < sizeof(void *))
 	{
-		return path;
+		alignment = sizeof(void *);
 	}
 
-	return c + 1;
+	return fs_global_hooks.aligned_malloc_fn(alignment, size);
 }
-#endif
 
-#if HAVE_WINDOWS_H
-LIBFS_PUBLIC(char *)
-fs_absolute(const char *path, char *buf, size_t size)
+LIBFS_PUBLIC(void)
+fs_aligned_free(void *ptr)
 {
-	LIBFS_UNUSED(size);
-	if (!GetFullPathName(path, (DWORD)size, buf, NULL))
+	if (ptr)
 	{
-		return NULL;
+		fs_global_hooks.aligned_free_fn(ptr);
 	}
+}
 
-	return buf;
+/* Context forwarding to the hooks, for calls without a context */
+static void *LIBFS_CDECL fs_hooks_malloc(void *user, size_t size)
+{
+	LIBFS_UNUSED(user);
+	return _LIBFS_MALLOC(size);
 }
 
-LIBFS_PUBLIC(void)
-fs_copy(const char *from, const char *to)
+static void LIBFS_CDECL fs_hooks_free(void *user, void *ptr)
 {
-	fs_copy_file(from, to);
+	LIBFS_UNUSED(user);
+	_LIBFS_FREE(ptr);
 }
 
-LIBFS_PUBLIC(void)
-fs_copy_file(const char *from, const char *to)
+static void *LIBFS_CDECL fs_hooks_aligned_malloc(void *user, size_t alignment, size_t size)
 {
-	CopyFile(from, to, 0);
+	LIBFS_UNUSED(user);
+	return fs_aligned_alloc(alignment, size);
 }
-#else
-#if HAVE_STDLIB_H
-LIBFS_PUBLIC(char *)
-fs_absolute(const char *path, char *buf, size_t size)
+
+static void LIBFS_CDECL fs_hooks_aligned_free(void *user, void *ptr)
 {
-	LIBFS_UNUSED(size);
-	if (!realpath(path, buf))
+	LIBFS_UNUSED(user);
+	fs_aligned_free(ptr);
+}
+
+static const fs_context fs_hooks_context = {
+	NULL,
+	fs_hooks_malloc,
+	NULL,
+	fs_hooks_free,
+	fs_hooks_aligned_malloc,
+	fs_hooks_aligned_free};
+
+#define fs_context_or_hooks(ctx) ((ctx) ? (ctx) : &fs_hooks_context)
+
+#define fs_ctx_malloc(ctx, size) (ctx)->malloc_fn((ctx)->user, size)
+#define fs_ctx_free(ctx, ptr) (ctx)->free_fn((ctx)->user, ptr)
+
+static void *fs_ctx_realloc(const fs_context *ctx, void *ptr, size_t old_size, size_t size)
+{
+	void *data;
+	if (ctx->realloc_fn)
 	{
-		return NULL;
+		return ctx->realloc_fn(ctx->user, ptr, old_size, size);
 	}
 
-	return buf;
-}
-#endif
+	data = fs_ctx_malloc(ctx, size);
+	if (data)
+	{
+		memcpy(data, ptr, old_size < size ? old_size : size);
+		fs_ctx_free(ctx, ptr);
+	}
 
-#if HAVE_SENDFILE_H
-LIBFS_PUBLIC(void)
-fs_copy(const char *from, const char *to)
-{
-	fs_copy_file(from, to);
+	return data;
 }
 
-LIBFS_PUBLIC(void)
-fs_copy_file(const char *from, const char *to)
+static void *fs_ctx_aligned_alloc(const fs_context *ctx, size_t alignment, size_t size)
 {
-	FILE *ffrom = fs_open(from, "rb");
-	if (!ffrom)
+	char *aligned;
+	char *ptr;
+	if (alignment < sizeof(void *))
 	{
-		return;
+		alignment = sizeof(void *);
 	}
 
-	FILE *fto = fs_open(to, "wb");
-	if (!fto)
+	if (ctx->aligned_malloc_fn)
 	{
-		return;
+		return ctx->aligned_malloc_fn(ctx->user, alignment, size);
 	}
 
-	fseek(ffrom, 0, SEEK_END);
-	long size = ftell(ffrom);
-	fseek(ffrom, 0, 0);
-
-	sendfile(ffrom, fto, 0, size);
+	/* Same layout as fs_default_aligned_malloc */
+	ptr = (char *)fs_ctx_malloc(ctx, size + alignment + sizeof(void *));
+	if (!ptr)
+	{
+		return NULL;
+	}
 
-	fclose(ffrom);
-	fclose(fto);
+	aligned = ptr + sizeof(void *);
+	aligned += (alignment - (size_t)aligned % alignment) % alignment;
+	((void **)aligned)[-1] = ptr;
+	return aligned;
 }
-#endif
-#endif
 
-#ifdef HAVE_WINDOWS_H
-LIBFS_PUBLIC(char *)
-fs_current_dir(char *buf, size_t size)
+static void fs_ctx_aligned_free(const fs_context *ctx, void *ptr)
 {
-	if (GetCurrentDirectory((DWORD)size, buf))
+	if (!ptr)
 	{
-		return buf;
+		return;
 	}
 
-	return NULL;
-}
-#else
-#ifdef HAVE_UNISTD_H
-LIBFS_PUBLIC(char *)
-fs_current_dir(char *buf, size_t size)
-{
-	return getcwd(buf, size);
+	if (ctx->aligned_malloc_fn)
+	{
+		ctx->aligned_free_fn(ctx->user, ptr);
+	}
+	else
+	{
+		fs_ctx_free(ctx, ((void **)ptr)[-1]);
+	}
 }
-#endif
-#endif
 
-#if HAVE_SYS_STAT_H
-LIBFS_PUBLIC(int)
-fs_exist(const char *path)
+LIBFS_PUBLIC(void)
+fs_aligned_free_ctx(const fs_context *ctx, void *ptr)
 {
-	struct stat s;
-	return stat(path, &s) == 0;
+	fs_ctx_aligned_free(fs_context_or_hooks(ctx), ptr);
 }
 
-LIBFS_PUBLIC(int)
-fs_is_directory(const char *path)
+/* Default size of the blocks of arenas */
+#define LIBFS_ARENA_BLOCK_SIZE (64 * 1024)
+
+/* Alignment of the allocations of arenas */
+#define LIBFS_ARENA_ALIGNMENT 16
+
+typedef struct fs_arena_block fs_arena_block;
+
+/* Block of an arena, the memory follows the header */
+struct fs_arena_block
 {
-	struct stat s;
-	return (stat(path, &s) == 0) && S_ISDIR(s.st_mode);
-}
+	fs_arena_block *next;
+	size_t size;
+	size_t used;
+};
 
-LIBFS_PUBLIC(int)
-fs_is_file(const char *path)
+struct fs_arena
 {
-	struct stat s;
-	return (stat(path, &s) == 0) && S_ISREG(s.st_mode);
-}
+	/* The head block is the one allocations are carved from */
+	fs_arena_block *head;
+	size_t block_size;
+	/* Last allocation of the head block, which can grow in place */
+	char *last;
+};
 
-LIBFS_PUBLIC(int)
-fs_is_symlink(const char *path)
+#define fs_arena_block_data(block) ((char *)((block) + 1))
+
+static fs_arena_block *fs_arena_block_new(size_t size)
 {
-#ifndef HAVE_WINDOWS_H
-	struct stat s;
-	LIBFS_UNUSED(path);
-	return (stat(path, &s) == 0) && S_ISLNK(s.st_mode);
-#else
-	LIBFS_UNUSED(path);
-	return 0;
-#endif
+	fs_arena_block *block = (fs_arena_block *)_LIBFS_MALLOC(sizeof(fs_arena_block) + size);
+	if (block)
+	{
+		block->next = NULL;
+		block->size = size;
+		block->used = 0;
+	}
+
+	return block;
 }
-#endif
 
-#ifdef HAVE_STDIO_H
-LIBFS_PUBLIC(off_t)
-fs_file_size(const char *path)
+/* Returns where an allocation would start in the head block, NULL if it doesn't fit */
+static char *fs_arena_fit(fs_arena *arena, size_t alignment, size_t size)
 {
-	struct stat stat;
-	FILE *file = fs_open(path, "rb");
-	if (!file)
+	char *data;
+	char *ptr;
+	if (!arena->head)
 	{
-		return -1L;
+		return NULL;
 	}
 
-	if (fstat(fileno(file), &stat) == -1)
+	data = fs_arena_block_data(arena->head);
+	ptr = data + arena->head->used;
+	ptr += (alignment - (size_t)ptr % alignment) % alignment;
+	if ((size_t)(ptr - data) > arena->head->size || size > arena->head->size - (size_t)(ptr - data))
 	{
-		return -1L;
+		return NULL;
 	}
 
-	fclose(file);
-	return stat.st_size;
+	return ptr;
 }
 
-static void *
-fs_read_file_internal(const char *path, void *buf, size_t size, size_t *readen)
+static void *fs_arena_alloc(fs_arena *arena, size_t alignment, size_t size)
 {
-	void *data;
-	size_t file_size;
-	size_t read_size;
-	FILE *file = fs_open(path, "rb");
-	if (!file)
+	fs_arena_block *block;
+	char *ptr = fs_arena_fit(arena, alignment, size);
+	if (!ptr)
 	{
-		return NULL;
-	}
-
-	/* File size */
-	fseek(file, 0, SEEK_END);
-	file_size = ftell(file);
-	fseek(file, 0, SEEK_SET);
+		/* Large allocations get their own block behind the head one */
+		if (arena->head && size > arena->block_size / 4)
+		{
+			block = fs_arena_block_new(size + alignment);
+			if (!block)
+			{
+				return NULL;
+			}
 
-	data = buf;
-	read_size = size;
-	if (!data)
-	{
-		read_size = file_size;
-		size = file_size + 1;
+			block->next = arena->head->next;
+			arena->head->next = block;
+			ptr = fs_arena_block_data(block);
+			ptr += (alignment - (size_t)ptr % alignment) % alignment;
+			block->used = block->size;
+			return ptr;
+		}
 
-		/* Create a buffer large enough */
-		data = _LIBFS_MALLOC(size);
-		if (!data)
+		block = fs_arena_block_new(size + alignment > arena->block_size ? size + alignment : arena->block_size);
+		if (!block)
 		{
-			fclose(file);
 			return NULL;
 		}
+
+		block->next = arena->head;
+		arena->head = block;
+		ptr = fs_arena_fit(arena, alignment, size);
 	}
 
-	if (size > 0)
-	{
-		read_size = fread(data, 1, read_size, file);
+	arena->head->used = (size_t)(ptr - fs_arena_block_data(arena->head)) + size;
+	arena->last = ptr;
+	return ptr;
+}
 
-		/* Append \0 */
-		if (read_size < size)
-		{
-			((char *)data)[read_size] = '\0';
-		}
-		else
+static void *LIBFS_CDECL fs_arena_malloc(void *user, size_t size)
+{
+	return fs_arena_alloc((fs_arena *)user, LIBFS_ARENA_ALIGNMENT, size);
+}
+
+static void *LIBFS_CDECL fs_arena_realloc(void *user, void *ptr, size_t old_size, size_t size)
+{
+	fs_arena *arena = (fs_arena *)user;
+	char *data;
+	size_t offset;
+
+	/* The last allocation grows in place while the head block has room */
+	if (ptr && (char *)ptr == arena->last)
+	{
+		offset = (size_t)(arena->last - fs_arena_block_data(arena->head));
+		if (size <= arena->head->size - offset)
 		{
-			((char *)data)[size - 1] = '\0';
+			arena->head->used = offset + size;
+			return ptr;
 		}
 	}
 
-	fclose(file);
+	data = (char *)fs_arena_alloc(arena, LIBFS_ARENA_ALIGNMENT, size);
+	if (data && ptr)
+	{
+		memcpy(data, ptr, old_size < size ? old_size : size);
+	}
 
-	*readen = file_size;
 	return data;
 }
 
-LIBFS_PUBLIC(size_t)
-fs_read_file_buffer(const char *path, void *buf, size_t size)
+static void LIBFS_CDECL fs_arena_free(void *user, void *ptr)
 {
-	size_t readen = 0;
-	fs_read_file_internal(path, buf, size, &readen);
-	return readen;
+	LIBFS_UNUSED(user);
+	LIBFS_UNUSED(ptr);
 }
 
-LIBFS_PUBLIC(void *)
-fs_read_file(const char *path, size_t *size)
+static void *LIBFS_CDECL fs_arena_aligned_malloc(void *user, size_t alignment, size_t size)
 {
-	return fs_read_file_internal(path, NULL, 0, size);
+	return fs_arena_alloc((fs_arena *)user, alignment, size);
 }
 
-LIBFS_PUBLIC(int)
-fs_write_file(const char *path, const void *buf, size_t size)
+LIBFS_PUBLIC(fs_arena *)
+fs_arena_create(size_t block_size)
 {
-	FILE *file = fs_open(path, "wb");
-	if (!file)
+	fs_arena *arena = (fs_arena *)_LIBFS_MALLOC(sizeof(fs_arena));
+	if (arena)
 	{
-		return LIBFS_FALSE;
+		arena->head = NULL;
+		arena->block_size = block_size ? block_size : LIBFS_ARENA_BLOCK_SIZE;
+		arena->last = NULL;
 	}
 
-	fwrite(buf, size, 1, file);
-	fclose(file);
-	return LIBFS_TRUE;
+	return arena;
 }
 
-typedef struct fs_file_iterator
+LIBFS_PUBLIC(void)
+fs_arena_context(fs_arena *arena, fs_context *ctx)
 {
-	FILE *file;
-} fs_file_iterator;
+	ctx->user = arena;
+	ctx->malloc_fn = fs_arena_malloc;
+	ctx->realloc_fn = fs_arena_realloc;
+	ctx->free_fn = fs_arena_free;
+	ctx->aligned_malloc_fn = fs_arena_aligned_malloc;
+	ctx->aligned_free_fn = fs_arena_free;
+}
 
-LIBFS_PUBLIC(fs_file_iterator *)
-fs_iter_file(const char *path)
+LIBFS_PUBLIC(void)
+fs_arena_reset(fs_arena *arena)
 {
-	fs_file_iterator *it;
-	FILE *f = fs_open(path, "r");
-	if (!f)
+	fs_arena_block *kept = NULL;
+	fs_arena_block *block = arena->head;
+	fs_arena_block *next;
+	for (; block; block = next)
 	{
-		return NULL;
+		next = block->next;
+		if (!kept && block->size == arena->block_size)
+		{
+			kept = block;
+		}
+		else
+		{
+			_LIBFS_FREE(block);
+		}
 	}
 
-	it = (fs_file_iterator *)_LIBFS_MALLOC(sizeof(fs_file_iterator));
-	memset(it, 0, sizeof(fs_file_iterator));
-	it->file = f;
-	return it;
-}
-
-LIBFS_PUBLIC(fs_file_iterator *)
-fs_next_char(fs_file_iterator *it, char *c)
-{
-	if (!fread(c, 1, 1, it->file))
+	if (kept)
 	{
-		return NULL;
+		kept->next = NULL;
+		kept->used = 0;
 	}
 
-	return it;
+	arena->head = kept;
+	arena->last = NULL;
 }
 
 LIBFS_PUBLIC(void)
-fs_close_file(fs_file_iterator *it)
+fs_arena_destroy(fs_arena *arena)
 {
-	fclose(it->file);
-	_LIBFS_FREE(it);
+	if (arena)
+	{
+		fs_arena_reset(arena);
+		if (arena->head)
+		{
+			_LIBFS_FREE(arena->head);
+		}
+
+		_LIBFS_FREE(arena);
+	}
+}
+
+#if !defined(HAVE_WINDOWS_H) && defined(HAVE_FCNTL_H) && defined(HAVE_UNISTD_H) && defined(HAVE_SYS_STAT_H)
+/* POSIX file descriptors are available */
+#define LIBFS_HAVE_FD 1
+
+#ifndef O_CLOEXEC
+#define O_CLOEXEC 0
+#endif
+
+static int fs_write_all(int fd, const void *buf, size_t size)
+{
+	ssize_t n;
+	while (size > 0)
+	{
+		n = write(fd, buf, size);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+
+			return LIBFS_FALSE;
+		}
+
+		buf = (const char *)buf + n;
+		size -= (size_t)n;
+	}
+
+	return LIBFS_TRUE;
+}
+
+/* Reads until size bytes are read or EOF, returns -1 on error */
+static ssize_t fs_read_all(int fd, void *buf, size_t size)
+{
+	size_t total = 0;
+	ssize_t n;
+	while (total < size)
+	{
+		n = read(fd, (char *)buf + total, size - total);
+		if (n == 0)
+		{
+			break;
+		}
+
+		if (n < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+
+			return -1;
+		}
+
+		total += (size_t)n;
+	}
+
+	return (ssize_t)total;
+}
+
+/* Size of the aligned buffer of unbuffered reads and writes */
+#define LIBFS_DIRECT_BUFFER_SIZE (1024 * 1024)
+
+/* Disables O_DIRECT on fd, returns if it was enabled */
+static int fs_clear_direct(int fd)
+{
+#ifdef O_DIRECT
+	int flags = fcntl(fd, F_GETFL);
+	return flags >= 0 && (flags & O_DIRECT) && fcntl(fd, F_SETFL, flags & ~O_DIRECT) == 0;
+#else
+	LIBFS_UNUSED(fd);
+	return LIBFS_FALSE;
+#endif
+}
+
+/* Opens path with O_DIRECT if direct, or without it where it is rejected */
+static int fs_open_direct(const char *path, int flags, mode_t mode, int direct)
+{
+#ifdef O_DIRECT
+	int fd;
+	if (direct)
+	{
+		fd = open(path, flags | O_DIRECT | O_CLOEXEC, mode);
+		if (fd >= 0 || errno != EINVAL)
+		{
+			return fd;
+		}
+	}
+#else
+	LIBFS_UNUSED(direct);
+#endif
+	return open(path, flags | O_CLOEXEC, mode);
+}
+
+/*
+ * Reads with O_DIRECT while the buffer, size and offset are aligned. Once
+ * one is not, such as after the last block of a file, or if the filesystem
+ * rejects O_DIRECT, O_DIRECT is disabled and the read is retried.
+ */
+static ssize_t fs_read_direct(int fd, void *buf, size_t size)
+{
+	ssize_t n;
+	for (;;)
+	{
+		n = read(fd, buf, size);
+		if (n >= 0 || (errno != EINTR && (errno != EINVAL || !fs_clear_direct(fd))))
+		{
+			return n;
+		}
+	}
+}
+
+/*
+ * Writes with O_DIRECT, copying buf to an aligned buffer if it is not
+ * aligned. The unaligned tail is written through the page cache.
+ */
+static int fs_write_direct(int fd, const void *buf, size_t size)
+{
+	char *bounce = NULL;
+	const char *data;
+	size_t aligned = size - size % LIBFS_DIRECT_ALIGNMENT;
+	size_t done = 0;
+	size_t chunk;
+	ssize_t n;
+
+	if ((size_t)buf % LIBFS_DIRECT_ALIGNMENT && aligned)
+	{
+		bounce = (char *)fs_aligned_alloc(LIBFS_DIRECT_ALIGNMENT, LIBFS_DIRECT_BUFFER_SIZE);
+		if (!bounce)
+		{
+			return LIBFS_FALSE;
+		}
+	}
+
+	while (done < aligned)
+	{
+		data = (const char *)buf + done;
+		chunk = aligned - done;
+		if (bounce)
+		{
+			chunk = chunk > LIBFS_DIRECT_BUFFER_SIZE ? LIBFS_DIRECT_BUFFER_SIZE : chunk;
+			memcpy(bounce, data, chunk);
+			data = bounce;
+		}
+
+		n = write(fd, data, chunk);
+		if (n < 0)
+		{
+			if (errno == EINTR || (errno == EINVAL && fs_clear_direct(fd)))
+			{
+				continue;
+			}
+
+			fs_aligned_free(bounce);
+			return LIBFS_FALSE;
+		}
+
+		done += (size_t)n;
+	}
+
+	fs_aligned_free(bounce);
+	if (done < size)
+	{
+		fs_clear_direct(fd);
+		return fs_write_all(fd, (const char *)buf + done, size - done);
+	}
+
+	return LIBFS_TRUE;
+}
+#endif
+
+typedef struct fs_job fs_job;
+typedef int (*fs_job_fn)(fs_job *job);
+
+/* Job submitted to a thread pool, embedded first in the caller's struct */
+struct fs_job
+{
+	fs_job_fn fn;
+	fs_job *next;
+};
+
+/*
+ * Pool of worker threads consuming a bounded FIFO of jobs. Without
+ * pthreads, or with no threads, jobs run synchronously on submit.
+ */
+typedef struct fs_thread_pool
+{
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_t lock;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+	pthread_cond_t idle;
+	pthread_t *threads;
+#endif
+	fs_job *head;
+	fs_job *tail;
+	size_t count;
+	size_t queued;
+	size_t capacity;
+	size_t active;
+	size_t failed;
+	int stopping;
+} fs_thread_pool;
+
+static size_t fs_cpu_count(void)
+{
+#if defined(HAVE_UNISTD_H) && defined(_SC_NPROCESSORS_ONLN)
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? (size_t)n : 1;
+#else
+	return 1;
+#endif
+}
+
+#ifdef HAVE_PTHREAD_H
+static void *fs_thread_pool_main(void *arg)
+{
+	fs_thread_pool *pool = (fs_thread_pool *)arg;
+	fs_job *job;
+	int result;
+
+	pthread_mutex_lock(&pool->lock);
+	for (;;)
+	{
+		while (!pool->head && !pool->stopping)
+		{
+			pthread_cond_wait(&pool->not_empty, &pool->lock);
+		}
+
+		if (!pool->head)
+		{
+			break;
+		}
+
+		job = pool->head;
+		pool->head = job->next;
+		if (!pool->head)
+		{
+			pool->tail = NULL;
+		}
+
+		pool->queued--;
+		pool->active++;
+		pthread_cond_signal(&pool->not_full);
+		pthread_mutex_unlock(&pool->lock);
+
+		result = job->fn(job);
+
+		pthread_mutex_lock(&pool->lock);
+		pool->active--;
+		if (!result)
+		{
+			pool->failed++;
+		}
+
+		if (!pool->head && !pool->active)
+		{
+			pthread_cond_broadcast(&pool->idle);
+		}
+	}
+
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+#endif
+
+static void fs_thread_pool_init(fs_thread_pool *pool, size_t threads, size_t capacity)
+{
+	memset(pool, 0, sizeof(fs_thread_pool));
+	pool->capacity = capacity;
+#ifdef HAVE_PTHREAD_H
+	if (threads <= 1)
+	{
+		return;
+	}
+
+	pool->threads = (pthread_t *)_LIBFS_MALLOC(threads * sizeof(pthread_t));
+	if (!pool->threads)
+	{
+		return;
+	}
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->not_empty, NULL);
+	pthread_cond_init(&pool->not_full, NULL);
+	pthread_cond_init(&pool->idle, NULL);
+	for (; pool->count < threads; ++pool->count)
+	{
+		if (pthread_create(&pool->threads[pool->count], NULL, fs_thread_pool_main, pool) != 0)
+		{
+			break;
+		}
+	}
+#else
+	LIBFS_UNUSED(threads);
+#endif
+}
+
+/* Queues a job, blocking while the queue is full */
+static void fs_thread_pool_submit(fs_thread_pool *pool, fs_job *job)
+{
+	job->next = NULL;
+#ifdef HAVE_PTHREAD_H
+	if (pool->count)
+	{
+		pthread_mutex_lock(&pool->lock);
+		while (pool->capacity && pool->queued >= pool->capacity)
+		{
+			pthread_cond_wait(&pool->not_full, &pool->lock);
+		}
+
+		if (pool->tail)
+		{
+			pool->tail->next = job;
+		}
+		else
+		{
+			pool->head = job;
+		}
+
+		pool->tail = job;
+		pool->queued++;
+		pthread_cond_signal(&pool->not_empty);
+		pthread_mutex_unlock(&pool->lock);
+		return;
+	}
+#endif
+
+	if (!job->fn(job))
+	{
+		pool->failed++;
+	}
+}
+
+/* Waits for all jobs to complete and returns the number of failed jobs */
+static size_t fs_thread_pool_wait(fs_thread_pool *pool)
+{
+	size_t failed;
+#ifdef HAVE_PTHREAD_H
+	if (pool->count)
+	{
+		pthread_mutex_lock(&pool->lock);
+		while (pool->head || pool->active)
+		{
+			pthread_cond_wait(&pool->idle, &pool->lock);
+		}
+
+		failed = pool->failed;
+		pthread_mutex_unlock(&pool->lock);
+		return failed;
+	}
+#endif
+
+	failed = pool->failed;
+	return failed;
+}
+
+/* Waits for all jobs to complete and joins the threads */
+static size_t fs_thread_pool_destroy(fs_thread_pool *pool)
+{
+	size_t failed = fs_thread_pool_wait(pool);
+#ifdef HAVE_PTHREAD_H
+	size_t i;
+	if (pool->threads)
+	{
+		pthread_mutex_lock(&pool->lock);
+		pool->stopping = LIBFS_TRUE;
+		pthread_cond_broadcast(&pool->not_empty);
+		pthread_mutex_unlock(&pool->lock);
+		for (i = 0; i < pool->count; ++i)
+		{
+			pthread_join(pool->threads[i], NULL);
+		}
+
+		pthread_cond_destroy(&pool->idle);
+		pthread_cond_destroy(&pool->not_full);
+		pthread_cond_destroy(&pool->not_empty);
+		pthread_mutex_destroy(&pool->lock);
+		_LIBFS_FREE(pool->threads);
+	}
+#endif
+
+	return failed;
+}
+
+#if defined(LIBFS_HAVE_FD) && defined(HAVE_LINUX_IO_URING_H) && defined(HAVE_SYS_MMAN_H) && defined(SYS_io_uring_setup) && \
+	defined(IORING_FEAT_RW_CUR_POS) && defined(HAVE_STATX) && defined(STATX_TYPE) && defined(__GNUC__)
+/* io_uring can be used, IORING_FEAT_RW_CUR_POS comes with the Linux 5.6 opcodes such as IORING_OP_STATX */
+#define LIBFS_HAVE_IO_URING 1
+
+/* Submission and completion rings shared with the kernel */
+typedef struct fs_uring
+{
+	int fd;
+	unsigned int entries;
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_ring;
+	void *cq_ring;
+	size_t sq_ring_size;
+	size_t cq_ring_size;
+	size_t sqes_size;
+	/* Entries queued since the last submit */
+	unsigned int pending;
+} fs_uring;
+
+static int fs_uring_init(fs_uring *ring, unsigned int entries)
+{
+	struct io_uring_params params;
+	char *sq;
+	char *cq;
+
+	memset(ring, 0, sizeof(fs_uring));
+	memset(&params, 0, sizeof(params));
+	ring->fd = (int)syscall(SYS_io_uring_setup, entries, &params);
+	if (ring->fd < 0)
+	{
+		return LIBFS_FALSE;
+	}
+
+	/* Kernels before 5.6 set up rings but reject opcodes such as IORING_OP_STATX */
+	if (!(params.features & IORING_FEAT_RW_CUR_POS))
+	{
+		close(ring->fd);
+		return LIBFS_FALSE;
+	}
+
+	ring->entries = params.sq_entries;
+	ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+	ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+	/* Both rings share one mapping when the kernel supports it */
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if (ring->cq_ring_size > ring->sq_ring_size)
+		{
+			ring->sq_ring_size = ring->cq_ring_size;
+		}
+
+		ring->cq_ring_size = ring->sq_ring_size;
+	}
+
+	ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, (off_t)IORING_OFF_SQ_RING);
+	ring->cq_ring = ring->sq_ring;
+	if (ring->sq_ring != MAP_FAILED && !(params.features & IORING_FEAT_SINGLE_MMAP))
+	{
+		ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, (off_t)IORING_OFF_CQ_RING);
+	}
+
+	ring->sqes = (struct io_uring_sqe *)mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, (off_t)IORING_OFF_SQES);
+	if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED || ring->sqes == MAP_FAILED)
+	{
+		if (ring->sqes != MAP_FAILED)
+		{
+			munmap(ring->sqes, ring->sqes_size);
+		}
+
+		if (ring->cq_ring != MAP_FAILED && ring->cq_ring != ring->sq_ring)
+		{
+			munmap(ring->cq_ring, ring->cq_ring_size);
+		}
+
+		if (ring->sq_ring != MAP_FAILED)
+		{
+			munmap(ring->sq_ring, ring->sq_ring_size);
+		}
+
+		close(ring->fd);
+		return LIBFS_FALSE;
+	}
+
+	sq = (char *)ring->sq_ring;
+	cq = (char *)ring->cq_ring;
+	ring->sq_head = (unsigned int *)(sq + params.sq_off.head);
+	ring->sq_tail = (unsigned int *)(sq + params.sq_off.tail);
+	ring->sq_mask = (unsigned int *)(sq + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned int *)(sq + params.sq_off.array);
+	ring->cq_head = (unsigned int *)(cq + params.cq_off.head);
+	ring->cq_tail = (unsigned int *)(cq + params.cq_off.tail);
+	ring->cq_mask = (unsigned int *)(cq + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+	return LIBFS_TRUE;
+}
+
+static void fs_uring_destroy(fs_uring *ring)
+{
+	munmap(ring->sqes, ring->sqes_size);
+	if (ring->cq_ring != ring->sq_ring)
+	{
+		munmap(ring->cq_ring, ring->cq_ring_size);
+	}
+
+	munmap(ring->sq_ring, ring->sq_ring_size);
+	close(ring->fd);
+}
+
+/* Gets a cleared submission entry, NULL when the ring is full */
+static struct io_uring_sqe *fs_uring_get_sqe(fs_uring *ring)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+	unsigned int tail = *ring->sq_tail + ring->pending;
+	unsigned int index;
+	if (tail - head >= ring->entries)
+	{
+		return NULL;
+	}
+
+	index = tail & *ring->sq_mask;
+	sqe = &ring->sqes[index];
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	ring->sq_array[index] = index;
+	ring->pending++;
+	return sqe;
+}
+
+/* Submits queued entries and waits for at least wait completions */
+static int fs_uring_submit(fs_uring *ring, unsigned int wait)
+{
+	long n;
+	unsigned int submit = ring->pending;
+	__atomic_store_n(ring->sq_tail, *ring->sq_tail + ring->pending, __ATOMIC_RELEASE);
+	ring->pending = 0;
+	for (;;)
+	{
+		n = syscall(SYS_io_uring_enter, ring->fd, submit, wait, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+		if (n >= 0)
+		{
+			submit -= (unsigned int)n;
+			if (!submit)
+			{
+				return LIBFS_TRUE;
+			}
+		}
+		else if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+		{
+			return LIBFS_FALSE;
+		}
+	}
+}
+
+/* Gets the oldest completion, NULL if there is none */
+static struct io_uring_cqe *fs_uring_peek(fs_uring *ring)
+{
+	unsigned int head = *ring->cq_head;
+	if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+	{
+		return NULL;
+	}
+
+	return &ring->cqes[head & *ring->cq_mask];
+}
+
+/* Releases the completion returned by fs_uring_peek */
+static void fs_uring_advance(fs_uring *ring)
+{
+	__atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+#endif
+
+#if HAVE_STRING_H
+LIBFS_PUBLIC(const char *)
+fs_rsplit(const char *path)
+{
+	char *c1;
+	char *c2;
+
+	c1 = strrchr(path, '/');
+	if (!c1)
+	{
+		return strrchr(path, '\\');
+	}
+
+	c2 = strrchr(c1, '\\');
+	return c2 ? c2 : c1;
+}
+#endif
+
+#if HAVE_STRING_H
+#if HAVE_WINDOWS_H
+#define fs_is_separator(c) ((c) == '/' || (c) == '\\')
+#else
+/* Backslashes are valid in names */
+#define fs_is_separator(c) ((c) == '/')
+#endif
+
+/* Writes length bytes at offset, truncated to keep room for the null-terminating character */
+static size_t fs_put(char *buf, size_t size, size_t offset, const char *src, size_t length)
+{
+	if (offset + 1 < size)
+	{
+		memcpy(buf + offset, src, offset + length < size ? length : size - offset - 1);
+	}
+
+	return offset + length;
+}
+
+/* Terminates what fs_put wrote, length being the untruncated length */
+static void fs_put_end(char *buf, size_t size, size_t length)
+{
+	if (size)
+	{
+		buf[length < size ? length : size - 1] = '\0';
+	}
+}
+#endif
+
+#if HAVE_STDIO_H && HAVE_STRING_H
+LIBFS_PUBLIC(size_t)
+fs_dirname(const char *path, char *buf, size_t size)
+{
+	const char *c = fs_rsplit(path);
+	size_t length = fs_put(buf, size, 0, path, c ? (size_t)(c - path) : 0);
+	fs_put_end(buf, size, length);
+	return length;
+}
+
+LIBFS_PUBLIC(const char *)
+fs_basename(const char *path)
+{
+	const char *c = fs_rsplit(path);
+	if (!c)
+	{
+		return path;
+	}
+
+	return c + 1;
+}
+#endif
+
+#if HAVE_WINDOWS_H
+LIBFS_PUBLIC(char *)
+fs_absolute(const char *path, char *buf, size_t size)
+{
+	LIBFS_UNUSED(size);
+	if (!GetFullPathName(path, (DWORD)size, buf, NULL))
+	{
+		return NULL;
+	}
+
+	return buf;
+}
+
+LIBFS_PUBLIC(int)
+fs_copy(const char *from, const char *to)
+{
+	if (fs_is_directory(from))
+	{
+		return fs_copy_tree(from, to, NULL);
+	}
+
+	return fs_copy_file(from, to);
+}
+
+LIBFS_PUBLIC(int)
+fs_copy_file_ex(const char *from, const char *to, const struct fs_copy_options *options, enum fs_copy_method *used)
+{
+	if (used)
+	{
+		*used = LIBFS_COPY_AUTO;
+	}
+
+	if (options && options->clone == LIBFS_CLONE_ALWAYS)
+	{
+		return LIBFS_FALSE;
+	}
+
+	return CopyFile(from, to, 0) != 0;
+}
+
+LIBFS_PUBLIC(int)
+fs_copy_file(const char *from, const char *to)
+{
+	return fs_copy_file_ex(from, to, NULL, NULL);
+}
+#else
+#if HAVE_STDLIB_H
+LIBFS_PUBLIC(char *)
+fs_absolute(const char *path, char *buf, size_t size)
+{
+	LIBFS_UNUSED(size);
+	if (!realpath(path, buf))
+	{
+		return NULL;
+	}
+
+	return buf;
+}
+#endif
+
+#ifdef LIBFS_HAVE_FD
+/* Size of the buffer used by the read/write fallback */
+#define LIBFS_COPY_BUFFER_SIZE (1024 * 1024)
+/* Maximum number of bytes transferred by a single kernel call */
+#define LIBFS_COPY_CHUNK_SIZE (1024 * 1024 * 1024)
+
+/*
+ * Each strategy copies from the current offset of in to the current offset
+ * of out and returns the number of bytes copied, or -1 if it failed before
+ * copying anything so the caller can fall back to the next strategy.
+ */
+typedef off_t (*fs_copy_fd_fn)(int in, int out, off_t size);
+
+#ifdef HAVE_COPY_FILE_RANGE
+static off_t fs_copy_fd_range(int in, int out, off_t size)
+{
+	off_t copied = 0;
+	ssize_t n;
+	size_t chunk;
+	while (copied < size)
+	{
+		chunk = (size - copied) > LIBFS_COPY_CHUNK_SIZE ? LIBFS_COPY_CHUNK_SIZE : (size_t)(size - copied);
+		n = copy_file_range(in, NULL, out, NULL, chunk, 0);
+		if (n == 0)
+		{
+			/* Source was truncated */
+			break;
+		}
+
+		if (n < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+
+			return copied ? copied : -1;
+		}
+
+		copied += n;
+	}
+
+	return copied;
+}
+#endif
+
+#ifdef HAVE_SYS_SENDFILE_H
+static off_t fs_copy_fd_sendfile(int in, int out, off_t size)
+{
+	off_t copied = 0;
+	ssize_t n;
+	size_t chunk;
+	while (copied < size)
+	{
+		chunk = (size - copied) > LIBFS_COPY_CHUNK_SIZE ? LIBFS_COPY_CHUNK_SIZE : (size_t)(size - copied);
+		n = sendfile(out, in, NULL, chunk);
+		if (n == 0)
+		{
+			break;
+		}
+
+		if (n < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+
+			return copied ? copied : -1;
+		}
+
+		copied += n;
+	}
+
+	return copied;
+}
+#endif
+
+static off_t fs_copy_fd_read_write(int in, int out, off_t size)
+{
+	off_t copied = 0;
+	ssize_t n;
+	void *buf = _LIBFS_MALLOC(LIBFS_COPY_BUFFER_SIZE);
+	LIBFS_UNUSED(size);
+	if (!buf)
+	{
+		return -1;
+	}
+
+	/* Read until EOF so files with an unreliable size are fully copied */
+	for (;;)
+	{
+		n = read(in, buf, LIBFS_COPY_BUFFER_SIZE);
+		if (n == 0)
+		{
+			break;
+		}
+
+		if (n < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+
+			copied = -1;
+			break;
+		}
+
+		if (!fs_write_all(out, buf, (size_t)n))
+		{
+			copied = -1;
+			break;
+		}
+
+		copied += n;
+	}
+
+	_LIBFS_FREE(buf);
+	return copied;
+}
+
+/* Strategies ordered from fastest to slowest, indexed by fs_copy_method - 1 */
+static const fs_copy_fd_fn fs_copy_fd_methods[] = {
+#ifdef HAVE_COPY_FILE_RANGE
+	fs_copy_fd_range,
+#else
+	NULL,
+#endif
+#ifdef HAVE_SYS_SENDFILE_H
+	fs_copy_fd_sendfile,
+#else
+	NULL,
+#endif
+	fs_copy_fd_read_write};
+
+static int fs_copy_fd(int in, int out, off_t size, enum fs_copy_method method, enum fs_copy_method *used)
+{
+	size_t i;
+	off_t n;
+	off_t copied = 0;
+	size_t count = sizeof(fs_copy_fd_methods) / sizeof(fs_copy_fd_methods[0]);
+
+	if (size == 0)
+	{
+		/* Empty files may be pseudo files whose size is unknown */
+		i = count - 1;
+	}
+	else
+	{
+		i = (method == LIBFS_COPY_AUTO || method == LIBFS_COPY_CLONE) ? 0 : (size_t)method - 1;
+	}
+
+	for (; i < count; ++i)
+	{
+		if (!fs_copy_fd_methods[i])
+		{
+			continue;
+		}
+
+		n = fs_copy_fd_methods[i](in, out, size - copied);
+		if (n < 0)
+		{
+			continue;
+		}
+
+		/* Pseudo files such as in sysfs report a size but kernel copies get nothing */
+		if (n == 0 && copied == 0 && fs_copy_fd_methods[i] != fs_copy_fd_read_write)
+		{
+			continue;
+		}
+
+		*used = (enum fs_copy_method)(i + 1);
+		copied += n;
+		if (copied >= size || n == 0 || fs_copy_fd_methods[i] == fs_copy_fd_read_write)
+		{
+			return LIBFS_TRUE;
+		}
+	}
+
+	return LIBFS_FALSE;
+}
+
+/* Copies through an aligned buffer without the page cache if possible */
+static int fs_copy_fd_direct(int in, int out)
+{
+	ssize_t n;
+	int result = LIBFS_TRUE;
+	char *buf = (char *)fs_aligned_alloc(LIBFS_DIRECT_ALIGNMENT, LIBFS_COPY_BUFFER_SIZE);
+	if (!buf)
+	{
+		return LIBFS_FALSE;
+	}
+
+	for (;;)
+	{
+		n = fs_read_direct(in, buf, LIBFS_COPY_BUFFER_SIZE);
+		if (n <= 0)
+		{
+			result = n == 0;
+			break;
+		}
+
+		if (!fs_write_direct(out, buf, (size_t)n))
+		{
+			result = LIBFS_FALSE;
+			break;
+		}
+	}
+
+	fs_aligned_free(buf);
+	return result;
+}
+
+static int fs_clone_fd(int in, int out)
+{
+#ifdef FICLONE
+	return ioctl(out, FICLONE, in) == 0;
+#else
+	LIBFS_UNUSED(in);
+	LIBFS_UNUSED(out);
+	return LIBFS_FALSE;
+#endif
+}
+
+LIBFS_PUBLIC(int)
+fs_copy(const char *from, const char *to)
+{
+	if (fs_is_directory(from))
+	{
+		return fs_copy_tree(from, to, NULL);
+	}
+
+	return fs_copy_file(from, to);
+}
+
+LIBFS_PUBLIC(int)
+fs_copy_file_ex(const char *from, const char *to, const struct fs_copy_options *options, enum fs_copy_method *used)
+{
+	int in;
+	int out;
+	int created;
+	int result;
+	struct stat s;
+	enum fs_copy_method method = LIBFS_COPY_AUTO;
+	enum fs_copy_method requested = options ? options->method : LIBFS_COPY_AUTO;
+	enum fs_clone_mode clone = options ? options->clone : LIBFS_CLONE_AUTO;
+	int direct = options && (options->flags & LIBFS_IO_DIRECT);
+
+	in = fs_open_direct(from, O_RDONLY, 0, direct);
+	if (in < 0)
+	{
+		return LIBFS_FALSE;
+	}
+
+	if (fstat(in, &s) != 0 || S_ISDIR(s.st_mode))
+	{
+		close(in);
+		return LIBFS_FALSE;
+	}
+
+	/* An existing destination is only truncated once the method is settled */
+	out = fs_open_direct(to, O_WRONLY | O_CREAT | O_EXCL, s.st_mode & 0777, direct);
+	created = out >= 0;
+	if (!created && errno == EEXIST)
+	{
+		out = fs_open_direct(to, O_WRONLY, 0, direct);
+	}
+
+	if (out < 0)
+	{
+		close(in);
+		return LIBFS_FALSE;
+	}
+
+	/* An explicit byte copy method is only overridden by LIBFS_CLONE_ALWAYS */
+	if (clone != LIBFS_CLONE_ALWAYS && requested != LIBFS_COPY_AUTO && requested != LIBFS_COPY_CLONE)
+	{
+		clone = LIBFS_CLONE_NEVER;
+	}
+
+	if (clone != LIBFS_CLONE_NEVER && fs_clone_fd(in, out))
+	{
+		method = LIBFS_COPY_CLONE;
+		result = ftruncate(out, s.st_size) == 0;
+	}
+	else if (clone == LIBFS_CLONE_ALWAYS)
+	{
+		result = LIBFS_FALSE;
+	}
+	else if (!created && ftruncate(out, 0) != 0)
+	{
+		result = LIBFS_FALSE;
+	}
+	else if (direct)
+	{
+		method = LIBFS_COPY_READ_WRITE;
+		result = fs_copy_fd_direct(in, out);
+	}
+	else
+	{
+		result = fs_copy_fd(in, out, s.st_size, requested, &method);
+	}
+
+	if (used)
+	{
+		*used = method;
+	}
+
+	close(in);
+	result = (close(out) == 0) && result;
+	/* Only remove a destination this call created */
+	if (!result && created && clone == LIBFS_CLONE_ALWAYS)
+	{
+		unlink(to);
+	}
+
+	return result;
+}
+
+LIBFS_PUBLIC(int)
+fs_copy_file(const char *from, const char *to)
+{
+	return fs_copy_file_ex(from, to, NULL, NULL);
+}
+#endif
+#endif
+
+#ifdef HAVE_WINDOWS_H
+LIBFS_PUBLIC(char *)
+fs_current_dir(char *buf, size_t size)
+{
+	if (GetCurrentDirectory((DWORD)size, buf))
+	{
+		return buf;
+	}
+
+	return NULL;
+}
+#else
+#ifdef HAVE_UNISTD_H
+LIBFS_PUBLIC(char *)
+fs_current_dir(char *buf, size_t size)
+{
+	return getcwd(buf, size);
+}
+#endif
+#endif
+
+#if HAVE_SYS_STAT_H
+static enum fs_file_type fs_file_type_from_mode(unsigned int mode)
+{
+	if (S_ISREG(mode))
+	{
+		return LIBFS_TYPE_FILE;
+	}
+
+	if (S_ISDIR(mode))
+	{
+		return LIBFS_TYPE_DIRECTORY;
+	}
+
+	if (S_ISLNK(mode))
+	{
+		return LIBFS_TYPE_SYMLINK;
+	}
+
+	return LIBFS_TYPE_OTHER;
+}
+
+LIBFS_PUBLIC(int)
+fs_exist(const char *path)
+{
+	struct stat s;
+	return stat(path, &s) == 0;
+}
+
+LIBFS_PUBLIC(int)
+fs_is_directory(const char *path)
+{
+	struct stat s;
+	return (stat(path, &s) == 0) && S_ISDIR(s.st_mode);
+}
+
+LIBFS_PUBLIC(int)
+fs_is_file(const char *path)
+{
+	struct stat s;
+	return (stat(path, &s) == 0) && S_ISREG(s.st_mode);
+}
+
+LIBFS_PUBLIC(int)
+fs_is_symlink(const char *path)
+{
+#ifndef HAVE_WINDOWS_H
+	struct stat s;
+	return (lstat(path, &s) == 0) && S_ISLNK(s.st_mode);
+#else
+	LIBFS_UNUSED(path);
+	return 0;
+#endif
+}
+
+static void fs_stat_from_stat(struct fs_stat_result *st, const struct stat *s)
+{
+	st->fields = LIBFS_STAT_ALL;
+	st->type = fs_file_type_from_mode(s->st_mode);
+	st->mode = s->st_mode & 07777;
+	st->size = s->st_size;
+	st->mtime.sec = s->st_mtime;
+	st->ctime.sec = s->st_ctime;
+#ifdef LIBFS_HAVE_STAT_TIMESPEC
+	st->mtime.nsec = fs_stat_mtim(s).tv_nsec;
+	st->ctime.nsec = fs_stat_ctim(s).tv_nsec;
+#else
+	st->mtime.nsec = 0;
+	st->ctime.nsec = 0;
+#endif
+	st->inode = s->st_ino;
+	st->dev = s->st_dev;
+	st->nlink = (unsigned long)s->st_nlink;
+#ifndef HAVE_WINDOWS_H
+	st->blocks = (off_t)s->st_blocks;
+#else
+	st->fields &= ~LIBFS_STAT_BLOCKS;
+	st->blocks = 0;
+#endif
+}
+
+#if defined(HAVE_STATX) && defined(STATX_TYPE)
+/* statx masks of each fs_stat_fields bit */
+static const unsigned int fs_statx_masks[] = {
+	STATX_TYPE,
+	STATX_MODE,
+	STATX_SIZE,
+	STATX_MTIME,
+	STATX_CTIME,
+	STATX_INO,
+	STATX_NLINK,
+	STATX_BLOCKS};
+
+static unsigned int fs_statx_mask(int fields)
+{
+	unsigned int mask = 0;
+	size_t i;
+	for (i = 0; i < sizeof(fs_statx_masks) / sizeof(fs_statx_masks[0]); ++i)
+	{
+		if (fields & (1 << i))
+		{
+			mask |= fs_statx_masks[i];
+		}
+	}
+
+	return mask;
+}
+
+static void fs_stat_from_statx(struct fs_stat_result *st, const struct statx *x)
+{
+	size_t i;
+	memset(st, 0, sizeof(struct fs_stat_result));
+	for (i = 0; i < sizeof(fs_statx_masks) / sizeof(fs_statx_masks[0]); ++i)
+	{
+		if (x->stx_mask & fs_statx_masks[i])
+		{
+			st->fields |= 1 << i;
+		}
+	}
+
+	st->type = (st->fields & LIBFS_STAT_TYPE) ? fs_file_type_from_mode(x->stx_mode) : LIBFS_TYPE_UNKNOWN;
+	st->mode = x->stx_mode & 07777;
+	st->size = (off_t)x->stx_size;
+	st->mtime.sec = (time_t)x->stx_mtime.tv_sec;
+	st->mtime.nsec = (long)x->stx_mtime.tv_nsec;
+	st->ctime.sec = (time_t)x->stx_ctime.tv_sec;
+	st->ctime.nsec = (long)x->stx_ctime.tv_nsec;
+	st->inode = (ino_t)x->stx_ino;
+#ifdef makedev
+	st->dev = makedev(x->stx_dev_major, x->stx_dev_minor);
+#endif
+	st->nlink = (unsigned long)x->stx_nlink;
+	st->blocks = (off_t)x->stx_blocks;
+}
+
+static int fs_stat_internal(const char *path, struct fs_stat_result *st, int fields, int follow)
+{
+	struct statx x;
+	struct stat s;
+	int result;
+
+	if (statx(AT_FDCWD, path, AT_STATX_SYNC_AS_STAT | (follow ? 0 : AT_SYMLINK_NOFOLLOW), fs_statx_mask(fields), &x) != 0)
+	{
+		/* Kernels older than 4.11, or sandboxes whose seccomp filters deny statx */
+		if (errno != ENOSYS && errno != EPERM)
+		{
+			return LIBFS_FALSE;
+		}
+
+		result = follow ? stat(path, &s) : lstat(path, &s);
+		if (result == 0)
+		{
+			fs_stat_from_stat(st, &s);
+		}
+
+		return result == 0;
+	}
+
+	fs_stat_from_statx(st, &x);
+	return LIBFS_TRUE;
+}
+#else
+static int fs_stat_internal(const char *path, struct fs_stat_result *st, int fields, int follow)
+{
+	struct stat s;
+	LIBFS_UNUSED(fields);
+	if ((follow ? stat(path, &s) : lstat(path, &s)) != 0)
+	{
+		return LIBFS_FALSE;
+	}
+
+	fs_stat_from_stat(st, &s);
+	return LIBFS_TRUE;
+}
+#endif
+
+LIBFS_PUBLIC(int)
+fs_stat(const char *path, struct fs_stat_result *st, int fields)
+{
+	return fs_stat_internal(path, st, fields, LIBFS_TRUE);
+}
+
+LIBFS_PUBLIC(int)
+fs_lstat(const char *path, struct fs_stat_result *st, int fields)
+{
+	return fs_stat_internal(path, st, fields, LIBFS_FALSE);
+}
+
+/* Number of statx requests kept in flight by fs_stat_many */
+#define LIBFS_STAT_MANY_DEPTH 256
+
+/* Number of paths stat'ed by each job of the thread pool fallback */
+#define LIBFS_STAT_MANY_CHUNK 64
+
+/* Marks a free request slot */
+#define LIBFS_STAT_MANY_FREE ((size_t)-1)
+
+typedef struct fs_stat_many_job
+{
+	fs_job base;
+	const char *const *paths;
+	struct fs_stat_result *results;
+	size_t count;
+	int fields;
+} fs_stat_many_job;
+
+static void fs_stat_many_one(const char *path, struct fs_stat_result *result, int fields)
+{
+	if (!fs_stat(path, result, fields))
+	{
+		memset(result, 0, sizeof(struct fs_stat_result));
+	}
+}
+
+static int fs_stat_many_chunk(fs_job *job)
+{
+	fs_stat_many_job *_job = (fs_stat_many_job *)job;
+	size_t i;
+	for (i = 0; i < _job->count; ++i)
+	{
+		fs_stat_many_one(_job->paths[i], &_job->results[i], _job->fields);
+	}
+
+	return LIBFS_TRUE;
+}
+
+/* Overlaps blocking stat calls on a pool of threads */
+static void fs_stat_many_pool(const char *const *paths, size_t count, struct fs_stat_result *results, int fields)
+{
+	fs_thread_pool pool;
+	fs_stat_many_job *jobs;
+	fs_stat_many_job job;
+	size_t n = (count + LIBFS_STAT_MANY_CHUNK - 1) / LIBFS_STAT_MANY_CHUNK;
+	size_t threads = fs_cpu_count() * 4;
+	size_t i;
+
+	jobs = n > 1 ? (fs_stat_many_job *)_LIBFS_MALLOC(n * sizeof(fs_stat_many_job)) : NULL;
+	if (!jobs)
+	{
+		job.paths = paths;
+		job.results = results;
+		job.count = count;
+		job.fields = fields;
+		fs_stat_many_chunk(&job.base);
+		return;
+	}
+
+	fs_thread_pool_init(&pool, threads < n ? threads : n, 0);
+	for (i = 0; i < n; ++i)
+	{
+		jobs[i].base.fn = fs_stat_many_chunk;
+		jobs[i].paths = paths + i * LIBFS_STAT_MANY_CHUNK;
+		jobs[i].results = results + i * LIBFS_STAT_MANY_CHUNK;
+		jobs[i].count = i + 1 < n ? LIBFS_STAT_MANY_CHUNK : count - i * LIBFS_STAT_MANY_CHUNK;
+		jobs[i].fields = fields;
+		fs_thread_pool_submit(&pool, &jobs[i].base);
+	}
+
+	fs_thread_pool_destroy(&pool);
+	_LIBFS_FREE(jobs);
+}
+
+#ifdef LIBFS_HAVE_IO_URING
+/*
+ * Keeps up to LIBFS_STAT_MANY_DEPTH IORING_OP_STATX requests in flight.
+ * Returns false if io_uring is not available.
+ */
+static int fs_stat_many_uring(const char *const *paths, size_t count, struct fs_stat_result *results, int fields)
+{
+	fs_uring ring;
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe *cqe;
+	struct statx *buffers;
+	size_t *indices;
+	unsigned int *slots;
+	unsigned int free_slots;
+	unsigned int depth;
+	unsigned int slot;
+	unsigned int mask = fs_statx_mask(fields);
+	unsigned int head;
+	unsigned int tail;
+	size_t next = 0;
+	size_t i;
+	int failed = LIBFS_FALSE;
+
+	if (!count || !fs_uring_init(&ring, count < LIBFS_STAT_MANY_DEPTH ? (unsigned int)count : LIBFS_STAT_MANY_DEPTH))
+	{
+		return LIBFS_FALSE;
+	}
+
+	/* One statx buffer per request slot, the slot is the user_data */
+	depth = ring.entries;
+	buffers = (struct statx *)_LIBFS_MALLOC(depth * (sizeof(struct statx) + sizeof(size_t) + sizeof(unsigned int)));
+	if (!buffers)
+	{
+		fs_uring_destroy(&ring);
+		return LIBFS_FALSE;
+	}
+
+	indices = (size_t *)(buffers + depth);
+	slots = (unsigned int *)(indices + depth);
+	for (free_slots = 0; free_slots < depth; ++free_slots)
+	{
+		slots[free_slots] = free_slots;
+		indices[free_slots] = LIBFS_STAT_MANY_FREE;
+	}
+
+	while ((!failed && next < count) || free_slots < depth)
+	{
+		while (!failed && next < count && free_slots && (sqe = fs_uring_get_sqe(&ring)) != NULL)
+		{
+			slot = slots[--free_slots];
+			indices[slot] = next;
+			sqe->opcode = IORING_OP_STATX;
+			sqe->fd = AT_FDCWD;
+			sqe->addr = (unsigned long)paths[next];
+			sqe->len = mask;
+			sqe->statx_flags = AT_STATX_SYNC_AS_STAT;
+			sqe->off = (unsigned long)&buffers[slot];
+			sqe->user_data = slot;
+			++next;
+		}
+
+		/* Once submitting failed, only waits for the requests in flight, retrying on errors */
+		if (!fs_uring_submit(&ring, free_slots < depth) && !failed)
+		{
+			/* Takes back the entries the kernel didn't consume, there is no SQPOLL thread reading them */
+			head = __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE);
+			for (tail = *ring.sq_tail; tail != head; --tail)
+			{
+				slot = (unsigned int)ring.sqes[ring.sq_array[(tail - 1) & *ring.sq_mask]].user_data;
+				fs_stat_many_one(paths[indices[slot]], &results[indices[slot]], fields);
+				indices[slot] = LIBFS_STAT_MANY_FREE;
+				slots[free_slots++] = slot;
+			}
+
+			__atomic_store_n(ring.sq_tail, head, __ATOMIC_RELEASE);
+			failed = LIBFS_TRUE;
+		}
+
+		while ((cqe = fs_uring_peek(&ring)) != NULL)
+		{
+			slot = (unsigned int)cqe->user_data;
+			i = indices[slot];
+			if (cqe->res == 0)
+			{
+				fs_stat_from_statx(&results[i], &buffers[slot]);
+			}
+			else if (cqe->res == -EINVAL || cqe->res == -EOPNOTSUPP)
+			{
+				/* Kernels older than 5.6 don't know the opcode */
+				fs_stat_many_one(paths[i], &results[i], fields);
+			}
+			else
+			{
+				memset(&results[i], 0, sizeof(struct fs_stat_result));
+			}
+
+			indices[slot] = LIBFS_STAT_MANY_FREE;
+			slots[free_slots++] = slot;
+			fs_uring_advance(&ring);
+		}
+	}
+
+	/* Buffers are no longer written once no request is in flight */
+	fs_uring_destroy(&ring);
+	_LIBFS_FREE(buffers);
+	if (failed)
+	{
+		fs_stat_many_pool(paths + next, count - next, results + next, fields);
+	}
+
+	return LIBFS_TRUE;
+}
+#endif
+
+LIBFS_PUBLIC(size_t)
+fs_stat_many(const char *const *paths, size_t count, struct fs_stat_result *results, int fields, int flags)
+{
+	size_t found = 0;
+	size_t i;
+
+#ifdef LIBFS_HAVE_IO_URING
+	if ((flags & LIBFS_STAT_MANY_THREADS) || !fs_stat_many_uring(paths, count, results, fields))
+#else
+	LIBFS_UNUSED(flags);
+#endif
+	{
+		fs_stat_many_pool(paths, count, results, fields);
+	}
+
+	for (i = 0; i < count; ++i)
+	{
+		if (results[i].fields)
+		{
+			++found;
+		}
+	}
+
+	return found;
+}
+#endif
+
+#ifdef HAVE_STDIO_H
+LIBFS_PUBLIC(off_t)
+fs_file_size(const char *path)
+{
+	struct fs_stat_result st;
+	if (!fs_stat(path, &st, LIBFS_STAT_SIZE) || !(st.fields & LIBFS_STAT_SIZE))
+	{
+		return -1L;
+	}
+
+	return st.size;
+}
+
+/* Initial buffer size for files whose size is unknown */
+#define LIBFS_READ_CHUNK_SIZE 4096
+
+#ifdef LIBFS_HAVE_FD
+/* Passes the access pattern hints of fs_io_flags to the kernel */
+static void fs_advise(int fd, int flags)
+{
+#ifdef HAVE_POSIX_FADVISE
+	if (flags & LIBFS_IO_SEQUENTIAL)
+	{
+		posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	}
+	else if (flags & LIBFS_IO_RANDOM)
+	{
+		posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
+	}
+#else
+	LIBFS_UNUSED(fd);
+	LIBFS_UNUSED(flags);
+#endif
+}
+
+/* Drops the pages of a file read with LIBFS_IO_ONCE and closes it */
+static void fs_close_advised(int fd, int flags)
+{
+#ifdef HAVE_POSIX_FADVISE
+	if (flags & LIBFS_IO_ONCE)
+	{
+		posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	}
+#else
+	LIBFS_UNUSED(flags);
+#endif
+
+	close(fd);
+}
+
+/* Reads the content of fd and closes it */
+static void *
+fs_read_fd_internal(const fs_context *ctx, int fd, void *buf, size_t size, size_t *readen, int flags)
+{
+	struct stat s;
+	char *data;
+	char *grown;
+	char extra;
+	size_t capacity;
+	size_t total = 0;
+	ssize_t n;
+	if (fd < 0)
+	{
+		return NULL;
+	}
+
+	if (fstat(fd, &s) != 0)
+	{
+		close(fd);
+		return NULL;
+	}
+
+	fs_advise(fd, flags);
+	if (buf)
+	{
+		/* Keep room for the null-terminating character */
+		n = size ? fs_read_all(fd, buf, size - 1) : 0;
+		fs_close_advised(fd, flags);
+		if (n < 0)
+		{
+			return NULL;
+		}
+
+		if (size)
+		{
+			((char *)buf)[n] = '\0';
+		}
+
+		/* Report the size that would have been needed if truncated */
+		*readen = (size_t)n;
+		if ((!size || (size_t)n == size - 1) && S_ISREG(s.st_mode) && (size_t)s.st_size > (size_t)n)
+		{
+			*readen = (size_t)s.st_size;
+		}
+
+		return buf;
+	}
+
+	capacity = (S_ISREG(s.st_mode) && s.st_size > 0) ? (size_t)s.st_size + 1 : LIBFS_READ_CHUNK_SIZE;
+	data = (char *)fs_ctx_malloc(ctx, capacity);
+	if (!data)
+	{
+		close(fd);
+		return NULL;
+	}
+
+	for (;;)
+	{
+		n = fs_read_all(fd, data + total, capacity - 1 - total);
+		if (n < 0)
+		{
+			fs_ctx_free(ctx, data);
+			close(fd);
+			return NULL;
+		}
+
+		total += (size_t)n;
+		if (total < capacity - 1)
+		{
+			break;
+		}
+
+		/* The buffer is full, one more byte tells if the file grew */
+		n = fs_read_all(fd, &extra, 1);
+		if (n <= 0)
+		{
+			if (n == 0)
+			{
+				break;
+			}
+
+			fs_ctx_free(ctx, data);
+			close(fd);
+			return NULL;
+		}
+
+		grown = (char *)fs_ctx_realloc(ctx, data, capacity, capacity * 2);
+		if (!grown)
+		{
+			fs_ctx_free(ctx, data);
+			close(fd);
+			return NULL;
+		}
+
+		data = grown;
+		data[total++] = extra;
+		capacity *= 2;
+	}
+
+	fs_close_advised(fd, flags);
+	data[total] = '\0';
+	*readen = total;
+	return data;
+}
+
+static void *
+fs_read_file_internal(const fs_context *ctx, const char *path, void *buf, size_t size, size_t *readen, int flags)
+{
+	return fs_read_fd_internal(ctx, open(path, O_RDONLY | O_CLOEXEC), buf, size, readen, flags);
+}
+#else
+static void *
+fs_read_file_internal(const fs_context *ctx, const char *path, void *buf, size_t size, size_t *readen, int flags)
+{
+	void *data;
+	size_t file_size;
+	size_t read_size;
+	FILE *file = fs_open(path, "rb");
+	LIBFS_UNUSED(flags);
+	if (!file)
+	{
+		return NULL;
+	}
+
+	/* File size */
+	fseek(file, 0, SEEK_END);
+	file_size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	data = buf;
+	read_size = size;
+	if (!data)
+	{
+		read_size = file_size;
+		size = file_size + 1;
+
+		/* Create a buffer large enough */
+		data = fs_ctx_malloc(ctx, size);
+		if (!data)
+		{
+			fclose(file);
+			return NULL;
+		}
+	}
+
+	if (size > 0)
+	{
+		read_size = fread(data, 1, read_size, file);
+
+		/* Append \0 */
+		if (read_size < size)
+		{
+			((char *)data)[read_size] = '\0';
+		}
+		else
+		{
+			((char *)data)[size - 1] = '\0';
+		}
+	}
+
+	fclose(file);
+
+	*readen = file_size;
+	return data;
+}
+
+#endif
+
+LIBFS_PUBLIC(size_t)
+fs_read_file_buffer(const char *path, void *buf, size_t size)
+{
+	size_t readen = 0;
+	fs_read_file_internal(&fs_hooks_context, path, buf, size, &readen, 0);
+	return readen;
+}
+
+LIBFS_PUBLIC(void *)
+fs_read_file(const char *path, size_t *size)
+{
+	return fs_read_file_internal(&fs_hooks_context, path, NULL, 0, size, 0);
+}
+
+/* Grows buf to at least size bytes, keeping its first keep bytes */
+static int fs_buffer_reserve(fs_buffer *buf, size_t size, size_t keep)
+{
+	char *data;
+	size_t capacity = buf->capacity * 2;
+	if (size <= buf->capacity)
+	{
+		return LIBFS_TRUE;
+	}
+
+	if (capacity < size)
+	{
+		capacity = size;
+	}
+
+	data = (char *)_LIBFS_MALLOC(capacity);
+	if (!data)
+	{
+		return LIBFS_FALSE;
+	}
+
+	if (buf->data)
+	{
+		memcpy(data, buf->data, keep);
+		_LIBFS_FREE(buf->data);
+	}
+
+	buf->data = data;
+	buf->capacity = capacity;
+	return LIBFS_TRUE;
+}
+
+#ifdef LIBFS_HAVE_FD
+static int fs_read_fd_into(int fd, fs_buffer *buf)
+{
+	struct stat s;
+	size_t total = 0;
+	ssize_t n;
+	char extra;
+
+	if (fstat(fd, &s) != 0 ||
+		!fs_buffer_reserve(buf, (S_ISREG(s.st_mode) && s.st_size > 0) ? (size_t)s.st_size + 1 : LIBFS_READ_CHUNK_SIZE, 0))
+	{
+		return LIBFS_FALSE;
+	}
+
+	for (;;)
+	{
+		n = fs_read_all(fd, buf->data + total, buf->capacity - 1 - total);
+		if (n < 0)
+		{
+			return LIBFS_FALSE;
+		}
+
+		total += (size_t)n;
+		if (total < buf->capacity - 1)
+		{
+			break;
+		}
+
+		/* The buffer is full, one more byte tells if the file is longer */
+		n = fs_read_all(fd, &extra, 1);
+		if (n <= 0)
+		{
+			if (n == 0)
+			{
+				break;
+			}
+
+			return LIBFS_FALSE;
+		}
+
+		if (!fs_buffer_reserve(buf, buf->capacity + 1, total))
+		{
+			return LIBFS_FALSE;
+		}
+
+		buf->data[total++] = extra;
+	}
+
+	buf->data[total] = '\0';
+	buf->size = total;
+	return LIBFS_TRUE;
+}
+
+LIBFS_PUBLIC(int)
+fs_read_file_into(const char *path, fs_buffer *buf)
+{
+	int result;
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	buf->size = 0;
+	if (fd < 0)
+	{
+		return LIBFS_FALSE;
+	}
+
+	result = fs_read_fd_into(fd, buf);
+	close(fd);
+	if (!result)
+	{
+		buf->size = 0;
+	}
+
+	return result;
+}
+#else
+static int fs_read_stream_into(FILE *file, fs_buffer *buf, off_t size)
+{
+	size_t total = 0;
+	size_t n;
+	char extra;
+
+	/* The size is only a hint, the file is read until EOF in case it grew */
+	if (!fs_buffer_reserve(buf, size > 0 ? (size_t)size + 1 : LIBFS_READ_CHUNK_SIZE, 0))
+	{
+		return LIBFS_FALSE;
+	}
+
+	for (;;)
+	{
+		total += fread(buf->data + total, 1, buf->capacity - 1 - total, file);
+		if (total < buf->capacity - 1)
+		{
+			break;
+		}
+
+		/* The buffer is full, one more byte tells if the file is longer */
+		n = fread(&extra, 1, 1, file);
+		if (n == 0)
+		{
+			break;
+		}
+
+		if (!fs_buffer_reserve(buf, buf->capacity + 1, total))
+		{
+			return LIBFS_FALSE;
+		}
+
+		buf->data[total++] = extra;
+	}
+
+	if (ferror(file))
+	{
+		return LIBFS_FALSE;
+	}
+
+	buf->data[total] = '\0';
+	buf->size = total;
+	return LIBFS_TRUE;
+}
+
+LIBFS_PUBLIC(int)
+fs_read_file_into(const char *path, fs_buffer *buf)
+{
+	int result;
+	off_t size = fs_file_size(path);
+	FILE *file = fs_open(path, "rb");
+	buf->size = 0;
+	if (!file)
+	{
+		return LIBFS_FALSE;
+	}
+
+	result = fs_read_stream_into(file, buf, size);
+	fclose(file);
+	if (!result)
+	{
+		buf->size = 0;
+	}
+
+	return result;
+}
+#endif
+
+LIBFS_PUBLIC(void)
+fs_free_buffer(fs_buffer *buf)
+{
+	if (buf->data)
+	{
+		_LIBFS_FREE(buf->data);
+	}
+
+	buf->data = NULL;
+	buf->size = 0;
+	buf->capacity = 0;
+}
+
+#ifdef LIBFS_HAVE_FD
+/* Reads a whole file into aligned memory, without the page cache if possible */
+static void *
+fs_read_file_direct(const fs_context *ctx, const char *path, size_t *readen)
+{
+	struct stat s;
+	char *data;
+	char *grown;
+	size_t capacity;
+	size_t total = 0;
+	ssize_t n = 0;
+	int fd = fs_open_direct(path, O_RDONLY, 0, LIBFS_TRUE);
+	if (fd < 0)
+	{
+		return NULL;
+	}
+
+	if (fstat(fd, &s) != 0)
+	{
+		close(fd);
+		return NULL;
+	}
+
+	/* Room for the null-terminating character, in whole blocks */
+	capacity = (S_ISREG(s.st_mode) && s.st_size > 0) ? (size_t)s.st_size + 1 : 1;
+	capacity += (LIBFS_DIRECT_ALIGNMENT - capacity % LIBFS_DIRECT_ALIGNMENT) % LIBFS_DIRECT_ALIGNMENT;
+	data = (char *)fs_ctx_aligned_alloc(ctx, LIBFS_DIRECT_ALIGNMENT, capacity);
+	if (!data)
+	{
+		close(fd);
+		return NULL;
+	}
+
+	for (;;)
+	{
+		if (total == capacity)
+		{
+			/* The file grew, its size is a multiple of the alignment so far */
+			grown = (char *)fs_ctx_aligned_alloc(ctx, LIBFS_DIRECT_ALIGNMENT, capacity * 2);
+			if (!grown)
+			{
+				break;
+			}
+
+			memcpy(grown, data, total);
+			fs_ctx_aligned_free(ctx, data);
+			data = grown;
+			capacity *= 2;
+		}
+
+		n = fs_read_direct(fd, data + total, capacity - total);
+		if (n <= 0)
+		{
+			break;
+		}
+
+		total += (size_t)n;
+	}
+
+	close(fd);
+	if (n < 0 || total == capacity)
+	{
+		fs_ctx_aligned_free(ctx, data);
+		return NULL;
+	}
+
+	data[total] = '\0';
+	*readen = total;
+	return data;
+}
+#else
+static void *
+fs_read_file_direct(const fs_context *ctx, const char *path, size_t *readen)
+{
+	void *data;
+	off_t size = fs_file_size(path);
+	if (size < 0)
+	{
+		return NULL;
+	}
+
+	data = fs_ctx_aligned_alloc(ctx, LIBFS_DIRECT_ALIGNMENT, (size_t)size + 1);
+	if (data && !fs_read_file_internal(ctx, path, data, (size_t)size + 1, readen, 0))
+	{
+		fs_ctx_aligned_free(ctx, data);
+		return NULL;
+	}
+
+	return data;
+}
+#endif
+
+LIBFS_PUBLIC(void *)
+fs_read_file_ctx(const fs_context *ctx, const char *path, size_t *size, int flags)
+{
+	ctx = fs_context_or_hooks(ctx);
+	if (flags & LIBFS_IO_DIRECT)
+	{
+		return fs_read_file_direct(ctx, path, size);
+	}
+
+	return fs_read_file_internal(ctx, path, NULL, 0, size, flags);
+}
+
+LIBFS_PUBLIC(void *)
+fs_read_file_ex(const char *path, size_t *size, int flags)
+{
+	return fs_read_file_ctx(NULL, path, size, flags);
+}
+
+/* Number of paths opened by each job of fs_prefetch */
+#define LIBFS_PREFETCH_CHUNK 64
+
+typedef struct fs_prefetch_job
+{
+	fs_job base;
+	const char *const *paths;
+	size_t count;
+	size_t opened;
+} fs_prefetch_job;
+
+typedef struct fs_prefetch_batch fs_prefetch_batch;
+
+/* Jobs, then copies of the paths, follow the batch in the same allocation */
+struct fs_prefetch_batch
+{
+	fs_thread_pool pool;
+	fs_prefetch_job *jobs;
+	size_t count;
+};
+
+/* Queues the reading of a whole file without waiting for it */
+static int fs_prefetch_one(const char *path)
+{
+#ifdef LIBFS_HAVE_FD
+	struct stat s;
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+	{
+		return LIBFS_FALSE;
+	}
+
+	if (fstat(fd, &s) == 0 && S_ISREG(s.st_mode) && s.st_size > 0)
+	{
+#if defined(HAVE_READAHEAD)
+		readahead(fd, 0, (size_t)s.st_size);
+#elif defined(HAVE_POSIX_FADVISE)
+		posix_fadvise(fd, 0, s.st_size, POSIX_FADV_WILLNEED);
+#endif
+	}
+
+	close(fd);
+	return LIBFS_TRUE;
+#else
+	FILE *file = fs_open(path, "rb");
+	if (!file)
+	{
+		return LIBFS_FALSE;
+	}
+
+	fclose(file);
+	return LIBFS_TRUE;
+#endif
+}
+
+static int fs_prefetch_chunk(fs_job *job)
+{
+	fs_prefetch_job *_job = (fs_prefetch_job *)job;
+	size_t i;
+	for (i = 0; i < _job->count; ++i)
+	{
+		if (fs_prefetch_one(_job->paths[i]))
+		{
+			++_job->opened;
+		}
+	}
+
+	return LIBFS_TRUE;
+}
+
+LIBFS_PUBLIC(fs_prefetch_batch *)
+fs_prefetch(const char *const *paths, size_t count)
+{
+	fs_prefetch_batch *batch;
+	char **copies;
+	char *names;
+	size_t n = (count + LIBFS_PREFETCH_CHUNK - 1) / LIBFS_PREFETCH_CHUNK;
+	size_t threads = fs_cpu_count() * 4;
+	size_t size = 0;
+	size_t length;
+	size_t i;
+
+	for (i = 0; i < count; ++i)
+	{
+		size += strlen(paths[i]) + 1;
+	}
+
+	/* Paths are copied so the caller doesn't have to keep them until fs_prefetch_wait */
+	batch = (fs_prefetch_batch *)_LIBFS_MALLOC(sizeof(fs_prefetch_batch) + n * sizeof(fs_prefetch_job) + count * sizeof(char *) + size);
+	if (!batch)
+	{
+		return NULL;
+	}
+
+	batch->jobs = (fs_prefetch_job *)(batch + 1);
+	batch->count = n;
+	copies = (char **)(batch->jobs + n);
+	names = (char *)(copies + count);
+	for (i = 0; i < count; ++i)
+	{
+		length = strlen(paths[i]) + 1;
+		memcpy(names, paths[i], length);
+		copies[i] = names;
+		names += length;
+	}
+
+	/* A pool of a single thread would run the jobs on submit */
+	if (threads > n)
+	{
+		threads = n > 1 ? n : 2;
+	}
+
+	fs_thread_pool_init(&batch->pool, n ? threads : 0, 0);
+	for (i = 0; i < n; ++i)
+	{
+		batch->jobs[i].base.fn = fs_prefetch_chunk;
+		batch->jobs[i].paths = (const char *const *)copies + i * LIBFS_PREFETCH_CHUNK;
+		batch->jobs[i].count = i + 1 < n ? LIBFS_PREFETCH_CHUNK : count - i * LIBFS_PREFETCH_CHUNK;
+		batch->jobs[i].opened = 0;
+		fs_thread_pool_submit(&batch->pool, &batch->jobs[i].base);
+	}
+
+	return batch;
+}
+
+LIBFS_PUBLIC(size_t)
+fs_prefetch_wait(fs_prefetch_batch *batch)
+{
+	size_t opened = 0;
+	size_t i;
+	if (!batch)
+	{
+		return 0;
+	}
+
+	fs_thread_pool_destroy(&batch->pool);
+	for (i = 0; i < batch->count; ++i)
+	{
+		opened += batch->jobs[i].opened;
+	}
+
+	_LIBFS_FREE(batch);
+	return opened;
+}
+
+#if defined(HAVE_WINDOWS_H)
+static int fs_map_file_internal(const char *path, struct fs_file_view *view, int flags)
+{
+	HANDLE file;
+	HANDLE mapping;
+	LARGE_INTEGER size;
+	LIBFS_UNUSED(flags);
+
+	file = CreateFile(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return LIBFS_FALSE;
+	}
+
+	if (!GetFileSizeEx(file, &size) || size.QuadPart == 0 || (LONGLONG)(size_t)size.QuadPart != size.QuadPart)
+	{
+		CloseHandle(file);
+		return LIBFS_FALSE;
+	}
+
+	mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	CloseHandle(file);
+	if (!mapping)
+	{
+		return LIBFS_FALSE;
+	}
+
+	/* The view keeps the mapping alive */
+	view->data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping);
+	view->size = (size_t)size.QuadPart;
+	return view->data != NULL;
+}
+
+static void fs_unmap_file_internal(struct fs_file_view *view)
+{
+	UnmapViewOfFile(view->data);
+}
+#elif defined(HAVE_SYS_MMAN_H) && defined(HAVE_FCNTL_H)
+static int fs_map_file_internal(const char *path, struct fs_file_view *view, int flags)
+{
+	struct stat s;
+	void *data;
+	int mmap_flags = MAP_SHARED;
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+	{
+		return LIBFS_FALSE;
+	}
+
+	if (fstat(fd, &s) != 0 || !S_ISREG(s.st_mode) || s.st_size == 0 || (off_t)(size_t)s.st_size != s.st_size)
+	{
+		close(fd);
+		return LIBFS_FALSE;
+	}
+
+#ifdef MAP_POPULATE
+	if (flags & LIBFS_MAP_POPULATE)
+	{
+		mmap_flags |= MAP_POPULATE;
+	}
+#endif
+
+	/* The mapping stays valid once the file is closed */
+	data = mmap(NULL, (size_t)s.st_size, PROT_READ, mmap_flags, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+	{
+		return LIBFS_FALSE;
+	}
+
+#ifdef MADV_SEQUENTIAL
+	if (flags & LIBFS_MAP_SEQUENTIAL)
+	{
+		madvise(data, (size_t)s.st_size, MADV_SEQUENTIAL);
+	}
+#endif
+#ifdef MADV_WILLNEED
+	if (flags & LIBFS_MAP_WILLNEED)
+	{
+		madvise(data, (size_t)s.st_size, MADV_WILLNEED);
+	}
+#endif
+#ifdef MADV_HUGEPAGE
+	if (flags & LIBFS_MAP_HUGE_PAGES)
+	{
+		madvise(data, (size_t)s.st_size, MADV_HUGEPAGE);
+	}
+#endif
+
+	view->data = data;
+	view->size = (size_t)s.st_size;
+	return LIBFS_TRUE;
+}
+
+static void fs_unmap_file_internal(struct fs_file_view *view)
+{
+	munmap((void *)view->data, view->size);
+}
+#else
+static int fs_map_file_internal(const char *path, struct fs_file_view *view, int flags)
+{
+	LIBFS_UNUSED(path);
+	LIBFS_UNUSED(view);
+	LIBFS_UNUSED(flags);
+	return LIBFS_FALSE;
+}
+
+static void fs_unmap_file_internal(struct fs_file_view *view)
+{
+	LIBFS_UNUSED(view);
+}
+#endif
+
+LIBFS_PUBLIC(int)
+fs_map_file(const char *path, struct fs_file_view *view, int flags)
+{
+	if (fs_map_file_internal(path, view, flags))
+	{
+		view->mapped = LIBFS_TRUE;
+		return LIBFS_TRUE;
+	}
+
+	/* Empty or special file */
+	view->mapped = LIBFS_FALSE;
+	view->data = fs_read_file(path, &view->size);
+	return view->data != NULL;
+}
+
+LIBFS_PUBLIC(void)
+fs_unmap_file(struct fs_file_view *view)
+{
+	if (view->mapped)
+	{
+		fs_unmap_file_internal(view);
+	}
+	else
+	{
+		_LIBFS_FREE((void *)view->data);
+	}
+
+	view->data = NULL;
+	view->size = 0;
+}
+
+LIBFS_PUBLIC(int)
+fs_write_file(const char *path, const void *buf, size_t size)
+{
+	FILE *file = fs_open(path, "wb");
+	if (!file)
+	{
+		return LIBFS_FALSE;
+	}
+
+	fwrite(buf, size, 1, file);
+	fclose(file);
+	return LIBFS_TRUE;
+}
+
+LIBFS_PUBLIC(int)
+fs_write_file_ex(const char *path, const void *buf, size_t size, int flags)
+{
+#ifdef LIBFS_HAVE_FD
+	int result;
+	int fd;
+	if (flags & LIBFS_IO_DIRECT)
+	{
+		fd = fs_open_direct(path, O_WRONLY | O_CREAT | O_TRUNC, 0666, LIBFS_TRUE);
+		if (fd < 0)
+		{
+			return LIBFS_FALSE;
+		}
+
+		result = fs_write_direct(fd, buf, size);
+		return (close(fd) == 0) && result;
+	}
+#else
+	LIBFS_UNUSED(flags);
+#endif
+
+	return fs_write_file(path, buf, size);
+}
+
+#if defined(LIBFS_HAVE_FD) && defined(HAVE_SYS_UIO_H)
+/* Number of buffers given to readv or writev at once */
+#define LIBFS_IOV_BATCH 64
+
+/* Reads or writes the buffers of iov until they are done, EOF or an error */
+static int fs_transfer_iov(int fd, const struct fs_iovec *iov, size_t count, int writing, size_t *total)
+{
+	struct iovec vec[LIBFS_IOV_BATCH];
+	size_t first = 0;
+	size_t skip = 0;
+	size_t left;
+	size_t n;
+	size_t i;
+	ssize_t res;
+
+	*total = 0;
+	while (first < count)
+	{
+		/* skip is the part of iov[first] already transferred */
+		if (skip == iov[first].size)
+		{
+			first++;
+			skip = 0;
+			continue;
+		}
+
+		n = count - first < LIBFS_IOV_BATCH ? count - first : LIBFS_IOV_BATCH;
+		for (i = 0; i < n; ++i)
+		{
+			vec[i].iov_base = iov[first + i].data;
+			vec[i].iov_len = iov[first + i].size;
+		}
+
+		vec[0].iov_base = (char *)vec[0].iov_base + skip;
+		vec[0].iov_len -= skip;
+		res = writing ? writev(fd, vec, (int)n) : readv(fd, vec, (int)n);
+		if (res < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+
+			return LIBFS_FALSE;
+		}
+
+		if (res == 0)
+		{
+			/* End of file when reading, nothing should stop a write there */
+			return !writing;
+		}
+
+		*total += (size_t)res;
+		for (left = (size_t)res; left > 0;)
+		{
+			if (left < iov[first].size - skip)
+			{
+				skip += left;
+				break;
+			}
+
+			left -= iov[first].size - skip;
+			first++;
+			skip = 0;
+		}
+	}
+
+	return LIBFS_TRUE;
+}
+
+LIBFS_PUBLIC(int)
+fs_write_filev(const char *path, const struct fs_iovec *iov, size_t count)
+{
+	size_t total;
+	int result;
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	if (fd < 0)
+	{
+		return LIBFS_FALSE;
+	}
+
+	result = fs_transfer_iov(fd, iov, count, LIBFS_TRUE, &total);
+	return (close(fd) == 0) && result;
+}
+
+LIBFS_PUBLIC(int)
+fs_read_filev(const char *path, const struct fs_iovec *iov, size_t count, size_t *readen)
+{
+	size_t total;
+	int result;
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+	{
+		return LIBFS_FALSE;
+	}
+
+	result = fs_transfer_iov(fd, iov, count, LIBFS_FALSE, &total);
+	close(fd);
+	if (readen)
+	{
+		*readen = total;
+	}
+
+	return result;
+}
+#else
+LIBFS_PUBLIC(int)
+fs_write_filev(const char *path, const struct fs_iovec *iov, size_t count)
+{
+	size_t i;
+	int result = LIBFS_TRUE;
+	FILE *file = fs_open(path, "wb");
+	if (!file)
+	{
+		return LIBFS_FALSE;
+	}
+
+	for (i = 0; i < count && result; ++i)
+	{
+		result = fwrite(iov[i].data, 1, iov[i].size, file) == iov[i].size;
+	}
+
+	return (fclose(file) == 0) && result;
+}
+
+LIBFS_PUBLIC(int)
+fs_read_filev(const char *path, const struct fs_iovec *iov, size_t count, size_t *readen)
+{
+	size_t total = 0;
+	size_t n;
+	size_t i;
+	int result;
+	FILE *file = fs_open(path, "rb");
+	if (!file)
+	{
+		return LIBFS_FALSE;
+	}
+
+	for (i = 0; i < count; ++i)
+	{
+		n = fread(iov[i].data, 1, iov[i].size, file);
+		total += n;
+		if (n < iov[i].size)
+		{
+			break;
+		}
+	}
+
+	result = !ferror(file);
+	fclose(file);
+	if (readen)
+	{
+		*readen = total;
+	}
+
+	return result;
+}
+#endif
+
+/* Room for the suffix of temporary files: ".tmp", two hexadecimal numbers, a dot and a null */
+#define LIBFS_ATOMIC_SUFFIX (6 + 4 * sizeof(unsigned long))
+/* Names tried before giving up on creating a temporary file */
+#define LIBFS_ATOMIC_ATTEMPTS 100
+
+#if defined(LIBFS_HAVE_FD) && defined(HAVE_SYNCFS)
+/* A batch is flushed with one syncfs per filesystem */
+#define LIBFS_HAVE_SYNCFS 1
+#endif
+
+typedef struct fs_atomic_batch fs_atomic_batch;
+
+/* Write waiting for commit, followed by its path and temporary path */
+typedef struct fs_atomic_entry
+{
+	dev_t dev;
+	char *temp;
+	char path[1];
+} fs_atomic_entry;
+
+struct fs_atomic_batch
+{
+	fs_atomic_entry **entries;
+	size_t count;
+	size_t capacity;
+};
+
+/* Writes n in hexadecimal and a null, returns the end of s */
+static char *fs_format_hex(char *s, unsigned long n)
+{
+	char digits[2 * sizeof(unsigned long)];
+	size_t count = 0;
+	do
+	{
+		digits[count++] = "0123456789abcdef"[n & 15];
+		n >>= 4;
+	} while (n);
+
+	while (count)
+	{
+		*s++ = digits[--count];
+	}
+
+	*s = '\0';
+	return s;
+}
+
+/* Names a temporary file next to path, unique for this process */
+static void fs_atomic_temp_path(const char *path, char *temp)
+{
+	static unsigned long counter;
+	size_t length = strlen(path);
+	char *s;
+	memcpy(temp, path, length);
+	memcpy(temp + length, ".tmp", 4);
+#if HAVE_WINDOWS_H
+	s = fs_format_hex(temp + length + 4, (unsigned long)GetCurrentProcessId());
+#elif defined(LIBFS_HAVE_FD)
+	s = fs_format_hex(temp + length + 4, (unsigned long)getpid());
+#else
+	s = fs_format_hex(temp + length + 4, 0);
+#endif
+	*s++ = '.';
+	fs_format_hex(s, counter++);
+}
+
+/* Length of the directory part of path, 0 for the current directory */
+static size_t fs_parent_length(const char *path)
+{
+	const char *slash = strrchr(path, '/');
+#if HAVE_WINDOWS_H
+	const char *backslash = strrchr(path, '\\');
+	if (backslash > slash)
+	{
+		slash = backslash;
+	}
+#endif
+	if (!slash)
+	{
+		return 0;
+	}
+
+	return slash == path ? 1 : (size_t)(slash - path);
+}
+
+#ifdef LIBFS_HAVE_FD
+/* Writes buf to a new temporary file next to path, flushed to the storage if sync */
+static int fs_atomic_write_temp(const char *path, char *temp, const void *buf, size_t size, int sync, dev_t *dev)
+{
+	struct stat s;
+	int result;
+	int attempt;
+	int fd = -1;
+	for (attempt = 0; attempt < LIBFS_ATOMIC_ATTEMPTS && fd < 0; ++attempt)
+	{
+		fs_atomic_temp_path(path, temp);
+		fd = open(temp, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+		if (fd < 0 && errno != EEXIST)
+		{
+			return LIBFS_FALSE;
+		}
+	}
+
+	if (fd < 0)
+	{
+		return LIBFS_FALSE;
+	}
+
+	/* Keep the permissions of the replaced file rather than the umask ones */
+	result = (stat(path, &s) != 0 || fchmod(fd, s.st_mode & 07777) == 0) && fs_write_all(fd, buf, size) &&
+			 (!sync || fsync(fd) == 0) && fstat(fd, &s) == 0;
+	if (result)
+	{
+		*dev = s.st_dev;
+	}
+
+	if (close(fd) != 0 || !result)
+	{
+		unlink(temp);
+		return LIBFS_FALSE;
+	}
+
+	return LIBFS_TRUE;
+}
+
+/* Flushes the directory part of path so the renames into it are durable */
+static int fs_sync_dir(const char *path, size_t length)
+{
+	char *dir;
+	int fd;
+	int result;
+	if (!length)
+	{
+		path = ".";
+		length = 1;
+	}
+
+	dir = (char *)_LIBFS_MALLOC(length + 1);
+	if (!dir)
+	{
+		return LIBFS_FALSE;
+	}
+
+	memcpy(dir, path, length);
+	dir[length] = '\0';
+	fd = open(dir, O_RDONLY | O_CLOEXEC);
+	_LIBFS_FREE(dir);
+	if (fd < 0)
+	{
+		return LIBFS_FALSE;
+	}
+
+	/* Some filesystems can't flush directories and have nothing to flush */
+	result = fsync(fd) == 0 || errno == EINVAL;
+	close(fd);
+	return result;
+}
+
+#define fs_atomic_rename(from, to) (rename(from, to) == 0)
+#define fs_atomic_remove unlink
+#else
+static int fs_atomic_write_temp(const char *path, char *temp, const void *buf, size_t size, int sync, dev_t *dev)
+{
+	FILE *file;
+	int result;
+	int attempt;
+	LIBFS_UNUSED(sync);
+	for (attempt = 0; attempt < LIBFS_ATOMIC_ATTEMPTS; ++attempt)
+	{
+		fs_atomic_temp_path(path, temp);
+		if (!fs_exist(temp))
+		{
+			break;
+		}
+	}
+
+	file = fs_open(temp, "wb");
+	if (!file)
+	{
+		return LIBFS_FALSE;
+	}
+
+#if HAVE_WINDOWS_H
+	/* There is no syncfs for batches, so every temporary file is flushed */
+	result = fwrite(buf, 1, size, file) == size && fs_sync_file(file);
+#else
+	result = fwrite(buf, 1, size, file) == size && fflush(file) == 0;
+#endif
+	*dev = 0;
+	if (fclose(file) != 0 || !result)
+	{
+		remove(temp);
+		return LIBFS_FALSE;
+	}
+
+	return LIBFS_TRUE;
+}
+
+/* Renames are only made durable by MOVEFILE_WRITE_THROUGH on Windows */
+#define fs_sync_dir(path, length) LIBFS_TRUE
+#if HAVE_WINDOWS_H
+#define fs_atomic_rename(from, to) (MoveFileEx(from, to, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0)
+#else
+#define fs_atomic_rename(from, to) (rename(from, to) == 0)
+#endif
+#define fs_atomic_remove remove
+#endif
+
+LIBFS_PUBLIC(int)
+fs_write_file_atomic(const char *path, const void *buf, size_t size)
+{
+	dev_t dev;
+	int result;
+	char *temp = (char *)_LIBFS_MALLOC(strlen(path) + LIBFS_ATOMIC_SUFFIX);
+	if (!temp)
+	{
+		return LIBFS_FALSE;
+	}
+
+	result = fs_atomic_write_temp(path, temp, buf, size, LIBFS_TRUE, &dev);
+	if (result && !fs_atomic_rename(temp, path))
+	{
+		fs_atomic_remove(temp);
+		result = LIBFS_FALSE;
+	}
+
+	_LIBFS_FREE(temp);
+	return result && fs_sync_dir(path, fs_parent_length(path));
+}
+
+LIBFS_PUBLIC(fs_atomic_batch *)
+fs_atomic_batch_create(void)
+{
+	fs_atomic_batch *batch = (fs_atomic_batch *)_LIBFS_MALLOC(sizeof(fs_atomic_batch));
+	if (batch)
+	{
+		memset(batch, 0, sizeof(fs_atomic_batch));
+	}
+
+	return batch;
+}
+
+LIBFS_PUBLIC(int)
+fs_atomic_batch_write(fs_atomic_batch *batch, const char *path, const void *buf, size_t size)
+{
+	fs_atomic_entry **entries;
+	fs_atomic_entry *entry;
+	size_t length = strlen(path);
+	int sync = LIBFS_TRUE;
+#ifdef LIBFS_HAVE_SYNCFS
+	/* Flushed by syncfs on commit */
+	sync = LIBFS_FALSE;
+#endif
+
+	if (batch->count == batch->capacity)
+	{
+		entries = (fs_atomic_entry **)_LIBFS_MALLOC((batch->capacity ? batch->capacity * 2 : 16) * sizeof(fs_atomic_entry *));
+		if (!entries)
+		{
+			return LIBFS_FALSE;
+		}
+
+		if (batch->entries)
+		{
+			memcpy(entries, batch->entries, batch->count * sizeof(fs_atomic_entry *));
+			_LIBFS_FREE(batch->entries);
+		}
+
+		batch->entries = entries;
+		batch->capacity = batch->capacity ? batch->capacity * 2 : 16;
+	}
+
+	entry = (fs_atomic_entry *)_LIBFS_MALLOC(sizeof(fs_atomic_entry) + length * 2 + LIBFS_ATOMIC_SUFFIX);
+	if (!entry)
+	{
+		return LIBFS_FALSE;
+	}
+
+	memcpy(entry->path, path, length + 1);
+	entry->temp = entry->path + length + 1;
+	if (!fs_atomic_write_temp(path, entry->temp, buf, size, sync, &entry->dev))
+	{
+		_LIBFS_FREE(entry);
+		return LIBFS_FALSE;
+	}
+
+	batch->entries[batch->count++] = entry;
+	return LIBFS_TRUE;
+}
+
+/* Releases the entries of a batch, deleting their temporary files if discard */
+static void fs_atomic_batch_clear(fs_atomic_batch *batch, int discard)
+{
+	size_t i;
+	for (i = 0; i < batch->count; ++i)
+	{
+		if (discard)
+		{
+			fs_atomic_remove(batch->entries[i]->temp);
+		}
+
+		_LIBFS_FREE(batch->entries[i]);
+	}
+
+	batch->count = 0;
+}
+
+LIBFS_PUBLIC(int)
+fs_atomic_batch_commit(fs_atomic_batch *batch)
+{
+	fs_atomic_entry *entry;
+	size_t *seen;
+	size_t count = 0;
+	size_t length;
+	size_t i;
+	size_t j;
+	int result = LIBFS_TRUE;
+#ifdef LIBFS_HAVE_SYNCFS
+	int fd;
+#endif
+
+	if (!batch->count)
+	{
+		return LIBFS_TRUE;
+	}
+
+	/* Indices of the entries on distinct filesystems, then in distinct directories */
+	seen = (size_t *)_LIBFS_MALLOC(batch->count * sizeof(size_t));
+	if (!seen)
+	{
+		fs_atomic_batch_clear(batch, LIBFS_TRUE);
+		return LIBFS_FALSE;
+	}
+
+#ifdef LIBFS_HAVE_SYNCFS
+	for (i = 0; i < batch->count && result; ++i)
+	{
+		for (j = 0; j < count && batch->entries[seen[j]]->dev != batch->entries[i]->dev; ++j)
+		{
+		}
+
+		if (j == count)
+		{
+			seen[count++] = i;
+			fd = open(batch->entries[i]->temp, O_RDONLY | O_CLOEXEC);
+			result = fd >= 0 && syncfs(fd) == 0;
+			if (fd >= 0)
+			{
+				close(fd);
+			}
+		}
+	}
+
+	/* Nothing is replaced unless every new content is durable */
+	if (!result)
+	{
+		_LIBFS_FREE(seen);
+		fs_atomic_batch_clear(batch, LIBFS_TRUE);
+		return LIBFS_FALSE;
+	}
+#endif
+
+	for (i = 0; i < batch->count; ++i)
+	{
+		entry = batch->entries[i];
+		if (!fs_atomic_rename(entry->temp, entry->path))
+		{
+			fs_atomic_remove(entry->temp);
+			result = LIBFS_FALSE;
+		}
+	}
+
+	count = 0;
+	for (i = 0; i < batch->count; ++i)
+	{
+		entry = batch->entries[i];
+		length = fs_parent_length(entry->path);
+		for (j = 0; j < count; ++j)
+		{
+			if (fs_parent_length(batch->entries[seen[j]]->path) == length &&
+				memcmp(batch->entries[seen[j]]->path, entry->path, length) == 0)
+			{
+				break;
+			}
+		}
+
+		if (j == count)
+		{
+			seen[count++] = i;
+			result = fs_sync_dir(entry->path, length) && result;
+		}
+	}
+
+	_LIBFS_FREE(seen);
+	fs_atomic_batch_clear(batch, LIBFS_FALSE);
+	return result;
+}
+
+LIBFS_PUBLIC(void)
+fs_atomic_batch_destroy(fs_atomic_batch *batch)
+{
+	fs_atomic_batch_clear(batch, LIBFS_TRUE);
+	if (batch->entries)
+	{
+		_LIBFS_FREE(batch->entries);
+	}
+
+	_LIBFS_FREE(batch);
+}
+
+typedef const char *(*fs_find_char_fn)(const char *data, size_t size, char c);
+typedef size_t (*fs_count_char_fn)(const char *data, size_t size, char c);
+
+static const char *fs_find_char_scalar(const char *data, size_t size, char c)
+{
+	return (const char *)memchr(data, c, size);
+}
+
+static size_t fs_count_char_scalar(const char *data, size_t size, char c)
+{
+	size_t count = 0;
+	size_t i;
+	for (i = 0; i < size; ++i)
+	{
+		count += data[i] == c;
+	}
+
+	return count;
+}
+
+#ifdef LIBFS_HAVE_SSE2
+/* Index of the lowest set bit of a non-zero mask */
+static unsigned int fs_ctz(unsigned int mask)
+{
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return (unsigned int)index;
+#else
+	return (unsigned int)__builtin_ctz(mask);
+#endif
+}
+
+static const char *fs_find_char_sse2(const char *data, size_t size, char c)
+{
+	const __m128i needle = _mm_set1_epi8(c);
+	size_t i = 0;
+	int mask;
+	for (; i + 16 <= size; i += 16)
+	{
+		mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(data + i)), needle));
+		if (mask)
+		{
+			return data + i + fs_ctz((unsigned int)mask);
+		}
+	}
+
+	return fs_find_char_scalar(data + i, size - i, c);
+}
+
+static size_t fs_count_char_sse2(const char *data, size_t size, char c)
+{
+	const __m128i needle = _mm_set1_epi8(c);
+	const __m128i zero = _mm_setzero_si128();
+	__m128i counts;
+	size_t count = 0;
+	size_t i = 0;
+	size_t n;
+	while (i + 16 <= size)
+	{
+		/* Matches are -1, so subtracting them counts up to 255 per byte */
+		counts = _mm_setzero_si128();
+		for (n = 0; n < 255 && i + 16 <= size; ++n, i += 16)
+		{
+			counts = _mm_sub_epi8(counts, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(data + i)), needle));
+		}
+
+		counts = _mm_sad_epu8(counts, zero);
+		count += (size_t)_mm_cvtsi128_si32(counts) + (size_t)_mm_cvtsi128_si32(_mm_srli_si128(counts, 8));
+	}
+
+	return count + fs_count_char_scalar(data + i, size - i, c);
+}
+#endif
+
+#ifdef LIBFS_HAVE_AVX2
+__attribute__((target("avx2"))) static const char *fs_find_char_avx2(const char *data, size_t size, char c)
+{
+	const __m256i needle = _mm256_set1_epi8(c);
+	__m256i a;
+	__m256i b;
+	unsigned int mask;
+	size_t i = 0;
+	for (; i + 64 <= size; i += 64)
+	{
+		/* Test two vectors at once and find which one matched after */
+		a = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(data + i)), needle);
+		b = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(data + i + 32)), needle);
+		if (!_mm256_testz_si256(_mm256_or_si256(a, b), _mm256_or_si256(a, b)))
+		{
+			mask = (unsigned int)_mm256_movemask_epi8(a);
+			if (mask)
+			{
+				return data + i + fs_ctz(mask);
+			}
+
+			return data + i + 32 + fs_ctz((unsigned int)_mm256_movemask_epi8(b));
+		}
+	}
+
+	return fs_find_char_sse2(data + i, size - i, c);
+}
+
+__attribute__((target("avx2"))) static size_t fs_count_char_avx2(const char *data, size_t size, char c)
+{
+	const __m256i needle = _mm256_set1_epi8(c);
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i counts;
+	__m128i sums;
+	size_t count = 0;
+	size_t i = 0;
+	size_t n;
+	while (i + 32 <= size)
+	{
+		counts = _mm256_setzero_si256();
+		for (n = 0; n < 255 && i + 32 <= size; ++n, i += 32)
+		{
+			counts = _mm256_sub_epi8(counts, _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(data + i)), needle));
+		}
+
+		counts = _mm256_sad_epu8(counts, zero);
+		sums = _mm_add_epi64(_mm256_castsi256_si128(counts), _mm256_extracti128_si256(counts, 1));
+		count += (size_t)_mm_cvtsi128_si32(sums) + (size_t)_mm_cvtsi128_si32(_mm_srli_si128(sums, 8));
+	}
+
+	return count + fs_count_char_sse2(data + i, size - i, c);
+}
+#endif
+
+static fs_find_char_fn fs_find_char_impl;
+static fs_count_char_fn fs_count_char_impl;
+
+/* Selects the fastest implementations supported by the CPU */
+static void fs_simd_init(void)
+{
+	fs_count_char_fn count = fs_count_char_scalar;
+	fs_find_char_fn find = fs_find_char_scalar;
+#ifdef LIBFS_HAVE_SSE2
+	count = fs_count_char_sse2;
+	find = fs_find_char_sse2;
+#endif
+#ifdef LIBFS_HAVE_AVX2
+	if (__builtin_cpu_supports("avx2"))
+	{
+		count = fs_count_char_avx2;
+		find = fs_find_char_avx2;
+	}
+#endif
+
+	/* Racing threads select the same functions */
+	fs_count_char_impl = count;
+	fs_find_char_impl = find;
+}
+
+static const char *fs_find_char(const char *data, size_t size, char c)
+{
+	if (!fs_find_char_impl)
+	{
+		fs_simd_init();
+	}
+
+	return fs_find_char_impl(data, size, c);
+}
+
+static size_t fs_count_char(const char *data, size_t size, char c)
+{
+	if (!fs_count_char_impl)
+	{
+		fs_simd_init();
+	}
+
+	return fs_count_char_impl(data, size, c);
+}
+
+/* Default size of the buffer of file iterators */
+#define LIBFS_FILE_BUFFER_SIZE (64 * 1024)
+
+typedef struct fs_file_iterator
+{
+#ifdef LIBFS_HAVE_FD
+	int fd;
+#else
+	FILE *file;
+#endif
+	/* Unread bytes are between begin and end */
+	char *buf;
+	size_t begin;
+	size_t end;
+	size_t capacity;
+	int eof;
+	/* Sticky, set when a read failed */
+	int error;
+	fs_context ctx;
+} fs_file_iterator;
+
+/* The initial buffer is allocated with the iterator */
+#define fs_file_iterator_inline_buf(it) ((char *)((it) + 1))
+
+/* Moves unread bytes to the front and reads more, returns if bytes were read */
+static int fs_file_iterator_fill(fs_file_iterator *it)
+{
+#ifdef LIBFS_HAVE_FD
+	ssize_t n;
+#else
+	size_t n;
+#endif
+	if (it->begin > 0)
+	{
+		memmove(it->buf, it->buf + it->begin, it->end - it->begin);
+		it->end -= it->begin;
+		it->begin = 0;
+	}
+
+	if (it->eof || it->end == it->capacity)
+	{
+		return LIBFS_FALSE;
+	}
+
+#ifdef LIBFS_HAVE_FD
+	do
+	{
+		n = read(it->fd, it->buf + it->end, it->capacity - it->end);
+	} while (n < 0 && errno == EINTR);
+	if (n < 0)
+	{
+		it->error = LIBFS_TRUE;
+	}
+#else
+	n = fread(it->buf + it->end, 1, it->capacity - it->end, it->file);
+	if (n == 0 && ferror(it->file))
+	{
+		it->error = LIBFS_TRUE;
+	}
+#endif
+	if (n <= 0)
+	{
+		it->eof = LIBFS_TRUE;
+		return LIBFS_FALSE;
+	}
+
+	it->end += (size_t)n;
+	return LIBFS_TRUE;
+}
+
+/* Doubles the buffer to fit a line longer than it */
+static int fs_file_iterator_grow(fs_file_iterator *it)
+{
+	char *buf;
+	if (it->buf != fs_file_iterator_inline_buf(it))
+	{
+		/* An arena can grow the last allocated buffer in place */
+		memmove(it->buf, it->buf + it->begin, it->end - it->begin);
+		it->end -= it->begin;
+		it->begin = 0;
+		buf = (char *)fs_ctx_realloc(&it->ctx, it->buf, it->capacity, it->capacity * 2);
+	}
+	else
+	{
+		buf = (char *)fs_ctx_malloc(&it->ctx, it->capacity * 2);
+		if (buf)
+		{
+			memcpy(buf, it->buf + it->begin, it->end - it->begin);
+			it->end -= it->begin;
+			it->begin = 0;
+		}
+	}
+
+	if (!buf)
+	{
+		return LIBFS_FALSE;
+	}
+
+	it->buf = buf;
+	it->capacity *= 2;
+	return LIBFS_TRUE;
+}
+
+LIBFS_PUBLIC(fs_file_iterator *)
+fs_iter_file_ctx(const fs_context *ctx, const char *path, size_t buffer_size)
+{
+	fs_file_iterator *it;
+#ifdef LIBFS_HAVE_FD
+	int f = open(path, O_RDONLY | O_CLOEXEC);
+	if (f < 0)
+	{
+		return NULL;
+	}
+#else
+	FILE *f = fs_open(path, "r");
+	if (!f)
+	{
+		return NULL;
+	}
+#endif
+
+	if (!buffer_size)
+	{
+		buffer_size = LIBFS_FILE_BUFFER_SIZE;
+	}
+
+	ctx = fs_context_or_hooks(ctx);
+	it = (fs_file_iterator *)fs_ctx_malloc(ctx, sizeof(fs_file_iterator) + buffer_size);
+	if (!it)
+	{
+#ifdef LIBFS_HAVE_FD
+		close(f);
+#else
+		fclose(f);
+#endif
+		return NULL;
+	}
+
+	memset(it, 0, sizeof(fs_file_iterator));
+#ifdef LIBFS_HAVE_FD
+	it->fd = f;
+#else
+	it->file = f;
+#endif
+	it->buf = fs_file_iterator_inline_buf(it);
+	it->capacity = buffer_size;
+	it->ctx = *ctx;
+	return it;
+}
+
+LIBFS_PUBLIC(fs_file_iterator *)
+fs_iter_file_ex(const char *path, size_t buffer_size)
+{
+	return fs_iter_file_ctx(NULL, path, buffer_size);
+}
+
+LIBFS_PUBLIC(fs_file_iterator *)
+fs_iter_file(const char *path)
+{
+	return fs_iter_file_ex(path, 0);
+}
+
+LIBFS_PUBLIC(fs_file_iterator *)
+fs_next_char(fs_file_iterator *it, char *c)
+{
+	if (it->begin == it->end && !fs_file_iterator_fill(it))
+	{
+		return NULL;
+	}
+
+	*c = it->buf[it->begin++];
+	return it;
+}
+
+LIBFS_PUBLIC(fs_file_iterator *)
+fs_next_chunk(fs_file_iterator *it, const char **data, size_t *size)
+{
+	if (it->begin == it->end && !fs_file_iterator_fill(it))
+	{
+		return NULL;
+	}
+
+	*data = it->buf + it->begin;
+	*size = it->end - it->begin;
+	it->begin = it->end;
+	return it;
+}
+
+LIBFS_PUBLIC(fs_file_iterator *)
+fs_next_token(fs_file_iterator *it, char delimiter, const char **token, size_t *size)
+{
+	const char *c;
+	size_t scanned = 0;
+	for (;;)
+	{
+		/* Only search bytes that were not searched before a refill */
+		c = fs_find_char(it->buf + it->begin + scanned, it->end - it->begin - scanned, delimiter);
+		if (c)
+		{
+			*token = it->buf + it->begin;
+			*size = (size_t)(c - *token);
+			it->begin += *size + 1;
+			return it;
+		}
+
+		scanned = it->end - it->begin;
+		if (it->begin == 0 && it->end == it->capacity && !fs_file_iterator_grow(it))
+		{
+			return NULL;
+		}
+
+		if (!fs_file_iterator_fill(it))
+		{
+			break;
+		}
+	}
+
+	/* Don't return a token cut short by a read error */
+	if (it->begin == it->end || it->error)
+	{
+		return NULL;
+	}
+
+	/* Last token without delimiter */
+	*token = it->buf + it->begin;
+	*size = it->end - it->begin;
+	it->begin = it->end;
+	return it;
+}
+
+LIBFS_PUBLIC(fs_file_iterator *)
+fs_next_line(fs_file_iterator *it, const char **line, size_t *size)
+{
+	return fs_next_token(it, '\n', line, size);
+}
+
+/* Size of the buffer used to count lines */
+#define LIBFS_COUNT_BUFFER_SIZE (1024 * 1024)
+
+LIBFS_PUBLIC(int)
+fs_count_lines(const char *path, size_t *count)
+{
+	const char *data;
+	size_t size;
+	char last = '\n';
+	fs_file_iterator *it = fs_iter_file_ex(path, LIBFS_COUNT_BUFFER_SIZE);
+	if (!it)
+	{
+		return LIBFS_FALSE;
+	}
+
+	*count = 0;
+	while (fs_next_chunk(it, &data, &size))
+	{
+		*count += fs_count_char(data, size, '\n');
+		last = data[size - 1];
+	}
+
+	if (fs_file_error(it))
+	{
+		fs_close_file(it);
+		return LIBFS_FALSE;
+	}
+
+	/* Last line without newline */
+	if (last != '\n')
+	{
+		++*count;
+	}
+
+	fs_close_file(it);
+	return LIBFS_TRUE;
+}
+
+LIBFS_PUBLIC(int)
+fs_file_error(const fs_file_iterator *it)
+{
+	return it->error;
+}
+
+LIBFS_PUBLIC(void)
+fs_close_file(fs_file_iterator *it)
+{
+#ifdef LIBFS_HAVE_FD
+	close(it->fd);
+#else
+	fclose(it->file);
+#endif
+	if (it->buf != fs_file_iterator_inline_buf(it))
+	{
+		fs_ctx_free(&it->ctx, it->buf);
+	}
+
+	fs_ctx_free(&it->ctx, it);
+}
+
+/* Default size of the buffer of file writers */
+#define LIBFS_WRITER_BUFFER_SIZE (1024 * 1024)
+
+typedef struct fs_file_writer
+{
+#ifdef LIBFS_HAVE_FD
+	int fd;
+#else
+	FILE *file;
+#endif
+	/* Bytes not yet written to the file */
+	char *buf;
+	size_t used;
+	size_t capacity;
+	/* Bytes written to the file */
+	off_t written;
+	int failed;
+	/* If blocks were reserved past the end of the file */
+	int preallocated;
+} fs_file_writer;
+
+/* Writes bytes to the file, bypassing the buffer */
+static int fs_file_writer_output(fs_file_writer *w, const void *data, size_t size)
+{
+#ifdef LIBFS_HAVE_FD
+	if (!fs_write_all(w->fd, data, size))
+#else
+	if (fwrite(data, 1, size, w->file) != size)
+#endif
+	{
+		w->failed = LIBFS_TRUE;
+		return LIBFS_FALSE;
+	}
+
+	w->written += (off_t)size;
+	return LIBFS_TRUE;
+}
+
+LIBFS_PUBLIC(fs_file_writer *)
+fs_open_file_writer(const char *path, const struct fs_file_writer_options *options)
+{
+	fs_file_writer *w;
+	size_t buffer_size = options && options->buffer_size ? options->buffer_size : LIBFS_WRITER_BUFFER_SIZE;
+#ifdef LIBFS_HAVE_FD
+	int f = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	if (f < 0)
+	{
+		return NULL;
+	}
+#else
+	FILE *f = fs_open(path, "wb");
+	if (!f)
+	{
+		return NULL;
+	}
+#endif
+
+	w = (fs_file_writer *)_LIBFS_MALLOC(sizeof(fs_file_writer) + buffer_size);
+	if (!w)
+	{
+#ifdef LIBFS_HAVE_FD
+		close(f);
+#else
+		fclose(f);
+#endif
+		return NULL;
+	}
+
+	memset(w, 0, sizeof(fs_file_writer));
+#ifdef LIBFS_HAVE_FD
+	w->fd = f;
+#else
+	w->file = f;
+#endif
+	w->buf = (char *)(w + 1);
+	w->capacity = buffer_size;
+#if defined(LIBFS_HAVE_FD) && defined(HAVE_FALLOCATE) && defined(FALLOC_FL_KEEP_SIZE)
+	/* Leaves the file size alone, so a crash or an error leaves no zero padding */
+	if (options && options->expected_size > 0)
+	{
+		w->preallocated = fallocate(f, FALLOC_FL_KEEP_SIZE, 0, options->expected_size) == 0;
+	}
+#endif
+	return w;
+}
+
+LIBFS_PUBLIC(int)
+fs_writer_flush(fs_file_writer *w)
+{
+	if (w->failed)
+	{
+		return LIBFS_FALSE;
+	}
+
+	if (w->used && !fs_file_writer_output(w, w->buf, w->used))
+	{
+		return LIBFS_FALSE;
+	}
+
+	w->used = 0;
+	return LIBFS_TRUE;
+}
+
+LIBFS_PUBLIC(int)
+fs_writer_append(fs_file_writer *w, const void *data, size_t size)
+{
+	size_t n;
+	if (w->failed)
+	{
+		return LIBFS_FALSE;
+	}
+
+	/* Fill the buffer first so writes to the file stay aligned on its size */
+	if (w->used)
+	{
+		n = w->capacity - w->used < size ? w->capacity - w->used : size;
+		memcpy(w->buf + w->used, data, n);
+		w->used += n;
+		data = (const char *)data + n;
+		size -= n;
+		if (w->used == w->capacity && !fs_writer_flush(w))
+		{
+			return LIBFS_FALSE;
+		}
+	}
+
+	if (size >= w->capacity)
+	{
+		n = size - size % w->capacity;
+		if (!fs_file_writer_output(w, data, n))
+		{
+			return LIBFS_FALSE;
+		}
+
+		data = (const char *)data + n;
+		size -= n;
+	}
+
+	memcpy(w->buf + w->used, data, size);
+	w->used += size;
+	return LIBFS_TRUE;
+}
+
+LIBFS_PUBLIC(int)
+fs_close_file_writer(fs_file_writer *w)
+{
+	int result = fs_writer_flush(w);
+#ifdef LIBFS_HAVE_FD
+	/* Blocks reserved past the end stay allocated until the file is truncated, even to its size */
+	if (result && w->preallocated)
+	{
+		result = ftruncate(w->fd, w->written) == 0;
+	}
+
+	result = (close(w->fd) == 0) && result;
+#else
+	result = (fclose(w->file) == 0) && result;
+#endif
+	_LIBFS_FREE(w);
+	return result;
+}
+#endif
+
+#ifdef HAVE_STRING_H
+LIBFS_PUBLIC(size_t)
+fs_join_path(char *buf, size_t size, const char *left, const char *right)
+{
+	size_t length = fs_put(buf, size, 0, left, strlen(left));
+	length = fs_put(buf, size, length, "/", 1);
+	length = fs_put(buf, size, length, right, strlen(right));
+	fs_put_end(buf, size, length);
+	return length;
+}
+
+/* Initial size of growable paths */
+#define LIBFS_PATH_SIZE 256
+
+/* Data of empty growable paths, never written */
+static char fs_path_empty[1];
+
+/* Makes room for size bytes, keeping the path */
+static int fs_path_reserve(struct fs_path *path, size_t size)
+{
+	char *grown;
+	size_t capacity;
+	if (size <= path->capacity)
+	{
+		return LIBFS_TRUE;
+	}
+
+	if (!path->growable)
+	{
+		return LIBFS_FALSE;
+	}
+
+	capacity = path->capacity ? path->capacity : LIBFS_PATH_SIZE;
+	while (capacity < size)
+	{
+		capacity *= 2;
+	}
+
+	grown = (char *)_LIBFS_MALLOC(capacity);
+	if (!grown)
+	{
+		return LIBFS_FALSE;
+	}
+
+	memcpy(grown, path->data, path->length + 1);
+	if (path->capacity)
+	{
+		_LIBFS_FREE(path->data);
+	}
+
+	path->data = grown;
+	path->capacity = capacity;
+	return LIBFS_TRUE;
+}
+
+LIBFS_PUBLIC(void)
+fs_path_init(struct fs_path *path, char *buf, size_t size)
+{
+	path->length = 0;
+	path->growable = !buf;
+	if (buf && size)
+	{
+		path->data = buf;
+		path->capacity = size;
+		buf[0] = '\0';
+	}
+	else
+	{
+		path->data = fs_path_empty;
+		path->capacity = 0;
+	}
+}
+
+LIBFS_PUBLIC(void)
+fs_path_free(struct fs_path *path)
+{
+	if (path->growable && path->capacity)
+	{
+		_LIBFS_FREE(path->data);
+		fs_path_init(path, NULL, 0);
+		return;
+	}
+
+	fs_path_truncate(path, 0);
+}
+
+LIBFS_PUBLIC(int)
+fs_path_set(struct fs_path *path, const char *value)
+{
+	size_t length = strlen(value);
+	if (!fs_path_reserve(path, length + 1))
+	{
+		return LIBFS_FALSE;
+	}
+
+	memmove(path->data, value, length + 1);
+	path->length = length;
+	return LIBFS_TRUE;
+}
+
+LIBFS_PUBLIC(int)
+fs_path_push(struct fs_path *path, const char *component)
+{
+	size_t length = strlen(component);
+	size_t separator = path->length && !fs_is_separator(path->data[path->length - 1]);
+	if (!fs_path_reserve(path, path->length + separator + length + 1))
+	{
+		return LIBFS_FALSE;
+	}
+
+	if (separator)
+	{
+		path->data[path->length++] = '/';
+	}
+
+	memcpy(path->data + path->length, component, length + 1);
+	path->length += length;
+	return LIBFS_TRUE;
+}
+
+LIBFS_PUBLIC(int)
+fs_path_pop(struct fs_path *path)
+{
+	size_t length = path->length;
+	while (length && !fs_is_separator(path->data[length - 1]))
+	{
+		--length;
+	}
+
+	/* Remove the separator too, except the root one */
+	if (length > 1)
+	{
+		--length;
+	}
+
+	if (length == path->length)
+	{
+		return LIBFS_FALSE;
+	}
+
+	fs_path_truncate(path, length);
+	return LIBFS_TRUE;
+}
+
+LIBFS_PUBLIC(int)
+fs_path_set_extension(struct fs_path *path, const char *extension)
+{
+	size_t length = strlen(extension);
+	size_t name = path->length;
+	size_t dot;
+	while (name && !fs_is_separator(path->data[name - 1]))
+	{
+		--name;
+	}
+
+	if (name == path->length)
+	{
+		return LIBFS_FALSE;
+	}
+
+	/* A dot starting the name isn't an extension */
+	for (dot = path->length; dot > name + 1 && path->data[dot - 1] != '.'; --dot)
+	{
+	}
+
+	dot = dot > name + 1 ? dot - 1 : path->length;
+	if (!fs_path_reserve(path, dot + length + 1))
+	{
+		return LIBFS_FALSE;
+	}
+
+	memcpy(path->data + dot, extension, length + 1);
+	path->length = dot + length;
+	return LIBFS_TRUE;
+}
+
+LIBFS_PUBLIC(void)
+fs_path_truncate(struct fs_path *path, size_t length)
+{
+	if (length < path->length)
+	{
+		path->length = length;
+		path->data[length] = '\0';
+	}
+}
+#endif
+
+#ifdef HAVE_STRING_H
+/* Length of the root of path: a separator, preceded by a drive on Windows */
+static size_t fs_root_length(const char *path)
+{
+	size_t length = 0;
+#if HAVE_WINDOWS_H
+	if (((path[0] >= 'a' && path[0] <= 'z') || (path[0] >= 'A' && path[0] <= 'Z')) && path[1] == ':')
+	{
+		length = 2;
+	}
+#endif
+	return fs_is_separator(path[length]) ? length + 1 : length;
+}
+
+/* Appends a component to the normalized path of length n, whose root is base bytes long */
+static int fs_normalize_append(char *buf, size_t size, size_t *n, size_t base, const char *component, size_t length)
+{
+	size_t separator = *n > base;
+	if (*n + separator + length >= size)
+	{
+		return LIBFS_FALSE;
+	}
+
+	if (separator)
+	{
+		buf[(*n)++] = '/';
+	}
+
+	/* Components are never written after where they are read from */
+	memmove(buf + *n, component, length);
+	*n += length;
+	return LIBFS_TRUE;
+}
+
+/* Normalizes path after the already normalized path of length n in buf */
+static char *fs_normalize_at(const char *path, char *buf, size_t size, size_t n, size_t base)
+{
+	size_t fixed = base;
+	size_t length;
+	int absolute = base && fs_is_separator(buf[base - 1]);
+	while (*path)
+	{
+		for (length = 0; path[length] && !fs_is_separator(path[length]); ++length)
+		{
+		}
+
+		if (length == 2 && path[0] == '.' && path[1] == '.')
+		{
+			if (n > fixed)
+			{
+				while (n > fixed && buf[n - 1] != '/')
+				{
+					--n;
+				}
+
+				if (n > fixed)
+				{
+					--n;
+				}
+			}
+			else if (!absolute)
+			{
+				/* Leading .. of relative paths can't be removed */
+				if (!fs_normalize_append(buf, size, &n, base, path, length))
+				{
+					return NULL;
+				}
+
+				fixed = n;
+			}
+		}
+		else if (length && !(length == 1 && path[0] == '.'))
+		{
+			if (!fs_normalize_append(buf, size, &n, base, path, length))
+			{
+				return NULL;
+			}
+		}
+
+		path += length;
+		if (*path)
+		{
+			++path;
+		}
+	}
+
+	if (!n)
+	{
+		if (size < 2)
+		{
+			return NULL;
+		}
+
+		buf[n++] = '.';
+	}
+
+	buf[n] = '\0';
+	return buf;
+}
+
+LIBFS_PUBLIC(char *)
+fs_normalize(const char *path, char *buf, size_t size)
+{
+	size_t root = fs_root_length(path);
+	if (root >= size)
+	{
+		return NULL;
+	}
+
+	memmove(buf, path, root);
+	if (root && fs_is_separator(buf[root - 1]))
+	{
+		buf[root - 1] = '/';
+	}
+
+	return fs_normalize_at(path + root, buf, size, root, root);
+}
+#endif
+
+#if defined(HAVE_STRING_H) && (defined(HAVE_WINDOWS_H) || defined(HAVE_UNISTD_H))
+/* Largest current directory cached for fs_absolute_lexical */
+#define LIBFS_CWD_MAX_SIZE (64 * 1024)
+
+/* Normalized current directory, read on first use */
+static struct fs_path fs_cwd = {fs_path_empty, 0, 0, LIBFS_TRUE};
+static size_t fs_cwd_root;
+static int fs_cwd_cached;
+#ifdef HAVE_PTHREAD_H
+static pthread_mutex_t fs_cwd_lock = PTHREAD_MUTEX_INITIALIZER;
+#define fs_cwd_lock() pthread_mutex_lock(&fs_cwd_lock)
+#define fs_cwd_unlock() pthread_mutex_unlock(&fs_cwd_lock)
+#else
+#define fs_cwd_lock()
+#define fs_cwd_unlock()
+#endif
+
+/* Reads the current directory into fs_cwd, called with fs_cwd_lock held */
+static int fs_cwd_cache(void)
+{
+	if (!fs_path_reserve(&fs_cwd, LIBFS_PATH_SIZE))
+	{
+		return LIBFS_FALSE;
+	}
+
+	while (!fs_current_dir(fs_cwd.data, fs_cwd.capacity))
+	{
+		if (fs_cwd.capacity >= LIBFS_CWD_MAX_SIZE || !fs_path_reserve(&fs_cwd, fs_cwd.capacity * 2))
+		{
+			return LIBFS_FALSE;
+		}
+	}
+
+	fs_normalize(fs_cwd.data, fs_cwd.data, fs_cwd.capacity);
+	fs_cwd.length = strlen(fs_cwd.data);
+	fs_cwd_root = fs_root_length(fs_cwd.data);
+	fs_cwd_cached = LIBFS_TRUE;
+	return LIBFS_TRUE;
+}
+
+LIBFS_PUBLIC(char *)
+fs_absolute_lexical(const char *path, char *buf, size_t size)
+{
+	size_t length;
+	size_t root;
+	if (fs_root_length(path))
+	{
+		return fs_normalize(path, buf, size);
+	}
+
+	fs_cwd_lock();
+	if ((!fs_cwd_cached && !fs_cwd_cache()) || fs_cwd.length >= size)
+	{
+		fs_cwd_unlock();
+		return NULL;
+	}
+
+	memcpy(buf, fs_cwd.data, fs_cwd.length);
+	length = fs_cwd.length;
+	root = fs_cwd_root;
+	fs_cwd_unlock();
+	return fs_normalize_at(path, buf, size, length, root);
+}
+
+LIBFS_PUBLIC(void)
+fs_invalidate_current_dir(void)
+{
+	fs_cwd_lock();
+	fs_cwd_cached = LIBFS_FALSE;
+	fs_cwd_unlock();
+}
+#endif
+
+#if defined(HAVE_WINDOWS_H)
+LIBFS_PUBLIC(char *)
+fs_temp_dir(char *buf, size_t size)
+{
+	if (!GetTempPath((DWORD)size, buf))
+	{
+		return NULL;
+	}
+
+	return buf;
+}
+
+LIBFS_PUBLIC(int)
+fs_delete_dir(const char *path)
+{
+	if (RemoveDirectory(path) == 0)
+	{
+		return ERROR_FILE_NOT_FOUND == GetLastError();
+	}
+
+	return LIBFS_TRUE;
+}
+
+LIBFS_PUBLIC(int)
+fs_delete_file(const char *path)
+{
+	if (DeleteFile(path) == 0)
+	{
+		return ERROR_FILE_NOT_FOUND == GetLastError();
+	}
+
+	return LIBFS_TRUE;
+}
+
+LIBFS_PUBLIC(int)
+fs_make_dir(const char *path)
+{
+	if (CreateDirectory(path, NULL) == 0)
+	{
+		return ERROR_ALREADY_EXISTS == GetLastError();
+	}
+
+	return LIBFS_TRUE;
+}
+#else /* !HAVE_WINDOWS_H */
+#if defined(HAVE_STDLIB_H)
+LIBFS_PUBLIC(char *)
+fs_temp_dir(char *buf, size_t size)
+{
+	const char *path = getenv("TMPDIR");
+	if (!path)
+	{
+		return NULL;
+	}
+
+	snprintf(buf, size, "%s", path);
+	return buf;
+}
+#endif
+
+#ifdef HAVE_UNISTD_H
+LIBFS_PUBLIC(int)
+fs_delete_dir(const char *path)
+{
+	return (rmdir(path) == 0) || (ENOENT == errno);
+}
+#endif
+
+#ifdef HAVE_STDIO_H
+LIBFS_PUBLIC(int)
+fs_delete_file(const char *path)
+{
+	return (remove(path) == 0) || (ENOENT == errno);
+}
+#endif
+
+#ifdef HAVE_SYS_STAT_H
+LIBFS_PUBLIC(int)
+fs_make_dir(const char *path)
+{
+	return (mkdir(path, LIBFS_MKDIR_PERMISSIONS) == 0) || (EEXIST == errno);
+}
+#endif
+#endif /* HAVE_WINDOWS_H */
+
+#if defined(HAVE_WINDOWS_H)
+typedef struct fs_win_directory_iterator
+{
+	fs_directory_iterator base;
+	WIN32_FIND_DATA fdFile;
+	HANDLE hFind;
+	size_t started;
+	TCHAR szPath[MAX_PATH];
+	fs_context ctx;
+	/* If the iterator is in a fs_dir_storage instead of allocated */
+	int embedded;
+} fs_win_directory_iterator;
+
+/* Fails to compile if the iterator doesn't fit in a fs_dir_storage */
+typedef char fs_dir_storage_fits[sizeof(fs_win_directory_iterator) <= LIBFS_DIR_STORAGE_SIZE ? 1 : -1];
+
+/* Starts searching the entries of path, returns false on error */
+static int fs_win_find_first(fs_win_directory_iterator *it, const char *path)
+{
+	TCHAR szDir[MAX_PATH];
+	StringCchCopy(szDir, MAX_PATH, path);
+	StringCchCat(szDir, MAX_PATH, TEXT("\\*"));
+	if (path != it->szPath)
+	{
+		StringCchCopy(it->szPath, MAX_PATH, path);
+	}
+
+	it->started = LIBFS_FALSE;
+	it->hFind = FindFirstFile(szDir, &it->fdFile);
+	return it->hFind != INVALID_HANDLE_VALUE;
+}
+
+static void fs_win_find_close(fs_win_directory_iterator *it)
+{
+	if (it->hFind != INVALID_HANDLE_VALUE)
+	{
+		FindClose(it->hFind);
+		it->hFind = INVALID_HANDLE_VALUE;
+	}
+}
+
+static fs_directory_iterator *fs_open_dir_internal(const fs_context *ctx, struct fs_dir_storage *storage, const char *path)
+{
+	fs_win_directory_iterator *it = (fs_win_directory_iterator *)storage;
+	if (!it)
+	{
+		it = (fs_win_directory_iterator *)fs_ctx_malloc(ctx, sizeof(fs_win_directory_iterator));
+	}
+
+	if (!it)
+	{
+		return NULL;
+	}
+
+	memset(it, 0, sizeof(fs_win_directory_iterator));
+	it->ctx = *ctx;
+	it->embedded = storage != NULL;
+	if (!fs_win_find_first(it, path))
+	{
+		if (!it->embedded)
+		{
+			fs_ctx_free(ctx, it);
+		}
+
+		return NULL;
+	}
+
+	return (fs_directory_iterator *)it;
+}
+
+LIBFS_PUBLIC(fs_directory_iterator *)
+fs_open_dir_ctx(const fs_context *ctx, const char *path)
+{
+	return fs_open_dir_internal(fs_context_or_hooks(ctx), NULL, path);
+}
+
+LIBFS_PUBLIC(fs_directory_iterator *)
+fs_open_dir(const char *path)
+{
+	return fs_open_dir_ctx(NULL, path);
+}
+
+LIBFS_PUBLIC(fs_directory_iterator *)
+fs_open_dir_in(struct fs_dir_storage *storage, const char *path)
+{
+	return fs_open_dir_internal(&fs_hooks_context, storage, path);
+}
+
+LIBFS_PUBLIC(fs_directory_iterator *)
+fs_reopen_dir(fs_directory_iterator *it, const char *path)
+{
+	fs_win_directory_iterator *_it = (fs_win_directory_iterator *)it;
+	fs_win_find_close(_it);
+	return path && fs_win_find_first(_it, path) ? it : NULL;
+}
+
+LIBFS_PUBLIC(void)
+fs_rewind_dir(fs_directory_iterator *it)
+{
+	fs_win_directory_iterator *_it = (fs_win_directory_iterator *)it;
+	if (_it->hFind != INVALID_HANDLE_VALUE)
+	{
+		fs_win_find_close(_it);
+		fs_win_find_first(_it, _it->szPath);
+	}
+}
+
+LIBFS_PUBLIC(fs_directory_iterator *)
+fs_read_dir(fs_directory_iterator *it)
+{
+	fs_win_directory_iterator *_it = (fs_win_directory_iterator *)it;
+	if (_it->hFind == INVALID_HANDLE_VALUE)
+	{
+		return NULL;
+	}
+
+	if (!_it->started)
+	{
+		_it->started = LIBFS_TRUE;
+	}
+	else if (!FindNextFile(_it->hFind, &_it->fdFile))
+	{
+		return NULL;
+	}
+
+	_it->base.path = _it->fdFile.cFileName;
+	if (_it->fdFile.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)
+	{
+		_it->base.type = LIBFS_TYPE_SYMLINK;
+	}
+	else if (_it->fdFile.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+	{
+		_it->base.type = LIBFS_TYPE_DIRECTORY;
+	}
+	else
+	{
+		_it->base.type = LIBFS_TYPE_FILE;
+	}
+
+	return it;
+}
+
+LIBFS_PUBLIC(enum fs_file_type)
+fs_dir_entry_type(fs_directory_iterator *it)
+{
+	return it->type;
+}
+
+LIBFS_PUBLIC(void)
+fs_close_dir(fs_directory_iterator *it)
+{
+	fs_win_directory_iterator *_it = (fs_win_directory_iterator *)it;
+	fs_win_find_close(_it);
+	if (!_it->embedded)
+	{
+		fs_ctx_free(&_it->ctx, _it);
+	}
+}
+#elif defined(HAVE_DIRENT_H)
+#ifdef DT_UNKNOWN
+static enum fs_file_type fs_file_type_from_dirent(unsigned char type)
+{
+	switch (type)
+	{
+	case DT_UNKNOWN:
+		return LIBFS_TYPE_UNKNOWN;
+	case DT_REG:
+		return LIBFS_TYPE_FILE;
+	case DT_DIR:
+		return LIBFS_TYPE_DIRECTORY;
+	case DT_LNK:
+		return LIBFS_TYPE_SYMLINK;
+	default:
+		return LIBFS_TYPE_OTHER;
+	}
+}
+#endif
+
+#if defined(HAVE_SYS_SYSCALL_H) && defined(SYS_getdents64) && defined(DT_UNKNOWN) && defined(LIBFS_HAVE_FD)
+/* Directories are read with getdents64 into the buffer of the iterator */
+#define LIBFS_HAVE_GETDENTS64 1
+#endif
+
+#ifdef LIBFS_HAVE_GETDENTS64
+/* Size of the buffer of iterators not opened in a fs_dir_storage */
+#define LIBFS_DIR_BUFFER_SIZE (32 * 1024)
+
+typedef int fs_dir_stream;
+#define fs_dir_stream_open(path) open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)
+#define fs_dir_stream_is_open(d) ((d) >= 0)
+#define fs_dir_stream_close(d) close(d)
+#define fs_dir_stream_fd(d) (d)
+#define LIBFS_DIR_STREAM_CLOSED (-1)
+#else
+typedef DIR *fs_dir_stream;
+#define fs_dir_stream_open(path) opendir(path)
+#define fs_dir_stream_is_open(d) ((d) != NULL)
+#define fs_dir_stream_close(d) closedir(d)
+#define fs_dir_stream_fd(d) dirfd(d)
+#define LIBFS_DIR_STREAM_CLOSED NULL
+#endif
+
+typedef struct fs_posix_directory_iterator
+{
+	fs_directory_iterator base;
+	fs_dir_stream dir;
+#ifdef LIBFS_HAVE_GETDENTS64
+	/* Records of the buffer not returned by fs_read_dir yet */
+	size_t offset;
+	size_t size;
+	size_t capacity;
+	/* Records of the last getdents64 call of fs_read_dir_batch not returned yet */
+	size_t batch_offset;
+	size_t batch_size;
+	/* Offset of the entry after the last one returned */
+	off_t position;
+#endif
+	fs_context ctx;
+	/* If the iterator is in a fs_dir_storage instead of allocated */
+	int embedded;
+} fs_posix_directory_iterator;
+
+/* Fails to compile if the iterator doesn't fit in a fs_dir_storage */
+typedef char fs_dir_storage_fits[sizeof(fs_posix_directory_iterator) < LIBFS_DIR_STORAGE_SIZE ? 1 : -1];
+
+/* The buffer of entries follows the iterator */
+#define fs_posix_directory_iterator_buf(it) ((char *)((it) + 1))
+
+/* Forgets the entries of the previous directory */
+static void fs_posix_directory_iterator_reset(fs_posix_directory_iterator *it)
+{
+#ifdef LIBFS_HAVE_GETDENTS64
+	it->offset = 0;
+	it->size = 0;
+	it->batch_offset = 0;
+	it->batch_size = 0;
+	it->position = 0;
+#else
+	LIBFS_UNUSED(it);
+#endif
+}
+
+static fs_directory_iterator *fs_open_dir_internal(const fs_context *ctx, struct fs_dir_storage *storage, fs_dir_stream d)
+{
+	fs_posix_directory_iterator *it;
+#ifdef LIBFS_HAVE_GETDENTS64
+	size_t capacity = storage ? LIBFS_DIR_STORAGE_SIZE - sizeof(fs_posix_directory_iterator) : LIBFS_DIR_BUFFER_SIZE;
+#endif
+	if (!fs_dir_stream_is_open(d))
+	{
+		return NULL;
+	}
+
+	if (storage)
+	{
+		it = (fs_posix_directory_iterator *)storage;
+	}
+	else
+	{
+#ifdef LIBFS_HAVE_GETDENTS64
+		it = (fs_posix_directory_iterator *)fs_ctx_malloc(ctx, sizeof(fs_posix_directory_iterator) + capacity);
+#else
+		it = (fs_posix_directory_iterator *)fs_ctx_malloc(ctx, sizeof(fs_posix_directory_iterator));
+#endif
+		if (!it)
+		{
+			fs_dir_stream_close(d);
+			return NULL;
+		}
+	}
+
+	memset(it, 0, sizeof(fs_posix_directory_iterator));
+	it->dir = d;
+#ifdef LIBFS_HAVE_GETDENTS64
+	it->capacity = capacity;
+#endif
+	it->ctx = *ctx;
+	it->embedded = storage != NULL;
+	return (fs_directory_iterator *)it;
+}
+
+LIBFS_PUBLIC(fs_directory_iterator *)
+fs_open_dir_ctx(const fs_context *ctx, const char *path)
+{
+	return fs_open_dir_internal(fs_context_or_hooks(ctx), NULL, fs_dir_stream_open(path));
+}
+
+LIBFS_PUBLIC(fs_directory_iterator *)
+fs_open_dir(const char *path)
+{
+	return fs_open_dir_ctx(NULL, path);
+}
+
+LIBFS_PUBLIC(fs_directory_iterator *)
+fs_open_dir_in(struct fs_dir_storage *storage, const char *path)
+{
+	return fs_open_dir_internal(&fs_hooks_context, storage, fs_dir_stream_open(path));
+}
+
+LIBFS_PUBLIC(fs_directory_iterator *)
+fs_reopen_dir(fs_directory_iterator *it, const char *path)
+{
+	fs_posix_directory_iterator *_it = (fs_posix_directory_iterator *)it;
+	if (fs_dir_stream_is_open(_it->dir))
+	{
+		fs_dir_stream_close(_it->dir);
+	}
+
+	fs_posix_directory_iterator_reset(_it);
+	_it->dir = path ? fs_dir_stream_open(path) : LIBFS_DIR_STREAM_CLOSED;
+	return fs_dir_stream_is_open(_it->dir) ? it : NULL;
+}
+
+LIBFS_PUBLIC(void)
+fs_rewind_dir(fs_directory_iterator *it)
+{
+	fs_posix_directory_iterator *_it = (fs_posix_directory_iterator *)it;
+	fs_posix_directory_iterator_reset(_it);
+	if (fs_dir_stream_is_open(_it->dir))
+	{
+#ifdef LIBFS_HAVE_GETDENTS64
+		lseek(_it->dir, 0, SEEK_SET);
+#else
+		rewinddir(_it->dir);
+#endif
+	}
+}
+
+#ifdef LIBFS_HAVE_GETDENTS64
+LIBFS_PUBLIC(fs_directory_iterator *)
+fs_read_dir(fs_directory_iterator *it)
+{
+	fs_posix_directory_iterator *_it = (fs_posix_directory_iterator *)it;
+	struct dirent64 *ent;
+	long n;
+
+	if (_it->offset >= _it->size)
+	{
+		if (!fs_dir_stream_is_open(_it->dir))
+		{
+			return NULL;
+		}
+
+		do
+		{
+			n = syscall(SYS_getdents64, _it->dir, fs_posix_directory_iterator_buf(_it), _it->capacity);
+		} while (n < 0 && errno == EINTR);
+
+		if (n <= 0)
+		{
+			return NULL;
+		}
+
+		_it->offset = 0;
+		_it->size = (size_t)n;
+	}
+
+	ent = (struct dirent64 *)(fs_posix_directory_iterator_buf(_it) + _it->offset);
+	_it->offset += ent->d_reclen;
+	_it->position = (off_t)ent->d_off;
+	_it->base.path = ent->d_name;
+	_it->base.inode = (ino_t)ent->d_ino;
+	_it->base.type = fs_file_type_from_dirent(ent->d_type);
+	return it;
+}
+#else
+LIBFS_PUBLIC(fs_directory_iterator *)
+fs_read_dir(fs_directory_iterator *it)
+{
+	fs_posix_directory_iterator *_it = (fs_posix_directory_iterator *)it;
+	struct dirent *ent;
+	if (!_it->dir || !(ent = readdir(_it->dir)))
+	{
+		return NULL;
+	}
+
+	_it->base.path = &ent->d_name[0];
+	_it->base.inode = ent->d_ino;
+#ifdef DT_UNKNOWN
+	_it->base.type = fs_file_type_from_dirent(ent->d_type);
+#else
+	_it->base.type = LIBFS_TYPE_UNKNOWN;
+#endif
+	return it;
+}
+#endif
+
+LIBFS_PUBLIC(enum fs_file_type)
+fs_dir_entry_type(fs_directory_iterator *it)
+{
+#ifdef AT_SYMLINK_NOFOLLOW
+	fs_posix_directory_iterator *_it = (fs_posix_directory_iterator *)it;
+	struct stat s;
+	if (it->type == LIBFS_TYPE_UNKNOWN && fstatat(fs_dir_stream_fd(_it->dir), it->path, &s, AT_SYMLINK_NOFOLLOW) == 0)
+	{
+		it->type = fs_file_type_from_mode(s.st_mode);
+	}
+#endif
+
+	return it->type;
+}
+
+#ifdef LIBFS_HAVE_GETDENTS64
+LIBFS_PUBLIC(size_t)
+fs_read_dir_batch(fs_directory_iterator *it, void *buf, size_t size, struct fs_dir_entry *entries, size_t count)
+{
+	fs_posix_directory_iterator *_it = (fs_posix_directory_iterator *)it;
+	struct dirent64 *ent;
+	long n;
+	size_t i = 0;
+
+	if (_it->batch_offset >= _it->batch_size)
+	{
+		if (!fs_dir_stream_is_open(_it->dir))
+		{
+			return 0;
+		}
+
+		do
+		{
+			n = syscall(SYS_getdents64, _it->dir, buf, size);
+		} while (n < 0 && errno == EINTR);
+
+		/* EINVAL when buf is too small for the next entry */
+		if (n < 0)
+		{
+			return (size_t)-1;
+		}
+
+		if (n == 0)
+		{
+			return 0;
+		}
+
+		_it->batch_offset = 0;
+		_it->batch_size = (size_t)n;
+	}
+
+	/* Entries are views over the records of buf */
+	while (i < count && _it->batch_offset < _it->batch_size)
+	{
+		ent = (struct dirent64 *)((char *)buf + _it->batch_offset);
+		entries[i].name = ent->d_name;
+		entries[i].name_length = strlen(ent->d_name);
+		entries[i].type = fs_file_type_from_dirent(ent->d_type);
+		entries[i].inode = (ino_t)ent->d_ino;
+		_it->batch_offset += ent->d_reclen;
+		_it->position = (off_t)ent->d_off;
+		++i;
+	}
+
+	return i;
+}
+
+/* Iterators can be resumed at the offset of an entry after being reopened */
+#define LIBFS_HAVE_DIR_SEEK 1
+
+/* Gets where to resume after the last entry returned */
+#define fs_dir_tell(it) (((fs_posix_directory_iterator *)(it))->position)
+
+/* Resumes at an offset from fs_dir_tell, from another open of the same directory */
+static int fs_dir_seek(fs_directory_iterator *it, off_t position)
+{
+	fs_posix_directory_iterator *_it = (fs_posix_directory_iterator *)it;
+	fs_posix_directory_iterator_reset(_it);
+	_it->position = position;
+	return lseek(_it->dir, position, SEEK_SET) != (off_t)-1;
+}
+#endif
+
+LIBFS_PUBLIC(void)
+fs_close_dir(fs_directory_iterator *it)
+{
+	fs_posix_directory_iterator *_it = (fs_posix_directory_iterator *)it;
+	if (fs_dir_stream_is_open(_it->dir))
+	{
+		fs_dir_stream_close(_it->dir);
+	}
+
+	if (!_it->embedded)
+	{
+		fs_ctx_free(&_it->ctx, _it);
+	}
+}
+#endif
+
+#if !defined(LIBFS_HAVE_GETDENTS64) && defined(HAVE_STRING_H)
+/* Longest entry name that fs_read_dir can return */
+#define LIBFS_DIR_NAME_MAX 260
+
+LIBFS_PUBLIC(size_t)
+fs_read_dir_batch(fs_directory_iterator *it, void *buf, size_t size, struct fs_dir_entry *entries, size_t count)
+{
+	size_t used = 0;
+	size_t i = 0;
+	char *name;
+
+	/* Same error as getdents64 when no name is sure to fit */
+	if (count && size <= LIBFS_DIR_NAME_MAX)
+	{
+		errno = EINVAL;
+		return (size_t)-1;
+	}
+
+	/* Stop while any name still fits as read entries can't be pushed back */
+	while (i < count && size - used > LIBFS_DIR_NAME_MAX && fs_read_dir(it))
+	{
+		name = (char *)buf + used;
+		entries[i].name_length = strlen(it->path);
+		memcpy(name, it->path, entries[i].name_length + 1);
+		entries[i].name = name;
+		entries[i].type = it->type;
+		entries[i].inode = it->inode;
+		used += entries[i].name_length + 1;
+		++i;
+	}
+
+	return i;
+}
+#endif
+
+#if !defined(HAVE_WINDOWS_H) && defined(HAVE_DIRENT_H) && defined(LIBFS_HAVE_FD) && defined(AT_FDCWD)
+#ifndef O_DIRECTORY
+#define O_DIRECTORY 0
+#endif
+
+/* Paths are resolved by the kernel relative to fd */
+struct fs_dir_handle
+{
+	int fd;
+};
+
+/* A NULL handle is the current directory */
+#define fs_dir_handle_fd(dir) ((dir) ? (dir)->fd : AT_FDCWD)
+
+static fs_dir_handle *fs_dir_handle_from_fd(int fd)
+{
+	fs_dir_handle *dir;
+	if (fd < 0)
+	{
+		return NULL;
+	}
+
+	dir = (fs_dir_handle *)_LIBFS_MALLOC(sizeof(fs_dir_handle));
+	if (!dir)
+	{
+		close(fd);
+		return NULL;
+	}
+
+	dir->fd = fd;
+	return dir;
+}
+
+LIBFS_PUBLIC(fs_dir_handle *)
+fs_open_dir_handle_at(fs_dir_handle *dir, const char *path)
+{
+	return fs_dir_handle_from_fd(openat(fs_dir_handle_fd(dir), path, O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+}
+
+LIBFS_PUBLIC(fs_dir_handle *)
+fs_open_dir_handle(const char *path)
+{
+	return fs_open_dir_handle_at(NULL, path);
+}
+
+LIBFS_PUBLIC(fs_dir_handle *)
+fs_dir_handle_from_iterator(fs_directory_iterator *it)
+{
+	fs_posix_directory_iterator *_it = (fs_posix_directory_iterator *)it;
+	if (!fs_dir_stream_is_open(_it->dir))
+	{
+		return NULL;
+	}
+
+#ifdef F_DUPFD_CLOEXEC
+	return fs_dir_handle_from_fd(fcntl(fs_dir_stream_fd(_it->dir), F_DUPFD_CLOEXEC, 0));
+#else
+	return fs_dir_handle_from_fd(dup(fs_dir_stream_fd(_it->dir)));
+#endif
+}
+
+LIBFS_PUBLIC(void)
+fs_close_dir_handle(fs_dir_handle *dir)
+{
+	if (dir)
+	{
+		close(dir->fd);
+		_LIBFS_FREE(dir);
+	}
+}
+
+LIBFS_PUBLIC(int)
+fs_exist_at(fs_dir_handle *dir, const char *path)
+{
+	struct stat s;
+	return fstatat(fs_dir_handle_fd(dir), path, &s, 0) == 0;
+}
+
+LIBFS_PUBLIC(int)
+fs_is_directory_at(fs_dir_handle *dir, const char *path)
+{
+	struct stat s;
+	return (fstatat(fs_dir_handle_fd(dir), path, &s, 0) == 0) && S_ISDIR(s.st_mode);
+}
+
+LIBFS_PUBLIC(int)
+fs_is_file_at(fs_dir_handle *dir, const char *path)
+{
+	struct stat s;
+	return (fstatat(fs_dir_handle_fd(dir), path, &s, 0) == 0) && S_ISREG(s.st_mode);
+}
+
+LIBFS_PUBLIC(void *)
+fs_read_file_at(fs_dir_handle *dir, const char *path, size_t *size)
+{
+	return fs_read_fd_internal(&fs_hooks_context, openat(fs_dir_handle_fd(dir), path, O_RDONLY | O_CLOEXEC), NULL, 0, size, 0);
+}
+
+LIBFS_PUBLIC(int)
+fs_write_file_at(fs_dir_handle *dir, const char *path, const void *buf, size_t size)
+{
+	int result;
+	int fd = openat(fs_dir_handle_fd(dir), path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	if (fd < 0)
+	{
+		return LIBFS_FALSE;
+	}
+
+	result = fs_write_all(fd, buf, size);
+	return (close(fd) == 0) && result;
+}
+
+LIBFS_PUBLIC(int)
+fs_make_dir_at(fs_dir_handle *dir, const char *path)
+{
+	return (mkdirat(fs_dir_handle_fd(dir), path, LIBFS_MKDIR_PERMISSIONS) == 0) || (EEXIST == errno);
+}
+
+LIBFS_PUBLIC(int)
+fs_delete_file_at(fs_dir_handle *dir, const char *path)
+{
+	return (unlinkat(fs_dir_handle_fd(dir), path, 0) == 0) || (ENOENT == errno);
+}
+
+LIBFS_PUBLIC(int)
+fs_delete_dir_at(fs_dir_handle *dir, const char *path)
+{
+	return (unlinkat(fs_dir_handle_fd(dir), path, AT_REMOVEDIR) == 0) || (ENOENT == errno);
+}
+
+LIBFS_PUBLIC(fs_directory_iterator *)
+fs_open_dir_at(fs_dir_handle *dir, const char *path)
+{
+	fs_dir_stream d;
+	int fd = openat(fs_dir_handle_fd(dir), path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0)
+	{
+		return NULL;
+	}
+
+#ifdef LIBFS_HAVE_GETDENTS64
+	d = fd;
+#else
+	if (!(d = fdopendir(fd)))
+	{
+		close(fd);
+		return NULL;
+	}
+#endif
+
+	return fs_open_dir_internal(&fs_hooks_context, NULL, d);
+}
+#elif defined(HAVE_STDIO_H) && defined(HAVE_STRING_H)
+/* Without openat, handles remember the directory path */
+struct fs_dir_handle
+{
+	char path[1];
+};
+
+/* Allocates the path of path relative to dir, a NULL handle is the current directory */
+static char *fs_dir_handle_join(fs_dir_handle *dir, const char *path)
+{
+	size_t size = (dir ? strlen(dir->path) + 1 : 0) + strlen(path) + 1;
+	char *buf = (char *)_LIBFS_MALLOC(size);
+	if (!buf)
+	{
+		return NULL;
+	}
+
+	if (dir)
+	{
+		fs_join_path(buf, size, dir->path, path);
+	}
+	else
+	{
+		memcpy(buf, path, size);
+	}
+
+	return buf;
+}
+
+static fs_dir_handle *fs_dir_handle_from_path(const char *path)
+{
+	size_t size = strlen(path) + 1;
+	fs_dir_handle *dir;
+	if (!fs_is_directory(path))
+	{
+		return NULL;
+	}
+
+	dir = (fs_dir_handle *)_LIBFS_MALLOC(sizeof(fs_dir_handle) + size);
+	if (dir)
+	{
+		memcpy(dir->path, path, size);
+	}
+
+	return dir;
+}
+
+LIBFS_PUBLIC(fs_dir_handle *)
+fs_open_dir_handle(const char *path)
+{
+	return fs_dir_handle_from_path(path);
+}
+
+LIBFS_PUBLIC(fs_dir_handle *)
+fs_open_dir_handle_at(fs_dir_handle *dir, const char *path)
+{
+	fs_dir_handle *result;
+	char *buf = fs_dir_handle_join(dir, path);
+	if (!buf)
+	{
+		return NULL;
+	}
+
+	result = fs_dir_handle_from_path(buf);
+	_LIBFS_FREE(buf);
+	return result;
+}
+
+LIBFS_PUBLIC(fs_dir_handle *)
+fs_dir_handle_from_iterator(fs_directory_iterator *it)
+{
+#ifdef HAVE_WINDOWS_H
+	return fs_dir_handle_from_path(((fs_win_directory_iterator *)it)->szPath);
+#else
+	LIBFS_UNUSED(it);
+	return NULL;
+#endif
+}
+
+LIBFS_PUBLIC(void)
+fs_close_dir_handle(fs_dir_handle *dir)
+{
+	_LIBFS_FREE(dir);
+}
+
+LIBFS_PUBLIC(int)
+fs_exist_at(fs_dir_handle *dir, const char *path)
+{
+	int result;
+	char *buf = fs_dir_handle_join(dir, path);
+	if (!buf)
+	{
+		return LIBFS_FALSE;
+	}
+
+	result = fs_exist(buf);
+	_LIBFS_FREE(buf);
+	return result;
+}
+
+LIBFS_PUBLIC(int)
+fs_is_directory_at(fs_dir_handle *dir, const char *path)
+{
+	int result;
+	char *buf = fs_dir_handle_join(dir, path);
+	if (!buf)
+	{
+		return LIBFS_FALSE;
+	}
+
+	result = fs_is_directory(buf);
+	_LIBFS_FREE(buf);
+	return result;
+}
+
+LIBFS_PUBLIC(int)
+fs_is_file_at(fs_dir_handle *dir, const char *path)
+{
+	int result;
+	char *buf = fs_dir_handle_join(dir, path);
+	if (!buf)
+	{
+		return LIBFS_FALSE;
+	}
+
+	result = fs_is_file(buf);
+	_LIBFS_FREE(buf);
+	return result;
+}
+
+LIBFS_PUBLIC(void *)
+fs_read_file_at(fs_dir_handle *dir, const char *path, size_t *size)
+{
+	void *result;
+	char *buf = fs_dir_handle_join(dir, path);
+	if (!buf)
+	{
+		return NULL;
+	}
+
+	result = fs_read_file(buf, size);
+	_LIBFS_FREE(buf);
+	return result;
+}
+
+LIBFS_PUBLIC(int)
+fs_write_file_at(fs_dir_handle *dir, const char *path, const void *data, size_t size)
+{
+	int result;
+	char *buf = fs_dir_handle_join(dir, path);
+	if (!buf)
+	{
+		return LIBFS_FALSE;
+	}
+
+	result = fs_write_file(buf, data, size);
+	_LIBFS_FREE(buf);
+	return result;
+}
+
+LIBFS_PUBLIC(int)
+fs_make_dir_at(fs_dir_handle *dir, const char *path)
+{
+	int result;
+	char *buf = fs_dir_handle_join(dir, path);
+	if (!buf)
+	{
+		return LIBFS_FALSE;
+	}
+
+	result = fs_make_dir(buf);
+	_LIBFS_FREE(buf);
+	return result;
+}
+
+LIBFS_PUBLIC(int)
+fs_delete_file_at(fs_dir_handle *dir, const char *path)
+{
+	int result;
+	char *buf = fs_dir_handle_join(dir, path);
+	if (!buf)
+	{
+		return LIBFS_FALSE;
+	}
+
+	result = fs_delete_file(buf);
+	_LIBFS_FREE(buf);
+	return result;
+}
+
+LIBFS_PUBLIC(int)
+fs_delete_dir_at(fs_dir_handle *dir, const char *path)
+{
+	int result;
+	char *buf = fs_dir_handle_join(dir, path);
+	if (!buf)
+	{
+		return LIBFS_FALSE;
+	}
+
+	result = fs_delete_dir(buf);
+	_LIBFS_FREE(buf);
+	return result;
+}
+
+LIBFS_PUBLIC(fs_directory_iterator *)
+fs_open_dir_at(fs_dir_handle *dir, const char *path)
+{
+	fs_directory_iterator *result;
+	char *buf = fs_dir_handle_join(dir, path);
+	if (!buf)
+	{
+		return NULL;
+	}
+
+	result = fs_open_dir(buf);
+	_LIBFS_FREE(buf);
+	return result;
+}
+#endif
+
+#if defined(HAVE_SYS_STAT_H) && defined(HAVE_STRING_H)
+/* Number of pending file copies per worker before the walk blocks */
+#define LIBFS_COPY_TREE_QUEUE_SIZE 64
+
+/* First readlink buffer size for links not reporting the size of their target */
+#ifdef PATH_MAX
+#define LIBFS_COPY_TREE_LINK_SIZE PATH_MAX
+#else
+#define LIBFS_COPY_TREE_LINK_SIZE 4096
+#endif
+
+typedef struct fs_copy_tree_dir fs_copy_tree_dir;
+
+/* Directory whose attributes are restored once its content is copied */
+struct fs_copy_tree_dir
+{
+	fs_copy_tree_dir *next;
+	struct stat stat;
+	char path[1];
+};
+
+typedef struct fs_copy_tree_state
+{
+	const struct fs_copy_tree_options *options;
+	fs_thread_pool pool;
+	fs_copy_tree_dir *dirs;
+} fs_copy_tree_state;
+
+typedef struct fs_copy_tree_job
+{
+	fs_job base;
+	fs_copy_tree_state *state;
+	struct stat stat;
+	char *from;
+	char *to;
+} fs_copy_tree_job;
+
+static int fs_copy_attributes(const char *path, const struct stat *s, int flags)
+{
+	int result = LIBFS_TRUE;
+#ifdef HAVE_WINDOWS_H
+	LIBFS_UNUSED(path);
+	LIBFS_UNUSED(s);
+	LIBFS_UNUSED(flags);
+#else
+	if (flags & LIBFS_COPY_TREE_PRESERVE_MODE)
+	{
+		result = chmod(path, s->st_mode & 07777) == 0;
+	}
+#endif
+
+#ifdef HAVE_UTIMENSAT
+	if (flags & LIBFS_COPY_TREE_PRESERVE_TIMES)
+	{
+		struct timespec times[2];
+#ifdef LIBFS_HAVE_STAT_TIMESPEC
+		times[0] = fs_stat_atim(s);
+		times[1] = fs_stat_mtim(s);
+#else
+		times[0].tv_sec = s->st_atime;
+		times[0].tv_nsec = 0;
+		times[1].tv_sec = s->st_mtime;
+		times[1].tv_nsec = 0;
+#endif
+		result = (utimensat(AT_FDCWD, path, times, AT_SYMLINK_NOFOLLOW) == 0) && result;
+	}
+#endif
+
+	return result;
+}
+
+static int fs_copy_tree_file(fs_job *job)
+{
+	fs_copy_tree_job *_job = (fs_copy_tree_job *)job;
+	const struct fs_copy_tree_options *options = _job->state->options;
+	int result = fs_copy_file_ex(_job->from, _job->to, &options->copy, NULL) &&
+				 fs_copy_attributes(_job->to, &_job->stat, options->flags);
+	_LIBFS_FREE(_job);
+	return result;
+}
+
+#ifndef HAVE_WINDOWS_H
+/* Reads a link target, growing the buffer until it fits since some filesystems report a zero size */
+static char *fs_copy_tree_read_link(const char *path, size_t size)
+{
+	ssize_t n;
+	char *target;
+	size = size ? size + 1 : LIBFS_COPY_TREE_LINK_SIZE;
+	for (;;)
+	{
+		target = (char *)_LIBFS_MALLOC(size);
+		if (!target)
+		{
+			return NULL;
+		}
+
+		n = readlink(path, target, size);
+		if (n >= 0 && (size_t)n < size)
+		{
+			target[n] = '\0';
+			return target;
+		}
+
+		_LIBFS_FREE(target);
+		if (n < 0 || size > ((size_t)-1) / 2)
+		{
+			return NULL;
+		}
+
+		size *= 2;
+	}
+}
+#endif
+
+static int fs_copy_tree_link(const char *from, const char *to, const struct stat *s)
+{
+#ifndef HAVE_WINDOWS_H
+	char *target = fs_copy_tree_read_link(from, (size_t)s->st_size);
+	char *existing;
+	int result;
+	if (!target)
+	{
+		return LIBFS_FALSE;
+	}
+
+	result = symlink(target, to) == 0;
+	/* An existing destination is kept if it already links to the same target, and replaced otherwise */
+	if (!result && errno == EEXIST)
+	{
+		existing = fs_copy_tree_read_link(to, strlen(target));
+		result = existing && strcmp(existing, target) == 0;
+		if (existing)
+		{
+			_LIBFS_FREE(existing);
+		}
+
+		if (!result)
+		{
+			result = unlink(to) == 0 && symlink(target, to) == 0;
+		}
+	}
+
+	_LIBFS_FREE(target);
+	return result;
+#else
+	LIBFS_UNUSED(from);
+	LIBFS_UNUSED(to);
+	LIBFS_UNUSED(s);
+	return LIBFS_FALSE;
+#endif
+}
+
+static int fs_copy_tree_walk(fs_copy_tree_state *state, const char *from, const char *to, const struct stat *s);
+
+static int fs_copy_tree_entry(fs_copy_tree_state *state, const char *from, const char *to, const char *name, enum fs_file_type type)
+{
+	size_t from_size = strlen(from) + strlen(name) + 2;
+	size_t to_size = strlen(to) + strlen(name) + 2;
+	fs_copy_tree_job *job;
+	int result;
+
+	/* Paths are stored after the job so a single allocation is needed */
+	job = (fs_copy_tree_job *)_LIBFS_MALLOC(sizeof(fs_copy_tree_job) + from_size + to_size);
+	if (!job)
+	{
+		return LIBFS_FALSE;
+	}
+
+	job->base.fn = fs_copy_tree_file;
+	job->state = state;
+	job->from = (char *)(job + 1);
+	job->to = job->from + from_size;
+	fs_join_path(job->from, from_size, from, name);
+	fs_join_path(job->to, to_size, to, name);
+
+	/* Only stat entries when their attributes are needed */
+	if (type == LIBFS_TYPE_SYMLINK || state->options->flags)
+	{
+		if (lstat(job->from, &job->stat) != 0)
+		{
+			_LIBFS_FREE(job);
+			return LIBFS_FALSE;
+		}
+
+		type = fs_file_type_from_mode(job->stat.st_mode);
+	}
+
+	switch (type)
+	{
+	case LIBFS_TYPE_FILE:
+		fs_thread_pool_submit(&state->pool, &job->base);
+		return LIBFS_TRUE;
+	case LIBFS_TYPE_DIRECTORY:
+		result = fs_copy_tree_walk(state, job->from, job->to, &job->stat);
+		break;
+	case LIBFS_TYPE_SYMLINK:
+		result = fs_copy_tree_link(job->from, job->to, &job->stat);
+		break;
+	default:
+		result = LIBFS_TRUE;
+		break;
+	}
+
+	_LIBFS_FREE(job);
+	return result;
+}
+
+static int fs_copy_tree_walk(fs_copy_tree_state *state, const char *from, const char *to, const struct stat *s)
+{
+	fs_directory_iterator *it;
+	fs_copy_tree_dir *dir;
+	int result = LIBFS_TRUE;
+	size_t size;
+
+	if (!fs_make_dir(to))
+	{
+		return LIBFS_FALSE;
+	}
+
+	if (state->options->flags)
+	{
+		/* Restored last as a read-only mode would prevent copying children */
+		size = strlen(to);
+		dir = (fs_copy_tree_dir *)_LIBFS_MALLOC(sizeof(fs_copy_tree_dir) + size);
+		if (!dir)
+		{
+			return LIBFS_FALSE;
+		}
+
+		dir->stat = *s;
+		memcpy(dir->path, to, size + 1);
+		dir->next = state->dirs;
+		state->dirs = dir;
+	}
+
+	it = fs_open_dir(from);
+	if (!it)
+	{
+		return LIBFS_FALSE;
+	}
+
+	while (fs_read_dir(it))
+	{
+		if (strcmp(it->path, ".") == 0 || strcmp(it->path, "..") == 0)
+		{
+			continue;
+		}
+
+		if (!fs_copy_tree_entry(state, from, to, it->path, fs_dir_entry_type(it)))
+		{
+			result = LIBFS_FALSE;
+		}
+	}
+
+	fs_close_dir(it);
+	return result;
+}
+
+#ifndef HAVE_WINDOWS_H
+/* Tells if to is the directory s or is inside it, walking up the parents of to as cp does */
+static int fs_copy_tree_is_inside(const char *to, const struct stat *s)
+{
+	struct stat current;
+	struct stat parent;
+	size_t length = strlen(to);
+	size_t size = length + 64;
+	char *path = (char *)_LIBFS_MALLOC(size);
+	char *grown;
+	int result = LIBFS_FALSE;
+	if (!path)
+	{
+		return LIBFS_FALSE;
+	}
+
+	/* The destination is created in its parent when it doesn't exist */
+	memcpy(path, to, length + 1);
+	if (stat(path, &current) != 0)
+	{
+		length = fs_dirname(to, path, size);
+		if (!length)
+		{
+			path[length++] = '.';
+			path[length] = '\0';
+		}
+
+		if (stat(path, &current) != 0)
+		{
+			_LIBFS_FREE(path);
+			return LIBFS_FALSE;
+		}
+	}
+
+	/* Parents are reached with .. so symbolic links are resolved by the kernel */
+	for (;;)
+	{
+		if (current.st_dev == s->st_dev && current.st_ino == s->st_ino)
+		{
+			result = LIBFS_TRUE;
+			break;
+		}
+
+		if (length + 4 > size)
+		{
+			grown = (char *)fs_ctx_realloc(&fs_hooks_context, path, size, size * 2);
+			if (!grown)
+			{
+				break;
+			}
+
+			path = grown;
+			size *= 2;
+		}
+
+		memcpy(path + length, "/..", 4);
+		length += 3;
+		if (stat(path, &parent) != 0 || (parent.st_dev == current.st_dev && parent.st_ino == current.st_ino))
+		{
+			break;
+		}
+
+		current = parent;
+	}
+
+	_LIBFS_FREE(path);
+	return result;
+}
+#endif
+
+LIBFS_PUBLIC(int)
+fs_copy_tree(const char *from, const char *to, const struct fs_copy_tree_options *options)
+{
+	fs_copy_tree_state state;
+	struct fs_copy_tree_options defaults;
+	fs_copy_tree_dir *dir;
+	struct stat s;
+	size_t threads;
+	int result;
+
+	if (!options)
+	{
+		memset(&defaults, 0, sizeof(defaults));
+		options = &defaults;
+	}
+
+	if (stat(from, &s) != 0 || !S_ISDIR(s.st_mode))
+	{
+		return LIBFS_FALSE;
+	}
+
+#ifndef HAVE_WINDOWS_H
+	/* Copying into itself would never end */
+	if (fs_copy_tree_is_inside(to, &s))
+	{
+		errno = EINVAL;
+		return LIBFS_FALSE;
+	}
+#endif
+
+	threads = options->threads ? options->threads : fs_cpu_count();
+	state.options = options;
+	state.dirs = NULL;
+	fs_thread_pool_init(&state.pool, threads, threads * LIBFS_COPY_TREE_QUEUE_SIZE);
+
+	result = fs_copy_tree_walk(&state, from, to, &s);
+	result = (fs_thread_pool_destroy(&state.pool) == 0) && result;
+
+	/* Children were pushed after their parent so they are restored first */
+	while (state.dirs)
+	{
+		dir = state.dirs;
+		state.dirs = dir->next;
+		result = fs_copy_attributes(dir->path, &dir->stat, options->flags) && result;
+		_LIBFS_FREE(dir);
+	}
+
+	return result;
+}
+#endif
+
+#if defined(HAVE_SYS_STAT_H) && defined(HAVE_STRING_H)
+/* Initial number of directories a worker deque can hold */
+#define LIBFS_WALK_DEQUE_SIZE 64
+
+/* Directory waiting to be read */
+typedef struct fs_walk_dir
+{
+	size_t depth;
+	char path[1];
+} fs_walk_dir;
+
+/* Directory already visited when following symbolic links */
+typedef struct fs_walk_visited
+{
+	dev_t dev;
+	ino_t ino;
+	int used;
+} fs_walk_visited;
+
+/*
+ * Ring of directories owned by a worker. The owner pushes and pops at
+ * the bottom to go depth first while idle workers steal the oldest
+ * directories at the top, which tend to hold the largest subtrees.
+ */
+typedef struct fs_walk_deque
+{
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_t lock;
+#endif
+	fs_walk_dir **items;
+	size_t capacity;
+	size_t top;
+	size_t count;
+} fs_walk_deque;
+
+typedef struct fs_walk_state fs_walk_state;
+
+typedef struct fs_walk_worker
+{
+	fs_walk_state *state;
+	fs_walk_deque deque;
+	struct fs_path path;
+	/* Reopened on each directory the worker reads */
+	fs_directory_iterator *it;
+#ifdef HAVE_PTHREAD_H
+	pthread_t thread;
+	int started;
+#endif
+} fs_walk_worker;
+
+struct fs_walk_state
+{
+	const struct fs_walk_options *options;
+	fs_walk_fn fn;
+	void *user;
+	fs_walk_worker *workers;
+	size_t count;
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+#endif
+	/* Directories queued or being read, the walk ends when it drops to 0 */
+	size_t pending;
+	/* Directories queued in any deque */
+	size_t queued;
+	size_t idle;
+	fs_walk_visited *visited;
+	size_t visited_count;
+	size_t visited_capacity;
+	/* Set by any worker, only through fs_walk_flag_set */
+	volatile int stopped;
+	volatile int failed;
+};
+
+#if defined(__GNUC__)
+#define fs_walk_flag_get(flag) __atomic_load_n(&(flag), __ATOMIC_RELAXED)
+#define fs_walk_flag_set(flag) __atomic_store_n(&(flag), LIBFS_TRUE, __ATOMIC_RELAXED)
+#else
+#define fs_walk_flag_get(flag) (flag)
+#define fs_walk_flag_set(flag) ((flag) = LIBFS_TRUE)
+#endif
+
+#ifdef HAVE_PTHREAD_H
+#define fs_walk_lock(mutex) pthread_mutex_lock(mutex)
+#define fs_walk_unlock(mutex) pthread_mutex_unlock(mutex)
+#else
+#define fs_walk_lock(mutex)
+#define fs_walk_unlock(mutex)
+#endif
+
+static int fs_walk_deque_push(fs_walk_deque *deque, fs_walk_dir *dir)
+{
+	fs_walk_dir **items;
+	size_t capacity;
+	size_t i;
+
+	fs_walk_lock(&deque->lock);
+	if (deque->count == deque->capacity)
+	{
+		capacity = deque->capacity ? deque->capacity * 2 : LIBFS_WALK_DEQUE_SIZE;
+		items = (fs_walk_dir **)_LIBFS_MALLOC(capacity * sizeof(fs_walk_dir *));
+		if (!items)
+		{
+			fs_walk_unlock(&deque->lock);
+			return LIBFS_FALSE;
+		}
+
+		for (i = 0; i < deque->count; ++i)
+		{
+			items[i] = deque->items[(deque->top + i) % deque->capacity];
+		}
+
+		if (deque->items)
+		{
+			_LIBFS_FREE(deque->items);
+		}
+
+		deque->items = items;
+		deque->capacity = capacity;
+		deque->top = 0;
+	}
+
+	deque->items[(deque->top + deque->count) % deque->capacity] = dir;
+	deque->count++;
+	fs_walk_unlock(&deque->lock);
+	return LIBFS_TRUE;
+}
+
+/* Pops the newest directory, or steals the oldest one */
+static fs_walk_dir *fs_walk_deque_pop(fs_walk_deque *deque, int steal)
+{
+	fs_walk_dir *dir = NULL;
+
+	fs_walk_lock(&deque->lock);
+	if (deque->count)
+	{
+		deque->count--;
+		if (steal)
+		{
+			dir = deque->items[deque->top];
+			deque->top = (deque->top + 1) % deque->capacity;
+		}
+		else
+		{
+			dir = deque->items[(deque->top + deque->count) % deque->capacity];
+		}
+	}
+
+	fs_walk_unlock(&deque->lock);
+	return dir;
+}
+
+/* Records a directory and tells if it was seen before, must be called locked */
+static int fs_walk_visit(fs_walk_state *state, const struct stat *s)
+{
+	fs_walk_visited *visited;
+	size_t capacity;
+	size_t i;
+	size_t j;
+
+	if (state->visited_count * 2 >= state->visited_capacity)
+	{
+		capacity = state->visited_capacity ? state->visited_capacity * 2 : LIBFS_WALK_DEQUE_SIZE;
+		visited = (fs_walk_visited *)_LIBFS_MALLOC(capacity * sizeof(fs_walk_visited));
+		if (!visited)
+		{
+			return LIBFS_TRUE;
+		}
+
+		memset(visited, 0, capacity * sizeof(fs_walk_visited));
+		for (i = 0; i < state->visited_capacity; ++i)
+		{
+			if (state->visited[i].used)
+			{
+				j = (size_t)state->visited[i].ino % capacity;
+				while (visited[j].used)
+				{
+					j = (j + 1) % capacity;
+				}
+
+				visited[j] = state->visited[i];
+			}
+		}
+
+		if (state->visited)
+		{
+			_LIBFS_FREE(state->visited);
+		}
+
+		state->visited = visited;
+		state->visited_capacity = capacity;
+	}
+
+	i = (size_t)s->st_ino % state->visited_capacity;
+	while (state->visited[i].used)
+	{
+		if (state->visited[i].ino == s->st_ino && state->visited[i].dev == s->st_dev)
+		{
+			return LIBFS_TRUE;
+		}
+
+		i = (i + 1) % state->visited_capacity;
+	}
+
+	state->visited[i].dev = s->st_dev;
+	state->visited[i].ino = s->st_ino;
+	state->visited[i].used = LIBFS_TRUE;
+	state->visited_count++;
+	return LIBFS_FALSE;
+}
+
+static int fs_walk_push(fs_walk_worker *worker, const char *path, size_t length, size_t depth)
+{
+	fs_walk_state *state = worker->state;
+	fs_walk_dir *dir = (fs_walk_dir *)_LIBFS_MALLOC(sizeof(fs_walk_dir) + length);
+	if (!dir)
+	{
+		return LIBFS_FALSE;
+	}
+
+	dir->depth = depth;
+	memcpy(dir->path, path, length + 1);
+
+	/* Counted before being published, or a thief could take and finish it first */
+	fs_walk_lock(&state->lock);
+	state->pending++;
+	state->queued++;
+	fs_walk_unlock(&state->lock);
+	if (!fs_walk_deque_push(&worker->deque, dir))
+	{
+		fs_walk_lock(&state->lock);
+		state->queued--;
+#ifdef HAVE_PTHREAD_H
+		if (--state->pending == 0)
+		{
+			pthread_cond_broadcast(&state->wake);
+		}
+#else
+		state->pending--;
+#endif
+		fs_walk_unlock(&state->lock);
+		_LIBFS_FREE(dir);
+		return LIBFS_FALSE;
+	}
+
+	fs_walk_lock(&state->lock);
+#ifdef HAVE_PTHREAD_H
+	if (state->idle)
+	{
+		pthread_cond_signal(&state->wake);
+	}
+#endif
+	fs_walk_unlock(&state->lock);
+	return LIBFS_TRUE;
+}
+
+/* Takes a directory from the worker's own deque or steals one */
+static fs_walk_dir *fs_walk_take(fs_walk_worker *worker)
+{
+	fs_walk_state *state = worker->state;
+	fs_walk_dir *dir = fs_walk_deque_pop(&worker->deque, LIBFS_FALSE);
+	size_t index = (size_t)(worker - state->workers);
+	size_t i;
+
+	for (i = 1; !dir && i < state->count; ++i)
+	{
+		dir = fs_walk_deque_pop(&state->workers[(index + i) % state->count].deque, LIBFS_TRUE);
+	}
+
+	if (dir)
+	{
+		fs_walk_lock(&state->lock);
+		state->queued--;
+		fs_walk_unlock(&state->lock);
+	}
+
+	return dir;
+}
+
+/* Waits for queued directories, returns false once the walk is over */
+static int fs_walk_wait(fs_walk_state *state)
+{
+	int result;
+
+	fs_walk_lock(&state->lock);
+#ifdef HAVE_PTHREAD_H
+	while (state->pending && !state->queued)
+	{
+		state->idle++;
+		pthread_cond_wait(&state->wake, &state->lock);
+		state->idle--;
+	}
+#endif
+
+	result = state->pending != 0;
+	fs_walk_unlock(&state->lock);
+	return result;
+}
+
+static void fs_walk_read_dir(fs_walk_worker *worker, fs_walk_dir *dir)
+{
+	fs_walk_state *state = worker->state;
+	const struct fs_walk_options *options = state->options;
+	struct fs_walk_entry entry;
+	struct stat s;
+	size_t dir_length;
+	int action;
+	int descend;
+	int followed;
+	fs_directory_iterator *it = worker->it ? fs_reopen_dir(worker->it, dir->path) : (worker->it = fs_open_dir(dir->path));
+	if (!it)
+	{
+		fs_walk_flag_set(state->failed);
+		return;
+	}
+
+	if (!fs_path_set(&worker->path, dir->path))
+	{
+		fs_walk_flag_set(state->failed);
+		fs_reopen_dir(it, NULL);
+		return;
+	}
+
+	dir_length = worker->path.length;
+
+	entry.depth = dir->depth + 1;
+	while (!fs_walk_flag_get(state->stopped) && fs_read_dir(it))
+	{
+		if (strcmp(it->path, ".") == 0 || strcmp(it->path, "..") == 0)
+		{
+			continue;
+		}
+
+		fs_path_truncate(&worker->path, dir_length);
+		if (!fs_path_push(&worker->path, it->path))
+		{
+			fs_walk_flag_set(state->failed);
+			break;
+		}
+
+		entry.path = worker->path.data;
+		entry.name = worker->path.data + worker->path.length - strlen(it->path);
+		entry.type = fs_dir_entry_type(it);
+		entry.inode = it->inode;
+
+		/* Links are resolved to their target when followed */
+		followed = LIBFS_FALSE;
+		if ((options->flags & LIBFS_WALK_FOLLOW_SYMLINKS) && (entry.type == LIBFS_TYPE_SYMLINK || entry.type == LIBFS_TYPE_DIRECTORY))
+		{
+			followed = stat(entry.path, &s) == 0;
+			if (followed)
+			{
+				entry.type = fs_file_type_from_mode(s.st_mode);
+				entry.inode = s.st_ino;
+			}
+		}
+
+		descend = entry.type == LIBFS_TYPE_DIRECTORY && (!options->max_depth || entry.depth < options->max_depth);
+		if (descend && followed)
+		{
+			/* Directories are only entered once to break link cycles */
+			fs_walk_lock(&state->lock);
+			descend = !fs_walk_visit(state, &s);
+			fs_walk_unlock(&state->lock);
+		}
+
+		action = state->fn(&entry, state->user);
+		if (action == LIBFS_WALK_STOP)
+		{
+			fs_walk_flag_set(state->stopped);
+			break;
+		}
+
+		if (descend && action != LIBFS_WALK_SKIP && !fs_walk_push(worker, entry.path, worker->path.length, entry.depth))
+		{
+			fs_walk_flag_set(state->failed);
+		}
+	}
+
+	/* Keep the iterator for the next directory */
+	fs_reopen_dir(it, NULL);
+}
+
+static void *fs_walk_main(void *arg)
+{
+	fs_walk_worker *worker = (fs_walk_worker *)arg;
+	fs_walk_state *state = worker->state;
+	fs_walk_dir *dir;
+
+	for (;;)
+	{
+		if (!(dir = fs_walk_take(worker)))
+		{
+			if (!fs_walk_wait(state))
+			{
+				break;
+			}
+
+			continue;
+		}
+
+		/* Once stopped, queued directories are only drained */
+		if (!fs_walk_flag_get(state->stopped))
+		{
+			fs_walk_read_dir(worker, dir);
+		}
+
+		_LIBFS_FREE(dir);
+		fs_walk_lock(&state->lock);
+#ifdef HAVE_PTHREAD_H
+		if (--state->pending == 0)
+		{
+			pthread_cond_broadcast(&state->wake);
+		}
+#else
+		state->pending--;
+#endif
+		fs_walk_unlock(&state->lock);
+	}
+
+	return NULL;
+}
+
+/* Default number of directories a streaming walk keeps open */
+#define LIBFS_WALK_MAX_OPEN_DIRS 32
+
+/* Directory being read by a streaming walk */
+typedef struct fs_walk_level
+{
+	/* NULL once closed to stay under the open directory limit */
+	fs_directory_iterator *it;
+	/* Length of the directory path in the path buffer */
+	size_t length;
+	/* Entries already read, skipped when the directory is reopened */
+	size_t read;
+#ifdef LIBFS_HAVE_DIR_SEEK
+	/* Where the directory was closed, seeked to instead of skipping entries */
+	off_t position;
+#endif
+	dev_t dev;
+	ino_t ino;
+} fs_walk_level;
+
+/* Iterators of closed levels, reopened on other directories instead of allocating new ones */
+typedef struct fs_walk_spares
+{
+	fs_directory_iterator **its;
+	size_t count;
+	size_t capacity;
+} fs_walk_spares;
+
+static fs_directory_iterator *fs_walk_open_dir(fs_walk_spares *spares, const char *path)
+{
+	fs_directory_iterator *it;
+	if (!spares->count)
+	{
+		return fs_open_dir(path);
+	}
+
+	it = fs_reopen_dir(spares->its[spares->count - 1], path);
+	if (it)
+	{
+		spares->count--;
+	}
+
+	return it;
+}
+
+static void fs_walk_close_dir(fs_walk_spares *spares, fs_directory_iterator *it)
+{
+	if (spares->count == spares->capacity)
+	{
+		fs_close_dir(it);
+		return;
+	}
+
+	fs_reopen_dir(it, NULL);
+	spares->its[spares->count++] = it;
+}
+
+/* Opens a level, or reopens it where it was closed */
+static int fs_walk_open_level(fs_walk_level *level, fs_walk_spares *spares, const char *path)
+{
+#ifndef LIBFS_HAVE_DIR_SEEK
+	size_t i;
+#endif
+	if (!(level->it = fs_walk_open_dir(spares, path)))
+	{
+		return LIBFS_FALSE;
+	}
+
+#ifdef LIBFS_HAVE_DIR_SEEK
+	/* Offsets survive entries being added or removed in between, unlike a count */
+	if (level->read && !fs_dir_seek(level->it, level->position))
+	{
+		fs_walk_close_dir(spares, level->it);
+		level->it = NULL;
+		return LIBFS_FALSE;
+	}
+
+	return LIBFS_TRUE;
+#else
+	for (i = 0; i < level->read && fs_read_dir(level->it); ++i)
+	{
+	}
+
+	return LIBFS_TRUE;
+#endif
+}
+
+/*
+ * Walks depth first from the calling thread. Only the chain of
+ * directories from the root to the current entry is kept, with a single
+ * path buffer where components are pushed and popped.
+ */
+static int fs_walk_stream(const char *path, const struct stat *root, const struct fs_walk_options *options, fs_walk_fn fn, void *user)
+{
+	fs_walk_level *levels = NULL;
+	fs_walk_level *level;
+	fs_walk_level *grown;
+	fs_walk_spares spares;
+	struct fs_walk_entry entry;
+	struct stat s;
+	struct fs_path buf;
+	size_t depth = 0;
+	size_t capacity = 0;
+	size_t opened = 0;
+	size_t max_open = options->max_open_dirs ? options->max_open_dirs : LIBFS_WALK_MAX_OPEN_DIRS;
+	dev_t dev = root->st_dev;
+	ino_t ino = root->st_ino;
+	size_t i;
+	int action;
+	int descend;
+	int followed;
+	int stopped = LIBFS_FALSE;
+	int failed = LIBFS_FALSE;
+
+	fs_path_init(&buf, NULL, 0);
+	if (!fs_path_set(&buf, path))
+	{
+		return LIBFS_FALSE;
+	}
+
+	/* At most max_open iterators exist, open or spare */
+	spares.its = (fs_directory_iterator **)_LIBFS_MALLOC(max_open * sizeof(fs_directory_iterator *));
+	spares.count = 0;
+	spares.capacity = spares.its ? max_open : 0;
+
+	for (;;)
+	{
+		/* Push the directory whose path is in buf */
+		if (depth == capacity)
+		{
+			capacity = capacity ? capacity * 2 : LIBFS_WALK_DEQUE_SIZE;
+			grown = (fs_walk_level *)_LIBFS_MALLOC(capacity * sizeof(fs_walk_level));
+			if (!grown)
+			{
+				failed = LIBFS_TRUE;
+				break;
+			}
+
+			if (levels)
+			{
+				memcpy(grown, levels, depth * sizeof(fs_walk_level));
+				_LIBFS_FREE(levels);
+			}
+
+			levels = grown;
+		}
+
+		/* Close the shallowest open directory, it is the last one needed again */
+		if (opened == max_open)
+		{
+			for (i = 0; !levels[i].it; ++i)
+			{
+			}
+
+#ifdef LIBFS_HAVE_DIR_SEEK
+			levels[i].position = fs_dir_tell(levels[i].it);
+#endif
+			fs_walk_close_dir(&spares, levels[i].it);
+			levels[i].it = NULL;
+			opened--;
+		}
+
+		level = &levels[depth];
+		level->length = buf.length;
+		level->read = 0;
+		level->dev = dev;
+		level->ino = ino;
+		if (fs_walk_open_level(level, &spares, buf.data))
+		{
+			opened++;
+			depth++;
+		}
+		else
+		{
+			failed = LIBFS_TRUE;
+			if (!depth)
+			{
+				break;
+			}
+		}
+
+		/* Read until a directory to descend into is found */
+		descend = LIBFS_FALSE;
+		while (depth && !descend)
+		{
+			level = &levels[depth - 1];
+			fs_path_truncate(&buf, level->length);
+			if (stopped)
+			{
+				if (level->it)
+				{
+					fs_walk_close_dir(&spares, level->it);
+					opened--;
+				}
+
+				depth--;
+				continue;
+			}
+
+			if (!level->it)
+			{
+				if (!fs_walk_open_level(level, &spares, buf.data))
+				{
+					failed = LIBFS_TRUE;
+					depth--;
+					continue;
+				}
+
+				opened++;
+			}
+
+			if (!fs_read_dir(level->it))
+			{
+				fs_walk_close_dir(&spares, level->it);
+				level->it = NULL;
+				opened--;
+				depth--;
+				continue;
+			}
+
+			level->read++;
+			if (strcmp(level->it->path, ".") == 0 || strcmp(level->it->path, "..") == 0)
+			{
+				continue;
+			}
+
+			if (!fs_path_push(&buf, level->it->path))
+			{
+				failed = LIBFS_TRUE;
+				stopped = LIBFS_TRUE;
+				continue;
+			}
+
+			entry.path = buf.data;
+			entry.name = buf.data + buf.length - strlen(level->it->path);
+			entry.depth = depth;
+			entry.type = fs_dir_entry_type(level->it);
+			entry.inode = level->it->inode;
+
+			followed = LIBFS_FALSE;
+			if ((options->flags & LIBFS_WALK_FOLLOW_SYMLINKS) && (entry.type == LIBFS_TYPE_SYMLINK || entry.type == LIBFS_TYPE_DIRECTORY))
+			{
+				followed = stat(entry.path, &s) == 0;
+				if (followed)
+				{
+					entry.type = fs_file_type_from_mode(s.st_mode);
+					entry.inode = s.st_ino;
+				}
+			}
+
+			descend = entry.type == LIBFS_TYPE_DIRECTORY && (!options->max_depth || entry.depth < options->max_depth);
+			if (descend && followed)
+			{
+				/* Don't enter a directory that is its own ancestor */
+				for (i = 0; descend && i < depth; ++i)
+				{
+					descend = levels[i].dev != s.st_dev || levels[i].ino != s.st_ino;
+				}
+
+				dev = s.st_dev;
+				ino = s.st_ino;
+			}
+
+			action = fn(&entry, user);
+			if (action == LIBFS_WALK_STOP)
+			{
+				stopped = LIBFS_TRUE;
+			}
+
+			descend = descend && action == LIBFS_WALK_CONTINUE;
+		}
+
+		if (!descend)
+		{
+			break;
+		}
+	}
+
+	if (levels)
+	{
+		_LIBFS_FREE(levels);
+	}
+
+	while (spares.count)
+	{
+		fs_close_dir(spares.its[--spares.count]);
+	}
+
+	if (spares.its)
+	{
+		_LIBFS_FREE(spares.its);
+	}
+
+	fs_path_free(&buf);
+	return !failed;
+}
+
+LIBFS_PUBLIC(int)
+fs_walk(const char *path, const struct fs_walk_options *options, fs_walk_fn fn, void *user)
+{
+	fs_walk_state state;
+	struct fs_walk_options defaults;
+	struct stat s;
+	size_t i;
+
+	if (!options)
+	{
+		memset(&defaults, 0, sizeof(defaults));
+		options = &defaults;
+	}
+
+	if (stat(path, &s) != 0 || !S_ISDIR(s.st_mode))
+	{
+		return LIBFS_FALSE;
+	}
+
+	if (options->flags & LIBFS_WALK_STREAMING)
+	{
+		return fs_walk_stream(path, &s, options, fn, user);
+	}
+
+	memset(&state, 0, sizeof(state));
+	state.options = options;
+	state.fn = fn;
+	state.user = user;
+	state.count = options->threads ? options->threads : fs_cpu_count();
+#ifndef HAVE_PTHREAD_H
+	state.count = 1;
+#endif
+	state.workers = (fs_walk_worker *)_LIBFS_MALLOC(state.count * sizeof(fs_walk_worker));
+	if (!state.workers)
+	{
+		return LIBFS_FALSE;
+	}
+
+	memset(state.workers, 0, state.count * sizeof(fs_walk_worker));
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_init(&state.lock, NULL);
+	pthread_cond_init(&state.wake, NULL);
+#endif
+	for (i = 0; i < state.count; ++i)
+	{
+		state.workers[i].state = &state;
+		fs_path_init(&state.workers[i].path, NULL, 0);
+#ifdef HAVE_PTHREAD_H
+		pthread_mutex_init(&state.workers[i].deque.lock, NULL);
+#endif
+	}
+
+	if (options->flags & LIBFS_WALK_FOLLOW_SYMLINKS)
+	{
+		fs_walk_visit(&state, &s);
+	}
+
+	if (!fs_walk_push(&state.workers[0], path, strlen(path), 0))
+	{
+		state.failed = LIBFS_TRUE;
+	}
+
+	/* The calling thread is the first worker */
+#ifdef HAVE_PTHREAD_H
+	for (i = 1; i < state.count; ++i)
+	{
+		state.workers[i].started = pthread_create(&state.workers[i].thread, NULL, fs_walk_main, &state.workers[i]) == 0;
+	}
+#endif
+
+	fs_walk_main(&state.workers[0]);
+
+	for (i = 0; i < state.count; ++i)
+	{
+#ifdef HAVE_PTHREAD_H
+		if (state.workers[i].started)
+		{
+			pthread_join(state.workers[i].thread, NULL);
+		}
+
+		pthread_mutex_destroy(&state.workers[i].deque.lock);
+#endif
+		if (state.workers[i].deque.items)
+		{
+			_LIBFS_FREE(state.workers[i].deque.items);
+		}
+
+		fs_path_free(&state.workers[i].path);
+
+		if (state.workers[i].it)
+		{
+			fs_close_dir(state.workers[i].it);
+		}
+	}
+
+#ifdef HAVE_PTHREAD_H
+	pthread_cond_destroy(&state.wake);
+	pthread_mutex_destroy(&state.lock);
+#endif
+	if (state.visited)
+	{
+		_LIBFS_FREE(state.visited);
+	}
+
+	_LIBFS_FREE(state.workers);
+	return !state.failed;
 }
 #endif
 
-#ifdef HAVE_STRING_H
-LIBFS_PUBLIC(size_t)
-fs_join_path(char *buf, size_t size, const char *left, const char *right)
+/* Default number of operations in flight of a fs_ring */
+#define LIBFS_RING_ENTRIES 64
+/* Completions moved out of a ring at once while destroying it */
+#define LIBFS_RING_DRAIN 16
+
+typedef struct fs_ring fs_ring;
+typedef struct fs_ring_task fs_ring_task;
+
+/* Steps of an operation run with io_uring */
+enum fs_ring_step
+{
+	LIBFS_RING_STEP_OPEN = 0,
+	LIBFS_RING_STEP_STAT,
+	LIBFS_RING_STEP_IO,
+	LIBFS_RING_STEP_SYNC,
+	LIBFS_RING_STEP_CLOSE
+};
+
+/* Operation in flight, followed by its path */
+struct fs_ring_task
+{
+	fs_job base;
+	fs_ring *ring;
+	fs_ring_task *next;
+	void *user;
+	char *data;
+	size_t size;
+	size_t done;
+	off_t offset;
+	int type;
+	int error;
+#ifdef LIBFS_HAVE_IO_URING
+	int step;
+	int fd;
+	/* The size of the file is unknown and data grows while reading */
+	int grow;
+	struct statx stx;
+#endif
+	char path[1];
+};
+
+struct fs_ring
+{
+#ifdef LIBFS_HAVE_IO_URING
+	fs_uring uring;
+	int use_uring;
+#endif
+	fs_thread_pool pool;
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_t lock;
+	pthread_cond_t completed;
+#endif
+	/* Completed operations not yet returned */
+	fs_ring_task *head;
+	fs_ring_task *tail;
+	size_t entries;
+	/* Operations submitted and not yet returned */
+	size_t in_flight;
+};
+
+static void fs_ring_complete(fs_ring *ring, fs_ring_task *op)
+{
+	op->next = NULL;
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_lock(&ring->lock);
+#endif
+	if (ring->tail)
+	{
+		ring->tail->next = op;
+	}
+	else
+	{
+		ring->head = op;
+	}
+
+	ring->tail = op;
+#ifdef HAVE_PTHREAD_H
+	pthread_cond_signal(&ring->completed);
+	pthread_mutex_unlock(&ring->lock);
+#endif
+}
+
+#ifdef LIBFS_HAVE_FD
+static int fs_ring_run_write(fs_ring_task *op)
+{
+	int error = 0;
+	int fd = open(op->path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	if (fd < 0)
+	{
+		return errno;
+	}
+
+	if (fs_write_all(fd, op->data, op->size))
+	{
+		op->done = op->size;
+	}
+	else
+	{
+		error = errno;
+	}
+
+	if (close(fd) != 0 && !error)
+	{
+		error = errno;
+	}
+
+	return error;
+}
+
+static int fs_ring_run_read_range(fs_ring_task *op)
+{
+	int error;
+	ssize_t n;
+	int fd = open(op->path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+	{
+		return errno;
+	}
+
+	while (op->done < op->size)
+	{
+		n = pread(fd, op->data + op->done, op->size - op->done, op->offset + (off_t)op->done);
+		if (n == 0)
+		{
+			break;
+		}
+
+		if (n < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+
+			error = errno;
+			close(fd);
+			return error;
+		}
+
+		op->done += (size_t)n;
+	}
+
+	close(fd);
+	return 0;
+}
+
+static int fs_ring_run_fsync(fs_ring_task *op)
+{
+	int error = 0;
+	int fd = open(op->path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+	{
+		return errno;
+	}
+
+	if (fsync(fd) != 0)
+	{
+		error = errno;
+	}
+
+	close(fd);
+	return error;
+}
+#else
+static int fs_ring_run_write(fs_ring_task *op)
 {
-	return snprintf(buf, size, "%s/%s", left, right);
+	int error = 0;
+	FILE *file = fs_open(op->path, "wb");
+	if (!file)
+	{
+		return errno ? errno : EIO;
+	}
+
+	op->done = fwrite(op->data, 1, op->size, file);
+	if (op->done != op->size)
+	{
+		error = EIO;
+	}
+
+	if (fclose(file) != 0 && !error)
+	{
+		error = EIO;
+	}
+
+	return error;
 }
-#endif
 
-#if defined(HAVE_WINDOWS_H)
-LIBFS_PUBLIC(char *)
-fs_temp_dir(char *buf, size_t size)
+static int fs_ring_run_read_range(fs_ring_task *op)
 {
-	if (!GetTempPath((DWORD)size, buf))
+	int error = 0;
+	FILE *file = fs_open(op->path, "rb");
+	if (!file)
 	{
-		return NULL;
+		return errno ? errno : EIO;
 	}
 
-	return buf;
+	if (fseek(file, (long)op->offset, SEEK_SET) != 0)
+	{
+		error = EINVAL;
+	}
+	else
+	{
+		op->done = fread(op->data, 1, op->size, file);
+		if (ferror(file))
+		{
+			error = EIO;
+		}
+	}
+
+	fclose(file);
+	return error;
 }
 
-LIBFS_PUBLIC(int)
-fs_delete_dir(const char *path)
+#if HAVE_WINDOWS_H
+static int fs_ring_run_fsync(fs_ring_task *op)
 {
-	if (RemoveDirectory(path) == 0)
+	int error = 0;
+	FILE *file = fs_open(op->path, "r+b");
+	if (!file)
 	{
-		return ERROR_FILE_NOT_FOUND == GetLastError();
+		return errno ? errno : EIO;
 	}
 
-	return LIBFS_TRUE;
+	if (!fs_sync_file(file))
+	{
+		error = EIO;
+	}
+
+	fclose(file);
+	return error;
+}
+#else
+/* Flushing to the storage needs file descriptors or Windows */
+static int fs_ring_run_fsync(fs_ring_task *op)
+{
+	LIBFS_UNUSED(op);
+	return ENOSYS;
 }
+#endif
+#endif
 
-LIBFS_PUBLIC(int)
-fs_delete_file(const char *path)
+/* Runs an operation synchronously on a thread of the pool */
+static int fs_ring_run(fs_job *job)
 {
-	if (DeleteFile(path) == 0)
+	fs_ring_task *op = (fs_ring_task *)job;
+	errno = 0;
+	switch (op->type)
 	{
-		return ERROR_FILE_NOT_FOUND == GetLastError();
+	case LIBFS_RING_READ_FILE:
+		op->data = (char *)fs_read_file(op->path, &op->done);
+		if (!op->data)
+		{
+			op->error = errno ? errno : EIO;
+		}
+		break;
+	case LIBFS_RING_WRITE_FILE:
+		op->error = fs_ring_run_write(op);
+		break;
+	case LIBFS_RING_READ_RANGE:
+		op->error = fs_ring_run_read_range(op);
+		break;
+	default:
+		op->error = fs_ring_run_fsync(op);
+		break;
 	}
 
+	fs_ring_complete(op->ring, op);
 	return LIBFS_TRUE;
 }
 
-LIBFS_PUBLIC(int)
-fs_make_dir(const char *path)
+#ifdef LIBFS_HAVE_IO_URING
+/* Largest read or write requested at once */
+#define LIBFS_RING_MAX_IO (1U << 30)
+/* Largest ring accepted by io_uring_setup */
+#define LIBFS_RING_MAX_ENTRIES 32768
+
+/*
+ * Queues the request for the current step of op. Each operation has at
+ * most one request in flight and the ring has room for all of them.
+ */
+static void fs_ring_uring_queue(fs_ring *ring, fs_ring_task *op)
 {
-	if (CreateDirectory(path, NULL) == 0)
+	size_t left;
+	struct io_uring_sqe *sqe = fs_uring_get_sqe(&ring->uring);
+	sqe->user_data = (unsigned long)op;
+	switch (op->step)
 	{
-		return ERROR_ALREADY_EXISTS == GetLastError();
+	case LIBFS_RING_STEP_OPEN:
+		sqe->opcode = IORING_OP_OPENAT;
+		sqe->fd = AT_FDCWD;
+		sqe->addr = (unsigned long)op->path;
+		sqe->open_flags = (op->type == LIBFS_RING_WRITE_FILE ? O_WRONLY | O_CREAT | O_TRUNC : O_RDONLY) | O_CLOEXEC;
+		sqe->len = 0666;
+		break;
+	case LIBFS_RING_STEP_STAT:
+		sqe->opcode = IORING_OP_STATX;
+		sqe->fd = op->fd;
+		sqe->addr = (unsigned long)"";
+		sqe->statx_flags = AT_EMPTY_PATH;
+		sqe->len = STATX_TYPE | STATX_SIZE;
+		sqe->off = (unsigned long)&op->stx;
+		break;
+	case LIBFS_RING_STEP_IO:
+		left = op->size - op->done;
+		sqe->opcode = op->type == LIBFS_RING_WRITE_FILE ? IORING_OP_WRITE : IORING_OP_READ;
+		sqe->fd = op->fd;
+		sqe->addr = (unsigned long)(op->data + op->done);
+		sqe->len = left > LIBFS_RING_MAX_IO ? LIBFS_RING_MAX_IO : (unsigned int)left;
+		sqe->off = op->offset + (off_t)op->done;
+		break;
+	case LIBFS_RING_STEP_SYNC:
+		sqe->opcode = IORING_OP_FSYNC;
+		sqe->fd = op->fd;
+		break;
+	default:
+		sqe->opcode = IORING_OP_CLOSE;
+		sqe->fd = op->fd;
+		break;
+	}
+}
+
+/* Doubles the buffer of a file whose size is unknown */
+static int fs_ring_uring_grow(fs_ring_task *op)
+{
+	char *grown = (char *)_LIBFS_MALLOC((op->size + 1) * 2);
+	if (!grown)
+	{
+		return LIBFS_FALSE;
 	}
 
+	memcpy(grown, op->data, op->done);
+	_LIBFS_FREE(op->data);
+	op->data = grown;
+	op->size = (op->size + 1) * 2 - 1;
 	return LIBFS_TRUE;
 }
-#else /* !HAVE_WINDOWS_H */
-#if defined(HAVE_STDLIB_H)
-LIBFS_PUBLIC(char *)
-fs_temp_dir(char *buf, size_t size)
+
+/* Moves op to its next step with the result of its last request, returns if it completed */
+static int fs_ring_uring_step(fs_ring *ring, fs_ring_task *op, int res)
 {
-	const char *path = getenv("TMPDIR");
-	if (!path)
+	switch (op->step)
 	{
-		return NULL;
+	case LIBFS_RING_STEP_OPEN:
+		if (res < 0)
+		{
+			op->error = -res;
+			return LIBFS_TRUE;
+		}
+
+		op->fd = res;
+		if (op->type == LIBFS_RING_READ_FILE)
+		{
+			op->step = LIBFS_RING_STEP_STAT;
+		}
+		else if (op->type == LIBFS_RING_FSYNC)
+		{
+			op->step = LIBFS_RING_STEP_SYNC;
+		}
+		else
+		{
+			op->step = op->size ? LIBFS_RING_STEP_IO : LIBFS_RING_STEP_CLOSE;
+		}
+		break;
+	case LIBFS_RING_STEP_STAT:
+		if (res < 0)
+		{
+			op->error = -res;
+			op->step = LIBFS_RING_STEP_CLOSE;
+			break;
+		}
+
+		/* Files such as those of /proc report no size and are read until EOF */
+		op->grow = !S_ISREG(op->stx.stx_mode) || !op->stx.stx_size;
+		op->size = op->grow ? LIBFS_READ_CHUNK_SIZE - 1 : (size_t)op->stx.stx_size;
+		op->data = (char *)_LIBFS_MALLOC(op->size + 1);
+		op->error = op->data ? 0 : ENOMEM;
+		op->step = op->data ? LIBFS_RING_STEP_IO : LIBFS_RING_STEP_CLOSE;
+		break;
+	case LIBFS_RING_STEP_IO:
+		if (res == -EINTR || res == -EAGAIN)
+		{
+			break;
+		}
+
+		if (res < 0)
+		{
+			op->error = -res;
+			op->step = LIBFS_RING_STEP_CLOSE;
+			break;
+		}
+
+		op->done += (size_t)res;
+		if (res == 0 && op->type == LIBFS_RING_WRITE_FILE)
+		{
+			op->error = EIO;
+		}
+
+		if (res > 0 && op->done == op->size && op->grow && !fs_ring_uring_grow(op))
+		{
+			op->error = ENOMEM;
+		}
+
+		if (res == 0 || op->error || op->done == op->size)
+		{
+			op->step = LIBFS_RING_STEP_CLOSE;
+		}
+		break;
+	case LIBFS_RING_STEP_SYNC:
+		if (res < 0)
+		{
+			op->error = -res;
+		}
+
+		op->step = LIBFS_RING_STEP_CLOSE;
+		break;
+	default:
+		if (res < 0 && !op->error)
+		{
+			op->error = -res;
+		}
+
+		if (op->type == LIBFS_RING_READ_FILE && op->data)
+		{
+			if (op->error)
+			{
+				_LIBFS_FREE(op->data);
+				op->data = NULL;
+			}
+			else
+			{
+				op->data[op->done] = '\0';
+			}
+		}
+
+		return LIBFS_TRUE;
 	}
 
-	snprintf(buf, size, "%s", path);
-	return buf;
+	fs_ring_uring_queue(ring, op);
+	return LIBFS_FALSE;
 }
-#endif
 
-#ifdef HAVE_UNISTD_H
-LIBFS_PUBLIC(int)
-fs_delete_dir(const char *path)
+/* Handles the available completions and submits the requests that follow */
+static void fs_ring_uring_reap(fs_ring *ring)
 {
-	return (rmdir(path) == 0) || (ENOENT == errno);
+	struct io_uring_cqe *cqe;
+	fs_ring_task *op;
+	int res;
+	while ((cqe = fs_uring_peek(&ring->uring)) != NULL)
+	{
+		op = (fs_ring_task *)(unsigned long)cqe->user_data;
+		res = cqe->res;
+		fs_uring_advance(&ring->uring);
+		if (fs_ring_uring_step(ring, op, res))
+		{
+			fs_ring_complete(ring, op);
+		}
+	}
+
+	if (ring->uring.pending)
+	{
+		fs_uring_submit(&ring->uring, 0);
+	}
 }
 #endif
 
-#ifdef HAVE_STDIO_H
-LIBFS_PUBLIC(int)
-fs_delete_file(const char *path)
+LIBFS_PUBLIC(fs_ring *)
+fs_ring_create(size_t entries, int flags)
 {
-	return (remove(path) == 0) || (ENOENT == errno);
-}
+	size_t threads;
+	fs_ring *ring = (fs_ring *)_LIBFS_MALLOC(sizeof(fs_ring));
+	if (!ring)
+	{
+		return NULL;
+	}
+
+	memset(ring, 0, sizeof(fs_ring));
+	ring->entries = entries ? entries : LIBFS_RING_ENTRIES;
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_init(&ring->lock, NULL);
+	pthread_cond_init(&ring->completed, NULL);
+#endif
+#ifdef LIBFS_HAVE_IO_URING
+	if (!(flags & LIBFS_RING_THREADS) && ring->entries <= LIBFS_RING_MAX_ENTRIES &&
+		fs_uring_init(&ring->uring, (unsigned int)ring->entries))
+	{
+		ring->use_uring = LIBFS_TRUE;
+		return ring;
+	}
+#else
+	LIBFS_UNUSED(flags);
 #endif
 
-#ifdef HAVE_SYS_STAT_H
-LIBFS_PUBLIC(int)
-fs_make_dir(const char *path)
-{
-	return (mkdir(path, LIBFS_MKDIR_PERMISSIONS) == 0) || (EEXIST == errno);
+	/* Threads mostly wait for the storage */
+	threads = fs_cpu_count() * 4;
+	fs_thread_pool_init(&ring->pool, threads < ring->entries ? threads : ring->entries, 0);
+	return ring;
 }
-#endif
-#endif /* HAVE_WINDOWS_H */
 
-#if defined(HAVE_WINDOWS_H)
-typedef struct fs_win_directory_iterator
+LIBFS_PUBLIC(void)
+fs_ring_destroy(fs_ring *ring)
 {
-	fs_directory_iterator base;
-	WIN32_FIND_DATA fdFile;
-	HANDLE hFind;
-	size_t started;
-} fs_win_directory_iterator;
+	struct fs_ring_completion completions[LIBFS_RING_DRAIN];
+	size_t n;
+	size_t i;
+	while (ring->in_flight)
+	{
+		n = fs_ring_wait(ring, completions, LIBFS_RING_DRAIN, 1);
+		if (!n)
+		{
+			break;
+		}
 
-LIBFS_PUBLIC(fs_directory_iterator *)
-fs_open_dir(const char *path)
-{
-	fs_win_directory_iterator *it;
-	TCHAR szDir[MAX_PATH];
-	WIN32_FIND_DATA fdFile;
-	HANDLE hFind;
-	StringCchCopy(szDir, MAX_PATH, path);
-	StringCchCat(szDir, MAX_PATH, TEXT("\\*"));
-	hFind = FindFirstFile(szDir, &fdFile);
-	if (hFind == INVALID_HANDLE_VALUE)
+		for (i = 0; i < n; ++i)
+		{
+			if (completions[i].op == LIBFS_RING_READ_FILE && completions[i].data)
+			{
+				_LIBFS_FREE(completions[i].data);
+			}
+		}
+	}
+
+#ifdef LIBFS_HAVE_IO_URING
+	if (ring->use_uring)
 	{
-		return NULL;
+		/* Closing the ring cancels the requests left after an error */
+		fs_uring_destroy(&ring->uring);
+	}
+	else
+#endif
+	{
+		fs_thread_pool_destroy(&ring->pool);
 	}
 
-	it = (fs_win_directory_iterator *)_LIBFS_MALLOC(sizeof(fs_win_directory_iterator));
-	memset(it, 0, sizeof(fs_win_directory_iterator));
-	it->fdFile = fdFile;
-	it->hFind = hFind;
-	return (fs_directory_iterator *)it;
+#ifdef HAVE_PTHREAD_H
+	pthread_cond_destroy(&ring->completed);
+	pthread_mutex_destroy(&ring->lock);
+#endif
+	_LIBFS_FREE(ring);
 }
 
-LIBFS_PUBLIC(fs_directory_iterator *)
-fs_read_dir(fs_directory_iterator *it)
+/* Creates an operation, NULL if the ring is full */
+static fs_ring_task *fs_ring_task_new(fs_ring *ring, int type, const char *path, void *user)
 {
-	fs_win_directory_iterator *_it = (fs_win_directory_iterator *)it;
-
-	if (!_it->started)
+	fs_ring_task *op;
+	size_t length = strlen(path);
+	if (ring->in_flight >= ring->entries)
 	{
-		_it->started = LIBFS_TRUE;
+		return NULL;
 	}
-	else if (!FindNextFile(_it->hFind, &_it->fdFile))
+
+	op = (fs_ring_task *)_LIBFS_MALLOC(sizeof(fs_ring_task) + length);
+	if (!op)
 	{
 		return NULL;
 	}
 
-	_it->base.path = _it->fdFile.cFileName;
-	return it;
+	memset(op, 0, sizeof(fs_ring_task));
+	op->ring = ring;
+	op->type = type;
+	op->user = user;
+	memcpy(op->path, path, length + 1);
+	return op;
 }
 
-LIBFS_PUBLIC(void)
-fs_close_dir(fs_directory_iterator *it)
+static int fs_ring_submit(fs_ring *ring, fs_ring_task *op)
 {
-	fs_win_directory_iterator *_it = (fs_win_directory_iterator *)it;
-	FindClose(_it->hFind);
-	_LIBFS_FREE(_it);
+	ring->in_flight++;
+#ifdef LIBFS_HAVE_IO_URING
+	if (ring->use_uring)
+	{
+		op->fd = -1;
+		op->step = LIBFS_RING_STEP_OPEN;
+		fs_ring_uring_queue(ring, op);
+		return LIBFS_TRUE;
+	}
+#endif
+
+	op->base.fn = fs_ring_run;
+	fs_thread_pool_submit(&ring->pool, &op->base);
+	return LIBFS_TRUE;
 }
-#elif defined(HAVE_DIRENT_H)
-typedef struct fs_posix_directory_iterator
+
+LIBFS_PUBLIC(int)
+fs_ring_read_file(fs_ring *ring, const char *path, void *user)
 {
-	fs_directory_iterator base;
-	DIR *dir;
-	struct dirent *ent;
-} fs_posix_directory_iterator;
+	fs_ring_task *op = fs_ring_task_new(ring, LIBFS_RING_READ_FILE, path, user);
+	return op && fs_ring_submit(ring, op);
+}
 
-LIBFS_PUBLIC(fs_directory_iterator *)
-fs_open_dir(const char *path)
+LIBFS_PUBLIC(int)
+fs_ring_write_file(fs_ring *ring, const char *path, const void *buf, size_t size, void *user)
 {
-	fs_posix_directory_iterator *it;
-	DIR *d = opendir(path);
-	if (!d)
+	fs_ring_task *op = fs_ring_task_new(ring, LIBFS_RING_WRITE_FILE, path, user);
+	if (!op)
 	{
-		return NULL;
+		return LIBFS_FALSE;
 	}
 
-	it = (fs_posix_directory_iterator *)_LIBFS_MALLOC(sizeof(fs_posix_directory_iterator));
-	memset(it, 0, sizeof(fs_posix_directory_iterator));
-	it->dir = d;
-	return (fs_directory_iterator *)it;
+	op->data = (char *)buf;
+	op->size = size;
+	return fs_ring_submit(ring, op);
 }
 
-LIBFS_PUBLIC(fs_directory_iterator *)
-fs_read_dir(fs_directory_iterator *it)
+LIBFS_PUBLIC(int)
+fs_ring_read_range(fs_ring *ring, const char *path, off_t offset, void *buf, size_t size, void *user)
 {
-	fs_posix_directory_iterator *_it = (fs_posix_directory_iterator *)it;
-	if (!(_it->ent = readdir(_it->dir)))
+	fs_ring_task *op = fs_ring_task_new(ring, LIBFS_RING_READ_RANGE, path, user);
+	if (!op)
 	{
-		return NULL;
+		return LIBFS_FALSE;
 	}
 
-	_it->base.path = &_it->ent->d_name[0];
-	return it;
+	op->data = (char *)buf;
+	op->size = size;
+	op->offset = offset;
+	return fs_ring_submit(ring, op);
 }
 
-LIBFS_PUBLIC(void)
-fs_close_dir(fs_directory_iterator *it)
+LIBFS_PUBLIC(int)
+fs_ring_fsync(fs_ring *ring, const char *path, void *user)
 {
-	fs_posix_directory_iterator *_it = (fs_posix_directory_iterator *)it;
-	closedir(_it->dir);
-	_LIBFS_FREE(_it);
+	fs_ring_task *op = fs_ring_task_new(ring, LIBFS_RING_FSYNC, path, user);
+	return op && fs_ring_submit(ring, op);
+}
+
+LIBFS_PUBLIC(size_t)
+fs_ring_poll(fs_ring *ring, struct fs_ring_completion *completions, size_t count)
+{
+	fs_ring_task *op;
+	size_t n = 0;
+#ifdef LIBFS_HAVE_IO_URING
+	if (ring->use_uring)
+	{
+		fs_ring_uring_reap(ring);
+	}
+#endif
+
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_lock(&ring->lock);
+#endif
+	while (n < count && ring->head)
+	{
+		op = ring->head;
+		ring->head = op->next;
+		completions[n].user = op->user;
+		completions[n].op = op->type;
+		completions[n].error = op->error;
+		completions[n].data = op->data;
+		completions[n].size = op->done;
+		_LIBFS_FREE(op);
+		n++;
+	}
+
+	if (!ring->head)
+	{
+		ring->tail = NULL;
+	}
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_unlock(&ring->lock);
+#endif
+
+	ring->in_flight -= n;
+	return n;
 }
+
+LIBFS_PUBLIC(size_t)
+fs_ring_wait(fs_ring *ring, struct fs_ring_completion *completions, size_t count, size_t min)
+{
+	size_t n;
+	if (min > count)
+	{
+		min = count;
+	}
+
+	if (min > ring->in_flight)
+	{
+		min = ring->in_flight;
+	}
+
+	/* Operations left after polling are all running */
+	n = fs_ring_poll(ring, completions, count);
+	while (n < min)
+	{
+#ifdef LIBFS_HAVE_IO_URING
+		if (ring->use_uring)
+		{
+			if (!fs_uring_submit(&ring->uring, 1))
+			{
+				break;
+			}
+		}
+		else
 #endif
+		{
+#ifdef HAVE_PTHREAD_H
+			pthread_mutex_lock(&ring->lock);
+			while (!ring->head)
+			{
+				pthread_cond_wait(&ring->completed, &ring->lock);
+			}
+
+			pthread_mutex_unlock(&ring->lock);
+#endif
+		}
+
+		n += fs_ring_poll(ring, completions + n, count - n);
+	}
+
+	return n;
+}
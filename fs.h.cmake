@@ -18,6 +18,26 @@ extern "C"
 #cmakedefine HAVE_DIRENT_H 1
 #endif
 
+/* Define to 1 if you have the <fcntl.h> header file. */
+#ifndef HAVE_FCNTL_H
+#cmakedefine HAVE_FCNTL_H 1
+#endif
+
+/* Define to 1 if you have the <linux/fs.h> header file. */
+#ifndef HAVE_LINUX_FS_H
+#cmakedefine HAVE_LINUX_FS_H 1
+#endif
+
+/* Define to 1 if you have the <linux/io_uring.h> header file. */
+#ifndef HAVE_LINUX_IO_URING_H
+#cmakedefine HAVE_LINUX_IO_URING_H 1
+#endif
+
+/* Define to 1 if you have the <pthread.h> header file. */
+#ifndef HAVE_PTHREAD_H
+#cmakedefine HAVE_PTHREAD_H 1
+#endif
+
 /* Define to 1 if you have the <stddef.h> header file. */
 #ifndef HAVE_STDDEF_H
 #cmakedefine HAVE_STDDEF_H 1
@@ -43,11 +63,36 @@ extern "C"
 #cmakedefine HAVE_SYS_STAT_H 1
 #endif
 
+/* Define to 1 if you have the <sys/ioctl.h> header file. */
+#ifndef HAVE_SYS_IOCTL_H
+#cmakedefine HAVE_SYS_IOCTL_H 1
+#endif
+
+/* Define to 1 if you have the <sys/mman.h> header file. */
+#ifndef HAVE_SYS_MMAN_H
+#cmakedefine HAVE_SYS_MMAN_H 1
+#endif
+
 /* Define to 1 if you have the <sys/sendfile.h> header file. */
 #ifndef HAVE_SYS_SENDFILE_H
 #cmakedefine HAVE_SYS_SENDFILE_H 1
 #endif
 
+/* Define to 1 if you have the <sys/syscall.h> header file. */
+#ifndef HAVE_SYS_SYSCALL_H
+#cmakedefine HAVE_SYS_SYSCALL_H 1
+#endif
+
+/* Define to 1 if you have the <sys/sysmacros.h> header file. */
+#ifndef HAVE_SYS_SYSMACROS_H
+#cmakedefine HAVE_SYS_SYSMACROS_H 1
+#endif
+
+/* Define to 1 if you have the <sys/uio.h> header file. */
+#ifndef HAVE_SYS_UIO_H
+#cmakedefine HAVE_SYS_UIO_H 1
+#endif
+
 /* Define to 1 if you have the <string.h> header file. */
 #ifndef HAVE_STRING_H
 #cmakedefine HAVE_STRING_H 1
@@ -63,6 +108,46 @@ extern "C"
 #cmakedefine HAVE_WINDOWS_H 1
 #endif
 
+/* Define to 1 if you have the `copy_file_range' function. */
+#ifndef HAVE_COPY_FILE_RANGE
+#cmakedefine HAVE_COPY_FILE_RANGE 1
+#endif
+
+/* Define to 1 if you have the `fallocate' function. */
+#ifndef HAVE_FALLOCATE
+#cmakedefine HAVE_FALLOCATE 1
+#endif
+
+/* Define to 1 if you have the `readahead' function. */
+#ifndef HAVE_READAHEAD
+#cmakedefine HAVE_READAHEAD 1
+#endif
+
+/* Define to 1 if you have the `statx' function. */
+#ifndef HAVE_STATX
+#cmakedefine HAVE_STATX 1
+#endif
+
+/* Define to 1 if you have the `syncfs' function. */
+#ifndef HAVE_SYNCFS
+#cmakedefine HAVE_SYNCFS 1
+#endif
+
+/* Define to 1 if you have the `utimensat' function. */
+#ifndef HAVE_UTIMENSAT
+#cmakedefine HAVE_UTIMENSAT 1
+#endif
+
+/* Define to 1 if `struct stat' has the `st_mtim' member. */
+#ifndef HAVE_STRUCT_STAT_ST_MTIM
+#cmakedefine HAVE_STRUCT_STAT_ST_MTIM 1
+#endif
+
+/* Define to 1 if `struct stat' has the `st_mtimespec' member. */
+#ifndef HAVE_STRUCT_STAT_ST_MTIMESPEC
+#cmakedefine HAVE_STRUCT_STAT_ST_MTIMESPEC 1
+#endif
+
 /* Define to 1 if you have the `free' function. */
 #ifndef HAVE_FREE
 #cmakedefine HAVE_FREE 1
@@ -98,6 +183,11 @@ extern "C"
 #cmakedefine HAVE_SNPRINTF 1
 #endif
 
+/* Define to 1 if you have the `posix_fadvise' function. */
+#ifndef HAVE_POSIX_FADVISE
+#cmakedefine HAVE_POSIX_FADVISE 1
+#endif
+
 /* Define to 1 if you have the `vsnprintf' function. */
 #ifndef HAVE_VSNPRINTF
 #cmakedefine HAVE_VSNPRINTF 1
@@ -196,11 +286,24 @@ extern "C"
 
         /**  Custom free function. */
         void(LIBFS_CDECL *free_fn)(void *ptr);
+
+        /**
+         * Custom function allocating size bytes aligned on alignment, a
+         * power of two. NULL to align memory from malloc_fn.
+         */
+        void *(LIBFS_CDECL *aligned_malloc_fn)(size_t alignment, size_t size);
+
+        /** Custom function freeing memory from aligned_malloc_fn, NULL with it. */
+        void(LIBFS_CDECL *aligned_free_fn)(void *ptr);
     };
 
     /**
      * Register custom hooks.
      *
+     * The hooks are shared by the whole process and replacing them is not
+     * synchronized with other threads. Prefer the functions taking a
+     * fs_context to allocate with a specific allocator.
+     *
      * @code{.c}
      * struct fs_hooks hooks = { malloc, free };
      * fs_init_hooks(&hooks);
@@ -212,7 +315,126 @@ extern "C"
     fs_init_hooks(struct fs_hooks *hooks);
 
     /**
-     * Composes an absolute path.
+     * Allocates memory aligned on some power of two with the hooks.
+     *
+     * @code{.c}
+     * void* buf = fs_aligned_alloc(LIBFS_DIRECT_ALIGNMENT, 1024 * 1024);
+     * fs_aligned_free(buf);
+     * @endcode
+     *
+     * @param[in] alignment Some power of two
+     * @param[in] size Number of bytes
+     * @return The allocated memory, NULL on error.
+     */
+    LIBFS_PUBLIC(void *)
+    fs_aligned_alloc(size_t alignment, size_t size);
+
+    /**
+     * Frees memory from fs_aligned_alloc.
+     *
+     * @param[in] ptr Some memory from fs_aligned_alloc, or NULL
+     */
+    LIBFS_PUBLIC(void)
+    fs_aligned_free(void *ptr);
+
+    /**
+     * Allocator used by the functions taking a context, instead of the
+     * process-wide hooks.
+     *
+     * Each call can use its own context, such as an arena from
+     * fs_arena_context freeing everything at once with fs_arena_reset.
+     * Objects like iterators keep a copy of the context they were opened
+     * with to release their memory.
+     *
+     * @code{.c}
+     * struct fs_arena* arena = fs_arena_create(0);
+     * struct fs_context ctx;
+     * fs_arena_context(arena, &ctx);
+     * data = fs_read_file_ctx(&ctx, "foo.txt", &size, 0);
+     * fs_arena_reset(arena);
+     * @endcode
+     */
+    struct fs_context
+    {
+        /** Pointer passed to the functions below. */
+        void *user;
+
+        /** Allocates size bytes. */
+        void *(LIBFS_CDECL *malloc_fn)(void *user, size_t size);
+
+        /**
+         * Resizes memory from malloc_fn of old_size bytes to size bytes.
+         * NULL to allocate, copy and free.
+         */
+        void *(LIBFS_CDECL *realloc_fn)(void *user, void *ptr, size_t old_size, size_t size);
+
+        /** Frees memory from malloc_fn or realloc_fn. */
+        void(LIBFS_CDECL *free_fn)(void *user, void *ptr);
+
+        /**
+         * Allocates size bytes aligned on alignment, a power of two. NULL
+         * to align memory from malloc_fn.
+         */
+        void *(LIBFS_CDECL *aligned_malloc_fn)(void *user, size_t alignment, size_t size);
+
+        /** Frees memory from aligned_malloc_fn, NULL with it. */
+        void(LIBFS_CDECL *aligned_free_fn)(void *user, void *ptr);
+    };
+
+    /**
+     * Frees aligned memory allocated from a context, such as the content
+     * read by fs_read_file_ctx with LIBFS_IO_DIRECT.
+     *
+     * @param[in] ctx Context the memory is from, NULL for the hooks
+     * @param[in] ptr Some aligned memory, or NULL
+     */
+    LIBFS_PUBLIC(void)
+    fs_aligned_free_ctx(const struct fs_context *ctx, void *ptr);
+
+    /** Bump allocator releasing all its allocations at once. */
+    struct fs_arena;
+
+    /**
+     * Creates an arena.
+     *
+     * Memory is carved out of blocks allocated with the hooks, and freeing
+     * a single allocation does nothing. An arena is not thread-safe, use
+     * one per thread or per request.
+     *
+     * @param[in] block_size Size of the blocks, 0 for 64 KiB
+     * @return The arena, NULL on error.
+     */
+    LIBFS_PUBLIC(struct fs_arena *)
+    fs_arena_create(size_t block_size);
+
+    /**
+     * Fills a context allocating from an arena.
+     *
+     * @param[in] arena Some arena
+     * @param[out] ctx Context to fill
+     */
+    LIBFS_PUBLIC(void)
+    fs_arena_context(struct fs_arena *arena, struct fs_context *ctx);
+
+    /**
+     * Frees all the allocations of an arena, keeping one block for reuse.
+     *
+     * @param[in] arena Some arena
+     */
+    LIBFS_PUBLIC(void)
+    fs_arena_reset(struct fs_arena *arena);
+
+    /**
+     * Frees an arena and all its allocations.
+     *
+     * @param[in] arena Some arena, or NULL
+     */
+    LIBFS_PUBLIC(void)
+    fs_arena_destroy(struct fs_arena *arena);
+
+    /**
+     * Composes an absolute path. Links are resolved, so the path must
+     * exist. See fs_absolute_lexical for paths that may not.
      *
      * @code{.c}
      * char buf[MAX_PATH];
@@ -234,6 +456,53 @@ extern "C"
     LIBFS_PUBLIC(char *)
     fs_absolute(const char *path, char *buf, size_t size);
 
+    /**
+     * Normalizes a path without accessing the filesystem.
+     *
+     * Repeated separators and "." components are removed, and ".."
+     * removes the component before it. Leading ".." are kept in
+     * relative paths and dropped at the root of absolute ones. On
+     * Windows, both / and \\ are separators and are written as /,
+     * elsewhere \\ is a valid character in names.
+     * Links aren't resolved, so "link/.." may not be the directory
+     * containing link.
+     *
+     * @code{.c}
+     * char buf[MAX_PATH];
+     * fs_normalize("foo//bar/./../baz.txt", buf, MAX_PATH); // "foo/baz.txt"
+     * @endcode
+     *
+     * @param[in] path Some null-terminated path
+     * @param[out] buf Buffer for storing the result path, may be path
+     * @param[in] size Buffer size
+     * @return A pointer to buf if there is no error, NULL if buf is too
+     * small.
+     */
+    LIBFS_PUBLIC(char *)
+    fs_normalize(const char *path, char *buf, size_t size);
+
+    /**
+     * Composes an absolute path like fs_absolute, but lexically as
+     * fs_normalize does. The path doesn't need to exist.
+     *
+     * Relative paths are appended to the current directory, which is
+     * read once and cached. Call fs_invalidate_current_dir after
+     * changing the current directory.
+     *
+     * @param[in] path Some null-terminated path
+     * @param[out] buf Buffer for storing the result path, not path
+     * @param[in] size Buffer size
+     * @return A pointer to buf if there is no error, NULL otherwise.
+     */
+    LIBFS_PUBLIC(char *)
+    fs_absolute_lexical(const char *path, char *buf, size_t size);
+
+    /**
+     * Discards the current directory cached by fs_absolute_lexical.
+     */
+    LIBFS_PUBLIC(void)
+    fs_invalidate_current_dir(void);
+
     /**
      * Gets a pointer to the rightmost path separator.
      *
@@ -286,23 +555,157 @@ extern "C"
      *
      * @param[in] from Some null-terminated path to the source file, directory, or symlink
      * @param[in] to Some null-terminated path to the destination file, directory, or symlink
+     * @return If the copy succeeded.
      */
-    LIBFS_PUBLIC(void)
+    LIBFS_PUBLIC(int)
     fs_copy(const char *from, const char *to);
 
     /**
      * Copies file contents.
      *
+     * On Linux, the copy is done by the kernel with copy_file_range or
+     * sendfile when possible, so data never goes through user space.
+     *
      * @code{.c}
-     * fs_copy_file("foo.txt", "bar.txt");
+     * if (!fs_copy_file("foo.txt", "bar.txt"))
+     * {
+     *     printf("fs_copy_file failed");
+     * }
      * @endcode
      *
      * @param[in] from Some null-terminated path to the source file
      * @param[in] to Some null-terminated path to the destination file
+     * @return If the copy succeeded.
      */
-    LIBFS_PUBLIC(void)
+    LIBFS_PUBLIC(int)
     fs_copy_file(const char *from, const char *to);
 
+    /** Strategies used to copy file contents. */
+    enum fs_copy_method
+    {
+        /** Let libfs pick the fastest available strategy. */
+        LIBFS_COPY_AUTO = 0,
+        /** In-kernel copy with copy_file_range. */
+        LIBFS_COPY_RANGE,
+        /** In-kernel copy with sendfile. */
+        LIBFS_COPY_SENDFILE,
+        /** User space copy with a large read/write buffer. */
+        LIBFS_COPY_READ_WRITE,
+        /** Copy-on-write clone of the file extents (reflink). */
+        LIBFS_COPY_CLONE
+    };
+
+    /** Policies for cloning file extents instead of copying bytes. */
+    enum fs_clone_mode
+    {
+        /** Clone if the filesystem supports it, copy bytes otherwise. */
+        LIBFS_CLONE_AUTO = 0,
+        /** Never clone, always copy bytes. */
+        LIBFS_CLONE_NEVER,
+        /** Fail if the file can't be cloned. */
+        LIBFS_CLONE_ALWAYS
+    };
+
+    /** Struct for configuring fs_copy_file_ex. */
+    struct fs_copy_options
+    {
+        /**
+         * First strategy to try. When it is not supported, libfs falls back
+         * to the next ones in order: copy_file_range, sendfile, read/write.
+         * Extents are only cloned when this is LIBFS_COPY_AUTO or
+         * LIBFS_COPY_CLONE, or when clone is LIBFS_CLONE_ALWAYS.
+         */
+        enum fs_copy_method method;
+
+        /**
+         * If file extents should be cloned with FICLONE on filesystems
+         * supporting reflinks such as btrfs or XFS. A clone shares the data
+         * of the source until either file is modified, so it costs the
+         * same whatever the file size.
+         */
+        enum fs_clone_mode clone;
+
+        /**
+         * Combination of fs_io_flags. With LIBFS_IO_DIRECT, bytes are
+         * copied with read/write through an aligned buffer.
+         */
+        int flags;
+    };
+
+    /**
+     * Copies file contents with options.
+     *
+     * @code{.c}
+     * struct fs_copy_options options = { LIBFS_COPY_AUTO, LIBFS_CLONE_ALWAYS };
+     * enum fs_copy_method used;
+     * if (fs_copy_file_ex("foo.txt", "bar.txt", &options, &used))
+     * {
+     *     printf("copied with method %d", used);
+     * }
+     * @endcode
+     *
+     * @param[in] from Some null-terminated path to the source file
+     * @param[in] to Some null-terminated path to the destination file
+     * @param[in] options Copy options or NULL for defaults
+     * @param[out] used Strategy that copied the last bytes, may be NULL
+     * @return If the copy succeeded.
+     */
+    LIBFS_PUBLIC(int)
+    fs_copy_file_ex(const char *from, const char *to, const struct fs_copy_options *options, enum fs_copy_method *used);
+
+    /** Flags for configuring fs_copy_tree. */
+    enum fs_copy_tree_flags
+    {
+        /** Copy the permission bits of files and directories. */
+        LIBFS_COPY_TREE_PRESERVE_MODE = 1,
+        /** Copy the access and modification times of files and directories. */
+        LIBFS_COPY_TREE_PRESERVE_TIMES = 2
+    };
+
+    /** Struct for configuring fs_copy_tree. */
+    struct fs_copy_tree_options
+    {
+        /**
+         * Number of threads copying files. 0 uses one thread per
+         * online CPU and 1 copies everything from the calling thread.
+         */
+        size_t threads;
+
+        /** Combination of fs_copy_tree_flags. */
+        int flags;
+
+        /** Options used to copy each file. */
+        struct fs_copy_options copy;
+    };
+
+    /**
+     * Recursively copies a directory.
+     *
+     * The source tree is walked once from the calling thread, which
+     * creates the directories and hands file copies to a pool of
+     * worker threads. Symbolic links are recreated, replacing existing
+     * links with another target, and other special files are skipped.
+     * Copying a directory into itself fails with
+     * errno set to EINVAL, as cp refuses it.
+     *
+     * @code{.c}
+     * struct fs_copy_tree_options options;
+     * memset(&options, 0, sizeof(options));
+     * options.flags = LIBFS_COPY_TREE_PRESERVE_MODE | LIBFS_COPY_TREE_PRESERVE_TIMES;
+     * if (!fs_copy_tree("./foo", "./bar", &options))
+     * {
+     *     printf("fs_copy_tree failed");
+     * }
+     * @endcode
+     *
+     * @param[in] from Some null-terminated path to the source directory
+     * @param[in] to Some null-terminated path to the destination directory
+     * @param[in] options Copy options or NULL for defaults
+     * @return If the whole tree was copied.
+     */
+    LIBFS_PUBLIC(int)
+    fs_copy_tree(const char *from, const char *to, const struct fs_copy_tree_options *options);
+
     /**
      * Get the current working directory.
      *
@@ -345,11 +748,139 @@ extern "C"
      * @param[in] size Buffer size
      * @param[in] left Left part null-terminated path
      * @param[in] right Right part null-terminated path
-     * @return The number of bytes written to buf.
+     * @return The number of bytes that would have been written if
+     * buf was large enough (excluding the null-terminating character).
+     * The result is truncated when this is greater than or equal to size.
      */
     LIBFS_PUBLIC(size_t)
     fs_join_path(char *buf, size_t size, const char *left, const char *right);
 
+    /**
+     * Path built in place by pushing and popping components.
+     *
+     * Each operation only touches the component it adds or removes,
+     * so walking a tree with a single fs_path doesn't copy the parent
+     * path for every entry. Operations that don't fit leave the path
+     * unchanged and return false. Backslashes are only separators on
+     * Windows.
+     *
+     * @code{.c}
+     * struct fs_path path;
+     * fs_path_init(&path, NULL, 0);
+     * fs_path_set(&path, "foo");
+     * fs_path_push(&path, "bar.txt");
+     * fs_path_set_extension(&path, ".md");
+     * printf("%s", path.data);
+     * fs_path_free(&path);
+     * @endcode
+     */
+    struct fs_path
+    {
+        /** Null-terminated path. */
+        char *data;
+        /** Length of the path excluding the null-terminating character. */
+        size_t length;
+        /** Size of data in bytes. */
+        size_t capacity;
+        /** Non-zero if data is allocated and grown by libfs. */
+        int growable;
+    };
+
+    /**
+     * Initializes an empty path.
+     *
+     * @param[out] path Path to initialize
+     * @param[in] buf Fixed buffer used for the path, or NULL to allocate
+     * and grow it as needed
+     * @param[in] size Buffer size
+     */
+    LIBFS_PUBLIC(void)
+    fs_path_init(struct fs_path *path, char *buf, size_t size);
+
+    /**
+     * Frees the memory allocated for a path and empties it.
+     *
+     * @param[in] path Some path
+     */
+    LIBFS_PUBLIC(void)
+    fs_path_free(struct fs_path *path);
+
+    /**
+     * Replaces a path.
+     *
+     * @param[in] path Some path
+     * @param[in] value Null-terminated path
+     * @return If the path was set, false if it doesn't fit.
+     */
+    LIBFS_PUBLIC(int)
+    fs_path_set(struct fs_path *path, const char *value);
+
+    /**
+     * Appends a component, preceded by a separator unless the path is
+     * empty or already ends with one.
+     *
+     * @param[in] path Some path
+     * @param[in] component Null-terminated component
+     * @return If the component was appended, false if it doesn't fit.
+     */
+    LIBFS_PUBLIC(int)
+    fs_path_push(struct fs_path *path, const char *component);
+
+    /**
+     * Removes the last component to get the parent directory, in the
+     * same way as fs_dirname except that the root separator is kept.
+     *
+     * @code{.c}
+     * fs_path_set(&path, "/foo/bar");
+     * fs_path_pop(&path); // "/foo"
+     * fs_path_pop(&path); // "/"
+     * fs_path_pop(&path); // false
+     * @endcode
+     *
+     * @param[in] path Some path
+     * @return If a component was removed.
+     */
+    LIBFS_PUBLIC(int)
+    fs_path_pop(struct fs_path *path);
+
+    /**
+     * Replaces the extension of the last component. Names starting
+     * with a dot, such as ".bashrc", have no extension.
+     *
+     * @param[in] path Some path
+     * @param[in] extension Null-terminated extension including the
+     * leading dot, or an empty string to remove it
+     * @return If the extension was replaced, false if it doesn't fit
+     * or the path doesn't end with a name.
+     */
+    LIBFS_PUBLIC(int)
+    fs_path_set_extension(struct fs_path *path, const char *extension);
+
+    /**
+     * Shortens a path to a length it had before, such as the length
+     * saved before pushing components.
+     *
+     * @param[in] path Some path
+     * @param[in] length New length, ignored if not shorter
+     */
+    LIBFS_PUBLIC(void)
+    fs_path_truncate(struct fs_path *path, size_t length);
+
+    /** Types of filesystem entries. */
+    enum fs_file_type
+    {
+        /** The type is not known yet. */
+        LIBFS_TYPE_UNKNOWN = 0,
+        /** Regular file. */
+        LIBFS_TYPE_FILE,
+        /** Directory. */
+        LIBFS_TYPE_DIRECTORY,
+        /** Symbolic link. */
+        LIBFS_TYPE_SYMLINK,
+        /** Other special file such as a pipe, socket or device. */
+        LIBFS_TYPE_OTHER
+    };
+
     /**
      * Checks if a path corresponds to an existing file or directory.
      *
@@ -444,278 +975,1276 @@ extern "C"
     LIBFS_PUBLIC(int)
     fs_is_symlink(const char *path);
 
+    /** Fields of fs_stat_result requested from fs_stat. */
+    enum fs_stat_fields
+    {
+        /** Type of the file. */
+        LIBFS_STAT_TYPE = 1,
+        /** Permission bits. */
+        LIBFS_STAT_MODE = 2,
+        /** Size in bytes. */
+        LIBFS_STAT_SIZE = 4,
+        /** Last modification time. */
+        LIBFS_STAT_MTIME = 8,
+        /** Last status change time. */
+        LIBFS_STAT_CTIME = 16,
+        /** Inode and device numbers. */
+        LIBFS_STAT_INODE = 32,
+        /** Number of hard links. */
+        LIBFS_STAT_NLINK = 64,
+        /** Number of 512 bytes blocks allocated. */
+        LIBFS_STAT_BLOCKS = 128,
+        /** All of the above. */
+        LIBFS_STAT_ALL = 255
+    };
+
+    /** Time with nanoseconds. */
+    struct fs_timespec
+    {
+        /** Seconds since the Epoch. */
+        time_t sec;
+
+        /** Nanoseconds. */
+        long nsec;
+    };
+
+    /** Metadata of a file returned by fs_stat. */
+    struct fs_stat_result
+    {
+        /**
+         * Combination of fs_stat_fields that were filled. It can include
+         * fields that were not requested, and lack fields the system
+         * doesn't support.
+         */
+        int fields;
+
+        /** Type of the file. */
+        enum fs_file_type type;
+
+        /** Permission bits. */
+        unsigned int mode;
+
+        /** Size in bytes. */
+        off_t size;
+
+        /** Last modification time. */
+        struct fs_timespec mtime;
+
+        /** Last status change time. */
+        struct fs_timespec ctime;
+
+        /** Inode number. */
+        ino_t inode;
+
+        /** Device containing the file. */
+        dev_t dev;
+
+        /** Number of hard links. */
+        unsigned long nlink;
+
+        /** Number of 512 bytes blocks allocated. */
+        off_t blocks;
+    };
+
     /**
-     * Writes file content to buffer.
+     * Gets the metadata of a file in a single system call.
+     *
+     * On Linux, statx only retrieves the requested fields, which can
+     * save work on network filesystems. Symbolic links are followed.
      *
      * @code{.c}
-     * void buf[1024];
-     * fs_read_file("foo.txt", buf, 1024);
+     * struct fs_stat_result st;
+     * if (fs_stat("foo.txt", &st, LIBFS_STAT_SIZE | LIBFS_STAT_MTIME))
+     * {
+     *     printf("%ld bytes", (long)st.size);
+     * }
      * @endcode
      *
-     * @param[in] path Some null-terminated path to existing file
-     * @param[in] buf Some memory buffer
-     * @param[in] size Buffer size
-     * @return The number of bytes that would have been readen if
-     * buf was large enough (excluding the null-terminating character).
+     * @param[in] path Some null-terminated path
+     * @param[out] st Metadata of the file
+     * @param[in] fields Combination of fs_stat_fields to retrieve
+     * @return If the file exists and its metadata was read.
      */
-    LIBFS_PUBLIC(size_t)
-    fs_read_file_buffer(const char *path, void *buf, size_t size);
+    LIBFS_PUBLIC(int)
+    fs_stat(const char *path, struct fs_stat_result *st, int fields);
 
     /**
-     * Reads a whole file content.
+     * Same as fs_stat but symbolic links are not followed.
      *
      * @code{.c}
-     * int size;
-     * void* buf;
-     * if (!(buf = fs_read_file("foo.txt", &size)))
+     * struct fs_stat_result st;
+     * if (fs_lstat("foo", &st, LIBFS_STAT_TYPE) && st.type == LIBFS_TYPE_SYMLINK)
      * {
-     *     printf("fs_read_file failed");
-     * }
-     * else
-     * {
-     *     printf("file size: %d", size);
+     *     printf("foo is a symbolic link");
      * }
      * @endcode
      *
-     * @param[in] path Some null-terminated path to existing file
-     * @param[out] size Number of bytes read
-     * @return A pointer to read bytes if there is no error, NULL otherwise.
+     * @param[in] path Some null-terminated path
+     * @param[out] st Metadata of the file or link
+     * @param[in] fields Combination of fs_stat_fields to retrieve
+     * @return If the file exists and its metadata was read.
      */
-    LIBFS_PUBLIC(void *)
-    fs_read_file(const char *path, size_t *size);
+    LIBFS_PUBLIC(int)
+    fs_lstat(const char *path, struct fs_stat_result *st, int fields);
+
+    /** Flags for fs_stat_many. */
+    enum fs_stat_many_flags
+    {
+        /** Runs on a pool of threads even if io_uring is available. */
+        LIBFS_STAT_MANY_THREADS = 1
+    };
 
     /**
-     * Writes content to file.
+     * Gets the metadata of many files at once.
+     *
+     * On Linux, statx requests are submitted in batches to an io_uring
+     * so hundreds of lookups overlap instead of waiting for each other.
+     * Elsewhere, when io_uring is not available, or with
+     * LIBFS_STAT_MANY_THREADS, the paths are split among a pool of
+     * threads.
      *
      * @code{.c}
-     * const char* buf = "hello";
-     * if (!fs_write_file("foo.txt", buf, 5))
+     * const char* paths[] = { "foo.txt", "bar.txt" };
+     * struct fs_stat_result results[2];
+     * if (fs_stat_many(paths, 2, results, LIBFS_STAT_SIZE, 0) != 2)
      * {
-     *     printf("fs_write_file failed");
+     *     printf("some files are missing");
      * }
      * @endcode
      *
-     * @param[in] path Some null-terminated path
-     * @param[in] buf Some memory buffer
-     * @param[in] size Buffer size
-     * @return If the file was written.
+     * @param[in] paths Array of null-terminated paths
+     * @param[in] count Number of paths
+     * @param[out] results Array receiving the metadata of each path, with
+     * fields set to 0 for paths that could not be read
+     * @param[in] fields Combination of fs_stat_fields to retrieve
+     * @param[in] flags Combination of fs_stat_many_flags
+     * @return The number of paths whose metadata was read.
      */
-    LIBFS_PUBLIC(int)
-    fs_write_file(const char *path, const void *buf, size_t size);
+    LIBFS_PUBLIC(size_t)
+    fs_stat_many(const char *const *paths, size_t count, struct fs_stat_result *results, int fields, int flags);
 
     /**
-     * @struct fs_file_iterator
-     * Struct used to iterate over a file.
+     * Writes file content to buffer.
      *
-     * @code{.c}
-     * struct fs_file_iterator* it = fs_iter_file("foo.txt");
-     * char c;
+     * The content is truncated to fit buf with its null-terminating
+     * character, which the result tells.
      *
-     * while(fs_next_char(it, &c))
+     * @code{.c}
+     * char buf[1024];
+     * if (fs_read_file_buffer("foo.txt", buf, 1024) >= 1024)
      * {
-     *     printf("%c", c);
+     *     printf("foo.txt was truncated");
      * }
-     *
-     * fs_close_file(it);
      * @endcode
+     *
+     * @param[in] path Some null-terminated path to existing file
+     * @param[in] buf Some memory buffer
+     * @param[in] size Buffer size
+     * @return The number of bytes that would have been readen if
+     * buf was large enough (excluding the null-terminating character),
+     * greater than or equal to size if the content was truncated.
      */
-    struct fs_file_iterator;
+    LIBFS_PUBLIC(size_t)
+    fs_read_file_buffer(const char *path, void *buf, size_t size);
 
     /**
-     * Opens a file to iterate over its content.
+     * Growable buffer reused between reads.
+     *
+     * Zero it before first use and release it with fs_free_buffer.
      *
      * @code{.c}
-     * struct fs_file_iterator* it = fs_iter_file("foo.txt");
+     * struct fs_buffer buf = { 0 };
+     * fs_read_file_into("foo.txt", &buf);
+     * fs_read_file_into("bar.txt", &buf);
+     * fs_free_buffer(&buf);
+     * @endcode
+     */
+    struct fs_buffer
+    {
+        /** Content, followed by a null-terminating character. */
+        char *data;
+
+        /** Size of the content, in bytes. */
+        size_t size;
+
+        /** Size of the allocated memory, in bytes. */
+        size_t capacity;
+    };
+
+    /**
+     * Reads a whole file content into a reusable buffer.
      *
-     * // iterate file
+     * The buffer is only reallocated when the file doesn't fit, and then
+     * at least doubles, so reading many files allocates a handful of
+     * times. The content is never truncated.
      *
-     * fs_close_file(it);
+     * @code{.c}
+     * struct fs_buffer buf = { 0 };
+     * for (i = 0; i < count; ++i)
+     * {
+     *     if (fs_read_file_into(paths[i], &buf))
+     *     {
+     *         fwrite(buf.data, 1, buf.size, stdout);
+     *     }
+     * }
+     * fs_free_buffer(&buf);
      * @endcode
      *
-     * @param[in] path Some null-terminated path
-     * @return A pointer for iterating over the file if there is no error,
-     * NULL otherwise.
+     * @param[in] path Some null-terminated path to existing file
+     * @param[in,out] buf Buffer receiving the content
+     * @return If the file was read. On error, size is 0.
      */
-    LIBFS_PUBLIC(struct fs_file_iterator *)
-    fs_iter_file(const char *path);
+    LIBFS_PUBLIC(int)
+    fs_read_file_into(const char *path, struct fs_buffer *buf);
 
     /**
-     * Iterates over the next char of a file.
+     * Frees the memory of a buffer and zeroes it.
+     *
+     * @param[in] buf Some buffer
+     */
+    LIBFS_PUBLIC(void)
+    fs_free_buffer(struct fs_buffer *buf);
+
+    /**
+     * Reads a whole file content.
      *
      * @code{.c}
-     * char c;
-     * while(fs_next_char(it, &c))
+     * int size;
+     * void* buf;
+     * if (!(buf = fs_read_file("foo.txt", &size)))
      * {
-     *     printf("%c", c);
+     *     printf("fs_read_file failed");
+     * }
+     * else
+     * {
+     *     printf("file size: %d", size);
      * }
      * @endcode
      *
-     * @param[in] it Some opened file iterator
-     * @param[out] c Character read
-     * @return The same it pointer or NULL if an error occurred or there
-     * is no more entry to iterate over.
+     * @param[in] path Some null-terminated path to existing file
+     * @param[out] size Number of bytes read
+     * @return A pointer to read bytes if there is no error, NULL otherwise.
      */
-    LIBFS_PUBLIC(struct fs_file_iterator *)
-    fs_next_char(struct fs_file_iterator *it, char *c);
+    LIBFS_PUBLIC(void *)
+    fs_read_file(const char *path, size_t *size);
+
+/**
+ * Alignment of the buffers, offsets and sizes of unbuffered reads and
+ * writes.
+ */
+#define LIBFS_DIRECT_ALIGNMENT 4096
+
+    /** Flags for reading and writing files. */
+    enum fs_io_flags
+    {
+        /**
+         * Bypasses the page cache with O_DIRECT so bulk transfers don't
+         * evict other cached data. Buffers are aligned on
+         * LIBFS_DIRECT_ALIGNMENT and the unaligned end of a file goes
+         * through the cache. Ignored where O_DIRECT is not available or
+         * rejected, such as on tmpfs.
+         */
+        LIBFS_IO_DIRECT = 1,
+        /** Hint that the file is read from start to end, doubling readahead. */
+        LIBFS_IO_SEQUENTIAL = 2,
+        /** Hint that the file is read at random offsets, disabling readahead. */
+        LIBFS_IO_RANDOM = 4,
+        /**
+         * Drops the file from the page cache once read, for data that is
+         * used only once. Unlike LIBFS_IO_DIRECT, this has no alignment
+         * requirements but also evicts pages cached by other readers.
+         */
+        LIBFS_IO_ONCE = 8
+    };
 
     /**
-     * Closes and frees an opened file iterator.
+     * Reads a whole file content with flags.
+     *
+     * With LIBFS_IO_DIRECT, the content is read into memory from
+     * fs_aligned_alloc, to be released with fs_aligned_free. Other flags
+     * are hints passed to posix_fadvise where available.
      *
      * @code{.c}
-     * struct fs_file_iterator* it = fs_iter_file("foo.txt");
+     * size_t size;
+     * void* buf = fs_read_file_ex("foo.bin", &size, LIBFS_IO_DIRECT);
+     * fs_aligned_free(buf);
+     * @endcode
      *
-     * // iterate file
+     * @param[in] path Some null-terminated path to existing file
+     * @param[out] size Number of bytes read
+     * @param[in] flags Combination of fs_io_flags
+     * @return A pointer to read bytes if there is no error, NULL otherwise.
+     */
+    LIBFS_PUBLIC(void *)
+    fs_read_file_ex(const char *path, size_t *size, int flags);
+
+    /**
+     * Reads a whole file content into memory from a context.
      *
-     * fs_close_file(it);
+     * @code{.c}
+     * size_t size;
+     * void* buf = fs_read_file_ctx(&ctx, "foo.txt", &size, 0);
+     * ctx.free_fn(ctx.user, buf);
      * @endcode
      *
-     * @param[in] it Some opened file iterator
+     * With LIBFS_IO_DIRECT, the memory is aligned and must be released
+     * with fs_aligned_free_ctx.
+     *
+     * @param[in] ctx Context to allocate from, NULL for the hooks
+     * @param[in] path Some null-terminated path to existing file
+     * @param[out] size Number of bytes read
+     * @param[in] flags Combination of fs_io_flags
+     * @return A pointer to read bytes if there is no error, NULL otherwise.
      */
-    LIBFS_PUBLIC(void)
-    fs_close_file(struct fs_file_iterator *it);
+    LIBFS_PUBLIC(void *)
+    fs_read_file_ctx(const struct fs_context *ctx, const char *path, size_t *size, int flags);
 
     /**
-     * Gets the absolute path to the platform specific temporary directory.
+     * @struct fs_prefetch_batch
+     * Files being prefetched in the background by fs_prefetch.
+     */
+    struct fs_prefetch_batch;
+
+    /**
+     * Warms up the page cache with the content of many files, in the
+     * background.
+     *
+     * Each file is opened and its content is queued for reading with
+     * readahead or posix_fadvise(POSIX_FADV_WILLNEED). Files are opened
+     * from a pool of threads to overlap the lookups of their metadata,
+     * and the call returns right away, so the caller can start reading
+     * the first files while the next ones are warmed up. The paths are
+     * copied. Without threads, the files are opened before returning.
+     * Does nothing but open the files where these hints are not
+     * available.
+     *
+     * Call fs_prefetch_wait to wait for the batch and free it. Calling
+     * it right after fs_prefetch blocks until every file was opened.
      *
      * @code{.c}
-     * char buf[MAX_PATH];
-     * if (!fs_temp_dir(buf, MAX_PATH))
-     * {
-     *     printf("fs_temp_dir failed");
-     * }
-     * else
-     * {
-     *     printf("%s", buf);
-     * }
+     * const char* paths[] = { "foo.txt", "bar.txt" };
+     * struct fs_prefetch_batch* batch = fs_prefetch(paths, 2);
+     * data = fs_read_file("foo.txt", &size);
+     * fs_prefetch_wait(batch);
      * @endcode
      *
-     * @param[in] buf Buffer for storing the result path
-     * @param[in] size Buffer size
-     * @return A pointer to buf if there is no error, NULL otherwise.
+     * @param[in] paths Array of null-terminated paths
+     * @param[in] count Number of paths
+     * @return A batch to pass to fs_prefetch_wait, NULL if it couldn't be
+     * allocated.
      */
-    LIBFS_PUBLIC(char *)
-    fs_temp_dir(char *buf, size_t size);
+    LIBFS_PUBLIC(struct fs_prefetch_batch *)
+    fs_prefetch(const char *const *paths, size_t count);
 
     /**
-     * Deletes an empty directory if it exists.
+     * Waits for the files of fs_prefetch to be opened and frees the batch.
      *
-     * @code
-     * if (!fs_delete_dir("foo"))
+     * @param[in] batch Batch returned by fs_prefetch, may be NULL
+     * @return The number of files that could be opened.
+     */
+    LIBFS_PUBLIC(size_t)
+    fs_prefetch_wait(struct fs_prefetch_batch *batch);
+
+    /** Flags for configuring fs_map_file. */
+    enum fs_map_flags
+    {
+        /** Prefault the whole mapping with MAP_POPULATE. */
+        LIBFS_MAP_POPULATE = 1,
+        /** Hint that the content will be read sequentially. */
+        LIBFS_MAP_SEQUENTIAL = 2,
+        /** Hint that the whole content will be needed soon. */
+        LIBFS_MAP_WILLNEED = 4,
+        /** Back the mapping with transparent huge pages when possible. */
+        LIBFS_MAP_HUGE_PAGES = 8
+    };
+
+    /**
+     * Read-only view over the content of a file.
+     *
+     * @code{.c}
+     * struct fs_file_view view;
+     * if (fs_map_file("foo.txt", &view, 0))
      * {
-     *     printf("fs_delete_dir failed");
+     *     fwrite(view.data, 1, view.size, stdout);
+     *     fs_unmap_file(&view);
      * }
      * @endcode
-     * @param[in] path Some null-terminated path
-     * @return If the directory was deleted.
      */
-    LIBFS_PUBLIC(int)
-    fs_delete_dir(const char *path);
+    struct fs_file_view
+    {
+        /** Content of the file. */
+        const void *data;
+
+        /** Size of the content, in bytes. */
+        size_t size;
+
+        /** If data is mapped in memory or was read into an allocated buffer. */
+        int mapped;
+    };
 
     /**
-     * Deletes a file if it exists.
+     * Maps a whole file in memory.
      *
-     * @code
-     * if (!fs_delete_file("foo.txt"))
+     * Regular files are mapped read-only so their pages are shared with
+     * the page cache and other processes. Empty and non-regular files
+     * can't be mapped and are read with fs_read_file instead.
+     *
+     * @code{.c}
+     * struct fs_file_view view;
+     * if (!fs_map_file("foo.txt", &view, LIBFS_MAP_SEQUENTIAL))
      * {
-     *     printf("fs_delete_file failed");
+     *     printf("fs_map_file failed");
      * }
      * @endcode
-     * @param[in] path Some null-terminated path
-     * @return If the file was deleted.
+     *
+     * @param[in] path Some null-terminated path to existing file
+     * @param[out] view View over the file content
+     * @param[in] flags Combination of fs_map_flags
+     * @return If the file was mapped or read.
      */
     LIBFS_PUBLIC(int)
-    fs_delete_file(const char *path);
+    fs_map_file(const char *path, struct fs_file_view *view, int flags);
 
     /**
-     * Creates a directory if it doesn't exist.
+     * Releases a view obtained with fs_map_file.
      *
-     * The parent directory must exist as it will not
-     * be created recursively.
+     * @code{.c}
+     * fs_unmap_file(&view);
+     * @endcode
      *
-     * @code
-     * if (!fs_make_dir("foo"))
+     * @param[in] view Some view over a file content
+     */
+    LIBFS_PUBLIC(void)
+    fs_unmap_file(struct fs_file_view *view);
+
+    /**
+     * Writes content to file.
+     *
+     * @code{.c}
+     * const char* buf = "hello";
+     * if (!fs_write_file("foo.txt", buf, 5))
      * {
-     *     printf("fs_make_dir failed");
+     *     printf("fs_write_file failed");
      * }
      * @endcode
+     *
      * @param[in] path Some null-terminated path
-     * @return If the directory was created.
+     * @param[in] buf Some memory buffer
+     * @param[in] size Buffer size
+     * @return If the file was written.
      */
     LIBFS_PUBLIC(int)
-    fs_make_dir(const char *path);
+    fs_write_file(const char *path, const void *buf, size_t size);
 
     /**
-     * Struct used to iterate over a directory.
+     * Writes content to file with flags.
      *
-     * @code{.c}
-     * struct fs_directory_iterator* it = fs_open_dir("./somedir");
+     * With LIBFS_IO_DIRECT, buf is written without copies if it is
+     * aligned on LIBFS_DIRECT_ALIGNMENT, and through an aligned buffer
+     * otherwise.
      *
-     * while(fs_read_dir(it))
+     * @code{.c}
+     * if (!fs_write_file_ex("foo.bin", buf, size, LIBFS_IO_DIRECT))
      * {
-     *     printf("%s", it->path);
+     *     printf("fs_write_file_ex failed");
      * }
-     *
-     * fs_close_dir(it);
      * @endcode
+     *
+     * @param[in] path Some null-terminated path
+     * @param[in] buf Some memory buffer
+     * @param[in] size Buffer size
+     * @param[in] flags Combination of fs_io_flags
+     * @return If the file was written.
      */
-    struct fs_directory_iterator
+    LIBFS_PUBLIC(int)
+    fs_write_file_ex(const char *path, const void *buf, size_t size, int flags);
+
+    /** Buffer of a vectored read or write. */
+    struct fs_iovec
     {
-        /** Path to file. */
-        const char *path;
+        /** Start of the buffer. */
+        void *data;
+
+        /** Size of the buffer. */
+        size_t size;
     };
 
     /**
-     * Gets an iterator over entries of a directory.
+     * Writes the content of many buffers to a file, one after another.
      *
-     * @code{.c}
-     * struct fs_directory_iterator* it = fs_open_dir("./somedir");
+     * Uses writev where available so the buffers don't have to be copied
+     * into a single one first.
      *
-     * while(fs_read_dir(it))
+     * @code{.c}
+     * struct fs_iovec iov[2];
+     * iov[0].data = header;
+     * iov[0].size = header_size;
+     * iov[1].data = body;
+     * iov[1].size = body_size;
+     * if (!fs_write_filev("foo.bin", iov, 2))
      * {
-     *     printf("%s", it->path);
+     *     printf("fs_write_filev failed");
      * }
-     *
-     * fs_close_dir(it);
      * @endcode
      *
      * @param[in] path Some null-terminated path
-     * @return A pointer for iterating over the directory if there is no error, NULL otherwise.
+     * @param[in] iov Array of buffers to write
+     * @param[in] count Number of buffers
+     * @return If the file was written.
      */
-    LIBFS_PUBLIC(struct fs_directory_iterator *)
-    fs_open_dir(const char *path);
+    LIBFS_PUBLIC(int)
+    fs_write_filev(const char *path, const struct fs_iovec *iov, size_t count);
 
     /**
-     * Iterates over the next entry of a directory.
-     *
-     * @code{.c}
-     * struct fs_directory_iterator* it = fs_open_dir("./somedir");
+     * Reads the beginning of a file into many buffers, one after another.
      *
-     * while(fs_read_dir(it))
-     * {
-     *     printf("%s", it->path);
-     * }
+     * Uses readv where available. Reading stops once the buffers are full
+     * or at the end of the file.
      *
-     * fs_close_dir(it);
+     * @code{.c}
+     * char header[16];
+     * char body[1024];
+     * size_t readen;
+     * struct fs_iovec iov[2];
+     * iov[0].data = header;
+     * iov[0].size = sizeof(header);
+     * iov[1].data = body;
+     * iov[1].size = sizeof(body);
+     * fs_read_filev("foo.bin", iov, 2, &readen);
      * @endcode
      *
-     * @param[in] it Some opened directory iterator
-     * @return The same it pointer or NULL if an error occurred or there is no more entry to iterate over.
+     * @param[in] path Some null-terminated path to existing file
+     * @param[in] iov Array of buffers to fill
+     * @param[in] count Number of buffers
+     * @param[out] readen Number of bytes read, can be NULL
+     * @return If the file was read.
      */
-    LIBFS_PUBLIC(struct fs_directory_iterator *)
-    fs_read_dir(struct fs_directory_iterator *it);
+    LIBFS_PUBLIC(int)
+    fs_read_filev(const char *path, const struct fs_iovec *iov, size_t count, size_t *readen);
 
     /**
-     * Closes and frees an opened directory iterator.
+     * Writes content to file so that a crash leaves either the old or the
+     * new content.
      *
-     * @code{.c}
-     * struct fs_directory_iterator* it = fs_open_dir("./somedir");
+     * The content is written to a temporary file next to path, flushed to
+     * the storage and renamed over path, then the directory is flushed so
+     * the rename itself is durable. Use fs_atomic_batch to write many
+     * files with fewer flushes.
      *
-     * while(fs_read_dir(it))
+     * @code{.c}
+     * const char* buf = "hello";
+     * if (!fs_write_file_atomic("foo.txt", buf, 5))
      * {
-     *     printf("%s", it->path);
+     *     printf("fs_write_file_atomic failed");
      * }
-     *
-     * fs_close_dir(it);
+     * @endcode
+     *
+     * @param[in] path Some null-terminated path
+     * @param[in] buf Some memory buffer
+     * @param[in] size Buffer size
+     * @return If the file was written and flushed.
+     */
+    LIBFS_PUBLIC(int)
+    fs_write_file_atomic(const char *path, const void *buf, size_t size);
+
+    /**
+     * Group of atomic writes sharing their flushes.
+     *
+     * Each write goes to a temporary file. On commit, a single syncfs per
+     * filesystem makes all of them durable before any is renamed over its
+     * target, then each directory is flushed once. Writing thousands of
+     * files costs a few flushes instead of two per file. Without syncfs,
+     * each temporary file is flushed when written. Note that syncfs also
+     * flushes unrelated data written to the same filesystem.
+     *
+     * @code{.c}
+     * struct fs_atomic_batch* batch = fs_atomic_batch_create();
+     * fs_atomic_batch_write(batch, "a.txt", "a", 1);
+     * fs_atomic_batch_write(batch, "b.txt", "b", 1);
+     * if (!fs_atomic_batch_commit(batch))
+     * {
+     *     printf("fs_atomic_batch_commit failed");
+     * }
+     *
+     * fs_atomic_batch_destroy(batch);
+     * @endcode
+     */
+    struct fs_atomic_batch;
+
+    /**
+     * Creates an empty group of atomic writes.
+     *
+     * @return The new batch, NULL on error.
+     */
+    LIBFS_PUBLIC(struct fs_atomic_batch *)
+    fs_atomic_batch_create(void);
+
+    /**
+     * Writes content to a temporary file replacing path on commit.
+     *
+     * @param[in] batch Some batch
+     * @param[in] path Some null-terminated path
+     * @param[in] buf Some memory buffer
+     * @param[in] size Buffer size
+     * @return If the temporary file was written.
+     */
+    LIBFS_PUBLIC(int)
+    fs_atomic_batch_write(struct fs_atomic_batch *batch, const char *path, const void *buf, size_t size);
+
+    /**
+     * Flushes and renames the files written to a batch, which is emptied
+     * and can be reused.
+     *
+     * If flushing fails, no file is replaced.
+     *
+     * @param[in] batch Some batch
+     * @return If every file was replaced and flushed.
+     */
+    LIBFS_PUBLIC(int)
+    fs_atomic_batch_commit(struct fs_atomic_batch *batch);
+
+    /**
+     * Deletes the temporary files of uncommitted writes and destroys a
+     * batch.
+     *
+     * @param[in] batch Some batch
+     */
+    LIBFS_PUBLIC(void)
+    fs_atomic_batch_destroy(struct fs_atomic_batch *batch);
+
+    /**
+     * @struct fs_file_iterator
+     * Struct used to iterate over a file.
+     *
+     * @code{.c}
+     * struct fs_file_iterator* it = fs_iter_file("foo.txt");
+     * char c;
+     *
+     * while(fs_next_char(it, &c))
+     * {
+     *     printf("%c", c);
+     * }
+     *
+     * fs_close_file(it);
+     * @endcode
+     */
+    struct fs_file_iterator;
+
+    /**
+     * Opens a file to iterate over its content.
+     *
+     * @code{.c}
+     * struct fs_file_iterator* it = fs_iter_file("foo.txt");
+     *
+     * // iterate file
+     *
+     * fs_close_file(it);
+     * @endcode
+     *
+     * @param[in] path Some null-terminated path
+     * @return A pointer for iterating over the file if there is no error,
+     * NULL otherwise.
+     */
+    LIBFS_PUBLIC(struct fs_file_iterator *)
+    fs_iter_file(const char *path);
+
+    /**
+     * Iterates over the next char of a file.
+     *
+     * @code{.c}
+     * char c;
+     * while(fs_next_char(it, &c))
+     * {
+     *     printf("%c", c);
+     * }
+     * @endcode
+     *
+     * @param[in] it Some opened file iterator
+     * @param[out] c Character read
+     * @return The same it pointer or NULL if an error occurred or there
+     * is no more char to iterate over, fs_file_error tells them apart.
+     */
+    LIBFS_PUBLIC(struct fs_file_iterator *)
+    fs_next_char(struct fs_file_iterator *it, char *c);
+
+    /**
+     * Opens a file to iterate over its content with a custom buffer size.
+     *
+     * The buffer size bounds the chunks returned by fs_next_chunk. It
+     * grows when a line returned by fs_next_line doesn't fit in it.
+     *
+     * @code{.c}
+     * struct fs_file_iterator* it = fs_iter_file_ex("foo.txt", 1024 * 1024);
+     *
+     * // iterate file
+     *
+     * fs_close_file(it);
+     * @endcode
+     *
+     * @param[in] path Some null-terminated path
+     * @param[in] buffer_size Size of the internal buffer or 0 for default
+     * @return A pointer for iterating over the file if there is no error,
+     * NULL otherwise.
+     */
+    LIBFS_PUBLIC(struct fs_file_iterator *)
+    fs_iter_file_ex(const char *path, size_t buffer_size);
+
+    /**
+     * Opens a file to iterate over its content, allocating from a context.
+     *
+     * The iterator and its buffer are freed with the context by
+     * fs_close_file.
+     *
+     * @param[in] ctx Context to allocate from, NULL for the hooks
+     * @param[in] path Some null-terminated path
+     * @param[in] buffer_size Size of the internal buffer or 0 for default
+     * @return A pointer for iterating over the file if there is no error,
+     * NULL otherwise.
+     */
+    LIBFS_PUBLIC(struct fs_file_iterator *)
+    fs_iter_file_ctx(const struct fs_context *ctx, const char *path, size_t buffer_size);
+
+    /**
+     * Iterates over the next chunk of a file.
+     *
+     * The chunk points into the internal buffer of the iterator and is
+     * valid until the next call on it.
+     *
+     * @code{.c}
+     * const char* data;
+     * size_t size;
+     * while(fs_next_chunk(it, &data, &size))
+     * {
+     *     fwrite(data, 1, size, stdout);
+     * }
+     * @endcode
+     *
+     * @param[in] it Some opened file iterator
+     * @param[out] data Pointer to the chunk
+     * @param[out] size Size of the chunk, in bytes
+     * @return The same it pointer or NULL if an error occurred or there
+     * is no more content to iterate over, fs_file_error tells them apart.
+     */
+    LIBFS_PUBLIC(struct fs_file_iterator *)
+    fs_next_chunk(struct fs_file_iterator *it, const char **data, size_t *size);
+
+    /**
+     * Iterates over the next line of a file.
+     *
+     * The line is not copied: it points into the internal buffer of the
+     * iterator, excludes the newline character, is not null-terminated
+     * and is valid until the next call on it.
+     *
+     * @code{.c}
+     * const char* line;
+     * size_t size;
+     * while(fs_next_line(it, &line, &size))
+     * {
+     *     printf("%.*s\n", (int)size, line);
+     * }
+     * @endcode
+     *
+     * @param[in] it Some opened file iterator
+     * @param[out] line Pointer to the line
+     * @param[out] size Size of the line, in bytes
+     * @return The same it pointer or NULL if an error occurred or there
+     * is no more line to iterate over, fs_file_error tells them apart.
+     */
+    LIBFS_PUBLIC(struct fs_file_iterator *)
+    fs_next_line(struct fs_file_iterator *it, const char **line, size_t *size);
+
+    /**
+     * Iterates over the next token of a file ending with a delimiter.
+     *
+     * This is fs_next_line with a custom delimiter. The delimiter is
+     * searched with SSE2 or AVX2 when the CPU supports it.
+     *
+     * @code{.c}
+     * const char* field;
+     * size_t size;
+     * while(fs_next_token(it, ',', &field, &size))
+     * {
+     *     printf("%.*s\n", (int)size, field);
+     * }
+     * @endcode
+     *
+     * @param[in] it Some opened file iterator
+     * @param[in] delimiter Character ending tokens
+     * @param[out] token Pointer to the token
+     * @param[out] size Size of the token, in bytes
+     * @return The same it pointer or NULL if an error occurred or there
+     * is no more token to iterate over, fs_file_error tells them apart.
+     */
+    LIBFS_PUBLIC(struct fs_file_iterator *)
+    fs_next_token(struct fs_file_iterator *it, char delimiter, const char **token, size_t *size);
+
+    /**
+     * Counts the lines of a file.
+     *
+     * The last line is counted even if it doesn't end with a newline,
+     * same as fs_next_line.
+     *
+     * @code{.c}
+     * size_t count;
+     * if (fs_count_lines("foo.txt", &count))
+     * {
+     *     printf("%d lines", (int)count);
+     * }
+     * @endcode
+     *
+     * @param[in] path Some null-terminated path
+     * @param[out] count Number of lines
+     * @return If the file was read, false if it couldn't be opened or a
+     * read failed.
+     */
+    LIBFS_PUBLIC(int)
+    fs_count_lines(const char *path, size_t *count);
+
+    /**
+     * Tells if a read failed on a file iterator.
+     *
+     * Iterating functions return NULL both at the end of the file and
+     * when a read fails. Once a read failed, they keep returning NULL.
+     *
+     * @code{.c}
+     * while(fs_next_line(it, &line, &size))
+     * {
+     *     // use line
+     * }
+     *
+     * if (fs_file_error(it))
+     * {
+     *     // the file was not read entirely
+     * }
+     * @endcode
+     *
+     * @param[in] it Some opened file iterator
+     * @return If a read failed, false if only the end of the file was
+     * reached.
+     */
+    LIBFS_PUBLIC(int)
+    fs_file_error(const struct fs_file_iterator *it);
+
+    /**
+     * Closes and frees an opened file iterator.
+     *
+     * @code{.c}
+     * struct fs_file_iterator* it = fs_iter_file("foo.txt");
+     *
+     * // iterate file
+     *
+     * fs_close_file(it);
+     * @endcode
+     *
+     * @param[in] it Some opened file iterator
+     */
+    LIBFS_PUBLIC(void)
+    fs_close_file(struct fs_file_iterator *it);
+
+    /** Struct for configuring fs_open_file_writer. */
+    struct fs_file_writer_options
+    {
+        /** Size of the internal buffer, 0 for the default of 1 MiB. */
+        size_t buffer_size;
+
+        /**
+         * Expected size of the file, 0 if unknown. Where supported, the
+         * space is reserved up front so the file is not fragmented as it
+         * grows. The file size only counts the bytes actually written,
+         * and space reserved past them is released when the writer is
+         * closed successfully.
+         */
+        off_t expected_size;
+    };
+
+    /**
+     * @struct fs_file_writer
+     * Writes a file incrementally through a buffer.
+     *
+     * @code{.c}
+     * struct fs_file_writer* w = fs_open_file_writer("foo.txt", NULL);
+     * fs_writer_append(w, "hello ", 6);
+     * fs_writer_append(w, "world", 5);
+     * if (!fs_close_file_writer(w))
+     * {
+     *     printf("writing foo.txt failed");
+     * }
+     * @endcode
+     */
+    struct fs_file_writer;
+
+    /**
+     * Creates or truncates a file to write it incrementally.
+     *
+     * @param[in] path Some null-terminated path
+     * @param[in] options Writer options or NULL for defaults
+     * @return A pointer for writing the file if there is no error, NULL
+     * otherwise.
+     */
+    LIBFS_PUBLIC(struct fs_file_writer *)
+    fs_open_file_writer(const char *path, const struct fs_file_writer_options *options);
+
+    /**
+     * Appends bytes to a file.
+     *
+     * Bytes are copied to the buffer, which is written to the file once
+     * full. Writes larger than the buffer go directly to the file.
+     *
+     * @param[in] w Some opened file writer
+     * @param[in] data Bytes to append
+     * @param[in] size Number of bytes
+     * @return If there was no error since the writer was opened.
+     */
+    LIBFS_PUBLIC(int)
+    fs_writer_append(struct fs_file_writer *w, const void *data, size_t size);
+
+    /**
+     * Writes the buffered bytes to the file.
+     *
+     * @param[in] w Some opened file writer
+     * @return If there was no error since the writer was opened.
+     */
+    LIBFS_PUBLIC(int)
+    fs_writer_flush(struct fs_file_writer *w);
+
+    /**
+     * Flushes, truncates the preallocated space, closes and frees a file
+     * writer.
+     *
+     * @param[in] w Some opened file writer
+     * @return If the whole file was written.
+     */
+    LIBFS_PUBLIC(int)
+    fs_close_file_writer(struct fs_file_writer *w);
+
+    /**
+     * Gets the absolute path to the platform specific temporary directory.
+     *
+     * @code{.c}
+     * char buf[MAX_PATH];
+     * if (!fs_temp_dir(buf, MAX_PATH))
+     * {
+     *     printf("fs_temp_dir failed");
+     * }
+     * else
+     * {
+     *     printf("%s", buf);
+     * }
+     * @endcode
+     *
+     * @param[in] buf Buffer for storing the result path
+     * @param[in] size Buffer size
+     * @return A pointer to buf if there is no error, NULL otherwise.
+     */
+    LIBFS_PUBLIC(char *)
+    fs_temp_dir(char *buf, size_t size);
+
+    /**
+     * Deletes an empty directory if it exists.
+     *
+     * @code
+     * if (!fs_delete_dir("foo"))
+     * {
+     *     printf("fs_delete_dir failed");
+     * }
+     * @endcode
+     * @param[in] path Some null-terminated path
+     * @return If the directory was deleted.
+     */
+    LIBFS_PUBLIC(int)
+    fs_delete_dir(const char *path);
+
+    /**
+     * Deletes a file if it exists.
+     *
+     * @code
+     * if (!fs_delete_file("foo.txt"))
+     * {
+     *     printf("fs_delete_file failed");
+     * }
+     * @endcode
+     * @param[in] path Some null-terminated path
+     * @return If the file was deleted.
+     */
+    LIBFS_PUBLIC(int)
+    fs_delete_file(const char *path);
+
+    /**
+     * Creates a directory if it doesn't exist.
+     *
+     * The parent directory must exist as it will not
+     * be created recursively.
+     *
+     * @code
+     * if (!fs_make_dir("foo"))
+     * {
+     *     printf("fs_make_dir failed");
+     * }
+     * @endcode
+     * @param[in] path Some null-terminated path
+     * @return If the directory was created.
+     */
+    LIBFS_PUBLIC(int)
+    fs_make_dir(const char *path);
+
+    /**
+     * Struct used to iterate over a directory.
+     *
+     * @code{.c}
+     * struct fs_directory_iterator* it = fs_open_dir("./somedir");
+     *
+     * while(fs_read_dir(it))
+     * {
+     *     printf("%s", it->path);
+     * }
+     *
+     * fs_close_dir(it);
+     * @endcode
+     */
+    struct fs_directory_iterator
+    {
+        /** Path to file. */
+        const char *path;
+
+        /**
+         * Type of the entry as reported by the directory listing, without
+         * following symbolic links. Some filesystems don't report it, in
+         * which case it is LIBFS_TYPE_UNKNOWN until fs_dir_entry_type is
+         * called.
+         */
+        enum fs_file_type type;
+
+        /** Inode number of the entry, 0 if not supported. */
+        ino_t inode;
+    };
+
+    /**
+     * Gets an iterator over entries of a directory.
+     *
+     * @code{.c}
+     * struct fs_directory_iterator* it = fs_open_dir("./somedir");
+     *
+     * while(fs_read_dir(it))
+     * {
+     *     printf("%s", it->path);
+     * }
+     *
+     * fs_close_dir(it);
+     * @endcode
+     *
+     * @param[in] path Some null-terminated path
+     * @return A pointer for iterating over the directory if there is no error, NULL otherwise.
+     */
+    LIBFS_PUBLIC(struct fs_directory_iterator *)
+    fs_open_dir(const char *path);
+
+    /**
+     * Gets an iterator over entries of a directory, allocated from a
+     * context and freed with it by fs_close_dir.
+     *
+     * @param[in] ctx Context to allocate from, NULL for the hooks
+     * @param[in] path Some null-terminated path
+     * @return A pointer for iterating over the directory if there is no error, NULL otherwise.
+     */
+    LIBFS_PUBLIC(struct fs_directory_iterator *)
+    fs_open_dir_ctx(const struct fs_context *ctx, const char *path);
+
+/** Size of struct fs_dir_storage, in bytes. */
+#define LIBFS_DIR_STORAGE_SIZE 8192
+
+    /**
+     * Caller-provided memory for a directory iterator, such as a local
+     * variable. Where directories are read with getdents64, the space
+     * left after the iterator is its buffer of entries.
+     */
+    struct fs_dir_storage
+    {
+        /** Opaque content. */
+        union
+        {
+            void *align_pointer;
+            double align_double;
+            long align_long;
+            unsigned char data[LIBFS_DIR_STORAGE_SIZE];
+        } opaque;
+    };
+
+    /**
+     * Gets an iterator over entries of a directory, stored in
+     * caller-provided memory.
+     *
+     * The iterator is closed with fs_close_dir, which doesn't free the
+     * storage. Where directories are read with getdents64, opening and
+     * reading a directory allocates no memory.
+     *
+     * @code{.c}
+     * struct fs_dir_storage storage;
+     * struct fs_directory_iterator* it = fs_open_dir_in(&storage, "./somedir");
+     *
+     * while(fs_read_dir(it))
+     * {
+     *     printf("%s", it->path);
+     * }
+     *
+     * fs_close_dir(it);
+     * @endcode
+     *
+     * @param[in] storage Memory for the iterator, which must outlive it
+     * @param[in] path Some null-terminated path
+     * @return A pointer for iterating over the directory if there is no error, NULL otherwise.
+     */
+    LIBFS_PUBLIC(struct fs_directory_iterator *)
+    fs_open_dir_in(struct fs_dir_storage *storage, const char *path);
+
+    /**
+     * Reuses a directory iterator and its buffer to iterate over another
+     * directory.
+     *
+     * The current directory is closed first. The iterator must still be
+     * closed with fs_close_dir, even if reopening failed. With a NULL
+     * path, the directory is only closed and the iterator is kept for a
+     * later call.
+     *
+     * @code{.c}
+     * struct fs_directory_iterator* it = fs_open_dir("./foo");
+     *
+     * // iterate foo
+     *
+     * if (fs_reopen_dir(it, "./bar"))
+     * {
+     *     // iterate bar
+     * }
+     *
+     * fs_close_dir(it);
+     * @endcode
+     *
+     * @param[in] it Some directory iterator
+     * @param[in] path Some null-terminated path, or NULL
+     * @return The iterator if the directory was opened, NULL otherwise.
+     */
+    LIBFS_PUBLIC(struct fs_directory_iterator *)
+    fs_reopen_dir(struct fs_directory_iterator *it, const char *path);
+
+    /**
+     * Restarts the iteration from the first entry of the directory.
+     *
+     * @param[in] it Some opened directory iterator
+     */
+    LIBFS_PUBLIC(void)
+    fs_rewind_dir(struct fs_directory_iterator *it);
+
+    /**
+     * Iterates over the next entry of a directory.
+     *
+     * @code{.c}
+     * struct fs_directory_iterator* it = fs_open_dir("./somedir");
+     *
+     * while(fs_read_dir(it))
+     * {
+     *     printf("%s", it->path);
+     * }
+     *
+     * fs_close_dir(it);
+     * @endcode
+     *
+     * @param[in] it Some opened directory iterator
+     * @return The same it pointer or NULL if an error occurred or there is no more entry to iterate over.
+     */
+    LIBFS_PUBLIC(struct fs_directory_iterator *)
+    fs_read_dir(struct fs_directory_iterator *it);
+
+    /**
+     * Gets the type of the current entry of a directory iterator.
+     *
+     * The type reported by the directory listing is returned when known,
+     * so no system call is made for most entries. Otherwise the entry is
+     * queried once relative to the opened directory and the result is
+     * stored in it->type.
+     *
+     * @code{.c}
+     * while(fs_read_dir(it))
+     * {
+     *     if (fs_dir_entry_type(it) == LIBFS_TYPE_DIRECTORY)
+     *     {
+     *         printf("%s is a directory", it->path);
+     *     }
+     * }
+     * @endcode
+     *
+     * @param[in] it Some directory iterator pointing to an entry
+     * @return The type of the entry, without following symbolic links.
+     */
+    LIBFS_PUBLIC(enum fs_file_type)
+    fs_dir_entry_type(struct fs_directory_iterator *it);
+
+    /** Entry of a directory returned by fs_read_dir_batch. */
+    struct fs_dir_entry
+    {
+        /** Null-terminated name of the entry. */
+        const char *name;
+
+        /** Length of the name, excluding the null-terminating character. */
+        size_t name_length;
+
+        /** Type of the entry, may be LIBFS_TYPE_UNKNOWN. */
+        enum fs_file_type type;
+
+        /** Inode number of the entry, 0 if not supported. */
+        ino_t inode;
+    };
+
+    /**
+     * Reads many entries of a directory at once.
+     *
+     * On Linux, entries are read with a single getdents64 call filling
+     * buf, so a large buffer lists huge directories with few system
+     * calls. Names point into buf, which must be aligned like memory
+     * returned by malloc and stay the same until the function returns 0.
+     * Don't mix this function with fs_read_dir on the same iterator.
+     *
+     * @code{.c}
+     * char* buf = malloc(1024 * 1024);
+     * struct fs_dir_entry entries[4096];
+     * size_t i, n;
+     * struct fs_directory_iterator* it = fs_open_dir("./somedir");
+     *
+     * while((n = fs_read_dir_batch(it, buf, 1024 * 1024, entries, 4096)) && n != (size_t)-1)
+     * {
+     *     for (i = 0; i < n; ++i)
+     *     {
+     *         printf("%s", entries[i].name);
+     *     }
+     * }
+     *
+     * fs_close_dir(it);
+     * free(buf);
+     * @endcode
+     *
+     * @param[in] it Some opened directory iterator
+     * @param[in] buf Buffer receiving the entry names
+     * @param[in] size Buffer size
+     * @param[out] entries Array receiving the entries
+     * @param[in] count Maximum number of entries
+     * @return The number of entries read, 0 if there is no more entry to
+     * iterate over, (size_t)-1 if an error occurred. errno is EINVAL when
+     * buf is too small for the next entry, 512 bytes are always enough.
+     */
+    LIBFS_PUBLIC(size_t)
+    fs_read_dir_batch(struct fs_directory_iterator *it, void *buf, size_t size, struct fs_dir_entry *entries, size_t count);
+
+    /**
+     * Closes and frees an opened directory iterator. Iterators from
+     * fs_open_dir_in are only closed.
+     *
+     * @code{.c}
+     * struct fs_directory_iterator* it = fs_open_dir("./somedir");
+     *
+     * while(fs_read_dir(it))
+     * {
+     *     printf("%s", it->path);
+     * }
+     *
+     * fs_close_dir(it);
      * @endcode
      *
      * @param[in] it Some opened directory iterator
@@ -723,6 +2252,495 @@ extern "C"
     LIBFS_PUBLIC(void)
     fs_close_dir(struct fs_directory_iterator *it);
 
+    /**
+     * @struct fs_dir_handle
+     * Handle on an opened directory that paths can be relative to.
+     *
+     * Functions ending in _at resolve their path relative to the handle,
+     * so the kernel only looks up the remaining components instead of the
+     * whole path from the root. A NULL handle stands for the current
+     * directory.
+     *
+     * @code{.c}
+     * struct fs_dir_handle* dir = fs_open_dir_handle("./build/out");
+     *
+     * if (fs_is_file_at(dir, "foo.o"))
+     * {
+     *     fs_delete_file_at(dir, "foo.o");
+     * }
+     *
+     * fs_close_dir_handle(dir);
+     * @endcode
+     */
+    struct fs_dir_handle;
+
+    /**
+     * Opens a handle on a directory.
+     *
+     * @code{.c}
+     * struct fs_dir_handle* dir = fs_open_dir_handle("./somedir");
+     * @endcode
+     *
+     * @param[in] path Some null-terminated path to existing directory
+     * @return A handle on the directory if there is no error, NULL
+     * otherwise.
+     */
+    LIBFS_PUBLIC(struct fs_dir_handle *)
+    fs_open_dir_handle(const char *path);
+
+    /**
+     * Opens a handle on a directory relative to another handle.
+     *
+     * @code{.c}
+     * struct fs_dir_handle* sub = fs_open_dir_handle_at(dir, "sub");
+     * @endcode
+     *
+     * @param[in] dir Some directory handle, or NULL
+     * @param[in] path Some null-terminated path relative to dir
+     * @return A handle on the directory if there is no error, NULL
+     * otherwise.
+     */
+    LIBFS_PUBLIC(struct fs_dir_handle *)
+    fs_open_dir_handle_at(struct fs_dir_handle *dir, const char *path);
+
+    /**
+     * Opens a handle on the directory of a directory iterator.
+     *
+     * The handle stays valid after the iterator is closed.
+     *
+     * @code{.c}
+     * struct fs_directory_iterator* it = fs_open_dir("./somedir");
+     * struct fs_dir_handle* dir = fs_dir_handle_from_iterator(it);
+     *
+     * while(fs_read_dir(it))
+     * {
+     *     if (fs_is_file_at(dir, it->path))
+     *     {
+     *         printf("%s", it->path);
+     *     }
+     * }
+     *
+     * fs_close_dir(it);
+     * fs_close_dir_handle(dir);
+     * @endcode
+     *
+     * @param[in] it Some opened directory iterator
+     * @return A handle on the directory if there is no error, NULL
+     * otherwise.
+     */
+    LIBFS_PUBLIC(struct fs_dir_handle *)
+    fs_dir_handle_from_iterator(struct fs_directory_iterator *it);
+
+    /**
+     * Closes a directory handle.
+     *
+     * @code{.c}
+     * fs_close_dir_handle(dir);
+     * @endcode
+     *
+     * @param[in] dir Some directory handle, or NULL
+     */
+    LIBFS_PUBLIC(void)
+    fs_close_dir_handle(struct fs_dir_handle *dir);
+
+    /**
+     * Same as fs_exist with a path relative to a directory handle.
+     *
+     * @param[in] dir Some directory handle, or NULL
+     * @param[in] path Some null-terminated path relative to dir
+     * @return If the file or directory exists.
+     */
+    LIBFS_PUBLIC(int)
+    fs_exist_at(struct fs_dir_handle *dir, const char *path);
+
+    /**
+     * Same as fs_is_file with a path relative to a directory handle.
+     *
+     * @param[in] dir Some directory handle, or NULL
+     * @param[in] path Some null-terminated path relative to dir
+     * @return If path points to an existing file.
+     */
+    LIBFS_PUBLIC(int)
+    fs_is_file_at(struct fs_dir_handle *dir, const char *path);
+
+    /**
+     * Same as fs_is_directory with a path relative to a directory handle.
+     *
+     * @param[in] dir Some directory handle, or NULL
+     * @param[in] path Some null-terminated path relative to dir
+     * @return If path points to an existing directory.
+     */
+    LIBFS_PUBLIC(int)
+    fs_is_directory_at(struct fs_dir_handle *dir, const char *path);
+
+    /**
+     * Same as fs_read_file with a path relative to a directory handle.
+     *
+     * @code{.c}
+     * size_t size;
+     * char* buf = (char*)fs_read_file_at(dir, "foo.txt", &size);
+     * @endcode
+     *
+     * @param[in] dir Some directory handle, or NULL
+     * @param[in] path Some null-terminated path relative to dir
+     * @param[out] size Size of the file
+     * @return A pointer to the allocated buffer if there is no error,
+     * NULL otherwise.
+     */
+    LIBFS_PUBLIC(void *)
+    fs_read_file_at(struct fs_dir_handle *dir, const char *path, size_t *size);
+
+    /**
+     * Same as fs_write_file with a path relative to a directory handle.
+     *
+     * @param[in] dir Some directory handle, or NULL
+     * @param[in] path Some null-terminated path relative to dir
+     * @param[in] buf Some memory buffer
+     * @param[in] size Buffer size
+     * @return If the file was written.
+     */
+    LIBFS_PUBLIC(int)
+    fs_write_file_at(struct fs_dir_handle *dir, const char *path, const void *buf, size_t size);
+
+    /**
+     * Same as fs_make_dir with a path relative to a directory handle.
+     *
+     * @param[in] dir Some directory handle, or NULL
+     * @param[in] path Some null-terminated path relative to dir
+     * @return If the directory was created.
+     */
+    LIBFS_PUBLIC(int)
+    fs_make_dir_at(struct fs_dir_handle *dir, const char *path);
+
+    /**
+     * Same as fs_delete_file with a path relative to a directory handle.
+     *
+     * @param[in] dir Some directory handle, or NULL
+     * @param[in] path Some null-terminated path relative to dir
+     * @return If the file was deleted.
+     */
+    LIBFS_PUBLIC(int)
+    fs_delete_file_at(struct fs_dir_handle *dir, const char *path);
+
+    /**
+     * Same as fs_delete_dir with a path relative to a directory handle.
+     *
+     * @param[in] dir Some directory handle, or NULL
+     * @param[in] path Some null-terminated path relative to dir
+     * @return If the directory was deleted.
+     */
+    LIBFS_PUBLIC(int)
+    fs_delete_dir_at(struct fs_dir_handle *dir, const char *path);
+
+    /**
+     * Same as fs_open_dir with a path relative to a directory handle.
+     *
+     * @code{.c}
+     * struct fs_directory_iterator* it = fs_open_dir_at(dir, "sub");
+     * @endcode
+     *
+     * @param[in] dir Some directory handle, or NULL
+     * @param[in] path Some null-terminated path relative to dir
+     * @return A pointer for iterating over the directory if there is no
+     * error, NULL otherwise.
+     */
+    LIBFS_PUBLIC(struct fs_directory_iterator *)
+    fs_open_dir_at(struct fs_dir_handle *dir, const char *path);
+
+    /** Flags for fs_walk_options. */
+    enum fs_walk_flags
+    {
+        /**
+         * Reports symbolic links with the type of their target and
+         * descends into linked directories. Each directory is entered
+         * once so link cycles are not followed.
+         */
+        LIBFS_WALK_FOLLOW_SYMLINKS = 1,
+        /**
+         * Walks depth first from the calling thread, keeping only the
+         * directories from the walked one to the current entry. Memory
+         * grows with the depth of the tree, not its breadth.
+         */
+        LIBFS_WALK_STREAMING = 2
+    };
+
+    /** Values returned by a fs_walk visitor. */
+    enum fs_walk_action
+    {
+        /** Continues the walk. */
+        LIBFS_WALK_CONTINUE = 0,
+        /** Doesn't descend into the visited directory. */
+        LIBFS_WALK_SKIP,
+        /** Stops the walk. */
+        LIBFS_WALK_STOP
+    };
+
+    /** Entry visited by fs_walk. */
+    struct fs_walk_entry
+    {
+        /** Null-terminated path of the entry, starting with the walked path. */
+        const char *path;
+
+        /** Null-terminated name of the entry, pointing into path. */
+        const char *name;
+
+        /** Depth of the entry, 1 for entries of the walked directory. */
+        size_t depth;
+
+        /** Type of the entry. */
+        enum fs_file_type type;
+
+        /** Inode number of the entry, 0 if not supported. */
+        ino_t inode;
+    };
+
+    /**
+     * Function called for each entry visited by fs_walk.
+     *
+     * The entry is only valid during the call.
+     *
+     * @param[in] entry Visited entry
+     * @param[in] user Pointer given to fs_walk
+     * @return One of fs_walk_action.
+     */
+    typedef int(LIBFS_CDECL *fs_walk_fn)(const struct fs_walk_entry *entry, void *user);
+
+    /** Struct for configuring fs_walk. */
+    struct fs_walk_options
+    {
+        /** Maximum depth of visited entries, 0 for no limit. */
+        size_t max_depth;
+
+        /**
+         * Number of threads reading directories. 0 uses one thread per
+         * online CPU and 1 walks from the calling thread only.
+         */
+        size_t threads;
+
+        /** Combination of fs_walk_flags. */
+        int flags;
+
+        /**
+         * Maximum number of directories kept open by a streaming walk, 0
+         * for the default of 32. Deeper directories close the shallowest
+         * ones, which are reopened once the walk comes back to them. On
+         * Linux, they resume at their getdents64 offset. Elsewhere, the
+         * entries read before are skipped by count, so entries added or
+         * removed in the meantime can be missed or visited twice.
+         */
+        size_t max_open_dirs;
+    };
+
+    /**
+     * Recursively visits the entries of a directory.
+     *
+     * Each thread reads directories from its own queue, depth first, and
+     * steals pending directories from the other threads once its queue
+     * is empty. With more than one thread, entries are visited in no
+     * particular order and the visitor is called concurrently. Use
+     * LIBFS_WALK_STREAMING to walk huge trees with bounded memory.
+     *
+     * @code{.c}
+     * static int print_entry(const struct fs_walk_entry *entry, void *user)
+     * {
+     *     printf("%s", entry->path);
+     *     return LIBFS_WALK_CONTINUE;
+     * }
+     *
+     * if (!fs_walk("./somedir", NULL, print_entry, NULL))
+     * {
+     *     printf("fs_walk failed");
+     * }
+     * @endcode
+     *
+     * @param[in] path Some null-terminated path to existing directory
+     * @param[in] options Walk options or NULL for defaults
+     * @param[in] fn Function called for each entry
+     * @param[in] user Pointer passed to fn
+     * @return If every directory could be read.
+     */
+    LIBFS_PUBLIC(int)
+    fs_walk(const char *path, const struct fs_walk_options *options, fs_walk_fn fn, void *user);
+
+    /** Flags for fs_ring_create. */
+    enum fs_ring_flags
+    {
+        /** Runs operations on a pool of threads even if io_uring is available. */
+        LIBFS_RING_THREADS = 1
+    };
+
+    /** Kind of operation submitted to a fs_ring. */
+    enum fs_ring_op
+    {
+        /** Reads a whole file into a new buffer, see fs_ring_read_file. */
+        LIBFS_RING_READ_FILE = 0,
+        /** Writes a whole file, see fs_ring_write_file. */
+        LIBFS_RING_WRITE_FILE,
+        /** Reads part of a file, see fs_ring_read_range. */
+        LIBFS_RING_READ_RANGE,
+        /** Flushes a file to the storage, see fs_ring_fsync. */
+        LIBFS_RING_FSYNC
+    };
+
+    /** Result of an operation completed by a fs_ring. */
+    struct fs_ring_completion
+    {
+        /** Pointer given when the operation was submitted. */
+        void *user;
+
+        /** One of fs_ring_op. */
+        int op;
+
+        /** 0 if the operation succeeded, an errno value otherwise. */
+        int error;
+
+        /**
+         * Content of the file for LIBFS_RING_READ_FILE, null-terminated and
+         * allocated with the malloc hook, to be released with the free hook,
+         * or NULL on error. The buffer given to fs_ring_read_range or
+         * fs_ring_write_file otherwise.
+         */
+        void *data;
+
+        /** Number of bytes read or written. */
+        size_t size;
+    };
+
+    /**
+     * Queue of asynchronous file operations.
+     *
+     * On Linux, operations are chains of io_uring requests so a single
+     * thread keeps many reads and writes in flight. Elsewhere, or when
+     * io_uring is not available, they run on a pool of threads. With
+     * io_uring, submitted operations are started by the next call to
+     * fs_ring_poll or fs_ring_wait, so a batch costs a single system
+     * call. A ring is used from one thread at a time.
+     *
+     * @code{.c}
+     * struct fs_ring_completion done;
+     * struct fs_ring* ring = fs_ring_create(64, 0);
+     * fs_ring_read_file(ring, "foo.txt", NULL);
+     * if (fs_ring_wait(ring, &done, 1, 1) == 1 && !done.error)
+     * {
+     *     printf("%s", (const char*)done.data);
+     *     free(done.data);
+     * }
+     *
+     * fs_ring_destroy(ring);
+     * @endcode
+     */
+    struct fs_ring;
+
+    /**
+     * Creates a queue of asynchronous file operations.
+     *
+     * @param[in] entries Maximum number of operations in flight, from
+     * submission until their completion is returned, 0 for 64
+     * @param[in] flags Combination of fs_ring_flags
+     * @return The new ring, NULL on error.
+     */
+    LIBFS_PUBLIC(struct fs_ring *)
+    fs_ring_create(size_t entries, int flags);
+
+    /**
+     * Waits for the operations in flight and destroys a ring.
+     *
+     * Buffers of LIBFS_RING_READ_FILE completions that were not returned
+     * are released.
+     *
+     * @param[in] ring Some ring
+     */
+    LIBFS_PUBLIC(void)
+    fs_ring_destroy(struct fs_ring *ring);
+
+    /**
+     * Submits reading a whole file.
+     *
+     * @param[in] ring Some ring
+     * @param[in] path Some null-terminated path, copied by the ring
+     * @param[in] user Pointer returned with the completion
+     * @return If the operation was submitted, false if the ring is full.
+     */
+    LIBFS_PUBLIC(int)
+    fs_ring_read_file(struct fs_ring *ring, const char *path, void *user);
+
+    /**
+     * Submits writing a whole file, replacing its content.
+     *
+     * @param[in] ring Some ring
+     * @param[in] path Some null-terminated path, copied by the ring
+     * @param[in] buf Content to write, kept valid until the completion
+     * @param[in] size Size of buf
+     * @param[in] user Pointer returned with the completion
+     * @return If the operation was submitted, false if the ring is full.
+     */
+    LIBFS_PUBLIC(int)
+    fs_ring_write_file(struct fs_ring *ring, const char *path, const void *buf, size_t size, void *user);
+
+    /**
+     * Submits reading up to size bytes of a file starting at offset.
+     *
+     * The completion size is less than size if the file ends before.
+     *
+     * @param[in] ring Some ring
+     * @param[in] path Some null-terminated path, copied by the ring
+     * @param[in] offset Position of the first byte to read
+     * @param[out] buf Buffer receiving the bytes, kept valid until the
+     * completion
+     * @param[in] size Size of buf
+     * @param[in] user Pointer returned with the completion
+     * @return If the operation was submitted, false if the ring is full.
+     */
+    LIBFS_PUBLIC(int)
+    fs_ring_read_range(struct fs_ring *ring, const char *path, off_t offset, void *buf, size_t size, void *user);
+
+    /**
+     * Submits flushing the content of a file to the storage.
+     *
+     * @param[in] ring Some ring
+     * @param[in] path Some null-terminated path, copied by the ring
+     * @param[in] user Pointer returned with the completion
+     * @return If the operation was submitted, false if the ring is full.
+     */
+    LIBFS_PUBLIC(int)
+    fs_ring_fsync(struct fs_ring *ring, const char *path, void *user);
+
+    /**
+     * Gets completed operations without waiting.
+     *
+     * @param[in] ring Some ring
+     * @param[out] completions Array receiving the completions
+     * @param[in] count Size of completions
+     * @return The number of completions written.
+     */
+    LIBFS_PUBLIC(size_t)
+    fs_ring_poll(struct fs_ring *ring, struct fs_ring_completion *completions, size_t count);
+
+    /**
+     * Gets completed operations, waiting for at least min of them.
+     *
+     * min is lowered to the number of operations in flight so waiting
+     * on an idle ring returns immediately.
+     *
+     * @code{.c}
+     * struct fs_ring_completion done[16];
+     * size_t i;
+     * size_t n = fs_ring_wait(ring, done, 16, 1);
+     * for (i = 0; i < n; ++i)
+     * {
+     *     handle(done[i].user, done[i].error);
+     * }
+     * @endcode
+     *
+     * @param[in] ring Some ring
+     * @param[out] completions Array receiving the completions
+     * @param[in] count Size of completions
+     * @param[in] min Number of completions to wait for, up to count
+     * @return The number of completions written.
+     */
+    LIBFS_PUBLIC(size_t)
+    fs_ring_wait(struct fs_ring *ring, struct fs_ring_completion *completions, size_t count, size_t min);
+
 #ifdef __cplusplus
 }
 #endif
@@ -3,7 +3,13 @@
 #include <stdlib.h>
 #include <setjmp.h>
 #include <stdint.h>
+#include <errno.h>
 #include <cmocka.h>
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/stat.h>
+#include <utime.h>
+#endif
 #include "fs_testutils.h"
 
 #define DIRECTORY_DATA "data"
@@ -88,6 +94,148 @@ static void test_basename_empty(void **state)
     assert_string_equal(fs_basename("/foo/bar/"), "");
 }
 
+static void assert_normalize(const char *path, const char *expected)
+{
+    char buf[LIBFS_MAX_PATH];
+    assert_non_null(fs_normalize(path, buf, LIBFS_MAX_PATH));
+    assert_string_equal(buf, expected);
+}
+
+static void test_normalize(void **state)
+{
+    char buf[LIBFS_MAX_PATH];
+    char small[4];
+
+    assert_normalize("", ".");
+    assert_normalize(".", ".");
+    assert_normalize("./", ".");
+    assert_normalize("foo/..", ".");
+    assert_normalize("foo//bar/./../baz.txt", "foo/baz.txt");
+    assert_normalize("foo/bar/", "foo/bar");
+#ifdef _WIN32
+    assert_normalize("/path/to\\bar.txt", "/path/to/bar.txt");
+    assert_normalize("\\foo\\..\\bar", "/bar");
+    assert_normalize("C:\\foo\\..\\bar", "C:/bar");
+#else
+    /* Backslashes are valid in names */
+    assert_normalize("/path/to\\bar.txt", "/path/to\\bar.txt");
+    assert_normalize("\\foo\\..\\bar", "\\foo\\..\\bar");
+    assert_normalize("a\\b/../c", "c");
+#endif
+    assert_normalize("../../foo/../bar", "../../bar");
+    assert_normalize("foo/../../bar", "../bar");
+    assert_normalize("/../foo/..", "/");
+    assert_normalize("//", "/");
+    assert_normalize(".hidden/..foo/...", ".hidden/..foo/...");
+
+    /* In place */
+    strcpy(buf, "a//./b/../c/");
+    assert_true(fs_normalize(buf, buf, LIBFS_MAX_PATH) == buf);
+    assert_string_equal(buf, "a/c");
+
+    assert_null(fs_normalize("foo/bar", small, sizeof(small)));
+    assert_non_null(fs_normalize("foo/../bar", small, sizeof(small)));
+    assert_string_equal(small, "bar");
+}
+
+static void test_absolute_lexical(void **state)
+{
+    char cwd[LIBFS_MAX_PATH];
+    char expected[LIBFS_MAX_PATH];
+    char buf[LIBFS_MAX_PATH];
+
+    _fs_current_dir(&cwd);
+    fs_invalidate_current_dir();
+
+    /* The path doesn't need to exist */
+    _fs_join_path(&expected, cwd, "unknown/file.txt");
+    assert_non_null(fs_absolute_lexical("./unknown//file.txt", buf, LIBFS_MAX_PATH));
+    assert_string_equal(buf, expected);
+
+    fs_dirname(cwd, expected, LIBFS_MAX_PATH);
+    assert_non_null(fs_absolute_lexical("..", buf, LIBFS_MAX_PATH));
+    assert_string_equal(buf, expected);
+
+    assert_non_null(fs_absolute_lexical(".", buf, LIBFS_MAX_PATH));
+    assert_string_equal(buf, cwd);
+
+    assert_non_null(fs_absolute_lexical("/foo/../bar", buf, LIBFS_MAX_PATH));
+    assert_string_equal(buf, "/bar");
+
+    assert_null(fs_absolute_lexical("foo", buf, 2));
+}
+
+static void test_join_path_truncated(void **state)
+{
+    char buf[8];
+    assert_int_equal(fs_join_path(buf, 8, "foo", "barbaz"), 10);
+    assert_string_equal(buf, "foo/bar");
+    assert_int_equal(fs_dirname("/path/to/bar.txt", buf, 4), 8);
+    assert_string_equal(buf, "/pa");
+}
+
+static void test_path(void **state)
+{
+    struct fs_path path;
+    char small[8];
+    size_t i;
+
+    fs_path_init(&path, NULL, 0);
+    assert_string_equal(path.data, "");
+    assert_true(fs_path_set(&path, "foo"));
+    assert_true(fs_path_push(&path, "bar.txt"));
+    assert_string_equal(path.data, "foo/bar.txt");
+    assert_true(fs_path_set_extension(&path, ".md"));
+    assert_string_equal(path.data, "foo/bar.md");
+    assert_true(fs_path_set_extension(&path, ""));
+    assert_string_equal(path.data, "foo/bar");
+    assert_true(fs_path_pop(&path));
+    assert_string_equal(path.data, "foo");
+    assert_true(fs_path_pop(&path));
+    assert_string_equal(path.data, "");
+    assert_false(fs_path_pop(&path));
+
+    /* Root separator is kept */
+    assert_true(fs_path_set(&path, "/foo/"));
+    assert_true(fs_path_push(&path, "bar"));
+    assert_string_equal(path.data, "/foo/bar");
+    assert_true(fs_path_pop(&path));
+    assert_true(fs_path_pop(&path));
+    assert_string_equal(path.data, "/");
+    assert_false(fs_path_pop(&path));
+    assert_false(fs_path_set_extension(&path, ".txt"));
+
+    /* Leading dots aren't extensions */
+    assert_true(fs_path_set(&path, "foo.d/.bashrc"));
+    assert_true(fs_path_set_extension(&path, ".bak"));
+    assert_string_equal(path.data, "foo.d/.bashrc.bak");
+
+    /* Growable paths grow */
+    fs_path_truncate(&path, 0);
+    for (i = 0; i < 100; ++i)
+    {
+        assert_true(fs_path_push(&path, "abcdefghij"));
+    }
+
+    assert_int_equal(path.length, 100 * 11 - 1);
+    assert_int_equal(strlen(path.data), path.length);
+    assert_true(path.capacity > path.length);
+    fs_path_free(&path);
+    assert_int_equal(path.length, 0);
+
+    /* Fixed paths report overflows and are left unchanged */
+    fs_path_init(&path, small, sizeof(small));
+    assert_true(fs_path_set(&path, "foo"));
+    assert_true(fs_path_push(&path, "bar"));
+    assert_false(fs_path_push(&path, "x"));
+    assert_false(fs_path_set_extension(&path, ".txt"));
+    assert_false(fs_path_set(&path, "too long path"));
+    assert_string_equal(path.data, "foo/bar");
+    assert_int_equal(path.length, 7);
+    assert_true(path.data == small);
+    fs_path_free(&path);
+}
+
 static void test_get_cwd(void **state)
 {
     char cwd[LIBFS_MAX_PATH];
@@ -130,6 +278,98 @@ static void test_file_size(void **state)
     assert_int_equal(fs_file_size(buf), -1L);
 }
 
+static void test_stat(void **state)
+{
+    char cwd[LIBFS_MAX_PATH];
+    fs_assert_current_dir(&cwd);
+
+    char buf[LIBFS_MAX_PATH];
+    struct fs_stat_result st;
+    fs_assert_join_path(&buf, cwd, FILE_HELLO);
+    assert_true(fs_stat(buf, &st, LIBFS_STAT_ALL));
+    assert_true(st.fields & LIBFS_STAT_SIZE);
+    assert_int_equal(st.type, LIBFS_TYPE_FILE);
+    assert_int_equal(st.size, 5);
+    assert_int_equal(st.nlink, 1);
+    assert_true(st.mtime.sec > 0);
+    assert_in_range(st.mtime.nsec, 0, 999999999);
+    assert_int_not_equal(st.inode, 0);
+
+    /* Requesting a single field is enough to get it */
+    assert_true(fs_stat(buf, &st, LIBFS_STAT_TYPE));
+    assert_true(st.fields & LIBFS_STAT_TYPE);
+    assert_int_equal(st.type, LIBFS_TYPE_FILE);
+
+    fs_assert_join_path(&buf, cwd, DIRECTORY_DATA);
+    assert_true(fs_lstat(buf, &st, LIBFS_STAT_TYPE));
+    assert_int_equal(st.type, LIBFS_TYPE_DIRECTORY);
+
+    fs_assert_join_path(&buf, cwd, FILE_UNKNOWN);
+    assert_false(fs_stat(buf, &st, LIBFS_STAT_ALL));
+    assert_false(fs_lstat(buf, &st, LIBFS_STAT_ALL));
+
+#ifndef _WIN32
+    char output[LIBFS_MAX_PATH];
+    fs_assert_join_path(&output, cwd, DIRECTORY_OUTPUT);
+    fs_assert_make_dir(output);
+
+    char link[LIBFS_MAX_PATH];
+    fs_assert_join_path(&link, output, "hello.lnk");
+    fs_assert_join_path(&buf, cwd, FILE_HELLO);
+    assert_int_equal(symlink(buf, link), 0);
+    assert_true(fs_is_symlink(link));
+    assert_false(fs_is_symlink(buf));
+    assert_true(fs_lstat(link, &st, LIBFS_STAT_TYPE));
+    assert_int_equal(st.type, LIBFS_TYPE_SYMLINK);
+    assert_true(fs_stat(link, &st, LIBFS_STAT_TYPE | LIBFS_STAT_SIZE));
+    assert_int_equal(st.type, LIBFS_TYPE_FILE);
+    assert_int_equal(st.size, 5);
+    fs_assert_delete_file(link);
+#endif
+}
+
+static void test_stat_many(void **state)
+{
+    char cwd[LIBFS_MAX_PATH];
+    fs_assert_current_dir(&cwd);
+
+    char hello[LIBFS_MAX_PATH];
+    char unknown[LIBFS_MAX_PATH];
+    fs_assert_join_path(&hello, cwd, FILE_HELLO);
+    fs_assert_join_path(&unknown, cwd, FILE_UNKNOWN);
+
+    /* More paths than requests in flight */
+    const char *paths[300];
+    struct fs_stat_result results[300];
+    for (size_t i = 0; i < 300; ++i)
+    {
+        paths[i] = i % 2 ? unknown : hello;
+    }
+
+    /* io_uring where available, then the thread pool */
+    const int backends[] = {0, LIBFS_STAT_MANY_THREADS};
+    for (size_t b = 0; b < 2; ++b)
+    {
+        memset(results, 0xff, sizeof(results));
+        assert_int_equal(fs_stat_many(paths, 300, results, LIBFS_STAT_TYPE | LIBFS_STAT_SIZE, backends[b]), 150);
+        for (size_t i = 0; i < 300; ++i)
+        {
+            if (i % 2)
+            {
+                assert_int_equal(results[i].fields, 0);
+            }
+            else
+            {
+                assert_true(results[i].fields & LIBFS_STAT_SIZE);
+                assert_int_equal(results[i].type, LIBFS_TYPE_FILE);
+                assert_int_equal(results[i].size, 5);
+            }
+        }
+    }
+
+    assert_int_equal(fs_stat_many(paths, 0, results, LIBFS_STAT_ALL, 0), 0);
+}
+
 static void test_is_directory(void **state)
 {
     char cwd[LIBFS_MAX_PATH];
@@ -219,6 +459,60 @@ static void test_read_file_buffer_too_small(void **state)
     assert_int_equal((int)data[2], '\0');
 }
 
+static void test_read_file_into(void **state)
+{
+    char cwd[LIBFS_MAX_PATH];
+    fs_assert_current_dir(&cwd);
+
+    char output[LIBFS_MAX_PATH];
+    fs_assert_join_path(&output, cwd, DIRECTORY_OUTPUT);
+    fs_assert_make_dir(output);
+
+    struct fs_buffer buf = {NULL, 0, 0};
+    assert_true(fs_read_file_into(FILE_HELLO, &buf));
+    assert_int_equal(buf.size, 5);
+    assert_string_equal(buf.data, "hello");
+
+    /* The buffer is reused while files fit */
+    char *data = buf.data;
+    size_t capacity = buf.capacity;
+    assert_true(fs_read_file_into(FILE_HELLO, &buf));
+    assert_true(buf.data == data);
+    assert_int_equal(buf.capacity, capacity);
+
+    /* And at least doubles otherwise */
+    char path[LIBFS_MAX_PATH];
+    fs_assert_join_path(&path, output, "into.txt");
+    char content[100];
+    memset(content, 'x', sizeof(content));
+    fs_assert_write_file(path, content, sizeof(content));
+    assert_true(fs_read_file_into(path, &buf));
+    assert_int_equal(buf.size, sizeof(content));
+    assert_memory_equal(buf.data, content, sizeof(content));
+    assert_int_equal((int)buf.data[buf.size], '\0');
+    assert_true(buf.capacity >= capacity * 2);
+
+    data = buf.data;
+    assert_true(fs_read_file_into(FILE_HELLO, &buf));
+    assert_true(buf.data == data);
+    assert_string_equal(buf.data, "hello");
+
+#ifdef __linux__
+    /* Files reporting a size of 0 are read until the end */
+    assert_true(fs_read_file_into("/proc/self/status", &buf));
+    assert_true(buf.size > 0);
+    assert_int_equal(strlen(buf.data), buf.size);
+    assert_int_equal((int)buf.data[buf.size - 1], '\n');
+#endif
+
+    assert_false(fs_read_file_into(FILE_UNKNOWN, &buf));
+    assert_int_equal(buf.size, 0);
+    fs_free_buffer(&buf);
+    assert_null(buf.data);
+    assert_int_equal(buf.capacity, 0);
+    fs_assert_delete_file(path);
+}
+
 static void test_read_file(void **state)
 {
     char cwd[LIBFS_MAX_PATH];
@@ -237,98 +531,1561 @@ static void test_read_file(void **state)
     free(data);
 }
 
-static void test_iter_file(void **state)
+static void test_read_file_unknown_size(void **state)
+{
+    /* Pseudo files report a size of 0 but have content */
+    size_t size;
+    char *data = (char *)fs_read_file("/proc/self/status", &size);
+    if (!data)
+    {
+        skip();
+    }
+
+    assert_true(size > 0);
+    assert_int_equal(strlen(data), size);
+    free(data);
+}
+
+static void test_read_file_large(void **state)
 {
     char cwd[LIBFS_MAX_PATH];
     fs_assert_current_dir(&cwd);
 
     char buf[LIBFS_MAX_PATH];
-    fs_assert_join_path(&buf, cwd, FILE_HELLO);
+    fs_assert_join_path(&buf, cwd, DIRECTORY_OUTPUT);
+    fs_assert_make_dir(buf);
 
-    char expected[] = "hello";
+    char path[LIBFS_MAX_PATH];
+    fs_assert_join_path(&path, buf, "large.txt");
 
-    size_t i = 0;
-    char c;
-    fs_file_iterator *it = fs_assert_iter_file(buf);
-    while (fs_next_char(it, &c))
+    size_t large_size = 1024 * 1024 + 3;
+    char *large = (char *)malloc(large_size);
+    assert_non_null(large);
+    memset(large, 'a', large_size);
+    fs_assert_write_file(path, large, large_size);
+
+    size_t size;
+    char *data = (char *)fs_assert_read_file(path, &size);
+    assert_int_equal(size, large_size);
+    assert_memory_equal(data, large, large_size);
+    assert_int_equal((int)data[size], '\0');
+
+    free(data);
+    free(large);
+    fs_assert_delete_file(path);
+}
+
+static void test_filev(void **state)
+{
+    char cwd[LIBFS_MAX_PATH];
+    fs_assert_current_dir(&cwd);
+
+    char buf[LIBFS_MAX_PATH];
+    fs_assert_join_path(&buf, cwd, DIRECTORY_OUTPUT);
+    fs_assert_make_dir(buf);
+
+    char path[LIBFS_MAX_PATH];
+    fs_assert_join_path(&path, buf, "filev.txt");
+
+    /* More buffers than given to writev at once, with empty ones */
+    char parts[100][4];
+    struct fs_iovec iov[100];
+    for (int i = 0; i < 100; ++i)
     {
-        assert_int_equal(c, expected[i]);
-        ++i;
+        sprintf(parts[i], "%03d", i);
+        iov[i].data = parts[i];
+        iov[i].size = i % 10 == 5 ? 0 : 3;
     }
-    assert_int_equal(i, 5);
-    fs_close_file(it);
+    assert_true(fs_write_filev(path, iov, 100));
+
+    size_t size;
+    char *data = (char *)fs_assert_read_file(path, &size);
+    assert_int_equal(size, 270);
+    assert_memory_equal(data, "000001002003004006", 18);
+    free(data);
+
+    /* Buffers split across parts, then the end of the file */
+    char head[5];
+    char tail[300];
+    iov[0].data = head;
+    iov[0].size = 5;
+    iov[1].data = NULL;
+    iov[1].size = 0;
+    iov[2].data = tail;
+    iov[2].size = 300;
+    size_t readen;
+    assert_true(fs_read_filev(path, iov, 3, &readen));
+    assert_int_equal(readen, 270);
+    assert_memory_equal(head, "00000", 5);
+    assert_memory_equal(tail, "1002", 4);
+    assert_memory_equal(tail + 256, "097098099", 9);
+
+    assert_false(fs_read_filev(FILE_UNKNOWN, iov, 3, &readen));
+    fs_assert_delete_file(path);
 }
 
-static void test_read_dir(void **state)
+static size_t count_dir_entries(const char *path)
+{
+    size_t count = 0;
+    fs_directory_iterator *it = fs_open_dir(path);
+    assert_non_null(it);
+    while (fs_read_dir(it))
+    {
+        count += strcmp(it->path, ".") != 0 && strcmp(it->path, "..") != 0;
+    }
+    fs_close_dir(it);
+    return count;
+}
+
+static void test_write_file_atomic(void **state)
 {
     char cwd[LIBFS_MAX_PATH];
     fs_assert_current_dir(&cwd);
 
-    fs_directory_iterator *it = fs_open_dir(cwd);
-    assert_non_null(it);
+    char output[LIBFS_MAX_PATH];
+    fs_assert_join_path(&output, cwd, DIRECTORY_OUTPUT);
+    fs_assert_make_dir(output);
 
-    size_t has_data = 0;
-    while (fs_read_dir(it))
+    char dir[LIBFS_MAX_PATH];
+    fs_assert_join_path(&dir, output, "atomic");
+    fs_assert_make_dir(dir);
+
+    char path[LIBFS_MAX_PATH];
+    fs_assert_join_path(&path, dir, "foo.txt");
+    fs_assert_write_file(path, "old content", 11);
+    assert_true(fs_write_file_atomic(path, "new", 3));
+
+    size_t size;
+    char *data = (char *)fs_assert_read_file(path, &size);
+    assert_string_equal(data, "new");
+    free(data);
+    assert_int_equal(count_dir_entries(dir), 1);
+
+#ifndef _WIN32
+    /* The mode of the replaced file is kept */
+    struct fs_stat_result st;
+    assert_int_equal(chmod(path, 0600), 0);
+    assert_true(fs_write_file_atomic(path, "private", 7));
+    assert_true(fs_stat(path, &st, LIBFS_STAT_MODE));
+    assert_int_equal(st.mode, 0600);
+#endif
+
+    char unknown[LIBFS_MAX_PATH];
+    fs_assert_join_path(&unknown, dir, FILE_UNKNOWN "/foo.txt");
+    assert_false(fs_write_file_atomic(unknown, "new", 3));
+
+    /* Targets are only replaced on commit */
+    struct fs_atomic_batch *batch = fs_atomic_batch_create();
+    assert_non_null(batch);
+    char name[16];
+    char file[LIBFS_MAX_PATH];
+    for (int i = 0; i < 20; ++i)
     {
-        if (strcmp(it->path, DIRECTORY_DATA) != 0)
-        {
-            has_data = 1;
-        }
+        sprintf(name, "%d.txt", i);
+        fs_assert_join_path(&file, dir, name);
+        assert_true(fs_atomic_batch_write(batch, file, name, strlen(name)));
     }
+    assert_true(fs_atomic_batch_write(batch, path, "batch", 5));
+    assert_false(fs_atomic_batch_write(batch, unknown, "new", 3));
+    assert_false(fs_exist(file));
+    assert_true(fs_atomic_batch_commit(batch));
+    assert_int_equal(count_dir_entries(dir), 21);
 
-    assert_true(has_data);
+    data = (char *)fs_assert_read_file(file, &size);
+    assert_string_equal(data, "19.txt");
+    free(data);
+    data = (char *)fs_assert_read_file(path, &size);
+    assert_string_equal(data, "batch");
+    free(data);
 
-    fs_close_dir(it);
+    /* Uncommitted writes are discarded */
+    assert_true(fs_atomic_batch_commit(batch));
+    assert_true(fs_atomic_batch_write(batch, path, "discarded", 9));
+    fs_atomic_batch_destroy(batch);
+    assert_int_equal(count_dir_entries(dir), 21);
+    data = (char *)fs_assert_read_file(path, &size);
+    assert_string_equal(data, "batch");
+    free(data);
+
+    for (int i = 0; i < 20; ++i)
+    {
+        sprintf(name, "%d.txt", i);
+        fs_assert_join_path(&file, dir, name);
+        fs_assert_delete_file(file);
+    }
+    fs_assert_delete_file(path);
+    fs_assert_delete_dir(dir);
 }
 
-static void test_make_dir(void **state)
+static void test_file_writer(void **state)
 {
     char cwd[LIBFS_MAX_PATH];
     fs_assert_current_dir(&cwd);
 
     char buf[LIBFS_MAX_PATH];
     fs_assert_join_path(&buf, cwd, DIRECTORY_OUTPUT);
-
-    fs_assert_delete_dir(buf);
-    fs_assert_non_exist(buf);
     fs_assert_make_dir(buf);
-    fs_assert_exist(buf);
-    fs_assert_delete_dir(buf);
-    fs_assert_non_exist(buf);
+
+    char path[LIBFS_MAX_PATH];
+    fs_assert_join_path(&path, buf, "writer.txt");
+
+    /* Pieces smaller and larger than the buffer, with space allocated up front */
+    struct fs_file_writer_options options;
+    options.buffer_size = 7;
+    options.expected_size = 4096;
+    struct fs_file_writer *w = fs_open_file_writer(path, &options);
+    assert_non_null(w);
+    assert_true(fs_writer_append(w, "abc", 3));
+    assert_true(fs_writer_append(w, "defghijklmnopqrstuvwxyz", 23));
+    assert_true(fs_writer_append(w, "", 0));
+    assert_true(fs_writer_flush(w));
+
+    /* The reserved space never shows in the file size */
+    assert_int_equal(fs_file_size(path), 26);
+    assert_true(fs_writer_append(w, "0123456789", 10));
+    assert_true(fs_close_file_writer(w));
+
+    size_t size;
+    char *data = (char *)fs_assert_read_file(path, &size);
+    assert_int_equal(size, 36);
+    assert_string_equal(data, "abcdefghijklmnopqrstuvwxyz0123456789");
+    free(data);
+
+#ifndef _WIN32
+    /* Space reserved past the written bytes is released on close */
+    struct fs_stat_result st;
+    options.buffer_size = 0;
+    options.expected_size = 64 * 1024 * 1024;
+    w = fs_open_file_writer(path, &options);
+    assert_non_null(w);
+    assert_true(fs_writer_append(w, "abc", 3));
+    assert_true(fs_close_file_writer(w));
+    assert_true(fs_stat(path, &st, LIBFS_STAT_SIZE | LIBFS_STAT_BLOCKS));
+    assert_int_equal(st.size, 3);
+    assert_true(st.blocks * 512 <= 64 * 1024);
+#endif
+
+    w = fs_open_file_writer(path, NULL);
+    assert_non_null(w);
+    assert_true(fs_close_file_writer(w));
+    assert_int_equal(fs_file_size(path), 0);
+
+    fs_assert_join_path(&buf, cwd, FILE_UNKNOWN "/writer.txt");
+    assert_null(fs_open_file_writer(buf, NULL));
+    fs_assert_delete_file(path);
 }
 
-static void test_delete_file(void **state)
+static void test_direct_io_in(const char *dir)
+{
+    char path[LIBFS_MAX_PATH];
+    fs_assert_join_path(&path, dir, "direct.bin");
+    char copy[LIBFS_MAX_PATH];
+    fs_assert_join_path(&copy, dir, "direct_copy.bin");
+
+    /* Unaligned buffer and size, with a tail shorter than a block */
+    size_t large_size = 3 * LIBFS_DIRECT_ALIGNMENT + 100;
+    char *large = (char *)malloc(large_size + 1);
+    assert_non_null(large);
+    for (size_t i = 0; i < large_size; ++i)
+    {
+        large[i + 1] = (char)('a' + i % 26);
+    }
+    assert_true(fs_write_file_ex(path, large + 1, large_size, LIBFS_IO_DIRECT));
+
+    size_t size;
+    char *data = (char *)fs_read_file_ex(path, &size, LIBFS_IO_DIRECT);
+    assert_non_null(data);
+    assert_int_equal((size_t)data % LIBFS_DIRECT_ALIGNMENT, 0);
+    assert_int_equal(size, large_size);
+    assert_memory_equal(data, large + 1, large_size);
+    assert_int_equal((int)data[size], '\0');
+    fs_aligned_free(data);
+
+    struct fs_copy_options options;
+    memset(&options, 0, sizeof(options));
+    options.clone = LIBFS_CLONE_NEVER;
+    options.flags = LIBFS_IO_DIRECT;
+    assert_true(fs_copy_file_ex(path, copy, &options, NULL));
+    data = (char *)fs_read_file_ex(copy, &size, 0);
+    assert_non_null(data);
+    assert_int_equal(size, large_size);
+    assert_memory_equal(data, large + 1, large_size);
+    free(data);
+
+    /* Files smaller than a block */
+    assert_true(fs_write_file_ex(path, "hello", 5, LIBFS_IO_DIRECT));
+    data = (char *)fs_read_file_ex(path, &size, LIBFS_IO_DIRECT);
+    assert_non_null(data);
+    assert_string_equal(data, "hello");
+    fs_aligned_free(data);
+
+    free(large);
+    fs_assert_delete_file(path);
+    fs_assert_delete_file(copy);
+}
+
+static void test_direct_io(void **state)
+{
+    char cwd[LIBFS_MAX_PATH];
+    fs_assert_current_dir(&cwd);
+
+    char output[LIBFS_MAX_PATH];
+    fs_assert_join_path(&output, cwd, DIRECTORY_OUTPUT);
+    fs_assert_make_dir(output);
+
+    void *aligned = fs_aligned_alloc(64, 100);
+    assert_non_null(aligned);
+    assert_int_equal((size_t)aligned % 64, 0);
+    fs_aligned_free(aligned);
+
+    test_direct_io_in(output);
+#ifdef __linux__
+    /* tmpfs rejects O_DIRECT before Linux 6.6 */
+    if (fs_is_directory("/dev/shm"))
+    {
+        test_direct_io_in("/dev/shm");
+    }
+#endif
+
+    assert_null(fs_read_file_ex(FILE_UNKNOWN, NULL, LIBFS_IO_DIRECT));
+}
+
+static void test_prefetch(void **state)
+{
+    const char *paths[] = {FILE_HELLO, FILE_UNKNOWN, FILE_HELLO};
+    assert_int_equal(fs_prefetch_wait(fs_prefetch(paths, 3)), 2);
+    assert_int_equal(fs_prefetch_wait(fs_prefetch(paths, 0)), 0);
+    assert_int_equal(fs_prefetch_wait(NULL), 0);
+
+    /* Paths are copied, more than one job's worth of them */
+    char *copies[200];
+    for (size_t i = 0; i < 200; ++i)
+    {
+        const char *path = i % 4 ? FILE_HELLO : FILE_UNKNOWN;
+        copies[i] = (char *)malloc(strlen(path) + 1);
+        assert_non_null(copies[i]);
+        strcpy(copies[i], path);
+    }
+    struct fs_prefetch_batch *batch = fs_prefetch((const char *const *)copies, 200);
+    assert_non_null(batch);
+    for (size_t i = 0; i < 200; ++i)
+    {
+        free(copies[i]);
+    }
+    assert_int_equal(fs_prefetch_wait(batch), 150);
+
+    /* Hints don't change what is read */
+    int flags[] = {LIBFS_IO_SEQUENTIAL, LIBFS_IO_RANDOM, LIBFS_IO_ONCE};
+    for (size_t i = 0; i < sizeof(flags) / sizeof(flags[0]); ++i)
+    {
+        size_t size;
+        char *data = (char *)fs_read_file_ex(FILE_HELLO, &size, flags[i]);
+        assert_non_null(data);
+        assert_int_equal(size, 5);
+        assert_string_equal(data, "hello");
+        free(data);
+    }
+
+    assert_null(fs_read_file_ex(FILE_UNKNOWN, NULL, LIBFS_IO_ONCE));
+}
+
+static void test_map_file(void **state)
 {
     char cwd[LIBFS_MAX_PATH];
     fs_assert_current_dir(&cwd);
 
     char buf[LIBFS_MAX_PATH];
-    fs_assert_join_path(&buf, cwd, DIRECTORY_OUTPUT);
+    fs_assert_join_path(&buf, cwd, FILE_HELLO);
+
+    struct fs_file_view view;
+    assert_true(fs_map_file(buf, &view, LIBFS_MAP_POPULATE | LIBFS_MAP_SEQUENTIAL | LIBFS_MAP_WILLNEED));
+    assert_true(view.mapped);
+    assert_int_equal(view.size, 5);
+    assert_memory_equal(view.data, "hello", 5);
+    fs_unmap_file(&view);
+    assert_null(view.data);
+
+    fs_assert_join_path(&buf, cwd, FILE_UNKNOWN);
+    assert_false(fs_map_file(buf, &view, 0));
+}
 
+static void test_map_empty_file(void **state)
+{
+    char cwd[LIBFS_MAX_PATH];
+    fs_assert_current_dir(&cwd);
+
+    char buf[LIBFS_MAX_PATH];
+    fs_assert_join_path(&buf, cwd, DIRECTORY_OUTPUT);
     fs_assert_make_dir(buf);
-    fs_assert_exist(buf);
 
-    char foo[LIBFS_MAX_PATH];
-    fs_assert_join_path(&foo, buf, "foo.txt");
+    char empty[LIBFS_MAX_PATH];
+    fs_assert_join_path(&empty, buf, "empty.txt");
+    fs_assert_write_file(empty, "", 0);
 
-    const char *hello = "hello";
-    fs_assert_write_file(foo, hello, 5);
-    fs_assert_exist(foo);
-    fs_assert_delete_file(foo);
-    fs_assert_non_exist(foo);
+    /* Empty files can't be mapped and are read instead */
+    struct fs_file_view view;
+    assert_true(fs_map_file(empty, &view, 0));
+    assert_false(view.mapped);
+    assert_int_equal(view.size, 0);
+    fs_unmap_file(&view);
+    fs_assert_delete_file(empty);
 }
 
-static void test_read_unknown_dir(void **state)
+static void test_iter_file(void **state)
 {
-    fs_directory_iterator *it = fs_open_dir("invalid dir");
-    assert_null(it);
+    char cwd[LIBFS_MAX_PATH];
+    fs_assert_current_dir(&cwd);
+
+    char buf[LIBFS_MAX_PATH];
+    fs_assert_join_path(&buf, cwd, FILE_HELLO);
+
+    char expected[] = "hello";
+
+    size_t i = 0;
+    char c;
+    fs_file_iterator *it = fs_assert_iter_file(buf);
+    while (fs_next_char(it, &c))
+    {
+        assert_int_equal(c, expected[i]);
+        ++i;
+    }
+    assert_int_equal(i, 5);
+    fs_close_file(it);
 }
 
-static void test_hooks(void **state)
+static void test_iter_file_chunks(void **state)
 {
-    struct fs_hooks hooks = {malloc, free};
-    fs_init_hooks(&hooks);
-    test_read_dir(state);
+    char cwd[LIBFS_MAX_PATH];
+    fs_assert_current_dir(&cwd);
+
+    char buf[LIBFS_MAX_PATH];
+    fs_assert_join_path(&buf, cwd, FILE_HELLO);
+
+    const char *data;
+    size_t size;
+    size_t total = 0;
+    fs_file_iterator *it = fs_iter_file_ex(buf, 2);
+    assert_non_null(it);
+    while (fs_next_chunk(it, &data, &size))
+    {
+        assert_in_range(size, 1, 2);
+        assert_memory_equal(data, "hello" + total, size);
+        total += size;
+    }
+    assert_int_equal(total, 5);
+    fs_close_file(it);
+}
+
+static void test_iter_file_lines(void **state)
+{
+    char cwd[LIBFS_MAX_PATH];
+    fs_assert_current_dir(&cwd);
+
+    char buf[LIBFS_MAX_PATH];
+    fs_assert_join_path(&buf, cwd, DIRECTORY_OUTPUT);
+    fs_assert_make_dir(buf);
+
+    char path[LIBFS_MAX_PATH];
+    fs_assert_join_path(&path, buf, "lines.txt");
+
+    /* Lines straddle and exceed the 4 bytes buffer, the last one has no newline */
+    const char *content = "ab\n\nlonger than buffer\nxyz\nend";
+    const char *expected[] = {"ab", "", "longer than buffer", "xyz", "end"};
+    fs_assert_write_file(path, content, strlen(content));
+
+    const char *line;
+    size_t size;
+    size_t i = 0;
+    fs_file_iterator *it = fs_iter_file_ex(path, 4);
+    assert_non_null(it);
+    while (fs_next_line(it, &line, &size))
+    {
+        assert_true(i < 5);
+        assert_int_equal(size, strlen(expected[i]));
+        assert_memory_equal(line, expected[i], size);
+        ++i;
+    }
+    assert_int_equal(i, 5);
+    assert_false(fs_file_error(it));
+    fs_close_file(it);
+    fs_assert_delete_file(path);
+
+#ifndef _WIN32
+    /* Reading a directory fails, which is not the end of the file */
+    it = fs_iter_file_ex(buf, 4);
+    assert_non_null(it);
+    assert_null(fs_next_chunk(it, &line, &size));
+    assert_true(fs_file_error(it));
+    assert_null(fs_next_line(it, &line, &size));
+    assert_true(fs_file_error(it));
+    fs_close_file(it);
+#endif
+}
+
+static void test_count_lines(void **state)
+{
+    char cwd[LIBFS_MAX_PATH];
+    fs_assert_current_dir(&cwd);
+
+    char buf[LIBFS_MAX_PATH];
+    fs_assert_join_path(&buf, cwd, DIRECTORY_OUTPUT);
+    fs_assert_make_dir(buf);
+
+    char path[LIBFS_MAX_PATH];
+    fs_assert_join_path(&path, buf, "count.txt");
+
+    /* Lines of varying length cover vector and scalar code paths */
+    size_t content_size = 200000;
+    char *content = (char *)malloc(content_size);
+    assert_non_null(content);
+    size_t expected = 0;
+    for (size_t i = 0; i < content_size; ++i)
+    {
+        content[i] = (i * 7919) % 97 == 0 ? '\n' : 'a';
+        expected += content[i] == '\n';
+    }
+    content[content_size - 1] = 'a';
+    fs_assert_write_file(path, content, content_size);
+
+    size_t count;
+    assert_true(fs_count_lines(path, &count));
+    assert_int_equal(count, expected + 1);
+
+    /* Tokens must match the lines */
+    const char *line;
+    size_t size;
+    size_t lines = 0;
+    size_t total = 0;
+    fs_file_iterator *it = fs_assert_iter_file(path);
+    while (fs_next_token(it, '\n', &line, &size))
+    {
+        assert_null(memchr(line, '\n', size));
+        total += size + 1;
+        ++lines;
+    }
+    fs_close_file(it);
+    assert_int_equal(lines, count);
+    assert_int_equal(total, content_size + 1);
+
+    free(content);
+    fs_assert_delete_file(path);
+    assert_false(fs_count_lines(FILE_UNKNOWN, &count));
+#ifndef _WIN32
+    /* Reading a directory fails instead of counting no line */
+    assert_false(fs_count_lines(buf, &count));
+#endif
+}
+
+static void test_read_dir(void **state)
+{
+    char cwd[LIBFS_MAX_PATH];
+    fs_assert_current_dir(&cwd);
+
+    fs_directory_iterator *it = fs_open_dir(cwd);
+    assert_non_null(it);
+
+    size_t has_data = 0;
+    while (fs_read_dir(it))
+    {
+        if (strcmp(it->path, DIRECTORY_DATA) != 0)
+        {
+            has_data = 1;
+        }
+    }
+
+    assert_true(has_data);
+
+    fs_close_dir(it);
+}
+
+static void test_read_dir_types(void **state)
+{
+    char cwd[LIBFS_MAX_PATH];
+    fs_assert_current_dir(&cwd);
+
+    char buf[LIBFS_MAX_PATH];
+    fs_assert_join_path(&buf, cwd, DIRECTORY_DATA);
+
+    size_t has_file = 0;
+    fs_directory_iterator *it = fs_assert_open_dir(cwd);
+    while (fs_read_dir(it))
+    {
+        if (strcmp(it->path, DIRECTORY_DATA) == 0)
+        {
+            assert_int_equal(fs_dir_entry_type(it), LIBFS_TYPE_DIRECTORY);
+        }
+    }
+    fs_close_dir(it);
+
+    it = fs_assert_open_dir(buf);
+    while (fs_read_dir(it))
+    {
+        if (strcmp(it->path, "hello.txt") == 0)
+        {
+            assert_int_equal(fs_dir_entry_type(it), LIBFS_TYPE_FILE);
+            has_file = 1;
+        }
+    }
+    fs_close_dir(it);
+
+    assert_true(has_file);
+}
+
+static size_t count_iterated_entries(fs_directory_iterator *it)
+{
+    size_t count = 0;
+    while (fs_read_dir(it))
+    {
+        count += strcmp(it->path, ".") != 0 && strcmp(it->path, "..") != 0;
+    }
+    return count;
+}
+
+static void test_open_dir_in(void **state)
+{
+    char cwd[LIBFS_MAX_PATH];
+    fs_assert_current_dir(&cwd);
+
+    char output[LIBFS_MAX_PATH];
+    fs_assert_join_path(&output, cwd, DIRECTORY_OUTPUT);
+    fs_assert_make_dir(output);
+
+    char dir[LIBFS_MAX_PATH];
+    fs_assert_join_path(&dir, output, "storage");
+    fs_assert_make_dir(dir);
+
+    /* More entries than the buffer of the storage holds at once */
+    char path[LIBFS_MAX_PATH];
+    char name[64];
+    for (int i = 0; i < 300; ++i)
+    {
+        sprintf(name, "entry_with_a_rather_long_name_%03d", i);
+        fs_assert_join_path(&path, dir, name);
+        fs_assert_write_file(path, "", 0);
+    }
+
+    struct fs_dir_storage storage;
+    fs_directory_iterator *it = fs_open_dir_in(&storage, dir);
+    assert_non_null(it);
+    assert_int_equal(count_iterated_entries(it), 300);
+    fs_rewind_dir(it);
+    assert_int_equal(count_iterated_entries(it), 300);
+
+    /* The same iterator goes through other directories */
+    assert_true(fs_reopen_dir(it, DIRECTORY_DATA) == it);
+    assert_int_equal(count_iterated_entries(it), count_dir_entries(DIRECTORY_DATA));
+    assert_null(fs_reopen_dir(it, FILE_UNKNOWN));
+    assert_null(fs_read_dir(it));
+    assert_null(fs_reopen_dir(it, NULL));
+    assert_true(fs_reopen_dir(it, dir) == it);
+    assert_int_equal(count_iterated_entries(it), 300);
+    fs_close_dir(it);
+
+    /* Allocated iterators can be reopened too */
+    it = fs_open_dir(DIRECTORY_DATA);
+    assert_non_null(it);
+    assert_true(fs_reopen_dir(it, dir) == it);
+    assert_int_equal(count_iterated_entries(it), 300);
+    fs_close_dir(it);
+
+    assert_null(fs_open_dir_in(&storage, FILE_UNKNOWN));
+    for (int i = 0; i < 300; ++i)
+    {
+        sprintf(name, "entry_with_a_rather_long_name_%03d", i);
+        fs_assert_join_path(&path, dir, name);
+        fs_assert_delete_file(path);
+    }
+    fs_assert_delete_dir(dir);
+}
+
+static void test_read_dir_batch(void **state)
+{
+    char cwd[LIBFS_MAX_PATH];
+    fs_assert_current_dir(&cwd);
+
+    char output[LIBFS_MAX_PATH];
+    fs_assert_join_path(&output, cwd, DIRECTORY_OUTPUT);
+    fs_assert_make_dir(output);
+
+    char dir[LIBFS_MAX_PATH];
+    fs_assert_join_path(&dir, output, "batch");
+    fs_assert_make_dir(dir);
+
+    char name[32];
+    char buf[LIBFS_MAX_PATH];
+    for (int i = 0; i < 50; ++i)
+    {
+        sprintf(name, "file%d", i);
+        fs_assert_join_path(&buf, dir, name);
+        fs_assert_write_file(buf, "", 0);
+    }
+
+    /* Fewer entries than the records of one call to keep some for later */
+    size_t size = 4096;
+    void *data = malloc(size);
+    assert_non_null(data);
+    struct fs_dir_entry entries[7];
+    size_t total = 0;
+    size_t n;
+    fs_directory_iterator *it = fs_assert_open_dir(dir);
+    while ((n = fs_read_dir_batch(it, data, size, entries, 7)))
+    {
+        assert_true(n <= 7);
+        for (size_t i = 0; i < n; ++i)
+        {
+            assert_int_equal(entries[i].name_length, strlen(entries[i].name));
+            if (entries[i].name[0] != '.')
+            {
+                assert_true(entries[i].type == LIBFS_TYPE_FILE || entries[i].type == LIBFS_TYPE_UNKNOWN);
+            }
+        }
+        total += n;
+    }
+    fs_close_dir(it);
+
+    /* Including . and .. */
+    assert_int_equal(total, 52);
+
+    /* A buffer too small for any entry is an error, not the end */
+    it = fs_assert_open_dir(dir);
+    errno = 0;
+    assert_true(fs_read_dir_batch(it, data, 8, entries, 7) == (size_t)-1);
+    assert_int_equal(errno, EINVAL);
+    assert_true(fs_read_dir_batch(it, data, 512, entries, 7) > 0);
+    fs_close_dir(it);
+    free(data);
+
+    for (int i = 0; i < 50; ++i)
+    {
+        sprintf(name, "file%d", i);
+        fs_assert_join_path(&buf, dir, name);
+        fs_assert_delete_file(buf);
+    }
+    fs_assert_delete_dir(dir);
+}
+
+static void test_dir_handle(void **state)
+{
+    char cwd[LIBFS_MAX_PATH];
+    fs_assert_current_dir(&cwd);
+
+    char output[LIBFS_MAX_PATH];
+    fs_assert_join_path(&output, cwd, DIRECTORY_OUTPUT);
+    fs_assert_make_dir(output);
+
+    struct fs_dir_handle *dir = fs_open_dir_handle(output);
+    assert_non_null(dir);
+    assert_null(fs_open_dir_handle_at(dir, FILE_UNKNOWN));
+
+    assert_true(fs_make_dir_at(dir, "handle"));
+    assert_true(fs_is_directory_at(dir, "handle"));
+    assert_false(fs_is_file_at(dir, "handle"));
+
+    struct fs_dir_handle *sub = fs_open_dir_handle_at(dir, "handle");
+    assert_non_null(sub);
+    assert_true(fs_write_file_at(sub, "foo.txt", "hello", 5));
+    assert_true(fs_exist_at(sub, "foo.txt"));
+    assert_true(fs_is_file_at(sub, "foo.txt"));
+    assert_true(fs_is_file_at(dir, "handle/foo.txt"));
+
+    size_t size;
+    char *data = (char *)fs_read_file_at(sub, "foo.txt", &size);
+    assert_non_null(data);
+    assert_int_equal(size, 5);
+    assert_string_equal(data, "hello");
+    free(data);
+
+    /* Handles opened from an iterator outlive it */
+    fs_directory_iterator *it = fs_open_dir_at(dir, "handle");
+    assert_non_null(it);
+    struct fs_dir_handle *from = fs_dir_handle_from_iterator(it);
+    assert_non_null(from);
+    int found = 0;
+    while (fs_read_dir(it))
+    {
+        if (strcmp(it->path, "foo.txt") == 0)
+        {
+            found = fs_is_file_at(from, it->path);
+        }
+    }
+    fs_close_dir(it);
+    assert_true(found);
+    assert_true(fs_delete_file_at(from, "foo.txt"));
+    assert_false(fs_exist_at(sub, "foo.txt"));
+    fs_close_dir_handle(from);
+
+    fs_close_dir_handle(sub);
+    assert_true(fs_delete_dir_at(dir, "handle"));
+    assert_false(fs_exist_at(dir, "handle"));
+    fs_close_dir_handle(dir);
+
+    /* A NULL handle is the current directory */
+    assert_true(fs_is_file_at(NULL, FILE_HELLO));
+    assert_false(fs_exist_at(NULL, FILE_UNKNOWN));
+}
+
+/* Entries of the tree walked by test_walk */
+static const char *walk_names[] = {"a", "x.txt", "b", "y.txt", "z.txt", "loop"};
+
+typedef struct walk_result
+{
+    int visited[6];
+    size_t depth[6];
+    enum fs_file_type type[6];
+    const char *skip;
+    int stop;
+} walk_result;
+
+static int walk_visit(const struct fs_walk_entry *entry, void *user)
+{
+    walk_result *result = (walk_result *)user;
+    for (size_t i = 0; i < 6; ++i)
+    {
+        if (strcmp(entry->name, walk_names[i]) == 0)
+        {
+            /* Each entry writes its own slot as visits may be concurrent */
+            result->visited[i]++;
+            result->depth[i] = entry->depth;
+            result->type[i] = entry->type;
+        }
+    }
+
+    if (result->stop)
+    {
+        return LIBFS_WALK_STOP;
+    }
+
+    if (result->skip && strcmp(entry->name, result->skip) == 0)
+    {
+        return LIBFS_WALK_SKIP;
+    }
+
+    return LIBFS_WALK_CONTINUE;
+}
+
+static int walk_count(const walk_result *result)
+{
+    int count = 0;
+    for (size_t i = 0; i < 6; ++i)
+    {
+        count += result->visited[i];
+    }
+
+    return count;
+}
+
+static void test_walk(void **state)
+{
+    char cwd[LIBFS_MAX_PATH];
+    fs_assert_current_dir(&cwd);
+
+    char output[LIBFS_MAX_PATH];
+    fs_assert_join_path(&output, cwd, DIRECTORY_OUTPUT);
+    fs_assert_make_dir(output);
+
+    char root[LIBFS_MAX_PATH];
+    fs_assert_join_path(&root, output, "walk");
+    fs_assert_make_dir(root);
+
+    struct fs_dir_handle *dir = fs_open_dir_handle(root);
+    assert_non_null(dir);
+    assert_true(fs_make_dir_at(dir, "a"));
+    assert_true(fs_make_dir_at(dir, "a/b"));
+    assert_true(fs_write_file_at(dir, "a/x.txt", "x", 1));
+    assert_true(fs_write_file_at(dir, "a/b/y.txt", "y", 1));
+    assert_true(fs_write_file_at(dir, "z.txt", "z", 1));
+
+    struct fs_walk_options options;
+    memset(&options, 0, sizeof(options));
+    walk_result result;
+
+    /* Parallel walks, then streaming walks with one or many open directories */
+    for (size_t mode = 0; mode < 4; ++mode)
+    {
+        options.threads = mode == 1 ? 4 : 1;
+        options.flags = mode >= 2 ? LIBFS_WALK_STREAMING : 0;
+        options.max_open_dirs = mode == 3 ? 1 : 0;
+        memset(&result, 0, sizeof(result));
+        assert_true(fs_walk(root, &options, walk_visit, &result));
+        assert_int_equal(walk_count(&result), 5);
+        assert_int_equal(result.depth[3], 3);
+        assert_int_equal(result.type[2], LIBFS_TYPE_DIRECTORY);
+        assert_int_equal(result.type[3], LIBFS_TYPE_FILE);
+    }
+
+    /* Only entries of the walked directory */
+    options.threads = 1;
+    options.flags = 0;
+    options.max_open_dirs = 0;
+    options.max_depth = 1;
+    memset(&result, 0, sizeof(result));
+    assert_true(fs_walk(root, &options, walk_visit, &result));
+    assert_int_equal(walk_count(&result), 2);
+    options.max_depth = 0;
+
+    for (size_t mode = 0; mode < 2; ++mode)
+    {
+        options.flags = mode ? LIBFS_WALK_STREAMING : 0;
+        memset(&result, 0, sizeof(result));
+        result.skip = "a";
+        assert_true(fs_walk(root, &options, walk_visit, &result));
+        assert_int_equal(walk_count(&result), 2);
+
+        memset(&result, 0, sizeof(result));
+        result.stop = 1;
+        assert_true(fs_walk(root, &options, walk_visit, &result));
+        assert_int_equal(walk_count(&result), 1);
+    }
+
+    options.flags = 0;
+
+#ifndef _WIN32
+    /* A link back to the root is reported but never entered */
+    char link[LIBFS_MAX_PATH];
+    fs_assert_join_path(&link, root, "a/b/loop");
+    assert_int_equal(symlink("../..", link), 0);
+
+    memset(&result, 0, sizeof(result));
+    assert_true(fs_walk(root, &options, walk_visit, &result));
+    assert_int_equal(walk_count(&result), 6);
+    assert_int_equal(result.type[5], LIBFS_TYPE_SYMLINK);
+
+    for (size_t mode = 0; mode < 2; ++mode)
+    {
+        options.flags = LIBFS_WALK_FOLLOW_SYMLINKS | (mode ? LIBFS_WALK_STREAMING : 0);
+        memset(&result, 0, sizeof(result));
+        assert_true(fs_walk(root, &options, walk_visit, &result));
+        assert_int_equal(walk_count(&result), 6);
+        assert_int_equal(result.type[5], LIBFS_TYPE_DIRECTORY);
+    }
+    assert_true(fs_delete_file_at(dir, "a/b/loop"));
+#endif
+
+    assert_false(fs_walk(FILE_UNKNOWN, NULL, walk_visit, &result));
+
+    assert_true(fs_delete_file_at(dir, "a/b/y.txt"));
+    assert_true(fs_delete_file_at(dir, "a/x.txt"));
+    assert_true(fs_delete_file_at(dir, "z.txt"));
+    assert_true(fs_delete_dir_at(dir, "a/b"));
+    assert_true(fs_delete_dir_at(dir, "a"));
+    fs_close_dir_handle(dir);
+    fs_assert_delete_dir(root);
+}
+
+typedef struct walk_resume
+{
+    struct fs_dir_handle *root;
+    int visited[20];
+    int created;
+} walk_resume;
+
+static int walk_resume_visit(const struct fs_walk_entry *entry, void *user)
+{
+    walk_resume *resume = (walk_resume *)user;
+    char name[16];
+    if (entry->depth == 1 && entry->name[0] == 'd')
+    {
+        resume->visited[atoi(entry->name + 1)]++;
+    }
+    else if (entry->depth == 2)
+    {
+        /* Add entries to the root while it is closed */
+        sprintf(name, "new%d", resume->created++);
+        assert_true(fs_write_file_at(resume->root, name, "n", 1));
+    }
+
+    return LIBFS_WALK_CONTINUE;
+}
+
+static void test_walk_resume(void **state)
+{
+#ifndef __linux__
+    /* Only Linux resumes at an offset, elsewhere new entries shift the count */
+    skip();
+#endif
+    char cwd[LIBFS_MAX_PATH];
+    fs_assert_current_dir(&cwd);
+
+    char output[LIBFS_MAX_PATH];
+    fs_assert_join_path(&output, cwd, DIRECTORY_OUTPUT);
+    fs_assert_make_dir(output);
+
+    char root[LIBFS_MAX_PATH];
+    fs_assert_join_path(&root, output, "walk_resume");
+    fs_assert_make_dir(root);
+
+    walk_resume resume;
+    memset(&resume, 0, sizeof(resume));
+    resume.root = fs_open_dir_handle(root);
+    assert_non_null(resume.root);
+
+    char name[32];
+    for (int i = 0; i < 20; ++i)
+    {
+        sprintf(name, "d%d", i);
+        assert_true(fs_make_dir_at(resume.root, name));
+        sprintf(name, "d%d/f", i);
+        assert_true(fs_write_file_at(resume.root, name, "f", 1));
+    }
+
+    /* The root is reopened after each subdirectory, every entry is still seen once */
+    struct fs_walk_options options;
+    memset(&options, 0, sizeof(options));
+    options.flags = LIBFS_WALK_STREAMING;
+    options.max_open_dirs = 1;
+    assert_true(fs_walk(root, &options, walk_resume_visit, &resume));
+    for (int i = 0; i < 20; ++i)
+    {
+        assert_int_equal(resume.visited[i], 1);
+    }
+
+    for (int i = 0; i < 20; ++i)
+    {
+        sprintf(name, "d%d/f", i);
+        assert_true(fs_delete_file_at(resume.root, name));
+        sprintf(name, "d%d", i);
+        assert_true(fs_delete_dir_at(resume.root, name));
+    }
+
+    for (int i = 0; i < resume.created; ++i)
+    {
+        sprintf(name, "new%d", i);
+        assert_true(fs_delete_file_at(resume.root, name));
+    }
+
+    fs_close_dir_handle(resume.root);
+    fs_assert_delete_dir(root);
+}
+
+static void test_ring(void **state)
+{
+    char cwd[LIBFS_MAX_PATH];
+    fs_assert_current_dir(&cwd);
+
+    char output[LIBFS_MAX_PATH];
+    fs_assert_join_path(&output, cwd, DIRECTORY_OUTPUT);
+    fs_assert_make_dir(output);
+
+    char path[LIBFS_MAX_PATH];
+    fs_assert_join_path(&path, output, "ring.txt");
+
+    /* io_uring when available, then the thread pool */
+    for (int mode = 0; mode < 2; ++mode)
+    {
+        struct fs_ring *ring = fs_ring_create(2, mode ? LIBFS_RING_THREADS : 0);
+        assert_non_null(ring);
+
+        struct fs_ring_completion done[4];
+        assert_int_equal(fs_ring_wait(ring, done, 4, 1), 0);
+
+        assert_true(fs_ring_write_file(ring, path, "hello ring", 10, &done[0]));
+        assert_true(fs_ring_fsync(ring, FILE_HELLO, &done[1]));
+        assert_false(fs_ring_read_file(ring, FILE_HELLO, NULL));
+        assert_int_equal(fs_ring_wait(ring, done, 4, 2), 2);
+        for (int i = 0; i < 2; ++i)
+        {
+            assert_int_equal(done[i].error, 0);
+            if (done[i].op == LIBFS_RING_WRITE_FILE)
+            {
+                assert_int_equal(done[i].size, 10);
+            }
+        }
+
+        char range[4];
+        assert_true(fs_ring_read_range(ring, path, 6, range, sizeof(range), range));
+        assert_true(fs_ring_read_file(ring, path, NULL));
+        assert_int_equal(fs_ring_wait(ring, done, 4, 2), 2);
+        for (int i = 0; i < 2; ++i)
+        {
+            assert_int_equal(done[i].error, 0);
+            if (done[i].op == LIBFS_RING_READ_RANGE)
+            {
+                assert_true(done[i].user == range);
+                assert_int_equal(done[i].size, 4);
+                assert_memory_equal(range, "ring", 4);
+            }
+            else
+            {
+                assert_int_equal(done[i].size, 10);
+                assert_string_equal(done[i].data, "hello ring");
+                free(done[i].data);
+            }
+        }
+
+        /* Ranges larger than what is left in the file are short */
+        char tail[16];
+        assert_true(fs_ring_read_range(ring, path, 8, tail, sizeof(tail), tail));
+        assert_int_equal(fs_ring_wait(ring, done, 4, 1), 1);
+        assert_int_equal(done[0].error, 0);
+        assert_true(done[0].user == tail);
+        assert_int_equal(done[0].size, 2);
+        assert_memory_equal(tail, "ng", 2);
+
+        assert_true(fs_ring_read_file(ring, FILE_UNKNOWN, NULL));
+        assert_int_equal(fs_ring_wait(ring, done, 4, 1), 1);
+        assert_int_equal(done[0].error, ENOENT);
+        assert_null(done[0].data);
+
+#ifdef __linux__
+        /* Files reporting no size are read until EOF */
+        assert_true(fs_ring_read_file(ring, "/proc/self/status", NULL));
+        assert_int_equal(fs_ring_wait(ring, done, 4, 1), 1);
+        assert_int_equal(done[0].error, 0);
+        assert_true(done[0].size > 0);
+        assert_int_equal(strlen((const char *)done[0].data), done[0].size);
+        free(done[0].data);
+#endif
+
+        /* Pending completions are released with the ring */
+        assert_true(fs_ring_read_file(ring, path, NULL));
+        fs_ring_destroy(ring);
+    }
+
+    fs_assert_delete_file(path);
+}
+
+static void test_make_dir(void **state)
+{
+    char cwd[LIBFS_MAX_PATH];
+    fs_assert_current_dir(&cwd);
+
+    char buf[LIBFS_MAX_PATH];
+    fs_assert_join_path(&buf, cwd, DIRECTORY_OUTPUT);
+
+    fs_assert_delete_dir(buf);
+    fs_assert_non_exist(buf);
+    fs_assert_make_dir(buf);
+    fs_assert_exist(buf);
+    fs_assert_delete_dir(buf);
+    fs_assert_non_exist(buf);
+}
+
+static void test_delete_file(void **state)
+{
+    char cwd[LIBFS_MAX_PATH];
+    fs_assert_current_dir(&cwd);
+
+    char buf[LIBFS_MAX_PATH];
+    fs_assert_join_path(&buf, cwd, DIRECTORY_OUTPUT);
+
+    fs_assert_make_dir(buf);
+    fs_assert_exist(buf);
+
+    char foo[LIBFS_MAX_PATH];
+    fs_assert_join_path(&foo, buf, "foo.txt");
+
+    const char *hello = "hello";
+    fs_assert_write_file(foo, hello, 5);
+    fs_assert_exist(foo);
+    fs_assert_delete_file(foo);
+    fs_assert_non_exist(foo);
+}
+
+static void test_read_unknown_dir(void **state)
+{
+    fs_directory_iterator *it = fs_open_dir("invalid dir");
+    assert_null(it);
+}
+
+static void test_copy_file(void **state)
+{
+    char cwd[LIBFS_MAX_PATH];
+    fs_assert_current_dir(&cwd);
+
+    char from[LIBFS_MAX_PATH];
+    fs_assert_join_path(&from, cwd, FILE_HELLO);
+
+    char buf[LIBFS_MAX_PATH];
+    fs_assert_join_path(&buf, cwd, DIRECTORY_OUTPUT);
+    fs_assert_make_dir(buf);
+
+    char to[LIBFS_MAX_PATH];
+    fs_assert_join_path(&to, buf, "copy.txt");
+
+    assert_true(fs_copy_file(from, to));
+
+    size_t size;
+    char *data = (char *)fs_assert_read_file(to, &size);
+    assert_int_equal(size, 5);
+    assert_string_equal(data, "hello");
+    free(data);
+
+    fs_assert_delete_file(to);
+    assert_false(fs_copy_file(FILE_UNKNOWN, to));
+    fs_assert_non_exist(to);
+}
+
+static void test_copy_file_methods(void **state)
+{
+    char cwd[LIBFS_MAX_PATH];
+    fs_assert_current_dir(&cwd);
+
+    char buf[LIBFS_MAX_PATH];
+    fs_assert_join_path(&buf, cwd, DIRECTORY_OUTPUT);
+    fs_assert_make_dir(buf);
+
+    char from[LIBFS_MAX_PATH];
+    fs_assert_join_path(&from, buf, "large.bin");
+
+    char to[LIBFS_MAX_PATH];
+    fs_assert_join_path(&to, buf, "large_copy.bin");
+
+    /* Larger than the read/write buffer to exercise partial transfers */
+    size_t large_size = 3 * 1024 * 1024 + 17;
+    char *large = (char *)malloc(large_size);
+    assert_non_null(large);
+    for (size_t i = 0; i < large_size; ++i)
+    {
+        large[i] = (char)(i * 31);
+    }
+    fs_assert_write_file(from, large, large_size);
+
+    enum fs_copy_method methods[] = {
+        LIBFS_COPY_AUTO,
+        LIBFS_COPY_RANGE,
+        LIBFS_COPY_SENDFILE,
+        LIBFS_COPY_READ_WRITE};
+    for (size_t i = 0; i < sizeof(methods) / sizeof(methods[0]); ++i)
+    {
+        struct fs_copy_options options = {methods[i], LIBFS_CLONE_NEVER};
+        enum fs_copy_method used;
+        assert_true(fs_copy_file_ex(from, to, &options, &used));
+        assert_int_not_equal(used, LIBFS_COPY_CLONE);
+        assert_int_not_equal(used, LIBFS_COPY_AUTO);
+
+        /* Unsupported methods only fall back to slower ones */
+        assert_true(used >= methods[i]);
+        if (methods[i] == LIBFS_COPY_READ_WRITE)
+        {
+            assert_int_equal(used, LIBFS_COPY_READ_WRITE);
+        }
+
+        size_t size;
+        char *data = (char *)fs_assert_read_file(to, &size);
+        assert_int_equal(size, large_size);
+        assert_memory_equal(data, large, large_size);
+        free(data);
+        fs_assert_delete_file(to);
+    }
+
+    fs_assert_delete_file(from);
+    free(large);
+
+#ifdef __linux__
+    /* sysfs files report a size but kernel copies return nothing */
+    const char *pseudo = "/sys/devices/system/cpu/online";
+    if (fs_exist(pseudo))
+    {
+        enum fs_copy_method used;
+        assert_true(fs_copy_file_ex(pseudo, to, NULL, &used));
+        assert_int_not_equal(used, LIBFS_COPY_AUTO);
+        assert_true(fs_file_size(to) > 0);
+        fs_assert_delete_file(to);
+    }
+#endif
+}
+
+static void test_copy_file_clone(void **state)
+{
+    char cwd[LIBFS_MAX_PATH];
+    fs_assert_current_dir(&cwd);
+
+    char from[LIBFS_MAX_PATH];
+    fs_assert_join_path(&from, cwd, FILE_HELLO);
+
+    char buf[LIBFS_MAX_PATH];
+    fs_assert_join_path(&buf, cwd, DIRECTORY_OUTPUT);
+    fs_assert_make_dir(buf);
+
+    char to[LIBFS_MAX_PATH];
+    fs_assert_join_path(&to, buf, "clone.txt");
+
+    /* Reflinks are only supported by some filesystems */
+    struct fs_copy_options options = {LIBFS_COPY_AUTO, LIBFS_CLONE_ALWAYS};
+    enum fs_copy_method used;
+    size_t size;
+    char *data;
+    fs_assert_write_file(to, "previous content", 16);
+    if (!fs_copy_file_ex(from, to, &options, &used))
+    {
+        /* A failed clone leaves an existing destination intact */
+        data = (char *)fs_assert_read_file(to, &size);
+        assert_int_equal(size, 16);
+        assert_memory_equal(data, "previous content", 16);
+        free(data);
+        fs_assert_delete_file(to);
+
+        /* And removes a destination it created */
+        assert_false(fs_copy_file_ex(from, to, &options, &used));
+        fs_assert_non_exist(to);
+        skip();
+    }
+
+    assert_int_equal(used, LIBFS_COPY_CLONE);
+
+    data = (char *)fs_assert_read_file(to, &size);
+    assert_int_equal(size, 5);
+    assert_string_equal(data, "hello");
+    free(data);
+    fs_assert_delete_file(to);
+
+    /* An explicit byte copy method isn't overridden by the default clone mode */
+    struct fs_copy_options explicit_method = {LIBFS_COPY_READ_WRITE, LIBFS_CLONE_AUTO};
+    assert_true(fs_copy_file_ex(from, to, &explicit_method, &used));
+    assert_int_equal(used, LIBFS_COPY_READ_WRITE);
+    fs_assert_delete_file(to);
+}
+
+static void test_copy_tree(void **state)
+{
+    char cwd[LIBFS_MAX_PATH];
+    fs_assert_current_dir(&cwd);
+
+    char output[LIBFS_MAX_PATH];
+    fs_assert_join_path(&output, cwd, DIRECTORY_OUTPUT);
+    fs_assert_make_dir(output);
+
+    char from[LIBFS_MAX_PATH];
+    fs_assert_join_path(&from, output, "tree");
+    fs_assert_make_dir(from);
+
+    char sub[LIBFS_MAX_PATH];
+    fs_assert_join_path(&sub, from, "sub");
+    fs_assert_make_dir(sub);
+
+    char buf[LIBFS_MAX_PATH];
+    fs_assert_join_path(&buf, from, "a.txt");
+    fs_assert_write_file(buf, "hello", 5);
+    fs_assert_join_path(&buf, sub, "b.txt");
+    fs_assert_write_file(buf, "world", 5);
+
+    char to[LIBFS_MAX_PATH];
+    fs_assert_join_path(&to, output, "tree_copy");
+
+    struct fs_copy_tree_options options;
+    memset(&options, 0, sizeof(options));
+    options.threads = 4;
+    options.flags = LIBFS_COPY_TREE_PRESERVE_MODE | LIBFS_COPY_TREE_PRESERVE_TIMES;
+
+#ifndef _WIN32
+    /* Modes and times are preserved, directories included */
+    struct utimbuf times = {1000000000, 1000000000};
+    fs_assert_join_path(&buf, from, "a.txt");
+    assert_int_equal(chmod(buf, 0640), 0);
+    assert_int_equal(utime(buf, &times), 0);
+    assert_int_equal(chmod(sub, 0750), 0);
+    assert_int_equal(utime(sub, &times), 0);
+
+    char link[LIBFS_MAX_PATH];
+    fs_assert_join_path(&link, from, "a.lnk");
+    assert_int_equal(symlink("a.txt", link), 0);
+
+    /* Copying a directory into itself is refused before creating anything */
+    fs_assert_join_path(&buf, sub, "inner");
+    assert_false(fs_copy_tree(from, buf, &options));
+    assert_false(fs_exist(buf));
+    assert_false(fs_copy_tree(from, from, &options));
+#endif
+
+    assert_true(fs_copy_tree(from, to, &options));
+
+    size_t size;
+    char *data;
+    fs_assert_join_path(&buf, to, "a.txt");
+    data = (char *)fs_assert_read_file(buf, &size);
+    assert_string_equal(data, "hello");
+    free(data);
+
+    char sub_copy[LIBFS_MAX_PATH];
+    fs_assert_join_path(&sub_copy, to, "sub");
+
+#ifndef _WIN32
+    struct fs_stat_result st;
+    assert_true(fs_stat(buf, &st, LIBFS_STAT_MODE | LIBFS_STAT_MTIME));
+    assert_int_equal(st.mode, 0640);
+    assert_int_equal(st.mtime.sec, 1000000000);
+    assert_true(fs_stat(sub_copy, &st, LIBFS_STAT_MODE | LIBFS_STAT_MTIME));
+    assert_int_equal(st.mode, 0750);
+    assert_int_equal(st.mtime.sec, 1000000000);
+
+    /* Symbolic links are copied as links with the same target */
+    char target[LIBFS_MAX_PATH];
+    fs_assert_join_path(&buf, to, "a.lnk");
+    assert_true(fs_is_symlink(buf));
+    ssize_t length = readlink(buf, target, sizeof(target));
+    assert_int_equal(length, 5);
+    assert_memory_equal(target, "a.txt", 5);
+
+    /* Copying again keeps a link with the same target and replaces one with another target */
+    assert_true(fs_copy_tree(from, to, &options));
+    assert_int_equal(readlink(buf, target, sizeof(target)), 5);
+    fs_assert_delete_file(buf);
+    assert_int_equal(symlink("sub", buf), 0);
+    assert_true(fs_copy_tree(from, to, &options));
+    length = readlink(buf, target, sizeof(target));
+    assert_int_equal(length, 5);
+    assert_memory_equal(target, "a.txt", 5);
+    fs_assert_delete_file(buf);
+    fs_assert_delete_file(link);
+
+#ifdef __linux__
+    /* procfs links report a zero size */
+    char ns[LIBFS_MAX_PATH];
+    fs_assert_join_path(&ns, output, "ns_copy");
+    if (fs_is_directory("/proc/self/ns"))
+    {
+        assert_true(fs_copy_tree("/proc/self/ns", ns, NULL));
+        fs_assert_join_path(&buf, ns, "net");
+        length = readlink(buf, target, sizeof(target));
+        assert_true(length > 5);
+        assert_memory_equal(target, "net:[", 5);
+
+        struct fs_directory_iterator *it = fs_open_dir(ns);
+        assert_non_null(it);
+        while (fs_read_dir(it))
+        {
+            if (strcmp(it->path, ".") != 0 && strcmp(it->path, "..") != 0)
+            {
+                fs_assert_join_path(&buf, ns, it->path);
+                fs_assert_delete_file(buf);
+            }
+        }
+
+        fs_close_dir(it);
+        fs_assert_delete_dir(ns);
+    }
+#endif
+#endif
+
+    fs_assert_join_path(&buf, to, "a.txt");
+    fs_assert_delete_file(buf);
+    fs_assert_join_path(&buf, sub_copy, "b.txt");
+    data = (char *)fs_assert_read_file(buf, &size);
+    assert_string_equal(data, "world");
+    free(data);
+    fs_assert_delete_file(buf);
+    fs_assert_delete_dir(sub_copy);
+    fs_assert_delete_dir(to);
+
+    /* fs_copy dispatches directories to fs_copy_tree */
+    assert_true(fs_copy(sub, to));
+    fs_assert_join_path(&buf, to, "b.txt");
+    fs_assert_exist(buf);
+    fs_assert_delete_file(buf);
+    fs_assert_delete_dir(to);
+
+    fs_assert_join_path(&buf, sub, "b.txt");
+    fs_assert_delete_file(buf);
+    fs_assert_delete_dir(sub);
+    fs_assert_join_path(&buf, from, "a.txt");
+    fs_assert_delete_file(buf);
+    fs_assert_delete_dir(from);
+}
+
+static void test_hooks(void **state)
+{
+    struct fs_hooks hooks = {malloc, free};
+    fs_init_hooks(&hooks);
+    test_read_dir(state);
+}
+
+typedef struct alloc_count
+{
+    size_t allocs;
+    size_t frees;
+} alloc_count;
+
+static void *count_malloc(void *user, size_t size)
+{
+    ((alloc_count *)user)->allocs++;
+    return malloc(size);
+}
+
+static void count_free(void *user, void *ptr)
+{
+    ((alloc_count *)user)->frees++;
+    free(ptr);
+}
+
+static void test_context(void **state)
+{
+    char cwd[LIBFS_MAX_PATH];
+    fs_assert_current_dir(&cwd);
+
+    char output[LIBFS_MAX_PATH];
+    fs_assert_join_path(&output, cwd, DIRECTORY_OUTPUT);
+    fs_assert_make_dir(output);
+
+    /* Every allocation is released with the context it comes from */
+    alloc_count count = {0, 0};
+    struct fs_context ctx = {&count, count_malloc, NULL, count_free, NULL, NULL};
+    size_t size;
+    char *data = (char *)fs_read_file_ctx(&ctx, FILE_HELLO, &size, 0);
+    assert_non_null(data);
+    assert_string_equal(data, "hello");
+    count_free(&count, data);
+    data = (char *)fs_read_file_ctx(&ctx, FILE_HELLO, &size, LIBFS_IO_DIRECT);
+    assert_non_null(data);
+    assert_int_equal((size_t)data % LIBFS_DIRECT_ALIGNMENT, 0);
+    assert_string_equal(data, "hello");
+    fs_aligned_free_ctx(&ctx, data);
+    fs_close_file(fs_iter_file_ctx(&ctx, FILE_HELLO, 0));
+    fs_close_dir(fs_open_dir_ctx(&ctx, DIRECTORY_DATA));
+    assert_int_equal(count.allocs, 4);
+    assert_int_equal(count.frees, 4);
+    assert_null(fs_read_file_ctx(&ctx, FILE_UNKNOWN, &size, 0));
+    assert_null(fs_open_dir_ctx(&ctx, FILE_UNKNOWN));
+    assert_int_equal(count.allocs, 4);
+
+    /* Small blocks so files grow in place, spill over and get their own block */
+    char path[LIBFS_MAX_PATH];
+    fs_assert_join_path(&path, output, "arena.txt");
+    char content[1000];
+    for (size_t i = 0; i < sizeof(content); ++i)
+    {
+        content[i] = (char)('a' + i % 26);
+    }
+    content[sizeof(content) - 1] = '\n';
+    fs_assert_write_file(path, content, sizeof(content));
+
+    struct fs_arena *arena = fs_arena_create(256);
+    assert_non_null(arena);
+    fs_arena_context(arena, &ctx);
+    for (int round = 0; round < 3; ++round)
+    {
+        data = (char *)fs_read_file_ctx(&ctx, FILE_HELLO, &size, 0);
+        assert_non_null(data);
+        assert_string_equal(data, "hello");
+        assert_int_equal((size_t)data % 16, 0);
+
+        data = (char *)fs_read_file_ctx(&ctx, path, &size, 0);
+        assert_non_null(data);
+        assert_int_equal(size, sizeof(content));
+        assert_memory_equal(data, content, sizeof(content));
+
+        data = (char *)fs_read_file_ctx(&ctx, path, &size, LIBFS_IO_DIRECT);
+        assert_non_null(data);
+        assert_int_equal((size_t)data % LIBFS_DIRECT_ALIGNMENT, 0);
+        assert_memory_equal(data, content, sizeof(content));
+
+        /* Lines longer than the buffer grow it from the arena */
+        const char *line;
+        fs_file_iterator *it = fs_iter_file_ctx(&ctx, path, 16);
+        assert_non_null(it);
+        assert_non_null(fs_next_line(it, &line, &size));
+        assert_int_equal(size, sizeof(content) - 1);
+        fs_close_file(it);
+
+        fs_directory_iterator *dir = fs_open_dir_ctx(&ctx, DIRECTORY_DATA);
+        assert_non_null(dir);
+        assert_non_null(fs_read_dir(dir));
+        fs_close_dir(dir);
+        fs_arena_reset(arena);
+    }
+
+    fs_arena_destroy(arena);
+    fs_arena_destroy(NULL);
+    fs_assert_delete_file(path);
 }
 
 int main(void)
@@ -346,22 +2103,53 @@ int main(void)
         cmocka_unit_test(test_basename_dot),
         cmocka_unit_test(test_basename_file),
         cmocka_unit_test(test_basename_empty),
+        cmocka_unit_test(test_normalize),
+        cmocka_unit_test(test_absolute_lexical),
+        cmocka_unit_test(test_join_path_truncated),
+        cmocka_unit_test(test_path),
         cmocka_unit_test(test_get_cwd),
         cmocka_unit_test(test_path_join),
         cmocka_unit_test(test_exists),
         cmocka_unit_test(test_file_size),
+        cmocka_unit_test(test_stat),
+        cmocka_unit_test(test_stat_many),
         cmocka_unit_test(test_is_directory),
         cmocka_unit_test(test_is_file),
         cmocka_unit_test(test_read_unknown_file),
         cmocka_unit_test(test_read_file_buffer),
         cmocka_unit_test(test_read_file_buffer_too_big),
         cmocka_unit_test(test_read_file_buffer_too_small),
+        cmocka_unit_test(test_read_file_into),
         cmocka_unit_test(test_read_file),
+        cmocka_unit_test(test_read_file_unknown_size),
+        cmocka_unit_test(test_read_file_large),
+        cmocka_unit_test(test_filev),
+        cmocka_unit_test(test_write_file_atomic),
+        cmocka_unit_test(test_file_writer),
+        cmocka_unit_test(test_direct_io),
+        cmocka_unit_test(test_prefetch),
+        cmocka_unit_test(test_map_file),
+        cmocka_unit_test(test_map_empty_file),
         cmocka_unit_test(test_iter_file),
+        cmocka_unit_test(test_iter_file_chunks),
+        cmocka_unit_test(test_iter_file_lines),
+        cmocka_unit_test(test_count_lines),
         cmocka_unit_test(test_read_dir),
+        cmocka_unit_test(test_read_dir_types),
+        cmocka_unit_test(test_read_dir_batch),
+        cmocka_unit_test(test_open_dir_in),
+        cmocka_unit_test(test_dir_handle),
+        cmocka_unit_test(test_walk),
+        cmocka_unit_test(test_walk_resume),
+        cmocka_unit_test(test_ring),
         cmocka_unit_test(test_make_dir),
         cmocka_unit_test(test_delete_file),
         cmocka_unit_test(test_read_unknown_dir),
-        cmocka_unit_test(test_hooks)};
+        cmocka_unit_test(test_copy_file),
+        cmocka_unit_test(test_copy_file_methods),
+        cmocka_unit_test(test_copy_file_clone),
+        cmocka_unit_test(test_copy_tree),
+        cmocka_unit_test(test_hooks),
+        cmocka_unit_test(test_context)};
     return cmocka_run_group_tests(tests, NULL, NULL);
 }
\ No newline at end of file